@@ -0,0 +1,64 @@
+#include "AdmissionControl.h"
+#include <algorithm>
+#include "Clock.h"
+
+namespace redis {
+
+// an overloaded interval with fewer requests says little about the
+// consumer, e.g. they queued behind one slow request
+static const uint64_t MIN_SAMPLES = 16;
+
+AdmissionControl::AdmissionControl(int target_us, int interval_us, int deadline_us) :
+    _overloaded(false), _service(0), _last_min(0), _start(Clock::now()), _min(UINT64_MAX), _dequeued(0),
+    _calm(0), _shed(0), _expired(0)
+{
+    _target = Clock::from_us(std::max(target_us, 1));
+    _interval = Clock::from_us(std::max(interval_us, 1));
+    _deadline = deadline_us > 0 ? Clock::from_us(deadline_us) : 0;
+}
+
+uint64_t AdmissionControl::deadline(uint64_t now, uint32_t client_ms) const {
+    uint64_t budget = _deadline;
+    if (client_ms > 0) {
+        uint64_t ticks = Clock::from_us((uint64_t)client_ms * 1000);
+        budget = budget > 0 ? std::min(budget, ticks) : ticks;
+    }
+    return budget > 0 ? now + budget : 0;
+}
+
+int AdmissionControl::dequeued(const Message& msg, uint64_t now) {
+    uint64_t sojourn = now > msg.QueuedAt() ? now - msg.QueuedAt() : 0;
+    uint64_t min = _min.load(std::memory_order_relaxed);
+    while (sojourn < min && !_min.compare_exchange_weak(min, sojourn, std::memory_order_relaxed)) {
+    }
+    _dequeued.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t start = _start.load(std::memory_order_relaxed);
+    if (now - start >= _interval && _start.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+        // this thread closes the interval
+        min = _min.exchange(UINT64_MAX, std::memory_order_relaxed);
+        uint64_t n = std::max<uint64_t>(_dequeued.exchange(0, std::memory_order_relaxed), 1);
+        _last_min.store(min, std::memory_order_relaxed);
+        uint64_t second = Clock::from_us(1000000);
+        if (min > _target && n >= MIN_SAMPLES) {
+            // the consumer was never idle
+            _service.store((now - start) / n, std::memory_order_relaxed);
+            _calm.store(0, std::memory_order_relaxed);
+        } else if (min <= _target && (uint64_t)_calm.fetch_add(1, std::memory_order_relaxed) * _interval >= second) {
+            _service.store(0, std::memory_order_relaxed);
+        }
+        _overloaded.store(min > _target, std::memory_order_relaxed);
+    }
+
+    if (msg.Deadline() > 0 && now >= msg.Deadline()) {
+        _expired.fetch_add(1, std::memory_order_relaxed);
+        return EXPIRED;
+    }
+    if (sojourn > 2 * _target && _overloaded.load(std::memory_order_relaxed)) {
+        _shed.fetch_add(1, std::memory_order_relaxed);
+        return SHED;
+    }
+    return PASS;
+}
+
+}; // namespace redis
@@ -0,0 +1,99 @@
+#ifndef REDIS_ADMISSION_CONTROL_H_
+#define REDIS_ADMISSION_CONTROL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "Message.h"
+
+namespace redis {
+
+// CoDel-style admission control on the Recv() queue, see
+// Transport::EnableAdmissionControl(). Times are Clock ticks.
+//
+// Every request taken off the queue reports how long it waited there (its
+// sojourn time). The queue is overloaded for an interval if even the
+// request that waited least in the interval before waited longer than the
+// target: a burst drains within an interval, a standing queue does not.
+// An overloaded interval also tells how long the consumer takes per
+// request, as its queue never ran dry; the estimate is forgotten after a
+// second without overload. Going by it:
+//  - while overloaded, the reactors shed a new request, rather than queue
+//    it, if the queue is already longer than the consumer gets through in
+//    the target time; the queue then stays around the target, and the
+//    requests that do get in are served in time
+//  - otherwise, they shed it if the queue would not drain within an
+//    interval, so that the queue does not fill up again each time it came
+//    down to the target
+//  - while overloaded, a request that waited more than twice the target is
+//    shed when taken off the queue, instead of being handled
+// Apart from that, a request is dropped when taken off the queue if its
+// deadline passed. Shed requests are answered with -BUSY, dropped ones
+// with -TIMEOUT.
+//
+// State is a handful of atomics: reactors only load them, the consumer
+// threads update them with a CAS or two per request.
+class AdmissionControl {
+public:
+    enum { PASS, SHED, EXPIRED };
+
+    // deadline_us is the longest a request may wait in the queue, 0 for no
+    // limit
+    AdmissionControl(int target_us, int interval_us, int deadline_us);
+
+    // false to shed a request instead of queueing it behind depth others;
+    // any thread
+    bool admit(size_t depth) const {
+        uint64_t limit = _overloaded.load(std::memory_order_relaxed) ? _target : _interval;
+        return depth * _service.load(std::memory_order_relaxed) <= limit;
+    }
+    // the deadline of a request queued now by a client that asked for one
+    // of client_ms (0 if it did not), 0 for none
+    uint64_t deadline(uint64_t now, uint32_t client_ms) const;
+    // a request taken off the queue at now: PASS, or SHED or EXPIRED if it
+    // is to be answered with an error instead of handled
+    int dequeued(const Message& msg, uint64_t now);
+
+    bool overloaded() const {
+        return _overloaded.load(std::memory_order_relaxed);
+    }
+    // least sojourn time in the last interval
+    uint64_t min_sojourn() const {
+        return _last_min.load(std::memory_order_relaxed);
+    }
+    // time the consumer takes per request, as of the last overloaded
+    // interval, 0 if none lately
+    uint64_t service_time() const {
+        return _service.load(std::memory_order_relaxed);
+    }
+    // by the consumer threads
+    uint64_t shed() const {
+        return _shed.load(std::memory_order_relaxed);
+    }
+    uint64_t expired() const {
+        return _expired.load(std::memory_order_relaxed);
+    }
+
+private:
+    uint64_t _target;
+    uint64_t _interval;
+    uint64_t _deadline;
+
+    std::atomic<bool> _overloaded;
+    std::atomic<uint64_t> _service;
+    std::atomic<uint64_t> _last_min;
+    // the current interval: when it began, the least sojourn time so far
+    // and requests taken off the queue
+    std::atomic<uint64_t> _start;
+    std::atomic<uint64_t> _min;
+    std::atomic<uint64_t> _dequeued;
+    // intervals since the last overloaded one
+    std::atomic<int> _calm;
+
+    std::atomic<uint64_t> _shed;
+    std::atomic<uint64_t> _expired;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,517 @@
+#include "Aof.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Clock.h"
+
+namespace redis {
+
+static int write_all(int fd, const char* data, size_t len, size_t* written) {
+    *written = 0;
+    while (*written < len) {
+        ssize_t n = ::write(fd, data + *written, len - *written);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        *written += n;
+    }
+    return 0;
+}
+
+// appends the file at path to fd, a missing file is empty
+static int copy_file(const std::string& path, int fd) {
+    int in = ::open(path.c_str(), O_RDONLY);
+    if (in == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    char buf[64 * 1024];
+    int ret = 0;
+    while (1) {
+        ssize_t n = ::read(in, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ret = (int)n;
+            break;
+        }
+        size_t written;
+        if (write_all(fd, buf, n, &written) == -1) {
+            ret = -1;
+            break;
+        }
+    }
+    ::close(in);
+    return ret;
+}
+
+// makes a rename() in the directory of path durable
+static int fsync_dir(const std::string& path) {
+    size_t pos = path.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : pos == 0 ? "/" : path.substr(0, pos);
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+    int ret = fsync(fd);
+    int e = errno;
+    ::close(fd);
+    errno = e;
+    return ret;
+}
+
+static uint64_t file_size(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 ? st.st_size : 0;
+}
+
+int Aof::parse_policy(const std::string& name) {
+    if (name == "always") {
+        return FSYNC_ALWAYS;
+    } else if (name == "everysec") {
+        return FSYNC_EVERYSEC;
+    } else if (name == "no") {
+        return FSYNC_NO;
+    }
+    return -1;
+}
+
+Aof::Aof() {
+    _policy = FSYNC_EVERYSEC;
+    _fd = -1;
+    _auto_rewrite_size = 0;
+    _buf_len = 0;
+    _stop = false;
+    _wakeup = false;
+    _rewrite_requested = false;
+    _rewriting = false;
+    _on_incr = false;
+    _size = 0;
+    _base_size = 0;
+    _dirty = 0;
+    _last_sync = 0;
+    _fsyncs = 0;
+    _rewrites = 0;
+    _last_write_errno = 0;
+}
+
+Aof::~Aof() {
+    this->close();
+}
+
+int Aof::open(const std::string& path, int shards, int policy, uint64_t auto_rewrite_size, size_t buffer_size) {
+    _path = path;
+    _policy = policy;
+    _auto_rewrite_size = auto_rewrite_size;
+    _fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_fd == -1) {
+        return -1;
+    }
+    // left over from an interrupted rewrite; load() has replayed it after
+    // path already, and records are idempotent, so appending is safe even
+    // if the rename had happened
+    std::string incr = path + ".incr";
+    if (access(incr.c_str(), F_OK) == 0) {
+        if (copy_file(incr, _fd) == -1 || fdatasync(_fd) == -1) {
+            ::close(_fd);
+            _fd = -1;
+            return -1;
+        }
+        unlink(incr.c_str());
+    }
+    for (int i = 0; i < shards; i++) {
+        unlink(snapshot_path(i).c_str());
+        _shards.push_back(new Shard(buffer_size));
+    }
+    _size = _base_size = file_size(_fd);
+    _last_sync = Clock::now();
+    _stop = false;
+    _writer = std::thread(&Aof::writer_func, this);
+    return 0;
+}
+
+void Aof::close() {
+    if (_writer.joinable()) {
+        _stop = true;
+        _cond.notify_one();
+        _writer.join();
+    }
+    if (_rewriting) {
+        abort_rewrite();
+    }
+    for (auto shard : _shards) {
+        delete shard;
+    }
+    _shards.clear();
+    if (_fd != -1) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+uint64_t Aof::append(int shard, const std::string& data) {
+    Shard* s = _shards[shard];
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        size_t n = s->ring.write_some(p, left);
+        p += n;
+        left -= n;
+        if (left > 0) {
+            // full, the disk is behind; wait for the writer
+            _wakeup = true;
+            _cond.notify_one();
+            std::this_thread::yield();
+        }
+    }
+    uint64_t seq = s->appended.load(std::memory_order_relaxed) + 1;
+    s->appended.store(seq, std::memory_order_release);
+    if (_policy == FSYNC_ALWAYS && !_wakeup.exchange(true)) {
+        _cond.notify_one();
+    }
+    return seq;
+}
+
+std::string Aof::snapshot_path(int shard) const {
+    return _path + ".base." + std::to_string(shard);
+}
+
+void Aof::snapshot_started(int shard) {
+    _shards[shard]->snapshot.store(SNAPSHOT_RUNNING, std::memory_order_release);
+}
+
+void Aof::snapshot_done(int shard, bool ok) {
+    _shards[shard]->snapshot.store(ok ? SNAPSHOT_DONE : SNAPSHOT_FAILED, std::memory_order_release);
+}
+
+int Aof::rewrite() {
+    if (_rewriting || _rewrite_requested.exchange(true)) {
+        return -1;
+    }
+    _cond.notify_one();
+    return 0;
+}
+
+std::string Aof::info() const {
+    static const char* policies[] = {"always", "everysec", "no"};
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+        "# Persistence\r\n"
+        "aof_enabled:1\r\n"
+        "aof_fsync:%s\r\n"
+        "aof_current_size:%llu\r\n"
+        "aof_base_size:%llu\r\n"
+        "aof_rewrite_in_progress:%d\r\n"
+        "aof_rewrites:%llu\r\n"
+        "aof_fsyncs:%llu\r\n"
+        "aof_last_write_status:%s\r\n",
+        policies[_policy],
+        (unsigned long long)_size.load(),
+        (unsigned long long)_base_size.load(),
+        _rewriting.load() ? 1 : 0,
+        (unsigned long long)_rewrites.load(),
+        (unsigned long long)_fsyncs.load(),
+        _last_write_errno.load() == 0 ? "ok" : strerror(_last_write_errno.load()));
+    return buf;
+}
+
+int64_t Aof::drain(std::vector<uint64_t>* seqs) {
+    // sequence numbers first: whatever they count is in the ring by now
+    for (size_t i = 0; i < _shards.size(); i++) {
+        (*seqs)[i] = _shards[i]->appended.load(std::memory_order_acquire);
+    }
+    // bytes left over from a failed write go first
+    size_t len = _buf_len;
+    for (auto shard : _shards) {
+        while (1) {
+            if (_buf.size() - len < 64 * 1024) {
+                _buf.resize(len + 256 * 1024);
+            }
+            size_t n = shard->ring.read(&_buf[len], _buf.size() - len);
+            if (n == 0) {
+                break;
+            }
+            len += n;
+        }
+    }
+    _buf_len = len;
+    if (len == 0) {
+        return 0;
+    }
+    size_t written;
+    int ret = write_all(_fd, &_buf[0], len, &written);
+    _size += written;
+    _dirty += written;
+    if (ret == -1) {
+        // keep the rest for the next round, nothing counts as durable
+        if (_last_write_errno.exchange(errno) == 0) {
+            fprintf(stderr, "aof write error: %s\n", strerror(errno));
+        }
+        memmove(&_buf[0], &_buf[written], len - written);
+        _buf_len = len - written;
+        return -1;
+    }
+    _last_write_errno = 0;
+    _buf_len = 0;
+    return (int64_t)len;
+}
+
+void Aof::sync() {
+    if (fdatasync(_fd) == -1) {
+        fprintf(stderr, "aof fsync error: %s\n", strerror(errno));
+        if (_policy == FSYNC_ALWAYS) {
+            // the kernel may have dropped the pages that failed, so a later
+            // fsync proves nothing, and the replies held for them could
+            // never be sent; like Redis, give up
+            fprintf(stderr, "can't persist aof with fsync policy 'always', exiting\n");
+            exit(1);
+        }
+        return;
+    }
+    _fsyncs++;
+    _dirty = 0;
+    _last_sync = Clock::now();
+}
+
+void Aof::writer_func(Aof* aof) {
+    std::vector<uint64_t> seqs(aof->_shards.size());
+    const uint64_t one_sec = Clock::from_us(1000 * 1000);
+    while (1) {
+        bool stop = aof->_stop;
+        int64_t n = aof->drain(&seqs);
+        if (aof->_dirty > 0) {
+            if (aof->_policy == FSYNC_ALWAYS || stop
+                || (aof->_policy == FSYNC_EVERYSEC && Clock::now() - aof->_last_sync >= one_sec))
+            {
+                aof->sync();
+            }
+        }
+        bool durable = n >= 0 && (aof->_policy != FSYNC_ALWAYS || aof->_dirty == 0);
+        for (size_t i = 0; durable && i < seqs.size(); i++) {
+            Shard* shard = aof->_shards[i];
+            if (seqs[i] != shard->durable.load(std::memory_order_relaxed)) {
+                shard->durable.store(seqs[i], std::memory_order_release);
+                if (aof->_policy == FSYNC_ALWAYS) {
+                    shard->notify.push(seqs[i]);
+                }
+            }
+        }
+        if (stop) {
+            break;
+        }
+
+        if (aof->_rewriting) {
+            bool done = true;
+            bool failed = false;
+            for (auto shard : aof->_shards) {
+                int state = shard->snapshot.load(std::memory_order_acquire);
+                done &= state == SNAPSHOT_DONE || state == SNAPSHOT_FAILED;
+                failed |= state == SNAPSHOT_FAILED;
+            }
+            if (done && failed) {
+                aof->abort_rewrite();
+            } else if (done) {
+                aof->finish_rewrite();
+            }
+        } else if (aof->_rewrite_requested) {
+            aof->start_rewrite();
+        } else if (aof->_auto_rewrite_size > 0 && !aof->_on_incr && aof->_size >= aof->_auto_rewrite_size
+            && aof->_size >= aof->_base_size * 2)
+        {
+            aof->_rewrite_requested = true;
+        }
+
+        if (n == 0) {
+            std::unique_lock<std::mutex> lk(aof->_mutex);
+            aof->_cond.wait_for(lk, std::chrono::milliseconds(1), [aof]() {
+                return aof->_wakeup.load() || aof->_stop.load();
+            });
+            aof->_wakeup = false;
+        }
+    }
+}
+
+void Aof::start_rewrite() {
+    // a failed abort left the incr file as the log, truncating it would
+    // lose acknowledged writes
+    if (_on_incr && fold_incr() == -1) {
+        fprintf(stderr, "aof rewrite: %s.incr is still the log: %s\n", _path.c_str(), strerror(errno));
+        _rewrite_requested = false;
+        return;
+    }
+    // from now on the shards' writes go to the incr file, and the shards
+    // start dumping their tables only after that
+    std::string incr = _path + ".incr";
+    int fd = ::open(incr.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "aof rewrite: open %s failed: %s\n", incr.c_str(), strerror(errno));
+        _rewrite_requested = false;
+        return;
+    }
+    if (_dirty > 0) {
+        sync();
+    }
+    ::close(_fd);
+    _fd = fd;
+    _size = 0;
+    _rewriting = true;
+    _rewrite_requested = false;
+    for (auto shard : _shards) {
+        shard->snapshot.store(SNAPSHOT_REQUESTED, std::memory_order_release);
+    }
+    printf("aof rewrite started\n");
+}
+
+void Aof::finish_rewrite() {
+    std::string incr = _path + ".incr";
+    std::string tmp = _path + ".rewrite";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    bool ok = fd != -1;
+    for (size_t i = 0; ok && i < _shards.size(); i++) {
+        ok = copy_file(snapshot_path(i), fd) == 0;
+    }
+    uint64_t base_size = ok ? file_size(fd) : 0;
+    // nothing is appended to the incr file while the writer copies it
+    ok = ok && copy_file(incr, fd) == 0 && fdatasync(fd) == 0 && rename(tmp.c_str(), _path.c_str()) == 0;
+    // renamed already, there is no going back; if the rename is not
+    // durable the old log may come back after a crash, so the incr file is
+    // kept for load() to replay after it
+    bool keep_incr = ok && fsync_dir(_path) == -1;
+    if (keep_incr) {
+        fprintf(stderr, "aof rewrite: fsync of the directory failed: %s\n", strerror(errno));
+    }
+    if (!ok) {
+        fprintf(stderr, "aof rewrite failed: %s\n", strerror(errno));
+        if (fd != -1) {
+            ::close(fd);
+            unlink(tmp.c_str());
+        }
+        abort_rewrite();
+        return;
+    }
+    ::close(_fd);
+    _fd = fd;
+    _dirty = 0;
+    if (!keep_incr) {
+        unlink(incr.c_str());
+    }
+    for (size_t i = 0; i < _shards.size(); i++) {
+        unlink(snapshot_path(i).c_str());
+        _shards[i]->snapshot.store(SNAPSHOT_NONE, std::memory_order_release);
+    }
+    _size = file_size(_fd);
+    _base_size = base_size;
+    _rewrites++;
+    _rewriting = false;
+    printf("aof rewrite done, %llu bytes\n", (unsigned long long)_size.load());
+}
+
+void Aof::abort_rewrite() {
+    if (fold_incr() == -1) {
+        // keep writing to the incr file, load() replays it after the log
+        fprintf(stderr, "aof rewrite abort: %s\n", strerror(errno));
+    }
+    for (size_t i = 0; i < _shards.size(); i++) {
+        unlink(snapshot_path(i).c_str());
+        _shards[i]->snapshot.store(SNAPSHOT_NONE, std::memory_order_release);
+    }
+    _size = file_size(_fd);
+    _rewriting = false;
+    printf("aof rewrite aborted\n");
+}
+
+int Aof::fold_incr() {
+    // put the incr part back behind the old log
+    std::string incr = _path + ".incr";
+    int fd = ::open(_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd == -1 || copy_file(incr, fd) == -1 || fdatasync(fd) == -1) {
+        if (fd != -1) {
+            int e = errno;
+            ::close(fd);
+            errno = e;
+        }
+        _on_incr = true;
+        return -1;
+    }
+    ::close(_fd);
+    _fd = fd;
+    _dirty = 0;
+    unlink(incr.c_str());
+    _on_incr = false;
+    return 0;
+}
+
+static int64_t load_file(const std::string& path, const std::function<void(const Message& msg)>& fn) {
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    std::string buf;
+    size_t off = 0;
+    uint64_t consumed = 0; // file offset of buf[off]
+    int64_t count = 0;
+    char tmp[64 * 1024];
+    bool eof = false;
+    while (1) {
+        // decode everything complete, then read more
+        while (off < buf.size()) {
+            Message msg;
+            int n = msg.Decode(buf.data() + off, (int)(buf.size() - off));
+            if (n == -1) {
+                fprintf(stderr, "%s: bad command at offset %llu\n", path.c_str(), (unsigned long long)consumed);
+                ::close(fd);
+                return -1;
+            }
+            if (n == 0) {
+                break;
+            }
+            off += n;
+            consumed += n;
+            fn(msg);
+            count++;
+        }
+        if (eof) {
+            break;
+        }
+        buf.erase(0, off);
+        off = 0;
+        ssize_t n = ::read(fd, tmp, sizeof(tmp));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            eof = true;
+            continue;
+        }
+        buf.append(tmp, n);
+    }
+    if (off < buf.size()) {
+        fprintf(stderr, "%s: truncated command at offset %llu, cut off\n", path.c_str(), (unsigned long long)consumed);
+        if (ftruncate(fd, consumed) == -1) {
+            fprintf(stderr, "%s: truncate failed: %s\n", path.c_str(), strerror(errno));
+        }
+    }
+    ::close(fd);
+    return count;
+}
+
+int64_t Aof::load(const std::string& path, const std::function<void(const Message& msg)>& fn) {
+    int64_t n = load_file(path, fn);
+    if (n == -1) {
+        return -1;
+    }
+    int64_t m = load_file(path + ".incr", fn);
+    if (m == -1) {
+        return -1;
+    }
+    return n + m;
+}
+
+}; // namespace redis
@@ -0,0 +1,144 @@
+#ifndef REDIS_AOF_H_
+#define REDIS_AOF_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Message.h"
+#include "RingBuffer.h"
+#include "SelectableQueue.h"
+
+namespace redis {
+
+// Append-only command log.
+//
+// Each shard appends encoded commands to its own RingBuffer, a writer
+// thread drains all rings into one write() and then syncs according to the
+// policy:
+//   FSYNC_ALWAYS    fdatasync after every batch, so everything appended
+//                   while the previous sync ran is committed together; the
+//                   process exits if fdatasync fails
+//   FSYNC_EVERYSEC  fdatasync at most once a second
+//   FSYNC_NO        leave it to the kernel
+// Every append gets a per-shard sequence number; durable() tells how far a
+// shard's log is on disk (synced for FSYNC_ALWAYS, written otherwise), and
+// notify() becomes readable whenever that advances, so a shard can hold
+// replies until their commands are durable.
+//
+// Records must be idempotent (absolute expiry times, resulting values), so
+// that a rewrite can snapshot the shards incrementally while they keep
+// changing: when a rewrite starts the writer switches to "<path>.incr",
+// every shard dumps its table to "<path>.base.<shard>" a slice at a time,
+// and once all are done the writer concatenates the snapshots and the incr
+// file into a new log and renames it over path.
+class Aof {
+public:
+    enum { FSYNC_ALWAYS = 0, FSYNC_EVERYSEC, FSYNC_NO };
+    // "always", "everysec" or "no", -1 if unknown
+    static int parse_policy(const std::string& name);
+
+    Aof();
+    ~Aof();
+
+    // Appends to path. auto_rewrite_size > 0 starts a rewrite whenever the
+    // log reaches that size and twice the size after the last rewrite.
+    int open(const std::string& path, int shards, int policy,
+        uint64_t auto_rewrite_size = 64 * 1024 * 1024, size_t buffer_size = 8 * 1024 * 1024);
+    void close();
+
+    int policy() const {
+        return _policy;
+    }
+
+    /* called by shard `shard` only */
+
+    // Returns the sequence number of data. Blocks while the ring is full.
+    uint64_t append(int shard, const std::string& data);
+    uint64_t durable(int shard) const {
+        return _shards[shard]->durable.load(std::memory_order_acquire);
+    }
+    SelectableQueue<uint64_t>* notify(int shard) {
+        return &_shards[shard]->notify;
+    }
+
+    // the shard should start dumping its snapshot to snapshot_path()
+    bool snapshot_requested(int shard) const {
+        return _shards[shard]->snapshot.load(std::memory_order_acquire) == SNAPSHOT_REQUESTED;
+    }
+    std::string snapshot_path(int shard) const;
+    void snapshot_started(int shard);
+    void snapshot_done(int shard, bool ok);
+
+    // Starts a background rewrite, -1 if one is already running.
+    int rewrite();
+
+    // INFO-style persistence section
+    std::string info() const;
+
+    // Calls fn for every command in path, followed by those in
+    // "<path>.incr" if a rewrite was interrupted. A truncated last command
+    // is cut off. Returns the number of commands, -1 on error.
+    static int64_t load(const std::string& path, const std::function<void(const Message& msg)>& fn);
+
+private:
+    enum { SNAPSHOT_NONE = 0, SNAPSHOT_REQUESTED, SNAPSHOT_RUNNING, SNAPSHOT_DONE, SNAPSHOT_FAILED };
+
+    struct Shard {
+        Shard(size_t buffer_size) : ring(buffer_size) {
+        }
+        RingBuffer ring;
+        // written by the shard
+        alignas(64) std::atomic<uint64_t> appended{0};
+        // written by the writer
+        alignas(64) std::atomic<uint64_t> durable{0};
+        std::atomic<int> snapshot{SNAPSHOT_NONE};
+        SelectableQueue<uint64_t> notify;
+    };
+
+    static void writer_func(Aof* aof);
+    // drains the rings to _fd, returns the bytes written, -1 on error
+    int64_t drain(std::vector<uint64_t>* seqs);
+    void sync();
+    void start_rewrite();
+    void finish_rewrite();
+    void abort_rewrite();
+    // appends the incr file to the log and makes the log _fd again, -1
+    // if that fails and _fd stays on the incr file
+    int fold_incr();
+
+    std::string _path;
+    int _policy;
+    int _fd;
+    uint64_t _auto_rewrite_size;
+    std::vector<Shard*> _shards;
+    // the writer's batch, _buf_len bytes of it are used
+    std::vector<char> _buf;
+    size_t _buf_len;
+
+    std::thread _writer;
+    std::atomic<bool> _stop;
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::atomic<bool> _wakeup;
+
+    std::atomic<bool> _rewrite_requested;
+    std::atomic<bool> _rewriting;
+    // writer only; _fd is the incr file of an aborted rewrite
+    bool _on_incr;
+    std::atomic<uint64_t> _size;
+    std::atomic<uint64_t> _base_size;
+    uint64_t _dirty;
+    uint64_t _last_sync;
+    std::atomic<uint64_t> _fsyncs;
+    std::atomic<uint64_t> _rewrites;
+    std::atomic<int> _last_write_errno;
+};
+
+}; // namespace redis
+
+#endif
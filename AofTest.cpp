@@ -0,0 +1,261 @@
+// Tests of Aof on files in /tmp, with the test playing the shards: loading
+// a log with a truncated tail, rewrites that finish or are aborted, and the
+// replay after a rewrite that was interrupted.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Aof.h"
+#include "TestUtil.h"
+
+static const int SHARDS = 2;
+
+static std::string record(const std::string& key, const std::string& val) {
+    return redis::Message(std::vector<std::string>{"SET", key, val}).Encode();
+}
+
+static void write_file(const std::string& path, const std::string& data) {
+    FILE* fp = fopen(path.c_str(), "wb");
+    CHECK(fp);
+    CHECK(fwrite(data.data(), 1, data.size(), fp) == data.size());
+    fclose(fp);
+}
+
+static bool exists(const std::string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+static int64_t size_of(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+}
+
+// the commands of the log as "key=val", in order
+static std::vector<std::string> load(const std::string& path) {
+    std::vector<std::string> ret;
+    int64_t n = redis::Aof::load(path, [&](const redis::Message& msg) {
+        ret.push_back(msg.Vals()[1] + "=" + msg.Vals()[2]);
+    });
+    CHECK(n == (int64_t)ret.size());
+    return ret;
+}
+
+static std::string join(const std::vector<std::string>& list) {
+    std::string ret;
+    for (auto& s : list) {
+        ret += (ret.empty() ? "" : " ") + s;
+    }
+    return ret;
+}
+
+static void remove_all(const std::string& path) {
+    unlink(path.c_str());
+    unlink((path + ".incr").c_str());
+    unlink((path + ".rewrite").c_str());
+    for (int i = 0; i < SHARDS; i++) {
+        unlink((path + ".base." + std::to_string(i)).c_str());
+    }
+}
+
+// waits until what was appended to shard is on disk
+static void wait_durable(redis::Aof* aof, int shard, uint64_t seq) {
+    for (int i = 0; i < 10000 && aof->durable(shard) < seq; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(aof->durable(shard) >= seq);
+}
+
+// waits for the writer to take up a requested rewrite
+static void wait_snapshot_requested(redis::Aof* aof) {
+    for (int shard = 0; shard < SHARDS; shard++) {
+        for (int i = 0; i < 10000 && !aof->snapshot_requested(shard); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(aof->snapshot_requested(shard));
+    }
+}
+
+// waits for the writer to finish or abort the rewrite
+static void wait_rewrite_over(redis::Aof* aof) {
+    for (int i = 0; i < 10000 && aof->info().find("aof_rewrite_in_progress:0") == std::string::npos; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(aof->info().find("aof_rewrite_in_progress:0") != std::string::npos);
+}
+
+// A command cut off by a crash is dropped, and so from the file, so that
+// what is appended next is not glued to it; a command that is not RESP
+// fails the load.
+static void test_load_truncated(const std::string& path) {
+    remove_all(path);
+    CHECK(join(load(path)) == "");
+
+    std::string data = record("a", "1") + record("b", "2");
+    std::string partial = record("c", "3");
+    write_file(path, data + partial.substr(0, partial.size() - 3));
+    CHECK_EQ(join(load(path)), "a=1 b=2");
+    CHECK(size_of(path) == (int64_t)data.size());
+    // and loads the same again
+    CHECK_EQ(join(load(path)), "a=1 b=2");
+
+    write_file(path, data + "?garbage\r\n" + record("c", "3"));
+    CHECK(redis::Aof::load(path, [](const redis::Message& msg) {}) == -1);
+
+    remove_all(path);
+    printf("load truncated ok\n");
+}
+
+// Appends of both shards reach the log, each shard's in order.
+static void test_append(const std::string& path) {
+    remove_all(path);
+    redis::Aof aof;
+    CHECK(aof.open(path, SHARDS, redis::Aof::FSYNC_ALWAYS, 0) == 0);
+    uint64_t seq = 0;
+    for (int i = 0; i < 100; i++) {
+        seq = aof.append(i % SHARDS, record("k" + std::to_string(i), std::to_string(i)));
+    }
+    wait_durable(&aof, 0, seq);
+    wait_durable(&aof, 1, seq);
+    aof.close();
+
+    std::vector<std::string> got = load(path);
+    CHECK(got.size() == 100);
+    int last[SHARDS] = {-1, -1};
+    for (auto& s : got) {
+        int i = atoi(s.c_str() + s.find('=') + 1);
+        CHECK(i > last[i % SHARDS]);
+        last[i % SHARDS] = i;
+    }
+    remove_all(path);
+    printf("append ok\n");
+}
+
+// Writes during a rewrite go to the incr file; the new log is the shards'
+// snapshots followed by them, and the temporary files are gone.
+static void test_rewrite(const std::string& path) {
+    remove_all(path);
+    redis::Aof aof;
+    CHECK(aof.open(path, SHARDS, redis::Aof::FSYNC_ALWAYS, 0) == 0);
+    wait_durable(&aof, 0, aof.append(0, record("a", "1")));
+    wait_durable(&aof, 1, aof.append(1, record("b", "1")));
+    wait_durable(&aof, 0, aof.append(0, record("a", "2")));
+
+    CHECK(aof.rewrite() == 0);
+    wait_snapshot_requested(&aof);
+    CHECK(aof.rewrite() == -1);
+    for (int shard = 0; shard < SHARDS; shard++) {
+        aof.snapshot_started(shard);
+    }
+    // a write racing with the snapshots
+    wait_durable(&aof, 1, aof.append(1, record("b", "2")));
+    CHECK(exists(path + ".incr"));
+    write_file(aof.snapshot_path(0), record("a", "2"));
+    write_file(aof.snapshot_path(1), record("b", "1"));
+    aof.snapshot_done(0, true);
+    aof.snapshot_done(1, true);
+    wait_rewrite_over(&aof);
+    CHECK(aof.info().find("aof_rewrites:1") != std::string::npos);
+
+    // the log is the new file now
+    wait_durable(&aof, 0, aof.append(0, record("a", "3")));
+    aof.close();
+    CHECK_EQ(join(load(path)), "a=2 b=1 b=2 a=3");
+    CHECK(!exists(path + ".incr"));
+    CHECK(!exists(path + ".rewrite"));
+    CHECK(!exists(aof.snapshot_path(0)) && !exists(aof.snapshot_path(1)));
+    remove_all(path);
+    printf("rewrite ok\n");
+}
+
+// A shard whose snapshot fails aborts the rewrite: the incr file is folded
+// back into the old log, which keeps every write, and the next rewrite
+// works.
+static void test_rewrite_abort(const std::string& path) {
+    remove_all(path);
+    redis::Aof aof;
+    CHECK(aof.open(path, SHARDS, redis::Aof::FSYNC_ALWAYS, 0) == 0);
+    wait_durable(&aof, 0, aof.append(0, record("a", "1")));
+
+    CHECK(aof.rewrite() == 0);
+    wait_snapshot_requested(&aof);
+    aof.snapshot_started(0);
+    aof.snapshot_started(1);
+    wait_durable(&aof, 1, aof.append(1, record("b", "1")));
+    write_file(aof.snapshot_path(0), record("a", "1"));
+    aof.snapshot_done(0, true);
+    aof.snapshot_done(1, false);
+    wait_rewrite_over(&aof);
+    CHECK(aof.info().find("aof_rewrites:0") != std::string::npos);
+    CHECK(!exists(path + ".incr"));
+    CHECK(!exists(aof.snapshot_path(0)));
+
+    // appends go to the log again
+    wait_durable(&aof, 0, aof.append(0, record("a", "2")));
+    CHECK_EQ(join(load(path)), "a=1 b=1 a=2");
+
+    CHECK(aof.rewrite() == 0);
+    wait_snapshot_requested(&aof);
+    write_file(aof.snapshot_path(0), record("a", "2"));
+    write_file(aof.snapshot_path(1), record("b", "1"));
+    aof.snapshot_done(0, true);
+    aof.snapshot_done(1, true);
+    wait_rewrite_over(&aof);
+    aof.close();
+    CHECK_EQ(join(load(path)), "a=2 b=1");
+    remove_all(path);
+    printf("rewrite abort ok\n");
+}
+
+// A crash during a rewrite leaves the old log and the incr file: load()
+// replays both, in that order, and open() appends the incr file to the log,
+// so that the next load has all of it from the log alone. The same holds
+// if the crash came after the rename, as records are idempotent.
+static void test_interrupted_rewrite(const std::string& path) {
+    remove_all(path);
+    write_file(path, record("a", "1") + record("b", "1"));
+    write_file(path + ".incr", record("a", "2"));
+    write_file(path + ".base.0", record("a", "1"));
+    CHECK_EQ(join(load(path)), "a=1 b=1 a=2");
+
+    redis::Aof aof;
+    CHECK(aof.open(path, SHARDS, redis::Aof::FSYNC_ALWAYS, 0) == 0);
+    CHECK(!exists(path + ".incr"));
+    CHECK(!exists(path + ".base.0"));
+    wait_durable(&aof, 1, aof.append(1, record("b", "2")));
+    aof.close();
+    CHECK_EQ(join(load(path)), "a=1 b=1 a=2 b=2");
+
+    // renamed already: the incr file is in the log, and replayed again
+    write_file(path, record("a", "2") + record("b", "1") + record("a", "3"));
+    write_file(path + ".incr", record("a", "3"));
+    CHECK_EQ(join(load(path)), "a=2 b=1 a=3 a=3");
+    CHECK(aof.open(path, SHARDS, redis::Aof::FSYNC_ALWAYS, 0) == 0);
+    aof.close();
+    CHECK_EQ(join(load(path)), "a=2 b=1 a=3 a=3");
+
+    // a torn incr file is cut off like the log
+    std::string rec = record("b", "3");
+    write_file(path + ".incr", record("a", "4") + rec.substr(0, 5));
+    CHECK_EQ(join(load(path)), "a=2 b=1 a=3 a=3 a=4");
+    CHECK(size_of(path + ".incr") == (int64_t)record("a", "4").size());
+    remove_all(path);
+    printf("interrupted rewrite ok\n");
+}
+
+int main(int argc, char** argv) {
+    std::string path = "/tmp/aof_test." + std::to_string(getpid()) + ".aof";
+
+    test_load_truncated(path);
+    test_append(path);
+    test_rewrite(path);
+    test_rewrite_abort(path);
+    test_interrupted_rewrite(path);
+
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "AsyncClient.h"
+#include <memory>
+#include "fde.h"
+
+namespace redis {
+
+AsyncClient::AsyncClient() {
+    _fdes = new Fdevents();
+    _conn = NULL;
+    _close_flag = false;
+}
+
+AsyncClient::~AsyncClient() {
+    Close();
+    delete _fdes;
+}
+
+int AsyncClient::Connect(const std::string& host, int port) {
+    if (_conn) {
+        return -1;
+    }
+    _conn = new Connection(_fdes);
+    _conn->on_push(_push_cb);
+    if (_conn->connect(host, port) == -1) {
+        delete _conn;
+        _conn = NULL;
+        return -1;
+    }
+    _fdes->set(_queue.fd(), FDEVENT_IN, 0, &_queue);
+    _close_flag = false;
+    _thread = std::thread(&AsyncClient::loop_func, this);
+    return 0;
+}
+
+void AsyncClient::Close() {
+    if (_thread.joinable()) {
+        _close_flag = true;
+        _thread.join();
+    }
+    // fails whatever is still in flight
+    delete _conn;
+    _conn = NULL;
+    while (_queue.size() > 0) {
+        Request* r = NULL;
+        _queue.pop(&r);
+        r->cb(Reply::Error("connection closed"));
+        delete r;
+    }
+}
+
+void AsyncClient::Call(const Message& req, Callback cb) {
+    if (!_thread.joinable()) {
+        cb(Reply::Error("not connected"));
+        return;
+    }
+    Request* r = new Request();
+    r->req = req;
+    r->cb = cb;
+    _queue.push(r);
+}
+
+std::future<Reply> AsyncClient::Call(const Message& req) {
+    auto promise = std::make_shared<std::promise<Reply>>();
+    Call(req, [promise](const Reply& reply) {
+        promise->set_value(reply);
+    });
+    return promise->get_future();
+}
+
+void AsyncClient::loop_func(AsyncClient* client) {
+    Fdevents* fdes = client->_fdes;
+    Connection* conn = client->_conn;
+    SelectableQueue<Request*>* queue = &client->_queue;
+    const Fdevents::events_t* events;
+
+    while (!client->_close_flag) {
+        events = fdes->wait(100);
+        if (events == NULL) {
+            break;
+        }
+        for (int i = 0; i < (int)events->size(); i++) {
+            const Fdevent* fde = events->at(i);
+            if (fde->data.ptr == queue) {
+                // everything queued so far goes out in one write
+                while (queue->size() > 0) {
+                    Request* r = NULL;
+                    queue->pop(&r);
+                    conn->send(r->req, r->cb);
+                    delete r;
+                }
+            } else if (fde->data.ptr == conn) {
+                conn->handle(fde);
+            }
+        }
+    }
+}
+
+}; // namespace redis
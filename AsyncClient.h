@@ -0,0 +1,58 @@
+#ifndef REDIS_ASYNC_CLIENT_H_
+#define REDIS_ASYNC_CLIENT_H_
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <thread>
+#include "Connection.h"
+#include "SelectableQueue.h"
+
+class Fdevents;
+
+namespace redis {
+
+// Thread-safe RESP client. Requests from any number of threads are
+// pipelined onto a single connection owned by the client's reactor
+// thread, callbacks run on that thread.
+class AsyncClient {
+public:
+    typedef Connection::Callback Callback;
+
+    AsyncClient();
+    ~AsyncClient();
+
+    // host may be a unix socket path, see LinkAddr. Does not wait for the
+    // connection to be established.
+    int Connect(const std::string& host, int port);
+    void Close();
+
+    void Call(const Message& req, Callback cb);
+    std::future<Reply> Call(const Message& req);
+
+    // cb gets the RESP3 push replies (after HELLO 3), e.g. the invalidations
+    // of CLIENT TRACKING, on the client's thread. Must be called before
+    // Connect().
+    void OnPush(Callback cb) {
+        _push_cb = cb;
+    }
+
+private:
+    struct Request {
+        Message req;
+        Callback cb;
+    };
+
+    static void loop_func(AsyncClient* client);
+
+    Fdevents* _fdes;
+    Connection* _conn;
+    Callback _push_cb;
+    SelectableQueue<Request*> _queue;
+    std::thread _thread;
+    std::atomic<bool> _close_flag;
+};
+
+}; // namespace redis
+
+#endif
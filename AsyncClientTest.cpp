@@ -0,0 +1,280 @@
+// Tests of AsyncClient against a Transport started in-process: pipelined
+// calls from several threads, reply order, and the error paths.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AsyncClient.h"
+#include "TestUtil.h"
+
+// "echo x" is answered with x, "echo slow:x" takes a while, "echo big:n"
+// is answered with n bytes
+static void echo_handler(const redis::Message& req, redis::Response* resp) {
+    std::string val = req.Key();
+    if (val.compare(0, 5, "slow:") == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    } else if (val.compare(0, 4, "big:") == 0) {
+        val = std::string(atoi(val.c_str() + 4), 'x');
+    }
+    resp->ReplyBulk(val);
+}
+
+static redis::Message echo(const std::string& val) {
+    return redis::Message(std::vector<std::string>{"echo", val});
+}
+
+// waits for n callbacks, or fails the test after 10s
+static void wait_for(std::atomic<int>* done, int n) {
+    for (int i = 0; i < 10000 && done->load() < n; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK(done->load() == n);
+}
+
+// Threads call concurrently without waiting for replies; every call gets
+// its own reply, and the calls of each thread are answered in the order it
+// made them.
+static void test_pipelined(const std::string& path) {
+    const int THREADS = 8;
+    const int CALLS = 2000;
+    redis::AsyncClient client;
+    CHECK(client.Connect(path, 0) == 0);
+
+    std::atomic<int> done(0);
+    std::atomic<int> mismatched(0);
+    std::vector<std::vector<int>> order(THREADS);
+    std::mutex mutex;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < CALLS; i++) {
+                std::string val = std::to_string(t) + ":" + std::to_string(i);
+                client.Call(echo(val), [&, t, i, val](const redis::Reply& reply) {
+                    if (reply.Type() != redis::Reply::BULK || reply.Str() != val) {
+                        mismatched++;
+                    }
+                    {
+                        std::lock_guard<std::mutex> lk(mutex);
+                        order[t].push_back(i);
+                    }
+                    done++;
+                });
+            }
+        }));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    wait_for(&done, THREADS * CALLS);
+    CHECK(mismatched == 0);
+    for (int t = 0; t < THREADS; t++) {
+        CHECK((int)order[t].size() == CALLS);
+        for (int i = 0; i < CALLS; i++) {
+            CHECK(order[t][i] == i);
+        }
+    }
+
+    // the future flavour
+    std::vector<std::future<redis::Reply>> futures;
+    for (int i = 0; i < 100; i++) {
+        futures.push_back(client.Call(echo("f" + std::to_string(i))));
+    }
+    for (int i = 0; i < 100; i++) {
+        redis::Reply reply = futures[i].get();
+        CHECK(reply.Str() == "f" + std::to_string(i));
+    }
+    client.Close();
+    printf("pipelined calls ok\n");
+}
+
+static std::string ordering_val(int i) {
+    if (i % 10 == 0) {
+        return "slow:" + std::to_string(i);
+    } else if (i % 10 == 5) {
+        // replies that take several reads, and share reads with others
+        return "big:" + std::to_string(i * 97 % 100000);
+    }
+    return std::to_string(i);
+}
+
+// Replies that come late, in pieces or many in one read: callbacks run in
+// call order, each with its own reply.
+static void test_ordering(const std::string& path) {
+    redis::AsyncClient client;
+    CHECK(client.Connect(path, 0) == 0);
+
+    const int CALLS = 400;
+    std::atomic<int> done(0);
+    std::vector<int> got;
+    for (int i = 0; i < CALLS; i++) {
+        std::string val = ordering_val(i);
+        std::string want = val.compare(0, 4, "big:") == 0 ? std::string(atoi(val.c_str() + 4), 'x') : val;
+        client.Call(echo(val), [&, i, want](const redis::Reply& reply) {
+            // callbacks run on the client's thread only
+            CHECK(reply.Str() == want);
+            got.push_back(i);
+            done++;
+        });
+    }
+    wait_for(&done, CALLS);
+    for (int i = 0; i < CALLS; i++) {
+        CHECK(got[i] == i);
+    }
+    client.Close();
+    printf("reply ordering ok\n");
+}
+
+// Nothing listens on the port: the connect fails right away, or every call
+// is answered with an error.
+static void test_connect_refused() {
+    // bound but not listening, so no one else gets the port meanwhile
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    socklen_t len = sizeof(addr);
+    CHECK(getsockname(sock, (struct sockaddr*)&addr, &len) == 0);
+    int port = ntohs(addr.sin_port);
+
+    redis::AsyncClient client;
+    if (client.Connect("127.0.0.1", port) == 0) {
+        const int CALLS = 10;
+        std::atomic<int> done(0);
+        std::atomic<int> errors(0);
+        for (int i = 0; i < CALLS; i++) {
+            client.Call(echo("x"), [&](const redis::Reply& reply) {
+                if (reply.IsError()) {
+                    errors++;
+                }
+                done++;
+            });
+        }
+        wait_for(&done, CALLS);
+        CHECK(errors == CALLS);
+        client.Close();
+    }
+    // not connected
+    redis::Reply reply = client.Call(echo("x")).get();
+    CHECK(reply.IsError());
+    close(sock);
+    printf("connect refused ok\n");
+}
+
+// The server reads the first request and closes the connection: every call
+// in flight is answered once, with an error.
+static void test_peer_close() {
+    int serv = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    CHECK(bind(serv, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    CHECK(listen(serv, 16) == 0);
+    socklen_t len = sizeof(addr);
+    CHECK(getsockname(serv, (struct sockaddr*)&addr, &len) == 0);
+    int port = ntohs(addr.sin_port);
+
+    std::thread peer([serv]() {
+        int fd = accept(serv, NULL, NULL);
+        CHECK(fd >= 0);
+        char buf[256];
+        CHECK(read(fd, buf, sizeof(buf)) > 0);
+        close(fd);
+    });
+
+    redis::AsyncClient client;
+    CHECK(client.Connect("127.0.0.1", port) == 0);
+    const int CALLS = 50;
+    std::atomic<int> done(0);
+    std::atomic<int> errors(0);
+    for (int i = 0; i < CALLS; i++) {
+        client.Call(echo("x"), [&](const redis::Reply& reply) {
+            if (reply.IsError()) {
+                errors++;
+            }
+            done++;
+        });
+    }
+    wait_for(&done, CALLS);
+    CHECK(errors == CALLS);
+    peer.join();
+
+    // and so is every call after that
+    redis::Reply reply = client.Call(echo("x")).get();
+    CHECK(reply.IsError());
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(done == CALLS);
+    client.Close();
+    close(serv);
+    printf("peer close ok\n");
+}
+
+// Decode() and Skip() of replies that are incomplete, malformed or carry
+// RESP3 attributes; both must agree on the size of a reply.
+static void test_decode() {
+    struct Case {
+        std::string data;
+        int size; // what Decode() and Skip() return
+    };
+    std::string attr = "|2\r\n+ttl\r\n:3600\r\n+key-popularity\r\n%1\r\n$1\r\na\r\n,0.19\r\n";
+    std::vector<Case> cases = {
+        {"*2\r\n:1\r\n$3\r\nabc\r\n", 17},
+        {"*2\r\n:1\r\n$3\r\nab", 0},
+        {"*0\r\n", 4},
+        {"*-1\r\n", 5},
+        {"%1\r\n+a\r\n:1\r\n", 12},
+        // counts and sizes that are not backed by input wait for more
+        {"*2147483647\r\n:1\r\n", 0},
+        {"%2147483647\r\n:1\r\n", 0},
+        {"~1073741824\r\n", 0},
+        {"$2147483647\r\nabc\r\n", 0},
+        // and those past any input are errors
+        {"*99999999999\r\n", -1},
+        {"$99999999999\r\n", -1},
+        {"?1\r\n", -1},
+        {attr + "+OK\r\n", (int)attr.size() + 5},
+        {attr + "+OK", 0},
+        {attr.substr(0, 20), 0},
+        {"*2\r\n" + attr + ":1\r\n:2\r\n", 4 + (int)attr.size() + 8},
+    };
+    for (auto& c : cases) {
+        redis::Reply reply;
+        if (reply.Decode(c.data) != c.size || redis::Reply::Skip(c.data.data(), c.data.size()) != c.size) {
+            fprintf(stderr, "%s: Decode %d, Skip %d, want %d\n", c.data.c_str(), reply.Decode(c.data),
+                redis::Reply::Skip(c.data.data(), c.data.size()), c.size);
+            exit(1);
+        }
+    }
+
+    redis::Reply reply;
+    CHECK(reply.Decode(attr + "+OK\r\n") > 0);
+    CHECK(reply.Type() == redis::Reply::STATUS && reply.Str() == "OK");
+    CHECK(reply.Decode("*2\r\n" + attr + ":1\r\n:2\r\n") > 0);
+    CHECK(reply.Elements().size() == 2 && reply.Elements()[0].Int() == 1);
+    printf("decode ok\n");
+}
+
+int main(int argc, char** argv) {
+    redis::TestServer server("async_client_test");
+    server.Start(echo_handler);
+
+    test_decode();
+    test_pipelined(server.path());
+    test_ordering(server.path());
+    test_connect_refused();
+    test_peer_close();
+
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "BlockedClients.h"
+#include <algorithm>
+#include "Reactor.h"
+
+namespace redis {
+
+static const int SHARDS = 64;
+
+BlockedClients::BlockedClients(int reactors) {
+    for (int i = 0; i < reactors; i++) {
+        _locals.push_back(new Local());
+    }
+    for (int i = 0; i < SHARDS; i++) {
+        _shards.push_back(new Shard());
+    }
+    _blocked = 0;
+}
+
+BlockedClients::~BlockedClients() {
+    for (auto local : _locals) {
+        delete local;
+    }
+    for (auto shard : _shards) {
+        delete shard;
+    }
+}
+
+BlockedClients::Shard* BlockedClients::shard(const std::string& key) {
+    return _shards[std::hash<std::string>()(key) % _shards.size()];
+}
+
+void BlockedClients::block(int client_id, const std::vector<std::string>& keys, uint64_t deadline) {
+    BlockedClientPtr client = std::make_shared<BlockedClient>();
+    client->client_id = client_id;
+    client->keys = keys;
+    client->deadline = deadline;
+
+    Local* l = local(client_id);
+    {
+        std::lock_guard<std::mutex> lk(l->mutex);
+        l->clients[client_id] = client;
+    }
+    for (auto& key : keys) {
+        Shard* s = shard(key);
+        std::lock_guard<std::mutex> lk(s->mutex);
+        s->keys[key].push_back(client);
+    }
+    _blocked++;
+    l->inbox.push(client);
+}
+
+int BlockedClients::wake(const std::string& key) {
+    BlockedClientPtr client;
+    {
+        Shard* s = shard(key);
+        std::lock_guard<std::mutex> lk(s->mutex);
+        auto it = s->keys.find(key);
+        if (it == s->keys.end()) {
+            return -1;
+        }
+        std::deque<BlockedClientPtr>& queue = it->second;
+        while (!queue.empty() && !client) {
+            if (queue.front()->claim()) {
+                client = queue.front();
+            }
+            queue.pop_front();
+        }
+        if (queue.empty()) {
+            s->keys.erase(it);
+        }
+    }
+    if (!client) {
+        return -1;
+    }
+    release(client);
+    return client->client_id;
+}
+
+void BlockedClients::release(const BlockedClientPtr& client) {
+    for (auto& key : client->keys) {
+        Shard* s = shard(key);
+        std::lock_guard<std::mutex> lk(s->mutex);
+        auto it = s->keys.find(key);
+        if (it == s->keys.end()) {
+            continue;
+        }
+        std::deque<BlockedClientPtr>& queue = it->second;
+        queue.erase(std::remove(queue.begin(), queue.end(), client), queue.end());
+        if (queue.empty()) {
+            s->keys.erase(it);
+        }
+    }
+    Local* l = local(client->client_id);
+    {
+        std::lock_guard<std::mutex> lk(l->mutex);
+        auto it = l->clients.find(client->client_id);
+        if (it != l->clients.end() && it->second == client) {
+            l->clients.erase(it);
+        }
+    }
+    _blocked--;
+}
+
+void BlockedClients::received(Reactor* reactor) {
+    Local* l = _locals[reactor->index()];
+    while (l->inbox.size() > 0) {
+        BlockedClientPtr client;
+        l->inbox.pop(&client);
+        auto it = reactor->_clients.find(client->client_id);
+        if (it == reactor->_clients.end() || it->second->blocking == 0) {
+            // closed before its reactor heard of it
+            if (client->claim()) {
+                release(client);
+            }
+            continue;
+        }
+        if (client->deadline > 0 && !client->claimed) {
+            l->timers.insert(std::make_pair(client->deadline, client));
+        }
+    }
+}
+
+uint64_t BlockedClients::expire(Reactor* reactor, uint64_t now, std::vector<int>* ids) {
+    Local* l = _locals[reactor->index()];
+    while (!l->timers.empty() && l->timers.begin()->first <= now) {
+        BlockedClientPtr client = l->timers.begin()->second;
+        l->timers.erase(l->timers.begin());
+        if (client->claim()) {
+            release(client);
+            ids->push_back(client->client_id);
+        }
+    }
+    return l->timers.empty() ? 0 : l->timers.begin()->first;
+}
+
+void BlockedClients::closed(int client_id) {
+    Local* l = local(client_id);
+    BlockedClientPtr client;
+    {
+        std::lock_guard<std::mutex> lk(l->mutex);
+        auto it = l->clients.find(client_id);
+        if (it == l->clients.end()) {
+            return;
+        }
+        client = it->second;
+    }
+    if (client->claim()) {
+        release(client);
+    }
+}
+
+}; // namespace redis
@@ -0,0 +1,103 @@
+#ifndef REDIS_BLOCKED_CLIENTS_H_
+#define REDIS_BLOCKED_CLIENTS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "SelectableQueue.h"
+
+namespace redis {
+
+class Reactor;
+
+// a client waiting on keys, see BlockedClients
+struct BlockedClient {
+    int client_id;
+    std::vector<std::string> keys;
+    // Clock, 0 for none
+    uint64_t deadline;
+    // set by whoever answers the client: Wake(), its timeout or its close
+    std::atomic<bool> claimed{false};
+
+    bool claim() {
+        bool expected = false;
+        return claimed.compare_exchange_strong(expected, true);
+    }
+};
+typedef std::shared_ptr<BlockedClient> BlockedClientPtr;
+
+// Clients blocked on keys by the consumer, see Transport::Block(). A
+// blocked client is on the queue of each of its keys, in a table shared by
+// all threads, sharded by key with a mutex per shard, and is handed to its
+// reactor for its timeout. Wake() of a key takes the client that waited
+// longest on it; a client is answered once, by whichever of a wake, its
+// timeout or its close claims it first, which then takes it off the queues
+// of its other keys.
+//
+// Until it is answered the client occupies no consumer thread and nothing
+// in the Recv() queue, and its reactor reads no more of its input, only
+// watches for it to close.
+class BlockedClients {
+public:
+    explicit BlockedClients(int reactors);
+    ~BlockedClients();
+
+    /* any thread */
+
+    void block(int client_id, const std::vector<std::string>& keys, uint64_t deadline);
+    // lets the client go, if it is blocked: its entries are claimed, and
+    // wake() skips them
+    void closed(int client_id);
+    // claims the client blocked longest on key, -1 if none
+    int wake(const std::string& key);
+    int blocked() const {
+        return _blocked.load(std::memory_order_relaxed);
+    }
+
+    /* called by the reactor thread only */
+
+    SelectableQueue<BlockedClientPtr>* inbox(int index) {
+        return &_locals[index]->inbox;
+    }
+    // takes the clients blocked since, for their timeouts; those that
+    // closed meanwhile are let go
+    void received(Reactor* reactor);
+    // claims the clients whose time is up at now, into *ids, and returns
+    // the next deadline, 0 if none
+    uint64_t expire(Reactor* reactor, uint64_t now, std::vector<int>* ids);
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::deque<BlockedClientPtr>> keys;
+    };
+    struct Local {
+        SelectableQueue<BlockedClientPtr> inbox;
+        // the clients of the reactor, to let them go on close
+        std::mutex mutex;
+        std::unordered_map<int, BlockedClientPtr> clients;
+        // reactor thread only; claimed ones are skipped when due
+        std::multimap<uint64_t, BlockedClientPtr> timers;
+    };
+
+    Shard* shard(const std::string& key);
+    Local* local(int client_id) {
+        return _locals[client_id % _locals.size()];
+    }
+    // takes a claimed client off the tables
+    void release(const BlockedClientPtr& client);
+
+    std::vector<Local*> _locals;
+    std::vector<Shard*> _shards;
+    std::atomic<int> _blocked;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,129 @@
+#include "BufferPool.h"
+#include "Numa.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace redis {
+
+BufferPool::BufferPool(size_t max_free) {
+    _max_free = max_free;
+    _node = -1;
+}
+
+BufferPool::~BufferPool() {
+    for (auto block : _free) {
+        bool carved = false;
+        for (auto chunk : _chunks) {
+            if (block >= chunk && block < chunk + NODE_CHUNK_BLOCKS * BLOCK_SIZE) {
+                carved = true;
+                break;
+            }
+        }
+        if (!carved) {
+            ::free(block);
+        }
+    }
+    for (auto chunk : _chunks) {
+        Numa::free(chunk, NODE_CHUNK_BLOCKS * BLOCK_SIZE);
+    }
+}
+
+void BufferPool::set_node(int node) {
+    _node = node;
+}
+
+char* BufferPool::alloc() {
+    used.add(BLOCK_SIZE);
+    if (_free.empty() && _node >= 0) {
+        char* chunk = (char*)Numa::alloc(NODE_CHUNK_BLOCKS * BLOCK_SIZE, _node);
+        if (chunk) {
+            _chunks.push_back(chunk);
+            for (size_t i = NODE_CHUNK_BLOCKS; i > 1; i--) {
+                _free.push_back(chunk + (i - 1) * BLOCK_SIZE);
+            }
+            idle.add((NODE_CHUNK_BLOCKS - 1) * BLOCK_SIZE);
+            return chunk;
+        }
+    }
+    if (_free.empty()) {
+        return (char*)malloc(BLOCK_SIZE);
+    }
+    char* ret = _free.back();
+    _free.pop_back();
+    idle.add(-(int64_t)BLOCK_SIZE);
+    return ret;
+}
+
+void BufferPool::free(char* block) {
+    used.add(-(int64_t)BLOCK_SIZE);
+    if (_free.size() >= _max_free && _node < 0) {
+        ::free(block);
+        return;
+    }
+    _free.push_back(block);
+    idle.add(BLOCK_SIZE);
+}
+
+void IoBuffer::reserve(BufferPool* pool, size_t n) {
+    if (cap - len >= n) {
+        return;
+    }
+    if (off > 0) {
+        memmove(data, data + off, len - off);
+        len -= off;
+        off = 0;
+        if (cap - len >= n) {
+            return;
+        }
+    }
+    if (!data && pool && n <= BufferPool::BLOCK_SIZE) {
+        data = pool->alloc();
+        cap = BufferPool::BLOCK_SIZE;
+        return;
+    }
+    size_t want = cap ? cap : BufferPool::BLOCK_SIZE;
+    while (want - len < n) {
+        want *= 2;
+    }
+    if (pool && cap == BufferPool::BLOCK_SIZE) {
+        // outgrows the block, which goes back to the pool
+        char* p = (char*)malloc(want);
+        memcpy(p, data, len);
+        pool->free(data);
+        pool->used.add(want);
+        data = p;
+    } else {
+        data = (char*)realloc(data, want);
+        if (pool) {
+            pool->used.add(want - cap);
+        }
+    }
+    cap = want;
+}
+
+void IoBuffer::append(BufferPool* pool, const char* p, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    reserve(pool, n);
+    memcpy(data + len, p, n);
+    len += n;
+}
+
+void IoBuffer::release(BufferPool* pool) {
+    if (!data) {
+        return;
+    }
+    if (pool && cap == BufferPool::BLOCK_SIZE) {
+        pool->free(data);
+    } else {
+        ::free(data);
+        if (pool) {
+            pool->used.add(-(int64_t)cap);
+        }
+    }
+    data = NULL;
+    off = len = cap = 0;
+}
+
+}; // namespace redis
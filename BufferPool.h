@@ -0,0 +1,92 @@
+#ifndef REDIS_BUFFER_POOL_H_
+#define REDIS_BUFFER_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "Stats.h"
+
+namespace redis {
+
+// Free list of fixed-size I/O blocks shared by the links of one reactor.
+// A link takes a block when data arrives and gives it back once the data
+// is consumed, so an idle connection holds no buffer memory. Single
+// threaded, the gauges may be read from any thread.
+class BufferPool {
+public:
+    static const size_t BLOCK_SIZE = 16 * 1024;
+    // blocks carved at a time from node-local memory
+    static const size_t NODE_CHUNK_BLOCKS = 64;
+
+    // keeps at most max_free blocks around
+    BufferPool(size_t max_free = 1024);
+    ~BufferPool();
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Take the blocks from memory placed on a NUMA node, before the first
+    // alloc(). Such blocks are kept for reuse, whatever max_free is.
+    void set_node(int node);
+
+    char* alloc();
+    void free(char* block);
+
+    // bytes in buffers of links, including ones larger than a block
+    Gauge used;
+    // bytes of free blocks in the pool
+    Gauge idle;
+
+private:
+    size_t _max_free;
+    int _node;
+    std::vector<char*> _free;
+    std::vector<char*> _chunks;
+};
+
+// A byte buffer consumed from the front, as a link's input or output.
+// Storage is a pool block, or malloc() memory once it outgrows one or when
+// there is no pool; it is returned by release(), which leaves no memory
+// behind.
+struct IoBuffer {
+    char* data = NULL;
+    size_t off = 0;
+    size_t len = 0;
+    size_t cap = 0;
+
+    IoBuffer() {
+    }
+    IoBuffer(const IoBuffer&) = delete;
+    IoBuffer& operator=(const IoBuffer&) = delete;
+
+    const char* begin() const {
+        return data + off;
+    }
+    size_t size() const {
+        return len - off;
+    }
+    bool empty() const {
+        return off == len;
+    }
+    // free space after the data
+    char* tail() {
+        return data + len;
+    }
+    size_t room() const {
+        return cap - len;
+    }
+
+    // makes room() at least n, moving the data to the front first
+    void reserve(BufferPool* pool, size_t n);
+    void append(BufferPool* pool, const char* p, size_t n);
+    void consume(size_t n) {
+        off += n;
+        if (off == len) {
+            off = len = 0;
+        }
+    }
+    void release(BufferPool* pool);
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,66 @@
+#include "BulkSink.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace redis {
+
+BulkSinkFactory FileBulkSink::factory(const std::string& dir) {
+    return [dir](const Message& header, size_t size) -> BulkSink* {
+        return create(dir);
+    };
+}
+
+FileBulkSink* FileBulkSink::create(const std::string& dir) {
+    std::string path = dir + "/bulk.XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd == -1) {
+        fprintf(stderr, "create %s failed: %s\n", path.c_str(), strerror(errno));
+        return NULL;
+    }
+    return new FileBulkSink(fd, path);
+}
+
+FileBulkSink::FileBulkSink(int fd, const std::string& path) {
+    _fd = fd;
+    _path = path;
+}
+
+FileBulkSink::~FileBulkSink() {
+    if (_fd >= 0) {
+        // not finished
+        ::close(_fd);
+        ::unlink(_path.c_str());
+    }
+}
+
+int FileBulkSink::write(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(_fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "write %s failed: %s\n", _path.c_str(), strerror(errno));
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int FileBulkSink::finish(std::string* arg) {
+    if (::close(_fd) == -1) {
+        _fd = -1;
+        ::unlink(_path.c_str());
+        return -1;
+    }
+    _fd = -1;
+    *arg = _path;
+    return 0;
+}
+
+}; // namespace redis
@@ -0,0 +1,55 @@
+#ifndef REDIS_BULK_SINK_H_
+#define REDIS_BULK_SINK_H_
+
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include "Message.h"
+
+namespace redis {
+
+// Receives a large argument of a request as it arrives, instead of having
+// the whole request buffered first, see Transport::SetBulkSink(). Runs in
+// the reactor thread of the client, so it must not block for long.
+class BulkSink {
+public:
+    // Deleted after finish(), or without it when the client goes away or
+    // the request failed, in which case whatever was written is dropped.
+    virtual ~BulkSink() {
+    }
+    // The next bytes of the argument. -1 fails the request: the rest of the
+    // argument is read and discarded, and the client gets an error.
+    virtual int write(const char* data, size_t len) = 0;
+    // The argument is complete. Sets *arg to what the request carries in
+    // its place, e.g. a file name or a digest. -1 fails the request.
+    virtual int finish(std::string* arg) = 0;
+};
+
+// Called in the reactor thread with the request so far, the command and
+// the arguments before the large one, and the size of the large one.
+// Returning NULL rejects the request.
+typedef std::function<BulkSink*(const Message& header, size_t size)> BulkSinkFactory;
+
+// Spools the argument to a new file in a directory, the request then
+// carries the path of the file, which the consumer owns from then on.
+class FileBulkSink : public BulkSink {
+public:
+    // makes a FileBulkSink in dir for every large argument
+    static BulkSinkFactory factory(const std::string& dir);
+    // NULL if the file cannot be created
+    static FileBulkSink* create(const std::string& dir);
+
+    ~FileBulkSink();
+    int write(const char* data, size_t len) override;
+    int finish(std::string* arg) override;
+
+private:
+    FileBulkSink(int fd, const std::string& path);
+
+    int _fd;
+    std::string _path;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,182 @@
+#include "BulkStream.h"
+
+namespace redis {
+
+static const uint64_t MAX_ARGC = 1024 * 1024;
+static const uint64_t MAX_SIZE = 1ULL << 40;
+
+// "<mark><digits>\r\n", returns the length of the line, 0 if it is not
+// complete yet, -1 if it is malformed
+static int parse_size(const char* data, size_t len, char mark, uint64_t* size) {
+    if (len == 0) {
+        return 0;
+    }
+    if (data[0] != mark) {
+        return -1;
+    }
+    uint64_t n = 0;
+    size_t i = 1;
+    for (; i < len && data[i] >= '0' && data[i] <= '9'; i++) {
+        n = n * 10 + (data[i] - '0');
+        if (n > MAX_SIZE) {
+            return -1;
+        }
+    }
+    if (i == 1 && i < len) {
+        return -1;
+    }
+    if (i + 2 > len) {
+        return 0;
+    }
+    if (data[i] != '\r' || data[i + 1] != '\n') {
+        return -1;
+    }
+    *size = n;
+    return (int)(i + 2);
+}
+
+BulkStream* BulkStream::start(const char* data, size_t len, size_t threshold,
+    const BulkSinkFactory* factory, int client_id)
+{
+    uint64_t argc;
+    int r = parse_size(data, len, '*', &argc);
+    if (r <= 0 || argc == 0 || argc > MAX_ARGC) {
+        return NULL;
+    }
+    size_t pos = r;
+    for (uint64_t i = 0; i < argc; i++) {
+        uint64_t size;
+        r = parse_size(data + pos, len - pos, '$', &size);
+        if (r <= 0) {
+            return NULL;
+        }
+        if (size >= threshold) {
+            return new BulkStream(threshold, factory, client_id);
+        }
+        pos += r + size + 2;
+        if (pos > len) {
+            // a small argument still coming
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+BulkStream::BulkStream(size_t threshold, const BulkSinkFactory* factory, int client_id) {
+    _threshold = threshold;
+    _factory = factory;
+    _client_id = client_id;
+    _state = ARRAY_HEADER;
+    _argc = 0;
+    _sink = NULL;
+    _left = 0;
+    _streamed = 0;
+}
+
+BulkStream::~BulkStream() {
+    delete _sink;
+}
+
+void BulkStream::open(uint64_t size) {
+    if (!_error.empty()) {
+        return;
+    }
+    Message header(_client_id, _args);
+    _sink = (*_factory)(header, size);
+    if (!_sink) {
+        fail("ERR argument too large");
+    }
+}
+
+void BulkStream::fail(const char* error) {
+    if (_error.empty()) {
+        _error = error;
+    }
+    delete _sink;
+    _sink = NULL;
+}
+
+void BulkStream::next_arg() {
+    _state = _args.size() == _argc ? DONE : ARG_HEADER;
+}
+
+int BulkStream::feed(const char* data, size_t len) {
+    size_t pos = 0;
+    while (_state != DONE) {
+        const char* p = data + pos;
+        size_t n = len - pos;
+        if (_state == ARRAY_HEADER) {
+            int r = parse_size(p, n, '*', &_argc);
+            if (r <= 0) {
+                return r == 0 ? (int)pos : -1;
+            }
+            if (_argc == 0 || _argc > MAX_ARGC) {
+                return -1;
+            }
+            pos += r;
+            _state = ARG_HEADER;
+        } else if (_state == ARG_HEADER) {
+            uint64_t size;
+            int r = parse_size(p, n, '$', &size);
+            if (r <= 0) {
+                return r == 0 ? (int)pos : -1;
+            }
+            if (size >= _threshold) {
+                pos += r;
+                open(size);
+                _left = size;
+                _state = size ? PAYLOAD : PAYLOAD_END;
+                continue;
+            }
+            if (n < r + size + 2) {
+                return (int)pos;
+            }
+            if (p[r + size] != '\r' || p[r + size + 1] != '\n') {
+                return -1;
+            }
+            _args.emplace_back(p + r, size);
+            pos += r + size + 2;
+            next_arg();
+        } else if (_state == PAYLOAD) {
+            if (n == 0) {
+                return (int)pos;
+            }
+            size_t take = n < _left ? n : (size_t)_left;
+            if (_sink && _sink->write(p, take) == -1) {
+                fail("ERR failed to store argument");
+            }
+            _left -= take;
+            _streamed += take;
+            pos += take;
+            if (_left == 0) {
+                _state = PAYLOAD_END;
+            }
+        } else {
+            if (n < 2) {
+                return (int)pos;
+            }
+            if (p[0] != '\r' || p[1] != '\n') {
+                return -1;
+            }
+            pos += 2;
+            std::string arg;
+            if (_sink && _sink->finish(&arg) == -1) {
+                fail("ERR failed to store argument");
+            }
+            delete _sink;
+            _sink = NULL;
+            _args.push_back(std::move(arg));
+            next_arg();
+        }
+    }
+    return (int)pos;
+}
+
+void BulkStream::take(Message* req) {
+    req->Assign(&_args);
+    if (!_error.empty()) {
+        req->Reject(_error);
+    }
+}
+
+}; // namespace redis
@@ -0,0 +1,64 @@
+#ifndef REDIS_BULK_STREAM_H_
+#define REDIS_BULK_STREAM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "BulkSink.h"
+#include "Message.h"
+
+namespace redis {
+
+// A request whose large arguments go to BulkSinks as they arrive, see
+// Transport::SetBulkSink(). The reactor starts one when Message::Decode()
+// wants more input for a request with an argument of at least threshold
+// bytes, and feeds it the client's input until the request is complete,
+// so the input buffer never holds more than a read's worth of the value.
+class BulkStream {
+public:
+    // A stream for the request at the start of data, if it is a RESP array
+    // with a large argument after only complete small ones, or NULL.
+    static BulkStream* start(const char* data, size_t len, size_t threshold,
+        const BulkSinkFactory* factory, int client_id);
+    ~BulkStream();
+
+    // Takes the next bytes of the request, from its first byte on. Returns
+    // how many were used, -1 on a protocol error. Bytes not used have to be
+    // fed again once more input follows them.
+    int feed(const char* data, size_t len);
+    bool done() const {
+        return _state == DONE;
+    }
+    // the request once done(), with what the sinks returned in place of the
+    // large arguments, or rejected with why it failed
+    void take(Message* req);
+    // bytes given to sinks so far
+    uint64_t streamed() const {
+        return _streamed;
+    }
+
+private:
+    enum { ARRAY_HEADER, ARG_HEADER, PAYLOAD, PAYLOAD_END, DONE };
+
+    BulkStream(size_t threshold, const BulkSinkFactory* factory, int client_id);
+    void open(uint64_t size);
+    void fail(const char* error);
+    void next_arg();
+
+    size_t _threshold;
+    const BulkSinkFactory* _factory;
+    int _client_id;
+    int _state;
+    uint64_t _argc;
+    std::vector<std::string> _args;
+    // the argument being streamed, NULL once the request failed
+    BulkSink* _sink;
+    uint64_t _left;
+    uint64_t _streamed;
+    std::string _error;
+};
+
+}; // namespace redis
+
+#endif
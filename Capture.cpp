@@ -0,0 +1,140 @@
+#include "Capture.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "Clock.h"
+
+namespace redis {
+
+static const char MAGIC[4] = {'R', 'C', 'A', 'P'};
+static const uint32_t VERSION = 1;
+
+#pragma pack(push, 1)
+struct RecordHeader {
+    uint32_t client_id;
+    uint64_t time_us;
+    uint32_t len;
+};
+#pragma pack(pop)
+
+Capture::Capture() {
+    _fp = NULL;
+    _stime = 0;
+    _stop = false;
+    _records = 0;
+    _dropped = 0;
+}
+
+Capture::~Capture() {
+    this->close();
+}
+
+int Capture::open(const std::string& path, int reactors, size_t buffer_size) {
+    _fp = fopen(path.c_str(), "wb");
+    if (!_fp) {
+        return -1;
+    }
+    if (fwrite(MAGIC, sizeof(MAGIC), 1, _fp) != 1 || fwrite(&VERSION, sizeof(VERSION), 1, _fp) != 1) {
+        fclose(_fp);
+        _fp = NULL;
+        return -1;
+    }
+    _stime = Clock::now();
+    for (int i = 0; i < reactors; i++) {
+        _rings.push_back(new RingBuffer(buffer_size));
+    }
+    _stop = false;
+    _writer = std::thread(&Capture::writer_func, this);
+    return 0;
+}
+
+void Capture::close() {
+    if (_writer.joinable()) {
+        _stop = true;
+        _writer.join();
+    }
+    for (auto ring : _rings) {
+        delete ring;
+    }
+    _rings.clear();
+    if (_fp) {
+        fclose(_fp);
+        _fp = NULL;
+    }
+}
+
+void Capture::record(int index, int client_id, const std::string& data) {
+    RecordHeader head;
+    head.client_id = (uint32_t)client_id;
+    head.time_us = Clock::to_us(Clock::now() - _stime);
+    head.len = (uint32_t)data.size();
+    if (_rings[index]->write(&head, sizeof(head), data.data(), data.size())) {
+        _records.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+int Capture::drain(char* buf, size_t len) {
+    int total = 0;
+    for (auto ring : _rings) {
+        while (1) {
+            size_t n = ring->read(buf, len);
+            if (n == 0) {
+                break;
+            }
+            if (fwrite(buf, 1, n, _fp) != n) {
+                fprintf(stderr, "capture write error: %s\n", strerror(errno));
+            }
+            total += n;
+        }
+    }
+    return total;
+}
+
+void Capture::writer_func(Capture* cap) {
+    const size_t BUF_SIZE = 256 * 1024;
+    char* buf = new char[BUF_SIZE];
+    while (!cap->_stop) {
+        if (cap->drain(buf, BUF_SIZE) == 0) {
+            fflush(cap->_fp);
+            usleep(1000);
+        }
+    }
+    // records in a ring are always complete, so the file ends on a record boundary
+    cap->drain(buf, BUF_SIZE);
+    fflush(cap->_fp);
+    delete[] buf;
+}
+
+int Capture::read_header(FILE* fp) {
+    char magic[4];
+    uint32_t version;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || fread(&version, sizeof(version), 1, fp) != 1) {
+        return -1;
+    }
+    if (memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION) {
+        return -1;
+    }
+    return 1;
+}
+
+int Capture::read_record(FILE* fp, Record* rec) {
+    RecordHeader head;
+    size_t n = fread(&head, 1, sizeof(head), fp);
+    if (n == 0 && feof(fp)) {
+        return 0;
+    }
+    if (n != sizeof(head)) {
+        return -1;
+    }
+    rec->client_id = head.client_id;
+    rec->time_us = head.time_us;
+    rec->data.resize(head.len);
+    if (head.len > 0 && fread(&rec->data[0], head.len, 1, fp) != 1) {
+        return -1;
+    }
+    return 1;
+}
+
+}; // namespace redis
@@ -0,0 +1,67 @@
+#ifndef REDIS_CAPTURE_H_
+#define REDIS_CAPTURE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RingBuffer.h"
+
+namespace redis {
+
+// Records decoded requests to a binary capture file for later replay.
+//
+// File layout, all integers in host byte order:
+//   header: "RCAP" uint32_t version
+//   record: uint32_t client_id, uint64_t time_us, uint32_t len, len bytes of RESP
+// time_us is relative to the start of the capture.
+//
+// Each reactor appends to its own RingBuffer, a background thread drains
+// them to disk. Records that don't fit in a full ring are dropped and
+// counted rather than stalling the reactor.
+class Capture {
+public:
+    struct Record {
+        uint32_t client_id;
+        uint64_t time_us;
+        std::string data;
+    };
+
+    Capture();
+    ~Capture();
+
+    int open(const std::string& path, int reactors, size_t buffer_size);
+    void close();
+
+    // called by reactor `index` only
+    void record(int index, int client_id, const std::string& data);
+
+    uint64_t records() const {
+        return _records.load(std::memory_order_relaxed);
+    }
+    uint64_t dropped() const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+    // 1: ok, 0: end of file, -1: error
+    static int read_header(FILE* fp);
+    static int read_record(FILE* fp, Record* rec);
+
+private:
+    static void writer_func(Capture* cap);
+    int drain(char* buf, size_t len);
+
+    FILE* _fp;
+    uint64_t _stime;
+    std::vector<RingBuffer*> _rings;
+    std::thread _writer;
+    std::atomic<bool> _stop;
+    std::atomic<uint64_t> _records;
+    std::atomic<uint64_t> _dropped;
+};
+
+}; // namespace redis
+
+#endif
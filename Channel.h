@@ -8,6 +8,7 @@
 #define CONCURRENT_QUEUE_
 
 #include <queue>
+#include <atomic>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
@@ -20,8 +21,9 @@ public:
         while (queue_.empty()) {
             cond_.wait(mlock);
         }
-        auto val = queue_.front();
+        auto val = std::move(queue_.front());
         queue_.pop();
+        size_.store(queue_.size(), std::memory_order_release);
         return val;
     }
 
@@ -30,13 +32,30 @@ public:
         while (queue_.empty()) {
             cond_.wait(mlock);
         }
-        item = queue_.front();
+        item = std::move(queue_.front());
         queue_.pop();
+        size_.store(queue_.size(), std::memory_order_release);
+    }
+
+    // never blocks, returns false if the queue is empty
+    bool try_pop(T& item) {
+        if (size_.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::unique_lock<std::mutex> mlock(mutex_);
+        if (queue_.empty()) {
+            return false;
+        }
+        item = std::move(queue_.front());
+        queue_.pop();
+        size_.store(queue_.size(), std::memory_order_release);
+        return true;
     }
 
     void push(const T& item) {
         std::unique_lock<std::mutex> mlock(mutex_);
         queue_.push(item);
+        size_.store(queue_.size(), std::memory_order_release);
         mlock.unlock();
         cond_.notify_one();
     }
@@ -44,10 +63,21 @@ public:
     void push(T&& item) {
         std::unique_lock<std::mutex> mlock(mutex_);
         queue_.push(std::move(item));
+        size_.store(queue_.size(), std::memory_order_release);
         mlock.unlock();
         cond_.notify_one();
     }
 
+    size_t size() {
+        std::unique_lock<std::mutex> mlock(mutex_);
+        return queue_.size();
+    }
+
+    // without the lock, possibly a little behind
+    size_t size_hint() const {
+        return size_.load(std::memory_order_relaxed);
+    }
+
     Channel() = default;
     Channel(const Channel&) = delete; // disable copying
     Channel& operator=(const Channel&) = delete; // disable assignment
@@ -56,6 +86,8 @@ private:
     std::queue<T> queue_;
     std::mutex mutex_;
     std::condition_variable cond_;
+    // lets try_pop() skip the lock when empty
+    std::atomic<size_t> size_{0};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,478 @@
+#include "ClientTracking.h"
+#include <stdlib.h>
+#include <strings.h>
+#include <functional>
+#include "Command.h"
+#include "Reactor.h"
+
+namespace redis {
+
+static const int SHARDS = 16;
+
+static void append_bulk(std::string* out, const std::string& s) {
+    out->push_back('$');
+    out->append(std::to_string(s.size()));
+    out->append("\r\n");
+    out->append(s);
+    out->append("\r\n");
+}
+
+static void append_header(std::string* out, char type, int64_t n) {
+    out->push_back(type);
+    out->append(std::to_string(n));
+    out->append("\r\n");
+}
+
+// calls fn for every key argument of a command
+template <class F>
+static void for_each_key(const Command* cmd, const std::vector<std::string>& args, F fn) {
+    if (cmd->first_key == 0) {
+        return;
+    }
+    int last = cmd->last_key < 0 ? (int)args.size() + cmd->last_key : cmd->last_key;
+    for (int i = cmd->first_key; i <= last && i < (int)args.size(); i += cmd->key_step) {
+        fn(args[i]);
+    }
+}
+
+ClientTracking::ClientTracking(int reactors, size_t max_keys) {
+    _reactors = reactors;
+    _max_keys = max_keys;
+    for (int i = 0; i < reactors; i++) {
+        Local* local = new Local();
+        for (int j = 0; j < reactors; j++) {
+            local->outbox.push_back(new Batch());
+        }
+        _locals.push_back(local);
+    }
+    for (int i = 0; i < SHARDS; i++) {
+        _shards.push_back(new Shard());
+    }
+    _keys = 0;
+    _clients = 0;
+    _bcast_clients = 0;
+}
+
+ClientTracking::~ClientTracking() {
+    for (auto local : _locals) {
+        while (local->inbox.size() > 0) {
+            Batch* batch;
+            local->inbox.pop(&batch);
+            delete batch;
+        }
+        for (auto batch : local->outbox) {
+            delete batch;
+        }
+        delete local;
+    }
+    for (auto shard : _shards) {
+        delete shard;
+    }
+}
+
+ClientTracking::Shard* ClientTracking::shard(const std::string& key) {
+    return _shards[std::hash<std::string>()(key) % _shards.size()];
+}
+
+size_t ClientTracking::prefixes() {
+    std::shared_lock<std::shared_mutex> lk(_prefix_mutex);
+    return _prefixes.size();
+}
+
+bool ClientTracking::process(Reactor* reactor, Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    if (!cmd) {
+        return false;
+    }
+    if (cmd->id == CMD_HELLO) {
+        hello(reactor, client, req);
+        return true;
+    }
+    if (cmd->id == CMD_CLIENT) {
+        return client_command(reactor, client, req);
+    }
+    if (cmd->flags & (CMD_FLAG_READ | CMD_FLAG_WRITE)) {
+        record(reactor, client, req);
+    }
+    return false;
+}
+
+void ClientTracking::hello(Reactor* reactor, Client* client, const Message& req) {
+    const std::vector<std::string>& args = req.Vals();
+    int proto = client->proto;
+    size_t i = 1;
+    if (args.size() > 1) {
+        char* end;
+        long ver = strtol(args[1].c_str(), &end, 10);
+        if (*end != '\0' || (ver != 2 && ver != 3)) {
+            reactor->answer(client, "-NOPROTO unsupported protocol version\r\n");
+            return;
+        }
+        proto = (int)ver;
+        i = 2;
+    }
+    for (; i < args.size(); i++) {
+        const char* opt = args[i].c_str();
+        if (strcasecmp(opt, "setname") == 0 && i + 1 < args.size()) {
+            // names are not kept
+            i++;
+        } else if (strcasecmp(opt, "auth") == 0 && i + 2 < args.size()) {
+            reactor->answer(client, "-ERR AUTH is not supported\r\n");
+            return;
+        } else {
+            reactor->answer(client, "-ERR Syntax error in HELLO option '" + args[i] + "'\r\n");
+            return;
+        }
+    }
+    client->proto = proto;
+
+    std::string out;
+    append_header(&out, proto >= 3 ? '%' : '*', proto >= 3 ? 7 : 14);
+    append_bulk(&out, "server");
+    append_bulk(&out, "redis");
+    // the first version that speaks RESP3
+    append_bulk(&out, "version");
+    append_bulk(&out, "6.0.0");
+    append_bulk(&out, "proto");
+    append_header(&out, ':', proto);
+    append_bulk(&out, "id");
+    append_header(&out, ':', client->id);
+    append_bulk(&out, "mode");
+    append_bulk(&out, "standalone");
+    append_bulk(&out, "role");
+    append_bulk(&out, "master");
+    append_bulk(&out, "modules");
+    append_header(&out, '*', 0);
+    reactor->answer(client, out);
+}
+
+bool ClientTracking::client_command(Reactor* reactor, Client* client, const Message& req) {
+    const std::vector<std::string>& args = req.Vals();
+    if (strcasecmp(args[1].c_str(), "id") == 0) {
+        reactor->answer(client, ":" + std::to_string(client->id) + "\r\n");
+        return true;
+    }
+    if (strcasecmp(args[1].c_str(), "tracking") != 0) {
+        return false;
+    }
+    if (args.size() < 3) {
+        reactor->answer(client, "-ERR wrong number of arguments for 'client|tracking' command\r\n");
+        return true;
+    }
+    bool on = strcasecmp(args[2].c_str(), "on") == 0;
+    if (!on && strcasecmp(args[2].c_str(), "off") != 0) {
+        reactor->answer(client, "-ERR syntax error\r\n");
+        return true;
+    }
+    bool bcast = false;
+    bool noloop = false;
+    std::vector<std::string> prefixes;
+    for (size_t i = 3; i < args.size(); i++) {
+        const char* opt = args[i].c_str();
+        if (strcasecmp(opt, "bcast") == 0) {
+            bcast = true;
+        } else if (strcasecmp(opt, "noloop") == 0) {
+            noloop = true;
+        } else if (strcasecmp(opt, "prefix") == 0 && i + 1 < args.size()) {
+            prefixes.push_back(args[++i]);
+        } else if (strcasecmp(opt, "optin") == 0 || strcasecmp(opt, "optout") == 0 || strcasecmp(opt, "redirect") == 0) {
+            reactor->answer(client, "-ERR " + args[i] + " is not supported\r\n");
+            return true;
+        } else {
+            reactor->answer(client, "-ERR syntax error\r\n");
+            return true;
+        }
+    }
+    if (!on) {
+        tracking_off(reactor, client);
+        reactor->answer(client, "+OK\r\n");
+        return true;
+    }
+    // invalidations are pushes on the same connection
+    if (client->proto < 3) {
+        reactor->answer(client, "-ERR CLIENT TRACKING needs RESP3, switch to it with HELLO 3 first\r\n");
+        return true;
+    }
+    if (!prefixes.empty() && !bcast) {
+        reactor->answer(client, "-ERR PREFIX option requires BCAST mode to be enabled\r\n");
+        return true;
+    }
+    TrackingState* st = client->tracking;
+    if (st && st->on && st->bcast != bcast) {
+        reactor->answer(client, "-ERR You can't switch BCAST mode on/off before disabling tracking for this client, and then re-enabling it with a different mode.\r\n");
+        return true;
+    }
+    // a key would be reported once per matching prefix
+    std::vector<std::string> all = prefixes;
+    if (st) {
+        all.insert(all.end(), st->prefixes.begin(), st->prefixes.end());
+    }
+    for (size_t i = 0; i < prefixes.size(); i++) {
+        for (size_t j = 0; j < all.size(); j++) {
+            const std::string& a = prefixes[i];
+            const std::string& b = all[j];
+            if (i != j && a != b && (a.compare(0, b.size(), b) == 0 || b.compare(0, a.size(), a) == 0)) {
+                reactor->answer(client, "-ERR Prefix '" + a + "' overlaps with an existing prefix '" + b
+                    + "'. Prefixes for a single client must not overlap.\r\n");
+                return true;
+            }
+        }
+    }
+    tracking_on(reactor, client, bcast, noloop, prefixes);
+    reactor->answer(client, "+OK\r\n");
+    return true;
+}
+
+void ClientTracking::tracking_on(Reactor* reactor, Client* client, bool bcast, bool noloop, const std::vector<std::string>& prefixes) {
+    if (!client->tracking) {
+        client->tracking = new TrackingState();
+    }
+    TrackingState* st = client->tracking;
+    if (!st->on) {
+        st->on = true;
+        _clients++;
+        if (bcast) {
+            _bcast_clients++;
+        }
+    }
+    st->bcast = bcast;
+    st->noloop = noloop;
+    if (!bcast) {
+        return;
+    }
+    std::vector<std::string> add = prefixes;
+    if (add.empty() && st->prefixes.empty()) {
+        // every key
+        add.push_back("");
+    }
+    Reader reader = ((uint64_t)reactor->index() << 32) | (uint32_t)client->id;
+    std::unique_lock<std::shared_mutex> lk(_prefix_mutex);
+    for (auto& prefix : add) {
+        std::unordered_set<Reader>& readers = _prefixes[prefix];
+        if (readers.empty()) {
+            _prefix_lens[prefix.size()]++;
+        }
+        if (readers.insert(reader).second) {
+            st->prefixes.push_back(prefix);
+        }
+    }
+}
+
+void ClientTracking::tracking_off(Reactor* reactor, Client* client) {
+    TrackingState* st = client->tracking;
+    if (!st || !st->on) {
+        return;
+    }
+    if (st->bcast) {
+        Reader reader = ((uint64_t)reactor->index() << 32) | (uint32_t)client->id;
+        std::unique_lock<std::shared_mutex> lk(_prefix_mutex);
+        for (auto& prefix : st->prefixes) {
+            auto it = _prefixes.find(prefix);
+            if (it == _prefixes.end()) {
+                continue;
+            }
+            it->second.erase(reader);
+            if (it->second.empty()) {
+                _prefixes.erase(it);
+                if (--_prefix_lens[prefix.size()] == 0) {
+                    _prefix_lens.erase(prefix.size());
+                }
+            }
+        }
+        _bcast_clients--;
+    }
+    // keys it read stay in the table, deliver() skips clients not tracking
+    st->prefixes.clear();
+    st->on = false;
+    st->bcast = false;
+    _clients--;
+}
+
+void ClientTracking::record(Reactor* reactor, Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    if (cmd->flags & CMD_FLAG_READ) {
+        TrackingState* st = client->tracking;
+        if (!st || !st->on || st->bcast) {
+            return;
+        }
+        Reader reader = ((uint64_t)reactor->index() << 32) | (uint32_t)client->id;
+        for_each_key(cmd, req.Vals(), [&](const std::string& key) {
+            Shard* s = shard(key);
+            std::lock_guard<std::mutex> lk(s->mutex);
+            auto it = s->keys.find(key);
+            if (it == s->keys.end()) {
+                it = s->keys.emplace(key, std::unordered_set<Reader>()).first;
+                _keys++;
+            }
+            it->second.insert(reader);
+        });
+        if (_keys.load(std::memory_order_relaxed) > _max_keys) {
+            evict(reactor);
+        }
+    } else if (_clients.load(std::memory_order_relaxed) > 0) {
+        // Nobody can have cached anything while no client tracks. A write
+        // decoded before the first client turned tracking on is missed.
+        if (!client->tracking) {
+            client->tracking = new TrackingState();
+        }
+        std::vector<std::string> keys;
+        for_each_key(cmd, req.Vals(), [&](const std::string& key) {
+            keys.push_back(key);
+        });
+        // its response will be number passed + 1
+        client->tracking->writes.push_back(std::make_pair(client->passed + 1, std::move(keys)));
+    }
+}
+
+void ClientTracking::answered(Reactor* reactor, Client* client) {
+    auto& writes = client->tracking->writes;
+    while (!writes.empty() && writes.front().first <= client->answered) {
+        for (auto& key : writes.front().second) {
+            invalidate(reactor, key, client->id);
+        }
+        writes.pop_front();
+    }
+}
+
+void ClientTracking::closed(Reactor* reactor, Client* client) {
+    TrackingState* st = client->tracking;
+    if (!st) {
+        return;
+    }
+    // may have been executed without the response being written
+    for (auto& write : st->writes) {
+        for (auto& key : write.second) {
+            invalidate(reactor, key, client->id);
+        }
+    }
+    tracking_off(reactor, client);
+    delete st;
+    client->tracking = NULL;
+}
+
+void ClientTracking::invalidate(Reactor* reactor, const std::string& key, int writer) {
+    if (_keys.load(std::memory_order_relaxed) > 0) {
+        Shard* s = shard(key);
+        std::unordered_set<Reader> readers;
+        {
+            std::lock_guard<std::mutex> lk(s->mutex);
+            auto it = s->keys.find(key);
+            if (it != s->keys.end()) {
+                readers.swap(it->second);
+                s->keys.erase(it);
+                _keys--;
+            }
+        }
+        for (auto reader : readers) {
+            queue(reactor, reader, key, writer);
+        }
+    }
+    if (_bcast_clients.load(std::memory_order_relaxed) > 0) {
+        std::shared_lock<std::shared_mutex> lk(_prefix_mutex);
+        for (auto& len : _prefix_lens) {
+            if (len.first > key.size()) {
+                break;
+            }
+            auto it = _prefixes.find(key.substr(0, len.first));
+            if (it == _prefixes.end()) {
+                continue;
+            }
+            for (auto reader : it->second) {
+                queue(reactor, reader, key, writer);
+            }
+        }
+    }
+}
+
+void ClientTracking::evict(Reactor* reactor) {
+    Local* local = _locals[reactor->index()];
+    for (int tries = 0; _keys.load() > _max_keys && tries < SHARDS * 2; tries++) {
+        Shard* s = _shards[local->evict_pos++ % _shards.size()];
+        std::string key;
+        std::unordered_set<Reader> readers;
+        {
+            std::lock_guard<std::mutex> lk(s->mutex);
+            if (s->keys.empty()) {
+                continue;
+            }
+            auto it = s->keys.begin();
+            key = it->first;
+            readers.swap(it->second);
+            s->keys.erase(it);
+            _keys--;
+        }
+        for (auto reader : readers) {
+            queue(reactor, reader, key, -1);
+        }
+    }
+}
+
+void ClientTracking::queue(Reactor* reactor, Reader reader, const std::string& key, int writer) {
+    Local* local = _locals[reactor->index()];
+    Invalidation inv;
+    inv.client_id = (int)(uint32_t)reader;
+    inv.writer = writer;
+    inv.key = key;
+    local->outbox[reader >> 32]->push_back(std::move(inv));
+    local->pending = true;
+}
+
+void ClientTracking::flush(Reactor* reactor) {
+    int index = reactor->index();
+    Local* local = _locals[index];
+    if (!local->pending) {
+        return;
+    }
+    local->pending = false;
+    for (int i = 0; i < _reactors; i++) {
+        if (local->outbox[i]->empty()) {
+            continue;
+        }
+        if (i == index) {
+            deliver(reactor, *local->outbox[i]);
+            local->outbox[i]->clear();
+        } else {
+            _locals[i]->inbox.push(local->outbox[i]);
+            local->outbox[i] = new Batch();
+        }
+    }
+}
+
+void ClientTracking::received(Reactor* reactor) {
+    SelectableQueue<Batch*>* inbox = &_locals[reactor->index()]->inbox;
+    while (inbox->size() > 0) {
+        Batch* batch;
+        inbox->pop(&batch);
+        deliver(reactor, *batch);
+        delete batch;
+    }
+}
+
+void ClientTracking::deliver(Reactor* reactor, const Batch& batch) {
+    // one push per client
+    std::unordered_map<Client*, std::vector<const std::string*>> keys;
+    for (auto& inv : batch) {
+        auto it = reactor->_clients.find(inv.client_id);
+        if (it == reactor->_clients.end()) {
+            continue;
+        }
+        TrackingState* st = it->second->tracking;
+        if (!st || !st->on || (st->noloop && inv.writer == inv.client_id)) {
+            continue;
+        }
+        keys[it->second].push_back(&inv.key);
+    }
+    for (auto& it : keys) {
+        std::string* out = new std::string();
+        append_header(out, '>', 2);
+        append_bulk(out, "invalidate");
+        append_header(out, '*', it.second.size());
+        for (auto key : it.second) {
+            append_bulk(out, *key);
+        }
+        reactor->push(it.first, SharedBuffer(out));
+        reactor->_stats->tracking_invalidations.add(it.second.size());
+    }
+}
+
+}; // namespace redis
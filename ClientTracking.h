@@ -0,0 +1,139 @@
+#ifndef REDIS_CLIENT_TRACKING_H_
+#define REDIS_CLIENT_TRACKING_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "Message.h"
+#include "SelectableQueue.h"
+#include "Transport.h"
+
+namespace redis {
+
+class Reactor;
+
+// What ClientTracking keeps for one client, owned by the client's reactor.
+struct TrackingState {
+    bool on = false;
+    bool bcast = false;
+    bool noloop = false;
+    std::vector<std::string> prefixes;
+    // keys of writes not answered yet, by the request number (see
+    // Transport::Client::passed) whose response completes them
+    std::deque<std::pair<uint64_t, std::vector<std::string>>> writes;
+};
+
+struct Invalidation {
+    int client_id;
+    // the client whose write it was, for NOLOOP; -1 for evictions
+    int writer;
+    std::string key;
+};
+
+// Server-assisted client side caching, as CLIENT TRACKING in Redis, see
+// Transport::EnableClientTracking().
+//
+// The reactors answer HELLO, which switches a client to RESP3, and CLIENT
+// TRACKING and CLIENT ID. Tracking needs RESP3: invalidations go out as
+// ">2 invalidate [keys]" pushes on the client's own connection.
+//
+// In the default mode every key a tracking client reads (CMD_FLAG_READ) is
+// recorded in a table shared by all reactors, sharded by key with a mutex
+// per shard. Once a write (CMD_FLAG_WRITE) has been answered, and so
+// executed, its keys are taken out of the table and their readers are
+// invalidated. The table holds at most max_keys keys; beyond that
+// arbitrary keys are evicted and invalidated, like Redis does. In BCAST
+// mode nothing is recorded, a client is invalidated for every written key
+// that starts with one of its prefixes.
+//
+// Invalidations are collected per reactor and handed over once per event
+// loop iteration, and each client gets one push per batch.
+class ClientTracking {
+public:
+    typedef std::vector<Invalidation> Batch;
+
+    ClientTracking(int reactors, size_t max_keys);
+    ~ClientTracking();
+
+    /* called by the reactor thread only */
+
+    // HELLO, CLIENT TRACKING and CLIENT ID; records the keys of reads and
+    // writes of other commands and returns false for them
+    bool process(Reactor* reactor, Transport::Client* client, const Message& req);
+    // responses of the client were written, see TrackingState::writes
+    void answered(Reactor* reactor, Transport::Client* client);
+    void closed(Reactor* reactor, Transport::Client* client);
+    // delivers the batches in inbox()
+    void received(Reactor* reactor);
+    // hands the invalidations of this iteration to their reactors
+    void flush(Reactor* reactor);
+
+    SelectableQueue<Batch*>* inbox(int index) {
+        return &_locals[index]->inbox;
+    }
+
+    // any thread
+    size_t keys() const {
+        return _keys.load(std::memory_order_relaxed);
+    }
+    size_t prefixes();
+
+private:
+    typedef Transport::Client Client;
+
+    // reactor << 32 | client id
+    typedef uint64_t Reader;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::unordered_set<Reader>> keys;
+    };
+
+    struct Local {
+        SelectableQueue<Batch*> inbox;
+        // invalidations for each reactor
+        std::vector<Batch*> outbox;
+        bool pending = false;
+        // next shard to evict from
+        size_t evict_pos = 0;
+    };
+
+    void hello(Reactor* reactor, Client* client, const Message& req);
+    bool client_command(Reactor* reactor, Client* client, const Message& req);
+    void tracking_on(Reactor* reactor, Client* client, bool bcast, bool noloop, const std::vector<std::string>& prefixes);
+    void tracking_off(Reactor* reactor, Client* client);
+
+    void record(Reactor* reactor, Client* client, const Message& req);
+    void invalidate(Reactor* reactor, const std::string& key, int writer);
+    void evict(Reactor* reactor);
+    void queue(Reactor* reactor, Reader reader, const std::string& key, int writer);
+    void deliver(Reactor* reactor, const Batch& batch);
+
+    Shard* shard(const std::string& key);
+
+    int _reactors;
+    size_t _max_keys;
+    std::vector<Local*> _locals;
+    std::vector<Shard*> _shards;
+    std::atomic<size_t> _keys;
+    // clients with tracking on, writes are not recorded while it is 0
+    std::atomic<int> _clients;
+
+    std::shared_mutex _prefix_mutex;
+    std::unordered_map<std::string, std::unordered_set<Reader>> _prefixes;
+    // prefix length, number of prefixes of that length
+    std::map<size_t, int> _prefix_lens;
+    std::atomic<int> _bcast_clients;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,60 @@
+#include "Clock.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace redis {
+
+bool Clock::_tsc = false;
+double Clock::_ns_per_tick = 1.0;
+bool Clock::_inited = Clock::init();
+
+static uint64_t mono_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// The TSC is only usable as a wall clock if it ticks at a constant rate and
+// keeps ticking in deep C-states.
+static bool invariant_tsc() {
+    FILE* fp = fopen("/proc/cpuinfo", "r");
+    if (!fp) {
+        return false;
+    }
+    bool constant = false;
+    bool nonstop = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "flags", 5) != 0) {
+            continue;
+        }
+        constant = strstr(line, " constant_tsc") != NULL;
+        nonstop = strstr(line, " nonstop_tsc") != NULL;
+        break;
+    }
+    fclose(fp);
+    return constant && nonstop;
+}
+
+bool Clock::init() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!invariant_tsc()) {
+        return true;
+    }
+    // calibrate against CLOCK_MONOTONIC over ~10ms
+    uint64_t ns0 = mono_ns();
+    uint64_t t0 = __builtin_ia32_rdtsc();
+    uint64_t ns1;
+    do {
+        ns1 = mono_ns();
+    } while (ns1 - ns0 < 10 * 1000 * 1000);
+    uint64_t t1 = __builtin_ia32_rdtsc();
+    if (t1 > t0) {
+        _ns_per_tick = (double)(ns1 - ns0) / (double)(t1 - t0);
+        _tsc = true;
+    }
+#endif
+    return true;
+}
+
+}; // namespace redis
@@ -0,0 +1,44 @@
+#ifndef REDIS_CLOCK_H_
+#define REDIS_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+namespace redis {
+
+// Cheap monotonic clock for hot paths. On x86 with an invariant TSC it reads
+// the time stamp counter directly, otherwise it falls back to
+// CLOCK_MONOTONIC. Ticks are only meaningful relative to each other, convert
+// with to_ns()/to_us().
+class Clock {
+public:
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        if (_tsc) {
+            return __builtin_ia32_rdtsc();
+        }
+#endif
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+    static uint64_t to_ns(uint64_t ticks) {
+        return (uint64_t)(ticks * _ns_per_tick);
+    }
+    static uint64_t to_us(uint64_t ticks) {
+        return (uint64_t)(ticks * _ns_per_tick / 1000);
+    }
+    static uint64_t from_us(uint64_t us) {
+        return (uint64_t)(us * 1000 / _ns_per_tick);
+    }
+
+private:
+    static bool _tsc;
+    static double _ns_per_tick;
+    static bool init();
+    static bool _inited;
+};
+
+}; // namespace redis
+
+#endif
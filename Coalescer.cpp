@@ -0,0 +1,219 @@
+#include "Coalescer.h"
+#include <stdio.h>
+#include "Command.h"
+#include "Reactor.h"
+
+namespace redis {
+
+static const int SHARDS = 64;
+
+Coalescer::Coalescer(int reactors, const std::vector<std::string>& commands) {
+    _reactors = reactors;
+    _commands.resize(command_table::COUNT, false);
+    for (auto& name : commands) {
+        const Command* cmd = Command::find(name);
+        if (!cmd) {
+            fprintf(stderr, "coalesce: unknown command %s\n", name.c_str());
+        } else if (cmd->flags & CMD_FLAG_WRITE) {
+            fprintf(stderr, "coalesce: %s writes, not coalesced\n", name.c_str());
+        } else {
+            _commands[cmd->id] = true;
+        }
+    }
+    for (int i = 0; i < reactors; i++) {
+        Local* local = new Local();
+        for (int j = 0; j < reactors; j++) {
+            local->outbox.push_back(new Batch());
+        }
+        _locals.push_back(local);
+    }
+    for (int i = 0; i < SHARDS; i++) {
+        _shards.push_back(new Shard());
+    }
+    _next_id = 1;
+    _flights = 0;
+}
+
+Coalescer::~Coalescer() {
+    for (auto local : _locals) {
+        while (local->inbox.size() > 0) {
+            Batch* batch;
+            local->inbox.pop(&batch);
+            delete batch;
+        }
+        for (auto batch : local->outbox) {
+            delete batch;
+        }
+        delete local;
+    }
+    for (auto shard : _shards) {
+        for (auto& it : shard->flights) {
+            delete it.second;
+        }
+        delete shard;
+    }
+}
+
+Coalescer::Shard* Coalescer::shard(const std::string& key) {
+    return _shards[std::hash<std::string>()(key) % _shards.size()];
+}
+
+bool Coalescer::process(Reactor* reactor, Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    if (!cmd || !_commands[cmd->id]) {
+        return false;
+    }
+    bool may_park = client->answered + 1 == client->passed;
+    if (!may_park && client->flight) {
+        return false;
+    }
+
+    // the command by id, so that GET and get meet, then the arguments
+    // with their lengths
+    std::string& key = _locals[reactor->index()]->key;
+    key.clear();
+    key.append(std::to_string(cmd->id));
+    const std::vector<std::string>& args = req.Vals();
+    for (size_t i = 1; i < args.size(); i++) {
+        key.push_back(' ');
+        key.append(std::to_string(args[i].size()));
+        key.push_back(':');
+        key.append(args[i]);
+    }
+
+    Shard* s = shard(key);
+    std::lock_guard<std::mutex> lk(s->mutex);
+    auto it = s->flights.find(key);
+    if (it != s->flights.end()) {
+        if (!may_park) {
+            return false;
+        }
+        Flight* flight = it->second;
+        flight->waiters.push_back(Flight::Waiter{reactor->index(), client->id, client->proto});
+        client->parked = flight->id;
+        reactor->_stats->coalesced.add();
+        return true;
+    }
+    if (client->flight) {
+        return false;
+    }
+    Flight* flight = new Flight();
+    flight->id = _next_id++;
+    flight->key = key;
+    s->flights[key] = flight;
+    client->flight = flight;
+    client->flight_at = client->passed;
+    _flights++;
+    return false;
+}
+
+void Coalescer::replied(Reactor* reactor, Client* client, const Response& resp, const std::string& out) {
+    Flight* flight = client->flight;
+    client->flight = NULL;
+    complete(reactor, flight, resp, client->proto, &out);
+}
+
+void Coalescer::orphan_replied(Reactor* reactor, const Response& resp) {
+    Local* local = _locals[reactor->index()];
+    auto it = local->orphans.find(resp.ClientId());
+    if (it == local->orphans.end()) {
+        return;
+    }
+    if (it->second.skip > 0) {
+        it->second.skip--;
+        return;
+    }
+    Flight* flight = it->second.flight;
+    local->orphans.erase(it);
+    complete(reactor, flight, resp, 0, NULL);
+}
+
+void Coalescer::closed(Reactor* reactor, Client* client) {
+    if (!client->flight) {
+        return;
+    }
+    Local* local = _locals[reactor->index()];
+    Orphan& orphan = local->orphans[client->id];
+    if (orphan.flight) {
+        // the id came round again before the old flight was answered
+        Response resp;
+        resp.ReplyError("request in flight lost");
+        complete(reactor, orphan.flight, resp, 0, NULL);
+    }
+    orphan.flight = client->flight;
+    orphan.skip = client->flight_at - client->answered - 1;
+    client->flight = NULL;
+}
+
+void Coalescer::complete(Reactor* reactor, Flight* flight, const Response& resp, int proto, const std::string* out) {
+    {
+        Shard* s = shard(flight->key);
+        std::lock_guard<std::mutex> lk(s->mutex);
+        s->flights.erase(flight->key);
+    }
+    _flights--;
+
+    // encoded once per protocol version
+    SharedBuffer bufs[2];
+    Local* local = _locals[reactor->index()];
+    for (auto& w : flight->waiters) {
+        int v = w.proto >= 3 ? 1 : 0;
+        if (!bufs[v]) {
+            if (out && (proto >= 3 ? 1 : 0) == v) {
+                bufs[v] = SharedBuffer(new std::string(*out));
+            } else {
+                bufs[v] = SharedBuffer(new std::string(resp.Encode(w.proto)));
+            }
+        }
+        local->outbox[w.reactor]->push_back(Delivery{w.client_id, flight->id, bufs[v]});
+        local->pending = true;
+    }
+    delete flight;
+}
+
+void Coalescer::flush(Reactor* reactor) {
+    int index = reactor->index();
+    Local* local = _locals[index];
+    // unparked clients may read on and complete more flights
+    while (local->pending) {
+        local->pending = false;
+        for (int i = 0; i < _reactors; i++) {
+            if (local->outbox[i]->empty()) {
+                continue;
+            }
+            if (i == index) {
+                Batch batch;
+                batch.swap(*local->outbox[i]);
+                for (auto& d : batch) {
+                    deliver(reactor, d);
+                }
+            } else {
+                _locals[i]->inbox.push(local->outbox[i]);
+                local->outbox[i] = new Batch();
+            }
+        }
+    }
+}
+
+void Coalescer::received(Reactor* reactor) {
+    SelectableQueue<Batch*>* inbox = &_locals[reactor->index()]->inbox;
+    while (inbox->size() > 0) {
+        Batch* batch;
+        inbox->pop(&batch);
+        for (auto& d : *batch) {
+            deliver(reactor, d);
+        }
+        delete batch;
+    }
+}
+
+void Coalescer::deliver(Reactor* reactor, const Delivery& d) {
+    auto it = reactor->_clients.find(d.client_id);
+    if (it == reactor->_clients.end() || it->second->parked != d.flight) {
+        // closed meanwhile
+        return;
+    }
+    reactor->unpark(it->second, d.data);
+}
+
+}; // namespace redis
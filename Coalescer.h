@@ -0,0 +1,124 @@
+#ifndef REDIS_COALESCER_H_
+#define REDIS_COALESCER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+#include "Response.h"
+#include "SelectableQueue.h"
+#include "Transport.h"
+#include "link.h"
+
+namespace redis {
+
+class Reactor;
+
+// requests answered by the same response, see Coalescer
+struct Flight {
+    struct Waiter {
+        int reactor;
+        int client_id;
+        int proto;
+    };
+
+    uint64_t id;
+    std::string key;
+    std::vector<Waiter> waiters;
+};
+
+// Single-flight for designated read commands, see
+// Transport::EnableCoalescing().
+//
+// The first request with a given command and arguments goes on to Recv()
+// as usual and leads a flight, kept in a table shared by all reactors,
+// sharded by request with a mutex per shard. Identical requests arriving
+// on any reactor while the flight is up are parked on it instead of
+// reaching the consumer. When the leader's response comes back it is
+// encoded once per protocol version in use, the flight leaves the table,
+// and the encoded buffers are handed to the reactors of the parked
+// requests, batched per event loop iteration.
+//
+// A client only parks a request when it has nothing else outstanding, and
+// its further input is not read until the request is answered, so that
+// parked responses need no reordering. A client leads one flight at a
+// time; if it goes away first, the flight is still answered.
+class Coalescer {
+public:
+    struct Delivery {
+        int client_id;
+        uint64_t flight;
+        SharedBuffer data;
+    };
+    typedef std::vector<Delivery> Batch;
+
+    Coalescer(int reactors, const std::vector<std::string>& commands);
+    ~Coalescer();
+
+    /* called by the reactor thread only */
+
+    // Parks req behind an identical request in flight and returns true, or
+    // makes it lead a flight (if it may) and returns false.
+    bool process(Reactor* reactor, Transport::Client* client, const Message& req);
+    // the response to the request the client leads, encoded as *out
+    void replied(Reactor* reactor, Transport::Client* client, const Response& resp, const std::string& out);
+    // a response to a closed client, which may have led a flight
+    void orphan_replied(Reactor* reactor, const Response& resp);
+    void closed(Reactor* reactor, Transport::Client* client);
+    // delivers the batches in inbox()
+    void received(Reactor* reactor);
+    // hands the responses of this iteration to the other reactors
+    void flush(Reactor* reactor);
+
+    SelectableQueue<Batch*>* inbox(int index) {
+        return &_locals[index]->inbox;
+    }
+
+    // any thread
+    int flights() const {
+        return _flights.load(std::memory_order_relaxed);
+    }
+
+private:
+    typedef Transport::Client Client;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Flight*> flights;
+    };
+    // a flight whose leader closed: skip responses are still due before
+    // the one that answers it
+    struct Orphan {
+        Flight* flight = NULL;
+        uint64_t skip = 0;
+    };
+    struct Local {
+        SelectableQueue<Batch*> inbox;
+        // responses for each reactor
+        std::vector<Batch*> outbox;
+        bool pending = false;
+        std::unordered_map<int, Orphan> orphans;
+        // scratch buffer for flight keys
+        std::string key;
+    };
+
+    void complete(Reactor* reactor, Flight* flight, const Response& resp, int proto, const std::string* out);
+    void deliver(Reactor* reactor, const Delivery& d);
+
+    Shard* shard(const std::string& key);
+
+    int _reactors;
+    // by CommandId
+    std::vector<bool> _commands;
+    std::vector<Local*> _locals;
+    std::vector<Shard*> _shards;
+    std::atomic<uint64_t> _next_id;
+    std::atomic<int> _flights;
+};
+
+}; // namespace redis
+
+#endif
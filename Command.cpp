@@ -0,0 +1,19 @@
+#include "Command.h"
+#include <strings.h>
+
+namespace redis {
+
+const Command* Command::find(const char* name, size_t len) {
+    using namespace command_table;
+    uint8_t i = INDEX.slots[hash(name, len, INDEX.seed) & (SLOTS - 1)];
+    if (i == 0xff) {
+        return NULL;
+    }
+    const Command* cmd = &COMMANDS[i];
+    if (length(cmd->name) != len || strncasecmp(cmd->name, name, len) != 0) {
+        return NULL;
+    }
+    return cmd;
+}
+
+}; // namespace redis
@@ -0,0 +1,184 @@
+#ifndef REDIS_COMMAND_H_
+#define REDIS_COMMAND_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+namespace redis {
+
+enum CommandId {
+    CMD_GET = 0,
+    CMD_SET,
+    CMD_DEL,
+    CMD_UNLINK,
+    CMD_EXISTS,
+    CMD_MGET,
+    CMD_MSET,
+    CMD_INCR,
+    CMD_INCRBY,
+    CMD_DECR,
+    CMD_DECRBY,
+    CMD_EXPIRE,
+    CMD_TTL,
+    CMD_PEXPIREAT,
+    CMD_PING,
+    CMD_ECHO,
+    CMD_INFO,
+    CMD_BGREWRITEAOF,
+    CMD_SUBSCRIBE,
+    CMD_UNSUBSCRIBE,
+    CMD_PSUBSCRIBE,
+    CMD_PUNSUBSCRIBE,
+    CMD_PUBLISH,
+    CMD_HELLO,
+    CMD_CLIENT,
+    CMD_LPUSH,
+    CMD_RPUSH,
+    CMD_LPOP,
+    CMD_RPOP,
+    CMD_BLPOP,
+    CMD_BRPOP,
+};
+
+// Command::flags
+enum {
+    // reads the values of its keys
+    CMD_FLAG_READ = 1,
+    // modifies its keys
+    CMD_FLAG_WRITE = 2,
+    // may leave the client blocked, see Transport::Block()
+    CMD_FLAG_BLOCKING = 4,
+};
+
+// Declaration of a command the server knows about. Messages of known
+// commands are checked against it once, when they are decoded (see
+// Message::Error()), so handlers can trust arity and typed arguments.
+struct Command {
+    const char* name;
+    int id;
+    // as in Redis: counts the name, -N means at least N
+    int arity;
+    // argument positions of the keys, 0 if none; a negative last_key counts
+    // from the end, -1 for the last argument; key_step 2 for key value pairs
+    int first_key;
+    int last_key;
+    int key_step;
+    // one char per argument after the name, the last one repeats:
+    // 's' string, 'i' int64, 'd' double
+    const char* types;
+    // CMD_FLAG_*
+    int flags;
+
+    // Case insensitive, no allocation. NULL if unknown.
+    static const Command* find(const char* name, size_t len);
+    static const Command* find(const std::string& name) {
+        return find(name.data(), name.size());
+    }
+};
+
+namespace command_table {
+
+constexpr Command COMMANDS[] = {
+    {"get", CMD_GET, 2, 1, 1, 1, "s", CMD_FLAG_READ},
+    {"set", CMD_SET, -3, 1, 1, 1, "s", CMD_FLAG_WRITE},
+    {"del", CMD_DEL, -2, 1, -1, 1, "s", CMD_FLAG_WRITE},
+    {"unlink", CMD_UNLINK, -2, 1, -1, 1, "s", CMD_FLAG_WRITE},
+    {"exists", CMD_EXISTS, -2, 1, -1, 1, "s", CMD_FLAG_READ},
+    {"mget", CMD_MGET, -2, 1, -1, 1, "s", CMD_FLAG_READ},
+    {"mset", CMD_MSET, -3, 1, -1, 2, "s", CMD_FLAG_WRITE},
+    {"incr", CMD_INCR, 2, 1, 1, 1, "s", CMD_FLAG_WRITE},
+    {"incrby", CMD_INCRBY, 3, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"decr", CMD_DECR, 2, 1, 1, 1, "s", CMD_FLAG_WRITE},
+    {"decrby", CMD_DECRBY, 3, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"expire", CMD_EXPIRE, 3, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"ttl", CMD_TTL, 2, 1, 1, 1, "s", CMD_FLAG_READ},
+    {"pexpireat", CMD_PEXPIREAT, 3, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"ping", CMD_PING, -1, 0, 0, 0, "s", 0},
+    {"echo", CMD_ECHO, 2, 0, 0, 0, "s", 0},
+    {"info", CMD_INFO, -1, 0, 0, 0, "s", 0},
+    {"bgrewriteaof", CMD_BGREWRITEAOF, 1, 0, 0, 0, "s", 0},
+    {"subscribe", CMD_SUBSCRIBE, -2, 0, 0, 0, "s", 0},
+    {"unsubscribe", CMD_UNSUBSCRIBE, -1, 0, 0, 0, "s", 0},
+    {"psubscribe", CMD_PSUBSCRIBE, -2, 0, 0, 0, "s", 0},
+    {"punsubscribe", CMD_PUNSUBSCRIBE, -1, 0, 0, 0, "s", 0},
+    {"publish", CMD_PUBLISH, 3, 0, 0, 0, "s", 0},
+    {"hello", CMD_HELLO, -1, 0, 0, 0, "s", 0},
+    {"client", CMD_CLIENT, -2, 0, 0, 0, "s", 0},
+    {"lpush", CMD_LPUSH, -3, 1, 1, 1, "s", CMD_FLAG_WRITE},
+    {"rpush", CMD_RPUSH, -3, 1, 1, 1, "s", CMD_FLAG_WRITE},
+    {"lpop", CMD_LPOP, -2, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"rpop", CMD_RPOP, -2, 1, 1, 1, "si", CMD_FLAG_WRITE},
+    {"blpop", CMD_BLPOP, -3, 1, -2, 1, "s", CMD_FLAG_WRITE | CMD_FLAG_BLOCKING},
+    {"brpop", CMD_BRPOP, -3, 1, -2, 1, "s", CMD_FLAG_WRITE | CMD_FLAG_BLOCKING},
+};
+
+constexpr size_t COUNT = sizeof(COMMANDS) / sizeof(COMMANDS[0]);
+constexpr size_t SLOTS = 128;
+
+constexpr size_t length(const char* s) {
+    size_t n = 0;
+    while (s[n]) {
+        n++;
+    }
+    return n;
+}
+
+// FNV-1a over the bytes with the case bit set, so "GET" and "get" hash
+// alike. Non-letters may collide after folding, find() compares the name.
+constexpr uint32_t hash(const char* s, size_t len, uint32_t seed) {
+    uint32_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)(s[i] | 0x20);
+        h *= 16777619u;
+    }
+    return h ^ (h >> 16);
+}
+
+struct Index {
+    uint32_t seed;
+    uint8_t slots[SLOTS]; // index into COMMANDS, 0xff: empty
+};
+
+// Tries seeds until every command name lands in its own slot.
+constexpr Index build_index() {
+    Index idx{0, {}};
+    for (uint32_t seed = 2166136261u;; seed++) {
+        for (size_t i = 0; i < SLOTS; i++) {
+            idx.slots[i] = 0xff;
+        }
+        bool ok = true;
+        for (size_t i = 0; i < COUNT && ok; i++) {
+            size_t pos = hash(COMMANDS[i].name, length(COMMANDS[i].name), seed) & (SLOTS - 1);
+            if (idx.slots[pos] != 0xff) {
+                ok = false;
+            }
+            idx.slots[pos] = (uint8_t)i;
+        }
+        if (ok) {
+            idx.seed = seed;
+            return idx;
+        }
+    }
+}
+
+constexpr Index INDEX = build_index();
+
+// handlers switch on id, and Message keeps the table index
+constexpr bool ids_in_order() {
+    for (size_t i = 0; i < COUNT; i++) {
+        if (COMMANDS[i].id != (int)i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static_assert(ids_in_order(), "COMMANDS must be listed in CommandId order");
+static_assert(COUNT < 0xff && COUNT * 2 <= SLOTS, "command table too large for its index");
+
+} // namespace command_table
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,145 @@
+#include "Connection.h"
+#include <errno.h>
+#include <string.h>
+#include "fde.h"
+#include "link.h"
+
+namespace redis {
+
+Connection::Connection(Fdevents* fdes) {
+    _fdes = fdes;
+    _link = NULL;
+    _tag = 0;
+    _connecting = false;
+}
+
+Connection::~Connection() {
+    fail("connection closed");
+}
+
+int Connection::connect(const std::string& host, int port, int tag) {
+    _link = Link::connect_noblock(host.c_str(), port);
+    if (!_link) {
+        return -1;
+    }
+    _tag = tag;
+    _connecting = true;
+    _error.clear();
+    _fdes->set(_link->fd(), FDEVENT_OUT, _tag, this);
+    return 0;
+}
+
+void Connection::close() {
+    fail("connection closed");
+}
+
+int Connection::fd() const {
+    return _link ? _link->fd() : -1;
+}
+
+void Connection::send(const Message& req, Callback cb) {
+    send_raw(req.Encode(), cb);
+}
+
+void Connection::send_raw(const std::string& data, Callback cb) {
+    if (!_link) {
+        cb(Reply::Error(_error.empty() ? "not connected" : _error));
+        return;
+    }
+    _link->send(data);
+    _callbacks.push_back(cb);
+    // written on the next EPOLLOUT, so requests queued in the same loop
+    // iteration share one write
+    _fdes->set(_link->fd(), FDEVENT_OUT, _tag, this);
+}
+
+void Connection::flush() {
+    if (_link->write() == -1) {
+        fail(strerror(errno));
+        return;
+    }
+    if (_link->output_size() > 0) {
+        _fdes->set(_link->fd(), FDEVENT_OUT, _tag, this);
+    } else {
+        _fdes->clr(_link->fd(), FDEVENT_OUT);
+    }
+}
+
+int Connection::handle(const Fdevent* fde) {
+    if (!_link) {
+        return -1;
+    }
+    if (_connecting) {
+        if (!(fde->events & (FDEVENT_OUT | FDEVENT_ERR))) {
+            return 0;
+        }
+        if (_link->finish_connect() == -1) {
+            fail(std::string("connect failed: ") + strerror(errno));
+            return -1;
+        }
+        _connecting = false;
+        _fdes->set(_link->fd(), FDEVENT_IN, _tag, this);
+        flush();
+        return _link ? 0 : -1;
+    }
+
+    if (fde->events & FDEVENT_OUT) {
+        flush();
+        if (!_link) {
+            return -1;
+        }
+    }
+    if (fde->events & (FDEVENT_IN | FDEVENT_ERR)) {
+        int ret = _link->read();
+        if (ret == -1) {
+            fail("connection lost");
+            return -1;
+        }
+        while (1) {
+            Reply reply;
+            ret = _link->recv(&reply);
+            if (ret == -1) {
+                fail("protocol error");
+                return -1;
+            } else if (ret == 0) {
+                break;
+            }
+            if (reply.IsPush()) {
+                // out of band, e.g. a tracking invalidation
+                if (_push_cb) {
+                    _push_cb(reply);
+                }
+            } else if (_callbacks.empty()) {
+                fail("unexpected reply");
+                return -1;
+            } else {
+                Callback cb = std::move(_callbacks.front());
+                _callbacks.pop_front();
+                cb(reply);
+            }
+            if (!_link) {
+                // closed by the callback
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+void Connection::fail(const std::string& msg) {
+    if (_link) {
+        _fdes->del(_link->fd());
+        delete _link;
+        _link = NULL;
+        _error = msg;
+    }
+    _connecting = false;
+    std::deque<Callback> callbacks;
+    callbacks.swap(_callbacks);
+    Reply err = Reply::Error(msg);
+    for (auto& cb : callbacks) {
+        cb(err);
+    }
+}
+
+}; // namespace redis
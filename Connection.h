@@ -0,0 +1,70 @@
+#ifndef REDIS_CONNECTION_H_
+#define REDIS_CONNECTION_H_
+
+#include <deque>
+#include <functional>
+#include <string>
+#include "Message.h"
+#include "Reply.h"
+
+class Fdevents;
+struct Fdevent;
+
+namespace redis {
+
+class Link;
+
+// One pipelined client connection, driven by whichever Fdevents loop owns
+// it. Requests are written back to back without waiting for replies, and
+// replies are matched to callbacks in order. Not thread-safe: every method
+// must be called on the loop's thread.
+class Connection {
+public:
+    typedef std::function<void(const Reply& reply)> Callback;
+
+    Connection(Fdevents* fdes);
+    ~Connection();
+
+    // Nonblocking connect, fd events are registered with data.num = tag and
+    // data.ptr = this.
+    int connect(const std::string& host, int port, int tag = 0);
+    void close();
+
+    // Queue req, cb is called with its reply. If the connection fails, cb
+    // is called with an ERROR reply.
+    void send(const Message& req, Callback cb);
+    // same as send(), for one already encoded request
+    void send_raw(const std::string& data, Callback cb);
+    // cb gets the RESP3 push replies, which answer no request
+    void on_push(Callback cb) {
+        _push_cb = cb;
+    }
+
+    // Handle an event on fd(). Returns -1 when the connection is gone.
+    int handle(const Fdevent* fde);
+
+    int fd() const;
+    bool closed() const {
+        return _link == NULL;
+    }
+    int inflight() const {
+        return (int)_callbacks.size();
+    }
+
+private:
+    void flush();
+    void fail(const std::string& msg);
+
+    Fdevents* _fdes;
+    Link* _link;
+    int _tag;
+    bool _connecting;
+    // why the connection went away
+    std::string _error;
+    std::deque<Callback> _callbacks;
+    Callback _push_cb;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,367 @@
+#ifndef REDIS_CORO_H_
+#define REDIS_CORO_H_
+
+// C++20 coroutine building blocks, for CoroService. Only this header and
+// CoroService need -std=c++20, the rest of the library does not.
+
+#include <stddef.h>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace redis {
+
+// Coroutine frames are recycled through per-thread free lists of a few
+// size classes, so a steady stream of requests allocates no frames. A frame
+// freed on another thread than the one that allocated it joins that
+// thread's lists.
+class FramePool {
+public:
+    static void* alloc(size_t size) {
+        size_t cls = (size + GRAIN - 1) / GRAIN;
+        if (cls >= CLASSES) {
+            return ::operator new(size);
+        }
+        std::vector<void*>& list = lists()[cls];
+        if (list.empty()) {
+            return ::operator new(cls * GRAIN);
+        }
+        void* p = list.back();
+        list.pop_back();
+        return p;
+    }
+    static void free(void* p, size_t size) {
+        size_t cls = (size + GRAIN - 1) / GRAIN;
+        if (cls >= CLASSES || lists()[cls].size() >= MAX_FREE) {
+            ::operator delete(p);
+            return;
+        }
+        lists()[cls].push_back(p);
+    }
+
+private:
+    static const size_t GRAIN = 64;
+    static const size_t CLASSES = 64;
+    static const size_t MAX_FREE = 1024;
+
+    struct Lists {
+        std::vector<void*> lists[CLASSES];
+        ~Lists() {
+            for (auto& list : lists) {
+                for (void* p : list) {
+                    ::operator delete(p);
+                }
+            }
+        }
+    };
+    static std::vector<void*>* lists() {
+        static thread_local Lists ret;
+        return ret.lists;
+    }
+};
+
+// Where coroutines run: a reactor (CoroService) or a WorkerPool.
+class Executor {
+public:
+    virtual ~Executor() {
+    }
+    // resume h on one of the executor's threads, callable from any thread
+    virtual void post(std::coroutine_handle<> h) = 0;
+
+    // the executor of the calling thread, NULL outside of one
+    static Executor* current() {
+        return _current;
+    }
+    static void set_current(Executor* ex) {
+        _current = ex;
+    }
+
+private:
+    static inline thread_local Executor* _current = NULL;
+};
+
+// co_await resume_on(ex): continue on ex, right away if already there.
+struct resume_on {
+    Executor* ex;
+
+    explicit resume_on(Executor* ex) : ex(ex) {
+    }
+    bool await_ready() const noexcept {
+        return Executor::current() == ex;
+    }
+    void await_suspend(std::coroutine_handle<> h) const {
+        ex->post(h);
+    }
+    void await_resume() const noexcept {
+    }
+};
+
+template <class T>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    enum { RUNNING, AWAITED, FINISHED };
+
+    std::coroutine_handle<> continuation;
+    // resumed past initial_suspend() already
+    bool started = false;
+    // set by whoever comes second of the awaiter and the final suspend,
+    // which may run on different threads
+    std::atomic<int> state{RUNNING};
+    std::exception_ptr error;
+
+    static void* operator new(size_t size) {
+        return FramePool::alloc(size);
+    }
+    static void operator delete(void* p, size_t size) {
+        FramePool::free(p, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+    struct FinalAwaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            PromiseBase& p = h.promise();
+            if (p.state.exchange(FINISHED, std::memory_order_acq_rel) == AWAITED) {
+                return p.continuation;
+            }
+            return std::noop_coroutine();
+        }
+        void await_resume() noexcept {
+        }
+    };
+    FinalAwaiter final_suspend() noexcept {
+        return {};
+    }
+    void unhandled_exception() {
+        error = std::current_exception();
+    }
+};
+
+template <class T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    template <class U>
+    void return_value(U&& v) {
+        value.emplace(std::forward<U>(v));
+    }
+    T take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {
+    }
+    void take() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+}; // namespace detail
+
+// A coroutine returning T. Lazy: it runs when awaited, or from start().
+// Awaiting a task continues the awaiting coroutine on the thread the task
+// finished on, follow with resume_on() to get back.
+template <class T = void>
+class Task {
+public:
+    typedef detail::Promise<T> promise_type;
+
+    Task() {
+    }
+    explicit Task(std::coroutine_handle<promise_type> h) : _h(h) {
+    }
+    Task(Task&& other) noexcept : _h(std::exchange(other._h, nullptr)) {
+    }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (_h) {
+                _h.destroy();
+            }
+            _h = std::exchange(other._h, nullptr);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (_h) {
+            _h.destroy();
+        }
+    }
+
+    // Run the task until it first suspends, returns true if it already
+    // finished, then result() is ready. Otherwise co_await it for the
+    // result, from a coroutine.
+    bool start() {
+        _h.promise().started = true;
+        _h.resume();
+        return done();
+    }
+    bool done() const {
+        return _h.promise().state.load(std::memory_order_acquire) == detail::PromiseBase::FINISHED;
+    }
+    // once done()
+    T result() {
+        return _h.promise().take();
+    }
+
+    struct Awaiter {
+        std::coroutine_handle<promise_type> h;
+
+        bool await_ready() const noexcept {
+            return h.promise().state.load(std::memory_order_acquire) == detail::PromiseBase::FINISHED;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) noexcept {
+            promise_type& p = h.promise();
+            p.continuation = cont;
+            bool started = p.started;
+            p.started = true;
+            if (p.state.exchange(detail::PromiseBase::AWAITED, std::memory_order_acq_rel)
+                == detail::PromiseBase::FINISHED) {
+                // finished on another thread meanwhile
+                return cont;
+            }
+            return started ? std::noop_coroutine() : std::coroutine_handle<>(h);
+        }
+        T await_resume() {
+            return h.promise().take();
+        }
+    };
+    Awaiter operator co_await() && noexcept {
+        return Awaiter{_h};
+    }
+    Awaiter operator co_await() & noexcept {
+        return Awaiter{_h};
+    }
+
+private:
+    std::coroutine_handle<promise_type> _h;
+};
+
+namespace detail {
+
+template <class T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}; // namespace detail
+
+// A coroutine nobody waits for, it runs right away and frees itself when
+// done.
+struct Detached {
+    struct promise_type {
+        static void* operator new(size_t size) {
+            return FramePool::alloc(size);
+        }
+        static void operator delete(void* p, size_t size) {
+            FramePool::free(p, size);
+        }
+        Detached get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {
+        }
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// Threads for blocking work, e.g. disk reads or CPU heavy requests:
+// co_await resume_on(&pool) moves a coroutine onto one of them.
+class WorkerPool : public Executor {
+public:
+    explicit WorkerPool(int threads) {
+        _closing = false;
+        for (int i = 0; i < threads; i++) {
+            _threads.emplace_back(&WorkerPool::run, this);
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _closing = true;
+        }
+        _cond.notify_all();
+        for (auto& t : _threads) {
+            t.join();
+        }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    void post(std::coroutine_handle<> h) override {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _queue.push_back(h);
+        }
+        _cond.notify_one();
+    }
+
+private:
+    void run() {
+        Executor::set_current(this);
+        while (1) {
+            std::coroutine_handle<> h;
+            {
+                std::unique_lock<std::mutex> lk(_mutex);
+                while (_queue.empty() && !_closing) {
+                    _cond.wait(lk);
+                }
+                if (_queue.empty()) {
+                    return;
+                }
+                h = _queue.front();
+                _queue.pop_front();
+            }
+            h.resume();
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<std::coroutine_handle<>> _queue;
+    bool _closing;
+    std::vector<std::thread> _threads;
+};
+
+}; // namespace redis
+
+#endif
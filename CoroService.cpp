@@ -0,0 +1,210 @@
+#include "CoroService.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include "Connection.h"
+#include "Reactor.h"
+#include "fde.h"
+#include "link.h"
+
+namespace redis {
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+CoroGroup::CoroGroup(CoroService::Handler handler, int reactors) {
+    _handler = handler;
+    for (int i = 0; i < reactors; i++) {
+        _shards.push_back(new CoroService(this, i));
+    }
+}
+
+ServiceFactory CoroGroup::factory() {
+    // the services exist up front so that shard() works from the start,
+    // each reactor takes (and deletes) its own
+    return [this](int index) -> Service* {
+        return _shards[index];
+    };
+}
+
+CoroService::CoroService(CoroGroup* group, int index) {
+    _group = group;
+    _index = index;
+    _reactor = NULL;
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    _timer_seq = 0;
+    _timer_armed = 0;
+}
+
+CoroService::~CoroService() {
+    // coroutines still suspended are leaked with their frames, the process
+    // is going away
+    if (_timer_fd >= 0) {
+        ::close(_timer_fd);
+    }
+}
+
+CoroService* CoroService::shard(int index) {
+    return _group->shard(index);
+}
+
+void CoroService::start(Reactor* reactor) {
+    _reactor = reactor;
+    Executor::set_current(this);
+    reactor->fdes()->set(_inbox.fd(), FDEVENT_IN, Reactor::TAG_SERVICE, &_inbox);
+    if (_timer_fd >= 0) {
+        reactor->fdes()->set(_timer_fd, FDEVENT_IN, Reactor::TAG_SERVICE, &_timer_fd);
+    }
+}
+
+bool CoroService::process(Reactor* reactor, const Message& req) {
+    int client_id = req.ClientId();
+    // copied into the handler's frame, req is reused by the reactor
+    Task<Response> task = _group->_handler(this, req);
+    if (task.start() && _order.empty(client_id)) {
+        // answered without suspending
+        reactor->reply(task.result());
+    } else {
+        ReplyOrder::SlotPtr slot = std::make_shared<ReplyOrder::Slot>();
+        _order.push(client_id, slot);
+        finish(std::move(task), client_id, slot);
+    }
+    resume_ready();
+    return true;
+}
+
+Detached CoroService::finish(Task<Response> task, int client_id, ReplyOrder::SlotPtr slot) {
+    std::string out;
+    try {
+        Response resp = co_await std::move(task);
+        out = resp.Encode();
+    } catch (const std::exception& e) {
+        out = std::string("-ERR ") + e.what() + "\r\n";
+    }
+    co_await resume_on(this);
+    slot->data = std::move(out);
+    slot->done = true;
+    _order.flush(_reactor, client_id);
+}
+
+void CoroService::closed(Reactor* reactor, int client_id) {
+    _order.drop(client_id);
+}
+
+void CoroService::post(std::coroutine_handle<> h) {
+    _inbox.push(h);
+}
+
+void CoroService::event(Reactor* reactor, const Fdevent* fde) {
+    if (fde->data.ptr == &_inbox) {
+        while (_inbox.size() > 0) {
+            std::coroutine_handle<> h;
+            if (_inbox.pop(&h) == -1) {
+                break;
+            }
+            _ready.push_back(h);
+        }
+    } else if (fde->data.ptr == &_timer_fd) {
+        fire_timers();
+    } else if (_conn_set.count((Connection*)fde->data.ptr)) {
+        ((Connection*)fde->data.ptr)->handle(fde);
+    } else {
+        IoAwaiter* io = (IoAwaiter*)fde->data.ptr;
+        reactor->fdes()->clr(fde->fd, io->flags);
+        io->error = (fde->events & FDEVENT_ERR) != 0;
+        _ready.push_back(io->h);
+    }
+    resume_ready();
+}
+
+void CoroService::resume_ready() {
+    // resuming may make more ready
+    for (size_t i = 0; i < _ready.size(); i++) {
+        _ready[i].resume();
+    }
+    _ready.clear();
+}
+
+void CoroService::add_timer(int64_t ms, std::coroutine_handle<> h) {
+    Timer t;
+    t.deadline = now_ns() + (uint64_t)ms * 1000000;
+    t.seq = _timer_seq++;
+    t.h = h;
+    _timers.push(t);
+    arm_timer();
+}
+
+void CoroService::arm_timer() {
+    if (_timers.empty()) {
+        return;
+    }
+    uint64_t deadline = _timers.top().deadline;
+    if (_timer_armed != 0 && _timer_armed <= deadline) {
+        return;
+    }
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = deadline / 1000000000;
+    its.it_value.tv_nsec = deadline % 1000000000;
+    if (timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+        fprintf(stderr, "timerfd_settime failed: %s\n", strerror(errno));
+        return;
+    }
+    _timer_armed = deadline;
+}
+
+void CoroService::fire_timers() {
+    uint64_t expirations;
+    while (::read(_timer_fd, &expirations, sizeof(expirations)) > 0) {
+    }
+    _timer_armed = 0;
+    uint64_t now = now_ns();
+    while (!_timers.empty() && _timers.top().deadline <= now) {
+        _ready.push_back(_timers.top().h);
+        _timers.pop();
+    }
+    arm_timer();
+}
+
+CoroService::IoAwaiter CoroService::readable(Link* link) {
+    IoAwaiter ret{this, link, FDEVENT_IN, nullptr};
+    return ret;
+}
+
+CoroService::IoAwaiter CoroService::writable(Link* link) {
+    IoAwaiter ret{this, link, FDEVENT_OUT, nullptr};
+    return ret;
+}
+
+void CoroService::wait_io(IoAwaiter* io) {
+    if (_reactor->fdes()->set(io->link->fd(), io->flags, Reactor::TAG_SERVICE, io) == -1) {
+        io->error = true;
+        _ready.push_back(io->h);
+    }
+}
+
+Connection* CoroService::connect(const std::string& host, int port) {
+    Connection* conn = new Connection(_reactor->fdes());
+    if (conn->connect(host, port, Reactor::TAG_SERVICE) == -1) {
+        delete conn;
+        return NULL;
+    }
+    _conns.emplace_back(conn);
+    _conn_set.insert(conn);
+    return conn;
+}
+
+void CoroService::CallAwaiter::await_suspend(std::coroutine_handle<> h) {
+    CallAwaiter* self = this;
+    conn->send(*req, [self, h](const Reply& r) {
+        self->reply = r;
+        self->svc->_ready.push_back(h);
+    });
+}
+
+}; // namespace redis
@@ -0,0 +1,195 @@
+#ifndef REDIS_CORO_SERVICE_H_
+#define REDIS_CORO_SERVICE_H_
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "Coro.h"
+#include "Service.h"
+#include "Response.h"
+#include "Reply.h"
+#include "ReplyOrder.h"
+#include "SelectableQueue.h"
+
+namespace redis {
+
+class Connection;
+class Link;
+class CoroGroup;
+
+// A Service whose requests are handled by C++20 coroutines, so a handler
+// waiting for a backend, a timer or a worker thread holds a suspended frame
+// instead of a thread:
+//
+//     Task<Response> handle(CoroService* svc, Message req) {
+//         co_await svc->sleep(10);
+//         Response resp(req);
+//         resp.ReplyOK();
+//         co_return resp;
+//     }
+//
+// The handler starts in the reactor thread. A request it answers without
+// suspending is replied to right away and costs no more than the handler's
+// own frame, which comes from a per-thread free list (FramePool). req is
+// taken by value: the reactor reuses its request, so the frame keeps its
+// own copy across co_await.
+// Responses go out in request order, whatever order the handlers finish in.
+//
+// Awaitables of a CoroService must be awaited on its reactor: after
+// resume_on() to a WorkerPool or another shard, resume_on(svc) first.
+class CoroService : public Service, public Executor {
+public:
+    typedef std::function<Task<Response>(CoroService* svc, Message req)> Handler;
+
+    CoroService(CoroGroup* group, int index);
+    ~CoroService();
+
+    int index() const {
+        return _index;
+    }
+    Reactor* reactor() {
+        return _reactor;
+    }
+    // the service of reactor `index`, co_await resume_on(svc->shard(i)) to
+    // run on it, e.g. for data owned by that reactor
+    CoroService* shard(int index);
+
+    // co_await svc->sleep(ms)
+    struct SleepAwaiter {
+        CoroService* svc;
+        int64_t ms;
+
+        bool await_ready() const noexcept {
+            return ms <= 0;
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            svc->add_timer(ms, h);
+        }
+        void await_resume() const noexcept {
+        }
+    };
+    SleepAwaiter sleep(int64_t ms) {
+        return SleepAwaiter{this, ms};
+    }
+
+    // co_await svc->readable(link), or writable(): resumes once the link's
+    // fd is ready. One coroutine at a time may wait on a fd.
+    struct IoAwaiter {
+        CoroService* svc;
+        Link* link;
+        int flags;
+        std::coroutine_handle<> h;
+        bool error = false;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> h) {
+            this->h = h;
+            svc->wait_io(this);
+        }
+        // false if the fd reported an error or hang-up
+        bool await_resume() const noexcept {
+            return !error;
+        }
+    };
+    IoAwaiter readable(Link* link);
+    IoAwaiter writable(Link* link);
+
+    // A pipelined connection driven by this reactor, owned by the service,
+    // for call(). NULL if the connect fails at once.
+    Connection* connect(const std::string& host, int port);
+    // co_await svc->call(conn, req): the reply of req on conn
+    struct CallAwaiter {
+        CoroService* svc;
+        Connection* conn;
+        const Message* req;
+        Reply reply;
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> h);
+        Reply await_resume() {
+            return std::move(reply);
+        }
+    };
+    CallAwaiter call(Connection* conn, const Message& req) {
+        return CallAwaiter{this, conn, &req, Reply()};
+    }
+
+    // Executor
+    void post(std::coroutine_handle<> h) override;
+
+    // Service
+    virtual void start(Reactor* reactor);
+    virtual bool process(Reactor* reactor, const Message& req);
+    virtual void event(Reactor* reactor, const Fdevent* fde);
+    virtual void closed(Reactor* reactor, int client_id);
+
+private:
+    struct Timer {
+        uint64_t deadline;
+        uint64_t seq;
+        std::coroutine_handle<> h;
+        bool operator>(const Timer& other) const {
+            return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+        }
+    };
+
+    Detached finish(Task<Response> task, int client_id, ReplyOrder::SlotPtr slot);
+    void add_timer(int64_t ms, std::coroutine_handle<> h);
+    void arm_timer();
+    void fire_timers();
+    void wait_io(IoAwaiter* io);
+    // resumes what became ready while in a callback, so coroutines never
+    // run inside Connection or Fdevents code
+    void resume_ready();
+
+    CoroGroup* _group;
+    int _index;
+    Reactor* _reactor;
+    ReplyOrder _order;
+    SelectableQueue<std::coroutine_handle<>> _inbox;
+    std::vector<std::coroutine_handle<>> _ready;
+
+    int _timer_fd;
+    uint64_t _timer_seq;
+    uint64_t _timer_armed;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> _timers;
+
+    std::vector<std::unique_ptr<Connection>> _conns;
+    std::unordered_set<Connection*> _conn_set;
+};
+
+// The CoroServices of all the reactors of a Transport, sharing a handler:
+//
+//     CoroGroup group(handle, Transport::NUM_REACTORS);
+//     xport.SetService(group.factory());
+class CoroGroup {
+public:
+    CoroGroup(CoroService::Handler handler, int reactors);
+
+    ServiceFactory factory();
+    CoroService* shard(int index) {
+        return _shards[index];
+    }
+    int size() const {
+        return (int)_shards.size();
+    }
+
+private:
+    friend class CoroService;
+
+    CoroService::Handler _handler;
+    // filled in as the reactors create their service
+    std::vector<CoroService*> _shards;
+};
+
+}; // namespace redis
+
+#endif
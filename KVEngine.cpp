@@ -0,0 +1,649 @@
+#include "KVEngine.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "Aof.h"
+#include "Reactor.h"
+#include "fde.h"
+
+namespace redis {
+
+struct KVJob {
+    int from; // shard that asked
+    int client_id;
+    bool done;
+    const Command* cmd;
+    Message req;
+    std::string result; // encoded reply
+    // owned by the asking shard, not touched by the owner
+    std::shared_ptr<ReplyOrder::Slot> pending;
+    std::vector<int> positions;
+};
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// now + n * unit in ms, false if that overflows
+static bool expire_time(int64_t now, int64_t n, int64_t unit, int64_t* at) {
+    return !__builtin_mul_overflow(n, unit, at) && !__builtin_add_overflow(now, *at, at);
+}
+
+static void append_bulk(std::string* out, const std::string& val) {
+    out->push_back('$');
+    out->append(std::to_string(val.size()));
+    out->append("\r\n");
+    out->append(val);
+    out->append("\r\n");
+}
+
+static void append_int(std::string* out, int64_t n) {
+    out->push_back(':');
+    out->append(std::to_string(n));
+    out->append("\r\n");
+}
+
+// header of a RESP command of argc bulks
+static void append_array(std::string* out, size_t argc) {
+    out->push_back('*');
+    out->append(std::to_string(argc));
+    out->append("\r\n");
+}
+
+KVStore::KVStore(int shards) : _inboxes(shards), _tables(shards) {
+    _aof = NULL;
+}
+
+int KVStore::open_aof(const std::string& path, int policy, uint64_t auto_rewrite_size) {
+    std::vector<KVEngine*> engines;
+    for (int i = 0; i < shards(); i++) {
+        engines.push_back(new KVEngine(this, i));
+    }
+    int64_t bad = 0;
+    int64_t now = now_ms();
+    int64_t n = Aof::load(path, [&](const Message& msg) {
+        const Command* cmd = msg.GetCommand();
+        if (!cmd || !msg.Error().empty() || cmd->first_key == 0) {
+            bad++;
+            return;
+        }
+        // every record holds keys of one shard
+        std::string out;
+        engines[shard(msg.Vals()[cmd->first_key])]->exec(cmd, msg, now, &out);
+    });
+    for (auto engine : engines) {
+        delete engine;
+    }
+    if (n == -1) {
+        return -1;
+    }
+    size_t keys = 0;
+    for (auto& table : _tables) {
+        keys += table.size();
+    }
+    printf("aof %s: %lld commands loaded, %lld skipped, %d keys\n", path.c_str(), (long long)n, (long long)bad, (int)keys);
+
+    _aof = new Aof();
+    if (_aof->open(path, shards(), policy, auto_rewrite_size) == -1) {
+        delete _aof;
+        _aof = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+KVStore::~KVStore() {
+    delete _aof;
+    for (auto& inbox : _inboxes) {
+        while (inbox.size() > 0) {
+            KVJobBatch* batch = NULL;
+            inbox.pop(&batch);
+            for (auto job : *batch) {
+                delete job;
+            }
+            delete batch;
+        }
+    }
+}
+
+KVEngine::KVEngine(KVStore* store, int index) : _table(store->_tables[index]) {
+    _store = store;
+    _index = index;
+    _reactor = NULL;
+    _inbox = &store->_inboxes[index];
+    _outbox.resize(store->shards());
+    _last_expire = 0;
+    _aof = store->_aof;
+    _logged = 0;
+    _snapshot = NULL;
+    _snapshot_ok = false;
+}
+
+KVEngine::~KVEngine() {
+    if (_snapshot) {
+        fclose(_snapshot);
+        _aof->snapshot_done(_index, false);
+    }
+    for (auto& batch : _outbox) {
+        for (auto job : batch) {
+            delete job;
+        }
+    }
+}
+
+void KVEngine::start(Reactor* reactor) {
+    _reactor = reactor;
+    reactor->fdes()->set(_inbox->fd(), FDEVENT_IN, Reactor::TAG_SERVICE, _inbox);
+    if (_aof && _aof->policy() == Aof::FSYNC_ALWAYS) {
+        SelectableQueue<uint64_t>* notify = _aof->notify(_index);
+        reactor->fdes()->set(notify->fd(), FDEVENT_IN, Reactor::TAG_SERVICE, notify);
+    }
+}
+
+void KVEngine::log(const std::string& record) {
+    if (_aof) {
+        _logged = _aof->append(_index, record);
+    }
+}
+
+void KVEngine::when_durable(std::function<void()> fn) {
+    if (_logged == 0 || _aof->policy() != Aof::FSYNC_ALWAYS || _aof->durable(_index) >= _logged) {
+        fn();
+        return;
+    }
+    _durable_waits.push_back(std::make_pair(_logged, std::move(fn)));
+}
+
+void KVEngine::durable_advanced() {
+    SelectableQueue<uint64_t>* notify = _aof->notify(_index);
+    while (notify->size() > 0) {
+        uint64_t seq;
+        notify->pop(&seq);
+    }
+    uint64_t durable = _aof->durable(_index);
+    while (!_durable_waits.empty() && _durable_waits.front().first <= durable) {
+        std::function<void()> fn = std::move(_durable_waits.front().second);
+        _durable_waits.pop_front();
+        fn();
+    }
+}
+
+void KVEngine::snapshot_step() {
+    if (!_snapshot) {
+        if (!_aof->snapshot_requested(_index)) {
+            return;
+        }
+        _snapshot = fopen(_aof->snapshot_path(_index).c_str(), "wb");
+        if (!_snapshot) {
+            fprintf(stderr, "aof snapshot %d: %s\n", _index, strerror(errno));
+            _aof->snapshot_done(_index, false);
+            return;
+        }
+        _aof->snapshot_started(_index);
+        _snapshot_ok = true;
+        _table.scan_begin();
+    }
+    int64_t now = now_ms();
+    std::string rec;
+    bool more = _table.scan_next(1024, [&](const KVTable::Entry& e) {
+        if (e.expire_at != 0 && e.expire_at <= now) {
+            return;
+        }
+        rec.clear();
+        append_array(&rec, e.expire_at ? 5 : 3);
+        append_bulk(&rec, "SET");
+        append_bulk(&rec, std::string(e.key.data(), e.key.size()));
+        append_bulk(&rec, e.val);
+        if (e.expire_at) {
+            append_bulk(&rec, "PXAT");
+            append_bulk(&rec, std::to_string(e.expire_at));
+        }
+        if (fwrite(rec.data(), 1, rec.size(), _snapshot) != rec.size()) {
+            _snapshot_ok = false;
+        }
+    });
+    if (!more || !_snapshot_ok) {
+        if (fclose(_snapshot) != 0) {
+            _snapshot_ok = false;
+        }
+        _snapshot = NULL;
+        _aof->snapshot_done(_index, _snapshot_ok);
+    }
+}
+
+void KVEngine::closed(Reactor* reactor, int client_id) {
+    _order.drop(client_id);
+}
+
+void KVEngine::tick(Reactor* reactor) {
+    if (_aof) {
+        snapshot_step();
+    }
+    for (int i = 0; i < (int)_outbox.size(); i++) {
+        if (!_outbox[i].empty()) {
+            KVJobBatch* batch = new KVJobBatch();
+            batch->swap(_outbox[i]);
+            _store->_inboxes[i].push(batch);
+        }
+    }
+
+    int64_t now = now_ms();
+    if (now - _last_expire >= 100) {
+        _last_expire = now;
+        _table.expire_some(now, 256);
+    }
+}
+
+bool KVEngine::process(Reactor* reactor, const Message& req) {
+    int client_id = req.ClientId();
+    const std::vector<std::string>& args = req.Vals();
+    const Command* cmd = req.GetCommand();
+    int argc = (int)args.size();
+
+    // arity and typed arguments were checked by the reactor
+    std::string out;
+    _logged = 0;
+    if (!cmd || (cmd->flags & CMD_FLAG_BLOCKING)) {
+        out = "-ERR unknown command '" + req.Cmd() + "'\r\n";
+    } else if (cmd->first_key == 0) {
+        exec(cmd, req, now_ms(), &out);
+    } else if (cmd->last_key == 1 && _store->shard(args[1]) == _index) {
+        exec(cmd, req, now_ms(), &out);
+    }
+    if (!out.empty()) {
+        if (_order.empty(client_id) && (_logged == 0 || _aof->policy() != Aof::FSYNC_ALWAYS)) {
+            reactor->reply(client_id, out);
+        } else {
+            PendingPtr pending = std::make_shared<Pending>();
+            _order.push(client_id, pending);
+            when_durable([this, client_id, pending, out]() {
+                finish(client_id, pending, out);
+            });
+        }
+        return true;
+    }
+
+    PendingPtr pending = std::make_shared<Pending>();
+    pending->type = cmd->id;
+    _order.push(client_id, pending);
+    if (cmd->last_key == 1) {
+        pending->parts = 1;
+        std::vector<int> positions;
+        dispatch(client_id, _store->shard(args[1]), cmd, req, pending, &positions);
+        return true;
+    }
+
+    // split by shard, positions are the key indexes in the original request
+    int step = cmd->key_step;
+    int nshards = _store->shards();
+    std::vector<std::vector<std::string>> sub(nshards);
+    std::vector<std::vector<int>> positions(nshards);
+    for (int i = 1; i < argc; i += step) {
+        int shard = _store->shard(args[i]);
+        if (sub[shard].empty()) {
+            sub[shard].push_back(args[0]);
+            pending->parts++;
+        }
+        for (int j = 0; j < step; j++) {
+            sub[shard].push_back(args[i + j]);
+        }
+        positions[shard].push_back((i - 1) / step);
+    }
+    if (cmd->id == CMD_MGET) {
+        pending->values.resize(argc - 1);
+    }
+    // the local part last, so remote shards start working first
+    for (int i = 0; i < nshards; i++) {
+        int shard = (_index + 1 + i) % nshards;
+        if (!sub[shard].empty()) {
+            // split parts take string arguments only
+            dispatch(client_id, shard, cmd, Message(client_id, sub[shard]), pending, &positions[shard]);
+        }
+    }
+    return true;
+}
+
+void KVEngine::dispatch(int client_id, int shard, const Command* cmd, const Message& req,
+    const PendingPtr& pending, std::vector<int>* positions)
+{
+    if (shard == _index) {
+        std::string result;
+        _logged = 0;
+        exec(cmd, req, now_ms(), &result);
+        std::vector<int> pos;
+        pos.swap(*positions);
+        when_durable([this, client_id, pending, pos, result]() {
+            merge(pending, pos, result);
+            if (pending->done) {
+                _order.flush(_reactor, client_id);
+            }
+        });
+        return;
+    }
+    KVJob* job = new KVJob();
+    job->from = _index;
+    job->client_id = client_id;
+    job->done = false;
+    job->cmd = cmd;
+    job->req = req;
+    job->pending = pending;
+    job->positions.swap(*positions);
+    post(shard, job);
+}
+
+void KVEngine::post(int shard, KVJob* job) {
+    _outbox[shard].push_back(job);
+}
+
+void KVEngine::event(Reactor* reactor, const Fdevent* fde) {
+    if (fde->data.ptr != _inbox) {
+        durable_advanced();
+        return;
+    }
+    int64_t now = now_ms();
+    while (_inbox->size() > 0) {
+        KVJobBatch* batch = NULL;
+        if (_inbox->pop(&batch) == -1) {
+            break;
+        }
+        for (auto job : *batch) {
+            if (!job->done) {
+                _logged = 0;
+                exec(job->cmd, job->req, now, &job->result);
+                job->done = true;
+                when_durable([this, job]() {
+                    post(job->from, job);
+                });
+                continue;
+            }
+            PendingPtr pending = std::static_pointer_cast<Pending>(job->pending);
+            merge(pending, job->positions, job->result);
+            if (pending->done) {
+                _order.flush(reactor, job->client_id);
+            }
+            delete job;
+        }
+        delete batch;
+    }
+}
+
+void KVEngine::merge(const PendingPtr& pending, const std::vector<int>& positions, const std::string& result) {
+    pending->parts--;
+    bool sum = pending->type == CMD_DEL || pending->type == CMD_UNLINK || pending->type == CMD_EXISTS;
+    if (!sum && pending->type != CMD_MGET && pending->type != CMD_MSET) {
+        pending->done = true;
+        pending->data = result;
+        return;
+    }
+    Reply reply;
+    reply.Decode(result);
+    if (reply.IsError() && pending->error.empty()) {
+        pending->error = reply.Str();
+    }
+    if (pending->type == CMD_MGET && reply.Type() == Reply::ARRAY) {
+        const std::vector<Reply>& vals = reply.Elements();
+        for (size_t i = 0; i < positions.size() && i < vals.size(); i++) {
+            pending->values[positions[i]] = vals[i];
+        }
+    } else if (sum) {
+        pending->sum += reply.Int();
+    }
+    if (pending->parts > 0) {
+        return;
+    }
+
+    std::string data;
+    if (!pending->error.empty()) {
+        data = "-" + pending->error + "\r\n";
+    } else if (pending->type == CMD_MGET) {
+        data = "*" + std::to_string(pending->values.size()) + "\r\n";
+        for (auto& v : pending->values) {
+            v.Encode(&data);
+        }
+    } else if (pending->type == CMD_MSET) {
+        data = "+OK\r\n";
+    } else {
+        append_int(&data, pending->sum);
+    }
+    pending->done = true;
+    pending->data.swap(data);
+    pending->values.clear();
+}
+
+void KVEngine::finish(int client_id, const PendingPtr& pending, const std::string& data) {
+    pending->done = true;
+    pending->data = data;
+    _order.flush(_reactor, client_id);
+}
+
+static int64_t parse_int(const std::string& s, bool* ok) {
+    char* end;
+    errno = 0;
+    long long n = strtoll(s.c_str(), &end, 10);
+    *ok = !s.empty() && errno == 0 && *end == '\0';
+    return n;
+}
+
+// SET key val [PXAT expire_at], the logged form of every write to a value
+static std::string set_record(const std::string& key, const std::string& val, int64_t expire_at) {
+    std::string rec;
+    append_array(&rec, expire_at ? 5 : 3);
+    append_bulk(&rec, "SET");
+    append_bulk(&rec, key);
+    append_bulk(&rec, val);
+    if (expire_at) {
+        append_bulk(&rec, "PXAT");
+        append_bulk(&rec, std::to_string(expire_at));
+    }
+    return rec;
+}
+
+void KVEngine::exec(const Command* cmd, const Message& req, int64_t now, std::string* out) {
+    const std::vector<std::string>& args = req.Vals();
+    switch (cmd->id) {
+    case CMD_GET: {
+        KVTable::Entry* e = _table.find(args[1], now);
+        if (e) {
+            append_bulk(out, e->val);
+        } else {
+            out->append("$-1\r\n");
+        }
+        break;
+    }
+    case CMD_SET: {
+        int64_t expire_at = 0;
+        for (size_t i = 3; i < args.size(); i += 2) {
+            bool ok;
+            const char* opt = args[i].c_str();
+            if (i + 1 >= args.size() || (strcasecmp(opt, "ex") != 0 && strcasecmp(opt, "px") != 0 && strcasecmp(opt, "pxat") != 0)) {
+                out->append("-ERR syntax error\r\n");
+                return;
+            }
+            int64_t n = parse_int(args[i + 1], &ok);
+            if (!ok) {
+                out->append("-ERR value is not an integer or out of range\r\n");
+                return;
+            }
+            if (n <= 0) {
+                out->append("-ERR invalid expire time in 'set' command\r\n");
+                return;
+            }
+            // PXAT may already be in the past, the key then just expires
+            if (strcasecmp(opt, "pxat") == 0) {
+                expire_at = n;
+            } else if (!expire_time(now, n, strcasecmp(opt, "ex") == 0 ? 1000 : 1, &expire_at)) {
+                out->append("-ERR invalid expire time in 'set' command\r\n");
+                return;
+            }
+        }
+        KVTable::Entry* e = _table.insert(args[1], now);
+        e->val = args[2];
+        e->expire_at = expire_at;
+        log(set_record(args[1], args[2], expire_at));
+        out->append("+OK\r\n");
+        break;
+    }
+    case CMD_INCR:
+    case CMD_INCRBY:
+    case CMD_DECR:
+    case CMD_DECRBY: {
+        int64_t by = cmd->id == CMD_INCR ? 1 : cmd->id == CMD_DECR ? -1 : req.Int(1);
+        if (cmd->id == CMD_DECRBY) {
+            if (by == INT64_MIN) {
+                out->append("-ERR decrement would overflow\r\n");
+                return;
+            }
+            by = -by;
+        }
+        bool created;
+        KVTable::Entry* e = _table.insert(args[1], now, &created);
+        int64_t n = 0;
+        bool ok = true;
+        if (!created) {
+            n = parse_int(e->val, &ok);
+        }
+        if (!ok) {
+            out->append("-ERR value is not an integer or out of range\r\n");
+            return;
+        }
+        if ((by > 0 && n > INT64_MAX - by) || (by < 0 && n < INT64_MIN - by)) {
+            out->append("-ERR increment or decrement would overflow\r\n");
+            return;
+        }
+        n += by;
+        e->val = std::to_string(n);
+        log(set_record(args[1], e->val, e->expire_at));
+        append_int(out, n);
+        break;
+    }
+    case CMD_EXPIRE:
+    case CMD_PEXPIREAT: {
+        int64_t at = req.Int(1);
+        if (cmd->id == CMD_EXPIRE && !expire_time(now, at, 1000, &at)) {
+            out->append("-ERR invalid expire time in 'expire' command\r\n");
+            return;
+        }
+        KVTable::Entry* e = _table.find(args[1], now);
+        if (!e) {
+            append_int(out, 0);
+            break;
+        }
+        std::string rec;
+        if (at <= now) {
+            _table.remove(args[1]);
+            append_array(&rec, 2);
+            append_bulk(&rec, "DEL");
+            append_bulk(&rec, args[1]);
+        } else {
+            e->expire_at = at;
+            append_array(&rec, 3);
+            append_bulk(&rec, "PEXPIREAT");
+            append_bulk(&rec, args[1]);
+            append_bulk(&rec, std::to_string(at));
+        }
+        log(rec);
+        append_int(out, 1);
+        break;
+    }
+    case CMD_TTL: {
+        KVTable::Entry* e = _table.find(args[1], now);
+        if (!e) {
+            append_int(out, -2);
+        } else if (e->expire_at == 0) {
+            append_int(out, -1);
+        } else {
+            append_int(out, (e->expire_at - now + 999) / 1000);
+        }
+        break;
+    }
+    case CMD_DEL:
+    case CMD_UNLINK:
+    case CMD_EXISTS: {
+        int64_t n = 0;
+        std::string keys;
+        for (size_t i = 1; i < args.size(); i++) {
+            // an expired key does not count
+            if (!_table.find(args[i], now)) {
+                continue;
+            }
+            if (cmd->id == CMD_EXISTS) {
+                n++;
+            } else if (_table.remove(args[i])) {
+                append_bulk(&keys, args[i]);
+                n++;
+            }
+        }
+        if (cmd->id != CMD_EXISTS && n > 0) {
+            std::string rec;
+            append_array(&rec, n + 1);
+            append_bulk(&rec, "DEL");
+            rec.append(keys);
+            log(rec);
+        }
+        append_int(out, n);
+        break;
+    }
+    case CMD_MGET: {
+        out->push_back('*');
+        out->append(std::to_string(args.size() - 1));
+        out->append("\r\n");
+        for (size_t i = 1; i < args.size(); i++) {
+            KVTable::Entry* e = _table.find(args[i], now);
+            if (e) {
+                append_bulk(out, e->val);
+            } else {
+                out->append("$-1\r\n");
+            }
+        }
+        break;
+    }
+    case CMD_MSET: {
+        for (size_t i = 1; i + 1 < args.size(); i += 2) {
+            KVTable::Entry* e = _table.insert(args[i], now);
+            e->val = args[i + 1];
+            e->expire_at = 0;
+        }
+        if (_aof) {
+            log(req.Encode());
+        }
+        out->append("+OK\r\n");
+        break;
+    }
+    case CMD_PING:
+        if (args.size() > 1) {
+            append_bulk(out, args[1]);
+        } else {
+            out->append("+PONG\r\n");
+        }
+        break;
+    case CMD_ECHO:
+        append_bulk(out, args[1]);
+        break;
+    case CMD_INFO: {
+        std::string info = _reactor->transport()->Info();
+        if (_aof) {
+            info.append("\r\n");
+            info.append(_aof->info());
+        }
+        append_bulk(out, info);
+        break;
+    }
+    case CMD_BGREWRITEAOF:
+        if (!_aof) {
+            out->append("-ERR append only file is not enabled\r\n");
+        } else if (_aof->rewrite() == -1) {
+            out->append("-ERR Background append only file rewriting already in progress\r\n");
+        } else {
+            out->append("+Background append only file rewriting started\r\n");
+        }
+        break;
+    default:
+        out->append("-ERR unknown command '" + args[0] + "'\r\n");
+        break;
+    }
+}
+
+}; // namespace redis
@@ -0,0 +1,139 @@
+#ifndef REDIS_KV_ENGINE_H_
+#define REDIS_KV_ENGINE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "KVTable.h"
+#include "Reply.h"
+#include "ReplyOrder.h"
+#include "SelectableQueue.h"
+#include "Service.h"
+
+namespace redis {
+
+class KVEngine;
+class Aof;
+
+// A job sent to the shard that owns its keys, and back with the result.
+struct KVJob;
+typedef std::vector<KVJob*> KVJobBatch;
+
+// The shared part of a KV engine: one inbox per shard. Create it before
+// Transport::Start() and give every reactor a KVEngine on it:
+//
+//     KVStore store(Transport::NUM_REACTORS);
+//     xport.SetService([&store](int index) {
+//         return new KVEngine(&store, index);
+//     });
+class KVStore {
+public:
+    KVStore(int shards);
+    ~KVStore();
+
+    // Replays the log at path into the shards, then logs every write to
+    // it, see Aof. Call before Transport::Start(). policy is one of
+    // Aof::FSYNC_*; with FSYNC_ALWAYS replies to writes are held until
+    // their commands are synced.
+    int open_aof(const std::string& path, int policy, uint64_t auto_rewrite_size = 64 * 1024 * 1024);
+
+    int shards() const {
+        return (int)_inboxes.size();
+    }
+    // the shard that owns key
+    int shard(const std::string& key) const {
+        return (int)((KVTable::hash(key.data(), key.size()) >> 32) % _inboxes.size());
+    }
+
+private:
+    friend class KVEngine;
+    std::vector<SelectableQueue<KVJobBatch*>> _inboxes;
+    // tables outlive the engines, they are loaded before the reactors start
+    std::vector<KVTable> _tables;
+    Aof* _aof;
+};
+
+// In-memory key-value engine, a Service with one shard per reactor.
+//
+// Keys are partitioned by hash over the shards and each shard's table is
+// touched only by its own reactor thread, so there is no locking. A request
+// for keys owned by another shard is sent to that shard's inbox and the
+// result sent back; multi-key commands are split by shard and merged. Jobs
+// are batched per shard and sent once per event loop iteration.
+// Responses are written in request order.
+//
+// Writes are logged to the store's AOF, if any, as idempotent records: SET
+// with an absolute PXAT expiry, PEXPIREAT, DEL and MSET.
+//
+// Commands: GET, SET key value [EX seconds|PX ms], DEL, UNLINK, EXISTS,
+// MGET, MSET, INCR, INCRBY, DECR, DECRBY, EXPIRE, PEXPIREAT, TTL, PING,
+// ECHO, INFO and BGREWRITEAOF,
+// see Command.h. Expired keys are removed when touched and by an
+// incremental scan in tick().
+class KVEngine : public Service {
+public:
+    KVEngine(KVStore* store, int index);
+    ~KVEngine();
+
+    virtual void start(Reactor* reactor);
+    virtual bool process(Reactor* reactor, const Message& req);
+    virtual void event(Reactor* reactor, const Fdevent* fde);
+    virtual void tick(Reactor* reactor);
+    virtual void closed(Reactor* reactor, int client_id);
+
+    const KVTable& table() const {
+        return _table;
+    }
+
+private:
+    friend class KVStore;
+
+    struct Pending : public ReplyOrder::Slot {
+        int type;
+        int parts = 0;
+        std::vector<Reply> values;
+        std::string error;
+        int64_t sum = 0;
+    };
+    typedef std::shared_ptr<Pending> PendingPtr;
+
+    // runs a command whose keys all belong to this shard
+    void exec(const Command* cmd, const Message& req, int64_t now_ms, std::string* out);
+    void dispatch(int client_id, int shard, const Command* cmd, const Message& req,
+        const PendingPtr& pending, std::vector<int>* positions);
+    void merge(const PendingPtr& pending, const std::vector<int>& positions, const std::string& result);
+    void finish(int client_id, const PendingPtr& pending, const std::string& data);
+    void post(int shard, KVJob* job);
+    // logs a write command made of argc bulks appended by the caller
+    void log(const std::string& record);
+    // runs fn now, or once the last logged write is durable if replies
+    // have to wait for that
+    void when_durable(std::function<void()> fn);
+    void durable_advanced();
+    void snapshot_step();
+
+    KVStore* _store;
+    int _index;
+    Reactor* _reactor;
+    SelectableQueue<KVJobBatch*>* _inbox;
+    // jobs to send, by shard
+    std::vector<KVJobBatch> _outbox;
+    KVTable& _table;
+    ReplyOrder _order;
+    int64_t _last_expire;
+
+    Aof* _aof;
+    // sequence of the last write logged by exec(), 0 if it logged nothing
+    uint64_t _logged;
+    std::deque<std::pair<uint64_t, std::function<void()>>> _durable_waits;
+    FILE* _snapshot;
+    bool _snapshot_ok;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,253 @@
+#include "KVTable.h"
+#include <stdlib.h>
+#include <string.h>
+
+namespace redis {
+
+KVTable::Key::Key(Key&& other) : _len(0), _heap(false) {
+    *this = std::move(other);
+}
+
+KVTable::Key& KVTable::Key::operator=(Key&& other) {
+    if (this != &other) {
+        clear();
+        // the union holds either the inline bytes or the heap pointer
+        _len = other._len;
+        _heap = other._heap;
+        memcpy(_buf, other._buf, INLINE);
+        other._len = 0;
+        other._heap = false;
+    }
+    return *this;
+}
+
+void KVTable::Key::assign(const char* data, size_t len) {
+    clear();
+    if (len > INLINE) {
+        _ptr = (char*)malloc(len);
+        _heap = true;
+        memcpy(_ptr, data, len);
+    } else {
+        memcpy(_buf, data, len);
+    }
+    _len = (uint32_t)len;
+}
+
+void KVTable::Key::clear() {
+    if (_heap) {
+        free(_ptr);
+        _heap = false;
+    }
+    _len = 0;
+}
+
+bool KVTable::Key::equals(const char* data, size_t len) const {
+    return _len == len && memcmp(this->data(), data, len) == 0;
+}
+
+KVTable::KVTable() {
+    _mask = 15;
+    _size = 0;
+    _cursor = 0;
+    _scanning = false;
+    _scan_pos = 0;
+    _tags = (uint32_t*)calloc(_mask + 1, sizeof(uint32_t));
+    _entries = new Entry[_mask + 1];
+}
+
+KVTable::~KVTable() {
+    free(_tags);
+    delete[] _entries;
+}
+
+uint64_t KVTable::hash(const char* data, size_t len) {
+    // FNV-1a, with a final mix so the low bits used for slots and the high
+    // bits used for sharding are both well spread
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint32_t KVTable::tag_of(const char* data, size_t len) const {
+    uint32_t tag = (uint32_t)hash(data, len);
+    return tag ? tag : 1;
+}
+
+int64_t KVTable::lookup(const char* data, size_t len, uint32_t tag) const {
+    size_t pos = tag & _mask;
+    while (_tags[pos] != 0) {
+        if (_tags[pos] == tag && _entries[pos].key.equals(data, len)) {
+            return (int64_t)pos;
+        }
+        pos = (pos + 1) & _mask;
+    }
+    return -1;
+}
+
+KVTable::Entry* KVTable::find(const std::string& key, int64_t now_ms) {
+    int64_t pos = lookup(key.data(), key.size(), tag_of(key.data(), key.size()));
+    if (pos == -1) {
+        return NULL;
+    }
+    Entry* e = &_entries[pos];
+    if (e->expire_at != 0 && e->expire_at <= now_ms) {
+        erase_at(pos);
+        return NULL;
+    }
+    return e;
+}
+
+KVTable::Entry* KVTable::insert(const std::string& key, int64_t now_ms, bool* created) {
+    uint32_t tag = tag_of(key.data(), key.size());
+    int64_t pos = lookup(key.data(), key.size(), tag);
+    if (pos != -1) {
+        Entry* e = &_entries[pos];
+        bool expired = e->expire_at != 0 && e->expire_at <= now_ms;
+        if (expired) {
+            e->expire_at = 0;
+            e->val.clear();
+        }
+        if (created) {
+            *created = expired;
+        }
+        return e;
+    }
+    // keep the load factor under 3/4
+    if ((_size + 1) * 4 > (_mask + 1) * 3) {
+        grow();
+    }
+    size_t p = tag & _mask;
+    while (_tags[p] != 0) {
+        p = (p + 1) & _mask;
+    }
+    _tags[p] = tag;
+    _entries[p].key.assign(key.data(), key.size());
+    _size++;
+    if (created) {
+        *created = true;
+    }
+    return &_entries[p];
+}
+
+bool KVTable::remove(const std::string& key) {
+    int64_t pos = lookup(key.data(), key.size(), tag_of(key.data(), key.size()));
+    if (pos == -1) {
+        return false;
+    }
+    erase_at(pos);
+    return true;
+}
+
+void KVTable::erase_at(size_t pos) {
+    size_t i = pos;
+    size_t j = pos;
+    while (1) {
+        j = (j + 1) & _mask;
+        if (_tags[j] == 0) {
+            break;
+        }
+        // move j back into the hole unless its home slot lies in (i, j]
+        size_t home = _tags[j] & _mask;
+        bool stay = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (stay) {
+            continue;
+        }
+        if (_scanning && i < _scan_pos && j >= _scan_pos) {
+            // moves behind the scan position, visit it at the end
+            _scan_missed.push_back(std::string(_entries[j].key.data(), _entries[j].key.size()));
+        }
+        _tags[i] = _tags[j];
+        _entries[i].key = std::move(_entries[j].key);
+        _entries[i].expire_at = _entries[j].expire_at;
+        _entries[i].val.swap(_entries[j].val);
+        i = j;
+    }
+    _tags[i] = 0;
+    _entries[i].key.clear();
+    _entries[i].expire_at = 0;
+    std::string().swap(_entries[i].val);
+    _size--;
+}
+
+void KVTable::grow() {
+    size_t old_cap = _mask + 1;
+    uint32_t* old_tags = _tags;
+    Entry* old_entries = _entries;
+
+    _mask = old_cap * 2 - 1;
+    // every entry moves, start over
+    _scan_pos = 0;
+    _scan_missed.clear();
+    _tags = (uint32_t*)calloc(_mask + 1, sizeof(uint32_t));
+    _entries = new Entry[_mask + 1];
+    _cursor = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old_tags[i] == 0) {
+            continue;
+        }
+        size_t p = old_tags[i] & _mask;
+        while (_tags[p] != 0) {
+            p = (p + 1) & _mask;
+        }
+        _tags[p] = old_tags[i];
+        _entries[p].key = std::move(old_entries[i].key);
+        _entries[p].expire_at = old_entries[i].expire_at;
+        _entries[p].val.swap(old_entries[i].val);
+    }
+    free(old_tags);
+    delete[] old_entries;
+}
+
+void KVTable::scan_begin() {
+    _scanning = true;
+    _scan_pos = 0;
+    _scan_missed.clear();
+}
+
+bool KVTable::scan_next(int budget, const std::function<void(const Entry& e)>& fn) {
+    if (!_scanning) {
+        return false;
+    }
+    for (int i = 0; i < budget && _scan_pos <= _mask; i++, _scan_pos++) {
+        if (_tags[_scan_pos] != 0) {
+            fn(_entries[_scan_pos]);
+        }
+    }
+    if (_scan_pos <= _mask) {
+        return true;
+    }
+    while (!_scan_missed.empty()) {
+        const std::string& key = _scan_missed.back();
+        int64_t pos = lookup(key.data(), key.size(), tag_of(key.data(), key.size()));
+        if (pos != -1) {
+            fn(_entries[pos]);
+        }
+        _scan_missed.pop_back();
+    }
+    _scanning = false;
+    return false;
+}
+
+int KVTable::expire_some(int64_t now_ms, int budget) {
+    int removed = 0;
+    for (int i = 0; i < budget && _size > 0; i++) {
+        size_t pos = _cursor & _mask;
+        Entry* e = &_entries[pos];
+        if (_tags[pos] != 0 && e->expire_at != 0 && e->expire_at <= now_ms) {
+            // an entry may have shifted into pos, look at it again
+            erase_at(pos);
+            removed++;
+            continue;
+        }
+        _cursor = (pos + 1) & _mask;
+    }
+    return removed;
+}
+
+}; // namespace redis
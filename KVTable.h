@@ -0,0 +1,107 @@
+#ifndef REDIS_KV_TABLE_H_
+#define REDIS_KV_TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace redis {
+
+// Open addressing hash table from string keys to string values with
+// optional expiry, for the exclusive use of one thread.
+//
+// Probing uses linear probing over a separate array of 32-bit hash tags, so
+// a lookup usually touches one cache line of tags and then the one entry it
+// is looking for. Keys of up to Key::INLINE bytes are stored inside the
+// entry. Deletion shifts the following entries back instead of leaving
+// tombstones, so long-lived tables do not degrade.
+class KVTable {
+public:
+    class Key {
+    public:
+        static const size_t INLINE = 24;
+
+        Key() : _len(0), _heap(false) {
+        }
+        Key(Key&& other);
+        Key& operator=(Key&& other);
+        Key(const Key&) = delete;
+        Key& operator=(const Key&) = delete;
+        ~Key() {
+            clear();
+        }
+
+        void assign(const char* data, size_t len);
+        void clear();
+        const char* data() const {
+            return _heap ? _ptr : _buf;
+        }
+        size_t size() const {
+            return _len;
+        }
+        bool equals(const char* data, size_t len) const;
+
+    private:
+        uint32_t _len;
+        bool _heap;
+        union {
+            char _buf[INLINE];
+            char* _ptr;
+        };
+    };
+
+    struct Entry {
+        Key key;
+        int64_t expire_at = 0; // unix time in ms, 0: never
+        std::string val;
+    };
+
+    KVTable();
+    ~KVTable();
+
+    static uint64_t hash(const char* data, size_t len);
+
+    size_t size() const {
+        return _size;
+    }
+
+    // NULL if key is missing or expired at now_ms
+    Entry* find(const std::string& key, int64_t now_ms);
+    // the entry of key, created with an empty value if missing
+    Entry* insert(const std::string& key, int64_t now_ms, bool* created = NULL);
+    bool remove(const std::string& key);
+    // Active expiry: checks up to budget slots from where the last call
+    // stopped and removes expired entries. Returns the number removed.
+    int expire_some(int64_t now_ms, int budget);
+
+    // Incremental full scan that tolerates changes between the calls:
+    // every key present from scan_begin() to the end is visited at least
+    // once, some may be visited twice. Entries that a deletion shifts
+    // behind the scan position are remembered and visited later, and a
+    // grow restarts the scan.
+    void scan_begin();
+    // Visits up to budget slots, false when the scan is complete.
+    bool scan_next(int budget, const std::function<void(const Entry& e)>& fn);
+
+private:
+    uint32_t tag_of(const char* data, size_t len) const;
+    int64_t lookup(const char* data, size_t len, uint32_t tag) const;
+    void erase_at(size_t pos);
+    void grow();
+
+    uint32_t* _tags; // 0: empty slot
+    Entry* _entries;
+    size_t _mask;
+    size_t _size;
+    size_t _cursor;
+
+    bool _scanning;
+    size_t _scan_pos;
+    std::vector<std::string> _scan_missed;
+};
+
+}; // namespace redis
+
+#endif
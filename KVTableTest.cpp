@@ -0,0 +1,253 @@
+// Tests of KVTable: backward-shift deletion, keys that share a home slot or
+// a whole tag, active expiry and scans across grow(), and keys around the
+// inline size.
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "KVTable.h"
+#include "TestUtil.h"
+
+using redis::KVTable;
+
+static const int64_t NOW = 1000000;
+
+static uint32_t tag_of(const std::string& key) {
+    uint32_t tag = (uint32_t)KVTable::hash(key.data(), key.size());
+    return tag ? tag : 1;
+}
+
+// n keys whose tags share the low bits under mask, i.e. their home slot
+static std::vector<std::string> same_home(uint32_t home, size_t mask, int n) {
+    std::vector<std::string> ret;
+    for (int i = 0; (int)ret.size() < n; i++) {
+        std::string key = "h" + std::to_string(i);
+        if ((tag_of(key) & mask) == home) {
+            ret.push_back(key);
+        }
+    }
+    return ret;
+}
+
+// the table holds exactly what model does
+static void check_model(KVTable* table, const std::map<std::string, std::string>& model) {
+    CHECK(table->size() == model.size());
+    for (auto& it : model) {
+        KVTable::Entry* e = table->find(it.first, NOW);
+        CHECK(e && e->val == it.second);
+        CHECK(std::string(e->key.data(), e->key.size()) == it.first);
+    }
+}
+
+// Random inserts and removes over a small key space against a std::map;
+// every removal shifts back the entries after it, and none may become
+// unreachable.
+static void test_erase_shift() {
+    KVTable table;
+    std::map<std::string, std::string> model;
+    srand(1);
+    for (int i = 0; i < 20000; i++) {
+        std::string key = "k" + std::to_string(rand() % 300);
+        if (rand() % 3 == 0) {
+            CHECK(table.remove(key) == (model.erase(key) == 1));
+        } else {
+            std::string val = std::to_string(i);
+            table.insert(key, NOW)->val = val;
+            model[key] = val;
+        }
+        if (i % 500 == 0) {
+            check_model(&table, model);
+        }
+    }
+    check_model(&table, model);
+    for (auto& it : model) {
+        CHECK(table.remove(it.first));
+    }
+    CHECK(table.size() == 0);
+    CHECK(!table.find("k1", NOW));
+    printf("erase shift ok\n");
+}
+
+// Keys piled up on one home slot, including the last one so that their run
+// wraps around the end of the table, are all found after any of them is
+// removed; keys with the very same 32-bit tag are told apart by the key.
+static void test_collisions() {
+    // a new table has 16 slots and grows past 12 entries
+    for (uint32_t home : {3u, 15u}) {
+        std::vector<std::string> keys = same_home(home, 15, 6);
+        for (size_t victim = 0; victim < keys.size(); victim++) {
+            KVTable table;
+            std::map<std::string, std::string> model;
+            for (auto& key : keys) {
+                table.insert(key, NOW)->val = "v" + key;
+                model[key] = "v" + key;
+            }
+            // others in the slots the run spills into
+            for (auto& key : same_home((home + 2) & 15, 15, 2)) {
+                table.insert(key, NOW)->val = "v" + key;
+                model[key] = "v" + key;
+            }
+            CHECK(table.remove(keys[victim]));
+            model.erase(keys[victim]);
+            check_model(&table, model);
+            CHECK(!table.find(keys[victim], NOW));
+        }
+    }
+
+    std::unordered_map<uint32_t, std::string> seen;
+    std::string a, b;
+    for (int i = 0; a.empty(); i++) {
+        std::string key = "t" + std::to_string(i);
+        auto it = seen.find(tag_of(key));
+        if (it != seen.end()) {
+            a = it->second;
+            b = key;
+        } else {
+            seen[tag_of(key)] = key;
+        }
+    }
+    KVTable table;
+    table.insert(a, NOW)->val = "a";
+    bool created;
+    table.insert(b, NOW, &created)->val = "b";
+    CHECK(created);
+    CHECK(table.size() == 2);
+    CHECK(table.find(a, NOW)->val == "a");
+    CHECK(table.find(b, NOW)->val == "b");
+    CHECK(table.remove(a));
+    CHECK(!table.find(a, NOW));
+    CHECK(table.find(b, NOW)->val == "b");
+    CHECK(!table.remove(a));
+    printf("collisions ok\n");
+}
+
+// Active expiry keeps going while the table grows under it: in the end
+// every expired entry is gone and every live one is left.
+static void test_expire_across_grow() {
+    KVTable table;
+    std::set<std::string> live;
+    for (int i = 0; i < 5000; i++) {
+        std::string key = "e" + std::to_string(i);
+        KVTable::Entry* e = table.insert(key, NOW);
+        if (i % 3 == 0) {
+            live.insert(key);
+        } else {
+            e->expire_at = NOW - 1 - i % 2;
+        }
+        // a little expiry between inserts, across every grow
+        table.expire_some(NOW, 4);
+    }
+    for (int i = 0; i < 100 && table.size() > live.size(); i++) {
+        table.expire_some(NOW, 256);
+    }
+    CHECK(table.size() == live.size());
+    for (auto& key : live) {
+        CHECK(table.find(key, NOW));
+    }
+
+    // due later: nothing goes before its time
+    for (auto& key : live) {
+        table.find(key, NOW)->expire_at = NOW + 10;
+    }
+    CHECK(table.expire_some(NOW, 1 << 20) == 0);
+    CHECK(table.size() == live.size());
+    CHECK(!table.find(*live.begin(), NOW + 10));
+    printf("expire across grow ok\n");
+}
+
+// A scan visits every key present throughout, while other keys are
+// inserted, which grows the table, and removed, which shifts keys behind
+// the scan position.
+static void test_scan_across_grow() {
+    KVTable table;
+    std::set<std::string> stable;
+    // 512 slots, that grow after 384 entries
+    for (int i = 0; i < 370; i++) {
+        std::string key = "s" + std::to_string(i);
+        table.insert(key, NOW);
+        stable.insert(key);
+    }
+    std::set<std::string> visited;
+    table.scan_begin();
+    int round = 0;
+    while (table.scan_next(16, [&](const KVTable::Entry& e) {
+        visited.insert(std::string(e.key.data(), e.key.size()));
+    })) {
+        // slow enough for the scan to get through between two grows
+        for (int i = 0; i < 4; i++) {
+            table.insert("x" + std::to_string(round * 4 + i), NOW);
+        }
+        for (int i = 0; i < 2; i++) {
+            table.remove("x" + std::to_string(round * 4 - 40 + i));
+        }
+        round++;
+    }
+    for (auto& key : stable) {
+        CHECK(visited.count(key));
+    }
+    // it did grow meanwhile
+    CHECK(table.size() > 384);
+    CHECK(!table.scan_next(16, [](const KVTable::Entry& e) {}));
+    printf("scan across grow ok\n");
+}
+
+// Keys of up to INLINE bytes live in the entry, longer ones on the heap;
+// both survive being moved by grow() and by deletions.
+static void test_key_sizes() {
+    std::vector<std::string> keys = {""};
+    for (size_t len : {(size_t)1, KVTable::Key::INLINE - 1, KVTable::Key::INLINE, KVTable::Key::INLINE + 1,
+        (size_t)1000})
+    {
+        for (char c = 'a'; c <= 'h'; c++) {
+            keys.push_back(std::string(len, c));
+        }
+    }
+    // same first INLINE bytes, differing after them
+    keys.push_back(std::string(KVTable::Key::INLINE, 'z') + "1");
+    keys.push_back(std::string(KVTable::Key::INLINE, 'z') + "2");
+
+    KVTable table;
+    std::map<std::string, std::string> model;
+    for (auto& key : keys) {
+        table.insert(key, NOW)->val = "v" + std::to_string(key.size());
+        model[key] = "v" + std::to_string(key.size());
+    }
+    // prefixes are other keys
+    CHECK(!table.find(std::string(KVTable::Key::INLINE, 'z'), NOW));
+    CHECK(!table.find(std::string(2, 'a'), NOW));
+    check_model(&table, model);
+
+    // grow a few times
+    for (int i = 0; i < 1000; i++) {
+        table.insert("g" + std::to_string(i), NOW)->val = "g";
+        model["g" + std::to_string(i)] = "g";
+    }
+    check_model(&table, model);
+    for (size_t i = 0; i < keys.size(); i += 2) {
+        CHECK(table.remove(keys[i]));
+        model.erase(keys[i]);
+    }
+    check_model(&table, model);
+
+    KVTable::Key k;
+    k.assign("short", 5);
+    KVTable::Key h;
+    h.assign(keys.back().data(), keys.back().size());
+    k = std::move(h);
+    CHECK(k.equals(keys.back().data(), keys.back().size()));
+    CHECK(h.size() == 0);
+    printf("key sizes ok\n");
+}
+
+int main(int argc, char** argv) {
+    test_erase_shift();
+    test_collisions();
+    test_expire_across_grow();
+    test_scan_across_grow();
+    test_key_sizes();
+    printf("all passed\n");
+    return 0;
+}
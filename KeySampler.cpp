@@ -0,0 +1,184 @@
+#include "KeySampler.h"
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include "Clock.h"
+
+namespace redis {
+
+// lists are published this often, and aged every AGE_EVERY publishes
+static const uint64_t PUBLISH_US = 1000000;
+static const int AGE_EVERY = 8;
+
+KeySampler::KeySampler() {
+    _rate = 16;
+    _big_bytes = 64 * 1024;
+    _tick = 0;
+    memset(_sketch, 0, sizeof(_sketch));
+    _hot.reserve(K);
+    _big.reserve(K);
+    _next_publish = 0;
+    _publishes = 0;
+}
+
+// conservative update: only the counters at the minimum grow, which keeps
+// the over-estimate of rare keys colliding with hot ones low
+uint32_t KeySampler::add(uint64_t hash) {
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    uint32_t* cells[DEPTH];
+    uint32_t min = UINT32_MAX;
+    for (int i = 0; i < DEPTH; i++) {
+        cells[i] = &_sketch[i][(h1 + i * h2) % WIDTH];
+        min = std::min(min, *cells[i]);
+    }
+    for (int i = 0; i < DEPTH; i++) {
+        if (*cells[i] == min) {
+            (*cells[i])++;
+        }
+    }
+    return min + 1;
+}
+
+uint64_t KeySampler::weight(const KeyStat& stat, bool by_size) {
+    return by_size ? std::max(stat.request_bytes, stat.reply_bytes) : stat.count;
+}
+
+// stat replaces the key's entry, or the lightest one if it is heavier
+void KeySampler::update(std::vector<Entry>* top, uint64_t hash, const std::string& key, const KeyStat& stat,
+    bool by_size)
+{
+    Entry* min = NULL;
+    for (auto& e : *top) {
+        if (e.hash == hash && e.stat.key == key) {
+            e.stat.count = by_size ? e.stat.count + 1 : stat.count;
+            e.stat.request_bytes = std::max(e.stat.request_bytes, stat.request_bytes);
+            e.stat.reply_bytes = std::max(e.stat.reply_bytes, stat.reply_bytes);
+            return;
+        }
+        if (!min || weight(e.stat, by_size) < weight(min->stat, by_size)) {
+            min = &e;
+        }
+    }
+    if ((int)top->size() < K) {
+        top->push_back(Entry{hash, stat});
+        top->back().stat.key = key;
+    } else if (weight(stat, by_size) > weight(min->stat, by_size)) {
+        min->hash = hash;
+        min->stat = stat;
+        min->stat.key = key;
+    }
+}
+
+void KeySampler::request(int client_id, uint64_t at, const std::string& key, size_t bytes) {
+    if (++_tick % _rate == 0) {
+        uint64_t hash = std::hash<std::string>()(key);
+        KeyStat stat;
+        stat.count = add(hash);
+        stat.request_bytes = bytes;
+        update(&_hot, hash, key, stat, false);
+    }
+    _pending[client_id].push_back(Pending{at, key, bytes});
+}
+
+void KeySampler::replied(int client_id, uint64_t at, size_t bytes) {
+    auto it = _pending.find(client_id);
+    if (it == _pending.end()) {
+        return;
+    }
+    std::deque<Pending>& q = it->second;
+    while (!q.empty() && q.front().at < at) {
+        q.pop_front();
+    }
+    if (q.empty() || q.front().at != at) {
+        return;
+    }
+    const Pending& p = q.front();
+    if (p.bytes >= _big_bytes || bytes >= _big_bytes) {
+        KeyStat stat;
+        stat.count = 1;
+        stat.request_bytes = p.bytes;
+        stat.reply_bytes = bytes;
+        update(&_big, std::hash<std::string>()(p.key), p.key, stat, true);
+    }
+    q.pop_front();
+}
+
+void KeySampler::closed(int client_id) {
+    _pending.erase(client_id);
+}
+
+void KeySampler::tick(uint64_t now) {
+    if (now < _next_publish) {
+        return;
+    }
+    _next_publish = now + Clock::from_us(PUBLISH_US);
+
+    std::vector<KeyStat> hot;
+    std::vector<KeyStat> big;
+    for (auto& e : _hot) {
+        hot.push_back(e.stat);
+        hot.back().count *= _rate;
+    }
+    // every request is checked for size, so big counts are not scaled
+    for (auto& e : _big) {
+        big.push_back(e.stat);
+    }
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        _published_hot.swap(hot);
+        _published_big.swap(big);
+    }
+
+    if (++_publishes % AGE_EVERY == 0) {
+        for (int i = 0; i < DEPTH; i++) {
+            for (int j = 0; j < WIDTH; j++) {
+                _sketch[i][j] >>= 1;
+            }
+        }
+        for (auto& e : _hot) {
+            e.stat.count >>= 1;
+        }
+        for (auto& e : _big) {
+            // sizes are what was seen, only how often ages
+            e.stat.count >>= 1;
+        }
+    }
+}
+
+std::vector<KeyStat> KeySampler::merge(KeySampler* samplers, int count, int n, bool by_size) {
+    // a key may be hot on several reactors, through different clients
+    std::unordered_map<std::string, KeyStat> keys;
+    for (int i = 0; i < count; i++) {
+        KeySampler* s = &samplers[i];
+        std::lock_guard<std::mutex> lk(s->_mutex);
+        for (auto& stat : by_size ? s->_published_big : s->_published_hot) {
+            KeyStat& m = keys[stat.key];
+            m.key = stat.key;
+            m.count += stat.count;
+            m.request_bytes = std::max(m.request_bytes, stat.request_bytes);
+            m.reply_bytes = std::max(m.reply_bytes, stat.reply_bytes);
+        }
+    }
+    std::vector<KeyStat> ret;
+    for (auto& it : keys) {
+        ret.push_back(it.second);
+    }
+    std::sort(ret.begin(), ret.end(), [by_size](const KeyStat& a, const KeyStat& b) {
+        return weight(a, by_size) > weight(b, by_size);
+    });
+    if ((int)ret.size() > n) {
+        ret.resize(n);
+    }
+    return ret;
+}
+
+std::vector<KeyStat> KeySampler::hot(KeySampler* samplers, int count, int n) {
+    return merge(samplers, count, n, false);
+}
+
+std::vector<KeyStat> KeySampler::big(KeySampler* samplers, int count, int n) {
+    return merge(samplers, count, n, true);
+}
+
+}; // namespace redis
@@ -0,0 +1,94 @@
+#ifndef REDIS_KEY_SAMPLER_H_
+#define REDIS_KEY_SAMPLER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace redis {
+
+// A key seen by the sampler, with its estimated request count, and the
+// largest request and reply seen for it.
+struct KeyStat {
+    std::string key;
+    uint64_t count = 0;
+    uint64_t request_bytes = 0;
+    uint64_t reply_bytes = 0;
+};
+
+// Hot key and big key detection of one reactor. One keyed request out of
+// `rate` is counted into a count-min sketch, and the keys estimated most
+// frequent are kept in a top-K list. Every keyed request is checked for
+// size: requests or replies of at least big_bytes put their key into a
+// second top-K list, ordered by size. Memory is fixed but for the keys of
+// the requests waiting for their reply: the sketch and two lists of K keys.
+//
+// The reactor thread writes; every second it publishes copies of the lists
+// for hot() and big(), which any thread may call, and every few seconds the
+// counts are halved so that the lists follow the current traffic.
+class KeySampler {
+public:
+    static const int K = 32;
+
+    KeySampler();
+
+    void init(int rate, size_t big_bytes) {
+        _rate = rate;
+        _big_bytes = big_bytes;
+    }
+
+    // a keyed request of the client, the at-th one it sent
+    void request(int client_id, uint64_t at, const std::string& key, size_t bytes);
+    // the reply to the at-th request of the client, which may not have
+    // been keyed
+    void replied(int client_id, uint64_t at, size_t bytes);
+    void closed(int client_id);
+    // publishes and ages the lists when due, called every loop iteration
+    void tick(uint64_t now);
+
+    // the published lists of several samplers merged, largest first
+    static std::vector<KeyStat> hot(KeySampler* samplers, int count, int n);
+    static std::vector<KeyStat> big(KeySampler* samplers, int count, int n);
+
+private:
+    enum { DEPTH = 4, WIDTH = 2048 };
+
+    struct Entry {
+        uint64_t hash;
+        KeyStat stat;
+    };
+    struct Pending {
+        uint64_t at;
+        std::string key;
+        size_t bytes;
+    };
+
+    uint32_t add(uint64_t hash);
+    static void update(std::vector<Entry>* top, uint64_t hash, const std::string& key, const KeyStat& stat,
+        bool by_size);
+    static uint64_t weight(const KeyStat& stat, bool by_size);
+    static std::vector<KeyStat> merge(KeySampler* samplers, int count, int n, bool by_size);
+
+    int _rate;
+    size_t _big_bytes;
+    uint64_t _tick;
+    uint32_t _sketch[DEPTH][WIDTH];
+    std::vector<Entry> _hot;
+    std::vector<Entry> _big;
+    // keyed requests waiting for their reply, by client, in request order
+    std::unordered_map<int, std::deque<Pending>> _pending;
+    uint64_t _next_publish;
+    int _publishes;
+
+    std::mutex _mutex;
+    std::vector<KeyStat> _published_hot;
+    std::vector<KeyStat> _published_big;
+};
+
+}; // namespace redis
+
+#endif
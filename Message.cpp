@@ -1,4 +1,6 @@
 #include "Message.h"
+#include <errno.h>
+#include <stdlib.h>
 
 namespace redis {
 
@@ -21,16 +23,116 @@ int Message::Decode(const std::string& buf) {
     return Decode(buf.data(), buf.size());
 }
 
-static int parse_plain(const char* data, int len, std::vector<std::string>* ret);
-static int parse(const char* data, int len, std::vector<std::string>* ret);
+// Stores the parsed arguments over the strings already in vals, instead of
+// clearing it, so a recycled Message decodes without allocating.
+struct ArgWriter {
+    std::vector<std::string>* vals;
+    size_t count;
+
+    ArgWriter(std::vector<std::string>* vals) : vals(vals), count(0) {
+        // room for the typical command at once, not 1, 2, then 4
+        if (vals->capacity() == 0) {
+            vals->reserve(4);
+        }
+    }
+    void add(const char* data, int size) {
+        if (count < vals->size()) {
+            (*vals)[count].assign(data, size);
+        } else {
+            vals->emplace_back(data, size);
+        }
+        count++;
+    }
+};
+
+static int parse_plain(const char* data, int len, ArgWriter* ret);
+static int parse(const char* data, int len, ArgWriter* ret);
 
 int Message::Decode(const char* data, int len) {
-    return parse(data, len, &_vals);
+    ArgWriter args(&_vals);
+    int ret = parse(data, len, &args);
+    _vals.resize(args.count);
+    if (ret > 0) {
+        resolve();
+    }
+    return ret;
 }
 
-static int parse(const char* data, int len, std::vector<std::string>* ret) {
-    ret->clear();
+static bool to_int(const std::string& s, int64_t* v) {
+    if (s.empty() || s.size() > 20) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    long long n = strtoll(s.c_str(), &end, 10);
+    if (errno != 0 || *end != '\0') {
+        return false;
+    }
+    *v = n;
+    return true;
+}
+
+static bool to_double(const std::string& s, double* v) {
+    if (s.empty()) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    double d = strtod(s.c_str(), &end);
+    if (errno != 0 || *end != '\0' || d != d) {
+        return false;
+    }
+    *v = d;
+    return true;
+}
+
+void Message::resolve() {
+    _command = NULL;
+    _error.clear();
+    _typed.clear();
+    if (_vals.empty()) {
+        return;
+    }
+    const Command* cmd = Command::find(_vals[0]);
+    if (!cmd) {
+        return;
+    }
+    _command = cmd;
+
+    int argc = (int)_vals.size();
+    bool arity_ok = cmd->arity > 0 ? argc == cmd->arity : argc >= -cmd->arity;
+    if (arity_ok && cmd->key_step > 1 && cmd->last_key == -1) {
+        arity_ok = (argc - cmd->first_key) % cmd->key_step == 0;
+    }
+    if (!arity_ok) {
+        _error = "ERR wrong number of arguments for '" + _vals[0] + "' command";
+        return;
+    }
+
+    // most commands take strings only
+    const char* types = cmd->types;
+    bool typed = false;
+    for (const char* p = types; *p; p++) {
+        typed |= *p != 's';
+    }
+    if (!typed) {
+        return;
+    }
+    size_t ntypes = command_table::length(types);
+    _typed.resize(argc);
+    for (int i = 1; i < argc; i++) {
+        char t = types[(size_t)(i - 1) < ntypes ? i - 1 : ntypes - 1];
+        if (t == 'i' && !to_int(_vals[i], &_typed[i].i)) {
+            _error = "ERR value is not an integer or out of range";
+            return;
+        } else if (t == 'd' && !to_double(_vals[i], &_typed[i].d)) {
+            _error = "ERR value is not a valid float";
+            return;
+        }
+    }
+}
 
+static int parse(const char* data, int len, ArgWriter* ret) {
     const int BULK = 0;
     const int ARRAY = 1;
     const int PLAIN = 2;
@@ -137,8 +239,7 @@ static int parse(const char* data, int len, std::vector<std::string>* ret) {
                         continue;
                     }
 
-                    std::string p(data + s, size);
-                    ret->push_back(p);
+                    ret->add(data + s, size);
 
                     status = MARK;
                     bulk--;
@@ -155,22 +256,20 @@ static int parse(const char* data, int len, std::vector<std::string>* ret) {
     return 0;
 }
 
-static int parse_plain(const char* data, int len, std::vector<std::string>* ret) {
+static int parse_plain(const char* data, int len, ArgWriter* ret) {
     int s = 0;
     for (int e = 0; e < len; e++) {
         char c = data[e];
         if (c == ' ') {
             int size = e - s;
-            std::string p(data + s, size);
-            ret->push_back(p);
+            ret->add(data + s, size);
             s = e + 1;
         } else if (c == '\n') {
             int size = e - s;
             if (size > 0 && data[e - 1] == '\r') {
                 size -= 1;
             }
-            std::string p(data + s, size);
-            ret->push_back(p);
+            ret->add(data + s, size);
             s = e + 1;
             return s;
         }
@@ -1,5 +1,7 @@
 #include <vector>
 #include <string>
+#include "Trace.h"
+#include "Command.h"
 
 #ifndef NET_MESSAGE_
 #define NET_MESSAGE_
@@ -25,6 +27,14 @@ public:
     int ClientId() const {
         return _client_id;
     }
+    // Reuse the message for the next request of client_id. The strings of
+    // its arguments keep their capacity, so decoding into a recycled
+    // message allocates only for arguments longer than before.
+    void Recycle(int client_id) {
+        _client_id = client_id;
+        _trace = Trace();
+        _deadline = 0;
+    }
     void SetClientId(int client_id) {
         _client_id = client_id;
     }
@@ -55,6 +65,10 @@ public:
     std::vector<std::string> Array() const {
         return _vals;
     }
+    // same as Array(), without the copy
+    const std::vector<std::string>& Vals() const {
+        return _vals;
+    }
     std::vector<std::string> Args() const {
         return Args(0);
     }
@@ -73,14 +87,80 @@ public:
         return "";
     }
 
+    // The declaration of the command, NULL if it is unknown or the message
+    // was not decoded.
+    const Command* GetCommand() const {
+        return _command;
+    }
+    // Why a known command was rejected, e.g. wrong arity or a non-integer
+    // for an 'i' argument. Empty if the message is valid.
+    const std::string& Error() const {
+        return _error;
+    }
+    // Typed arguments, converted when decoded. idx counts like Arg(), and
+    // must be an argument declared 'i' or 'd'.
+    int64_t Int(int idx) const {
+        return _typed[idx + 1].i;
+    }
+    double Double(int idx) const {
+        return _typed[idx + 1].d;
+    }
+
+    const Trace& GetTrace() const {
+        return _trace;
+    }
+    Trace* MutableTrace() {
+        return &_trace;
+    }
+
+    // When the reactor queued the message for Recv(), and when it is no
+    // longer worth handling, 0 for never (Clock). Set only with
+    // Transport::EnableAdmissionControl().
+    uint64_t QueuedAt() const {
+        return _queued_at;
+    }
+    uint64_t Deadline() const {
+        return _deadline;
+    }
+    void SetQueued(uint64_t queued_at, uint64_t deadline) {
+        _queued_at = queued_at;
+        _deadline = deadline;
+    }
+
+    // Take the arguments of *vals as if they had been decoded, e.g. for a
+    // request assembled by a BulkStream. *vals gets the old ones.
+    void Assign(std::vector<std::string>* vals) {
+        _vals.swap(*vals);
+        resolve();
+    }
+    // mark the message invalid, Error() tells why
+    void Reject(const std::string& error) {
+        _error = error;
+    }
+
     std::string Encode() const;
     // 返回解析了多少字节
     int Decode(const std::string& buf);
     int Decode(const char* data, int len);
 
 private:
+    union TypedArg {
+        int64_t i;
+        double d;
+    };
+
+    // looks up the command and validates/converts the arguments
+    void resolve();
+
     int _client_id = -1;
     std::vector<std::string> _vals;
+    const Command* _command = NULL;
+    std::string _error;
+    // by position, only filled for commands with typed arguments
+    std::vector<TypedArg> _typed;
+    Trace _trace;
+    uint64_t _queued_at = 0;
+    uint64_t _deadline = 0;
 };
 
 }; // namespace redis
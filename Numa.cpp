@@ -0,0 +1,158 @@
+#include "Numa.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <mutex>
+
+namespace redis {
+
+// from <linux/mempolicy.h>
+static const int MPOL_PREFERRED_ = 1;
+static const int MAX_NODES = 1024;
+
+static std::once_flag init_once;
+// cpus of each node, and node of each cpu
+static std::vector<std::vector<int>> node_cpus;
+static std::vector<int> cpu_node;
+
+// "0-3,8,10-11"
+static void parse_cpulist(const char* s, std::vector<int>* cpus) {
+    while (*s) {
+        char* end;
+        long lo = strtol(s, &end, 10);
+        if (end == s) {
+            break;
+        }
+        long hi = lo;
+        s = end;
+        if (*s == '-') {
+            s++;
+            hi = strtol(s, &end, 10);
+            s = end;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            cpus->push_back((int)cpu);
+        }
+        while (*s == ',' || *s == '\n') {
+            s++;
+        }
+    }
+}
+
+void Numa::init() {
+    const char* dir = "/sys/devices/system/node";
+    DIR* d = opendir(dir);
+    if (d) {
+        struct dirent* ent;
+        while ((ent = readdir(d)) != NULL) {
+            int node;
+            if (sscanf(ent->d_name, "node%d", &node) != 1 || node < 0 || node >= MAX_NODES) {
+                continue;
+            }
+            char path[256];
+            snprintf(path, sizeof(path), "%s/node%d/cpulist", dir, node);
+            FILE* fp = fopen(path, "r");
+            if (!fp) {
+                continue;
+            }
+            char buf[4096];
+            std::vector<int> cpus;
+            if (fgets(buf, sizeof(buf), fp)) {
+                parse_cpulist(buf, &cpus);
+            }
+            fclose(fp);
+            if ((int)node_cpus.size() <= node) {
+                node_cpus.resize(node + 1);
+            }
+            node_cpus[node] = cpus;
+        }
+        closedir(d);
+    }
+    if (node_cpus.empty()) {
+        node_cpus.resize(1);
+        long n = sysconf(_SC_NPROCESSORS_CONF);
+        for (long cpu = 0; cpu < n; cpu++) {
+            node_cpus[0].push_back((int)cpu);
+        }
+    }
+    for (int node = 0; node < (int)node_cpus.size(); node++) {
+        for (int cpu : node_cpus[node]) {
+            if ((int)cpu_node.size() <= cpu) {
+                cpu_node.resize(cpu + 1, -1);
+            }
+            cpu_node[cpu] = node;
+        }
+    }
+}
+
+int Numa::nodes() {
+    std::call_once(init_once, init);
+    return (int)node_cpus.size();
+}
+
+int Numa::node_of_cpu(int cpu) {
+    std::call_once(init_once, init);
+    if (cpu < 0 || cpu >= (int)cpu_node.size()) {
+        return -1;
+    }
+    return cpu_node[cpu];
+}
+
+const std::vector<int>& Numa::cpus(int node) {
+    std::call_once(init_once, init);
+    static const std::vector<int> none;
+    if (node < 0 || node >= (int)node_cpus.size()) {
+        return none;
+    }
+    return node_cpus[node];
+}
+
+int Numa::current_node() {
+    return node_of_cpu(sched_getcpu());
+}
+
+int Numa::bind_thread(int node) {
+    const std::vector<int>& list = cpus(node);
+    if (list.empty()) {
+        return -1;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : list) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void* Numa::alloc(size_t size, int node) {
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    if (node >= 0 && node < MAX_NODES && nodes() > 1) {
+        unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = {0};
+        mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        // best effort, the pages are still usable if the policy is refused
+        syscall(SYS_mbind, p, size, MPOL_PREFERRED_, mask, (unsigned long)MAX_NODES + 1, 0);
+    }
+    return p;
+}
+
+void Numa::free(void* p, size_t size) {
+    if (p) {
+        munmap(p, size);
+    }
+}
+
+}; // namespace redis
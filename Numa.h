@@ -0,0 +1,36 @@
+#ifndef REDIS_NUMA_H_
+#define REDIS_NUMA_H_
+
+#include <stddef.h>
+#include <vector>
+
+namespace redis {
+
+// NUMA topology read from /sys/devices/system/node, and node-local memory
+// through mbind(2), without depending on libnuma. A machine without NUMA
+// (or without sysfs) looks like a single node 0 holding every CPU.
+class Numa {
+public:
+    static int nodes();
+    // -1 if unknown
+    static int node_of_cpu(int cpu);
+    static const std::vector<int>& cpus(int node);
+    // node of the CPU the calling thread runs on
+    static int current_node();
+
+    // Pin the calling thread to the CPUs of node. Memory it touches first
+    // is then allocated on that node by the kernel's default policy.
+    static int bind_thread(int node);
+
+    // Page-aligned memory whose pages go to node when there is room left on
+    // it, zero filled. Release with free(). NULL on error.
+    static void* alloc(size_t size, int node);
+    static void free(void* p, size_t size);
+
+private:
+    static void init();
+};
+
+}; // namespace redis
+
+#endif
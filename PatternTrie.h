@@ -0,0 +1,285 @@
+#ifndef REDIS_PATTERN_TRIE_H_
+#define REDIS_PATTERN_TRIE_H_
+
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace redis {
+
+// Glob patterns as in Redis (* ? [abc] [^a-z] \x) kept in a trie of their
+// tokens, so matching a string walks the prefixes that patterns share once
+// instead of trying every pattern on its own. Patterns that only differ in
+// spelling ("a**" and "a*", "\a" and "a") share one entry.
+template <class T>
+class PatternTrie {
+public:
+    PatternTrie() {
+        _root = new Node();
+        _size = 0;
+    }
+    ~PatternTrie() {
+        delete _root;
+    }
+    PatternTrie(const PatternTrie&) = delete;
+    PatternTrie& operator=(const PatternTrie&) = delete;
+
+    size_t size() const {
+        return _size;
+    }
+
+    // the value of pattern, default constructed if it is new
+    T* insert(const std::string& pattern);
+    // NULL if pattern is not in the trie
+    T* find(const std::string& pattern) const;
+    void remove(const std::string& pattern);
+
+    // Calls fn(value) once for every entry that matches s.
+    void match(const std::string& s, const std::function<void(T& value)>& fn) const;
+
+private:
+    // literal chars are keyed by themselves, "?", "*" and "[...]" by their
+    // text; a '[' without ']' is a class up to the end of the pattern
+    struct Node {
+        std::unordered_map<char, Node*> literals;
+        std::vector<std::pair<std::string, Node*>> wildcards;
+        T* value = NULL;
+
+        ~Node() {
+            for (auto it : literals) {
+                delete it.second;
+            }
+            for (auto& it : wildcards) {
+                delete it.second;
+            }
+            delete value;
+        }
+        bool empty() const {
+            return !value && literals.empty() && wildcards.empty();
+        }
+    };
+
+    // splits a pattern into tokens, a literal is one char or an escaped
+    // '*', '?' or '['
+    static std::vector<std::string> tokenize(const std::string& pattern);
+    static bool literal(const std::string& token, char* c);
+    static bool class_match(const std::string& token, char c);
+    Node* child(Node* node, const std::string& token, bool create) const;
+    void match(Node* node, const std::string& s, size_t pos, std::vector<Node*>* found) const;
+    bool remove(Node* node, const std::vector<std::string>& tokens, size_t i);
+
+    Node* _root;
+    size_t _size;
+};
+
+template <class T>
+std::vector<std::string> PatternTrie<T>::tokenize(const std::string& pattern) {
+    std::vector<std::string> tokens;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.size()) {
+            c = pattern[++i];
+            if (c == '*' || c == '?' || c == '[') {
+                tokens.push_back(std::string("\\") + c);
+            } else {
+                tokens.push_back(std::string(1, c));
+            }
+        } else if (c == '*') {
+            // "**" is "*"
+            if (tokens.empty() || tokens.back() != "*") {
+                tokens.push_back("*");
+            }
+        } else if (c == '?') {
+            tokens.push_back("?");
+        } else if (c == '[') {
+            // up to the closing ']', or the end of the pattern like Redis
+            size_t j = i + 1;
+            while (j < pattern.size() && pattern[j] != ']') {
+                j += pattern[j] == '\\' ? 2 : 1;
+            }
+            j = j < pattern.size() ? j : pattern.size() - 1;
+            tokens.push_back(pattern.substr(i, j - i + 1));
+            i = j;
+        } else {
+            tokens.push_back(std::string(1, c));
+        }
+    }
+    return tokens;
+}
+
+template <class T>
+bool PatternTrie<T>::literal(const std::string& token, char* c) {
+    if (token.size() == 1 && token[0] != '*' && token[0] != '?' && token[0] != '[') {
+        *c = token[0];
+        return true;
+    }
+    if (token.size() == 2 && token[0] == '\\') {
+        *c = token[1];
+        return true;
+    }
+    return false;
+}
+
+template <class T>
+bool PatternTrie<T>::class_match(const std::string& token, char c) {
+    // up to the unescaped ']', like tokenize()
+    size_t i = 1;
+    size_t end = token.size();
+    bool negate = i < end && token[i] == '^';
+    if (negate) {
+        i++;
+    }
+    bool found = false;
+    while (i < end && token[i] != ']' && !found) {
+        if (token[i] == '\\' && i + 1 < end) {
+            found = token[i + 1] == c;
+            i += 2;
+        } else if (i + 2 < end && token[i + 1] == '-' && token[i + 2] != ']') {
+            unsigned char lo = token[i];
+            unsigned char hi = token[i + 2];
+            if (lo > hi) {
+                std::swap(lo, hi);
+            }
+            found = (unsigned char)c >= lo && (unsigned char)c <= hi;
+            i += 3;
+        } else {
+            found = token[i] == c;
+            i++;
+        }
+    }
+    return negate ? !found : found;
+}
+
+template <class T>
+typename PatternTrie<T>::Node* PatternTrie<T>::child(Node* node, const std::string& token, bool create) const {
+    char c;
+    if (literal(token, &c)) {
+        auto it = node->literals.find(c);
+        if (it != node->literals.end()) {
+            return it->second;
+        }
+        if (!create) {
+            return NULL;
+        }
+        Node* ret = new Node();
+        node->literals[c] = ret;
+        return ret;
+    }
+    for (auto& it : node->wildcards) {
+        if (it.first == token) {
+            return it.second;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    Node* ret = new Node();
+    node->wildcards.push_back(std::make_pair(token, ret));
+    return ret;
+}
+
+template <class T>
+T* PatternTrie<T>::insert(const std::string& pattern) {
+    Node* node = _root;
+    for (auto& token : tokenize(pattern)) {
+        node = child(node, token, true);
+    }
+    if (!node->value) {
+        node->value = new T();
+        _size++;
+    }
+    return node->value;
+}
+
+template <class T>
+T* PatternTrie<T>::find(const std::string& pattern) const {
+    Node* node = _root;
+    for (auto& token : tokenize(pattern)) {
+        node = child(node, token, false);
+        if (!node) {
+            return NULL;
+        }
+    }
+    return node->value;
+}
+
+template <class T>
+void PatternTrie<T>::remove(const std::string& pattern) {
+    remove(_root, tokenize(pattern), 0);
+}
+
+// returns true if node has become empty
+template <class T>
+bool PatternTrie<T>::remove(Node* node, const std::vector<std::string>& tokens, size_t i) {
+    if (i == tokens.size()) {
+        if (node->value) {
+            delete node->value;
+            node->value = NULL;
+            _size--;
+        }
+        return node->empty();
+    }
+    Node* next = child(node, tokens[i], false);
+    if (!next || !remove(next, tokens, i + 1)) {
+        return false;
+    }
+    // prune the emptied child
+    char c;
+    if (literal(tokens[i], &c)) {
+        node->literals.erase(c);
+    } else {
+        for (size_t j = 0; j < node->wildcards.size(); j++) {
+            if (node->wildcards[j].second == next) {
+                node->wildcards.erase(node->wildcards.begin() + j);
+                break;
+            }
+        }
+    }
+    delete next;
+    return node->empty();
+}
+
+template <class T>
+void PatternTrie<T>::match(const std::string& s, const std::function<void(T& value)>& fn) const {
+    // a '*' may reach the same pattern along several paths
+    std::vector<Node*> found;
+    match(_root, s, 0, &found);
+    for (auto node : found) {
+        fn(*node->value);
+    }
+}
+
+template <class T>
+void PatternTrie<T>::match(Node* node, const std::string& s, size_t pos, std::vector<Node*>* found) const {
+    if (pos == s.size() && node->value) {
+        bool dup = false;
+        for (auto n : *found) {
+            dup |= n == node;
+        }
+        if (!dup) {
+            found->push_back(node);
+        }
+    }
+    if (pos < s.size()) {
+        auto it = node->literals.find(s[pos]);
+        if (it != node->literals.end()) {
+            match(it->second, s, pos + 1, found);
+        }
+    }
+    for (auto& it : node->wildcards) {
+        const std::string& token = it.first;
+        if (token[0] == '*') {
+            for (size_t i = pos; i <= s.size(); i++) {
+                match(it.second, s, i, found);
+            }
+        } else if (pos < s.size() && (token[0] == '?' || class_match(token, s[pos]))) {
+            match(it.second, s, pos + 1, found);
+        }
+    }
+}
+
+}; // namespace redis
+
+#endif
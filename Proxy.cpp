@@ -0,0 +1,283 @@
+#include "Proxy.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "Connection.h"
+#include "Reactor.h"
+#include "fde.h"
+
+namespace redis {
+
+// how the replies of split commands are merged
+enum { MERGE_NONE = 0, MERGE_MGET, MERGE_MSET, MERGE_SUM };
+
+static uint64_t fnv1a(const char* data, size_t len) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Lamping & Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm".
+// Adding a backend moves only 1/n of the keys.
+static int jump_hash(uint64_t key, int buckets) {
+    int64_t b = -1;
+    int64_t j = 0;
+    while (j < buckets) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (int64_t)((b + 1) * (double(1LL << 31) / double((key >> 33) + 1)));
+    }
+    return (int)b;
+}
+
+// commands that leave state on the connection they are sent on, or hold it
+// until answered; backend connections are shared by clients, so these are
+// refused
+static bool connection_bound(const std::string& cmd) {
+    static const char* names[] = {
+        "subscribe", "unsubscribe", "psubscribe", "punsubscribe", "ssubscribe",
+        "sunsubscribe", "multi", "exec", "discard", "watch", "unwatch", "select",
+        "swapdb", "auth", "hello", "client", "reset", "monitor", "readonly",
+        "readwrite", "wait", "blpop", "brpop", "brpoplpush", "blmove", "blmpop",
+        "bzpopmin", "bzpopmax", "bzmpop",
+    };
+    for (const char* name : names) {
+        if (strcasecmp(cmd.c_str(), name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Proxy::Proxy(const std::vector<Backend>& backends, int pool_size) {
+    _backends = backends;
+    _pool_size = pool_size > 0 ? pool_size : 1;
+    _reactor = NULL;
+}
+
+Proxy::~Proxy() {
+    for (auto conn : _conns) {
+        delete conn;
+    }
+}
+
+int Proxy::parse_backends(const std::string& str, std::vector<Backend>* backends) {
+    size_t s = 0;
+    while (s < str.size()) {
+        size_t e = str.find(',', s);
+        if (e == std::string::npos) {
+            e = str.size();
+        }
+        std::string addr = str.substr(s, e - s);
+        size_t colon = addr.rfind(':');
+        if (colon == std::string::npos || colon == 0) {
+            return -1;
+        }
+        Backend b;
+        b.host = addr.substr(0, colon);
+        b.port = atoi(addr.c_str() + colon + 1);
+        if (b.port <= 0) {
+            return -1;
+        }
+        backends->push_back(b);
+        s = e + 1;
+    }
+    return backends->empty() ? -1 : 0;
+}
+
+int Proxy::shard(const std::string& key, int backends) {
+    const char* p = key.data();
+    size_t len = key.size();
+    size_t s = key.find('{');
+    if (s != std::string::npos) {
+        size_t e = key.find('}', s + 1);
+        if (e != std::string::npos && e > s + 1) {
+            p += s + 1;
+            len = e - s - 1;
+        }
+    }
+    return jump_hash(fnv1a(p, len), backends);
+}
+
+void Proxy::start(Reactor* reactor) {
+    _reactor = reactor;
+    for (size_t i = 0; i < _backends.size() * _pool_size; i++) {
+        _conns.push_back(new Connection(reactor->fdes()));
+    }
+}
+
+Connection* Proxy::conn(int backend, int client_id) {
+    Connection* conn = _conns[backend * _pool_size + client_id % _pool_size];
+    if (conn->closed()) {
+        // (re)connected lazily, requests queued while connecting are sent
+        // once it is established
+        const Backend& b = _backends[backend];
+        if (conn->connect(b.host, b.port, Reactor::TAG_SERVICE) == -1) {
+            return NULL;
+        }
+    }
+    return conn;
+}
+
+void Proxy::event(Reactor* reactor, const Fdevent* fde) {
+    Connection* conn = (Connection*)fde->data.ptr;
+    conn->handle(fde);
+}
+
+void Proxy::closed(Reactor* reactor, int client_id) {
+    _order.drop(client_id);
+}
+
+bool Proxy::process(Reactor* reactor, const Message& req) {
+    int client_id = req.ClientId();
+    const std::vector<std::string>& args = req.Vals();
+    const Command* cmd = req.GetCommand();
+    int id = cmd ? cmd->id : -1;
+
+    PendingPtr pending = std::make_shared<Pending>();
+    _order.push(client_id, pending);
+
+    if (id == CMD_PING && args.size() == 1) {
+        finish(pending, "+PONG\r\n");
+        _order.flush(_reactor, client_id);
+        return true;
+    }
+    if (connection_bound(req.Cmd())) {
+        finish(pending, "-ERR '" + req.Cmd() + "' is not supported by the proxy\r\n");
+        _order.flush(_reactor, client_id);
+        return true;
+    }
+
+    // arity was checked by the reactor
+    int step = 0;
+    if (id == CMD_MGET) {
+        pending->type = MERGE_MGET;
+        step = 1;
+    } else if (id == CMD_MSET) {
+        pending->type = MERGE_MSET;
+        step = 2;
+    } else if (id == CMD_DEL || id == CMD_UNLINK || id == CMD_EXISTS) {
+        pending->type = MERGE_SUM;
+        step = 1;
+    } else {
+        pending->type = MERGE_NONE;
+    }
+
+    int nbackends = (int)_backends.size();
+    if (step == 0 || nbackends == 1) {
+        int backend = args.size() > 1 ? shard(args[1], nbackends) : 0;
+        if (pending->type == MERGE_MGET) {
+            pending->values.resize(args.size() - 1);
+        }
+        std::vector<int> positions;
+        for (int i = 0; i < (int)pending->values.size(); i++) {
+            positions.push_back(i);
+        }
+        pending->parts = 1;
+        forward(client_id, backend, args, pending, positions);
+        _order.flush(_reactor, client_id);
+        return true;
+    }
+
+    // split by shard, positions are the key indexes in the original request
+    std::vector<std::vector<std::string>> sub(nbackends);
+    std::vector<std::vector<int>> positions(nbackends);
+    for (size_t i = 1; i < args.size(); i += step) {
+        int backend = shard(args[i], nbackends);
+        if (sub[backend].empty()) {
+            sub[backend].push_back(args[0]);
+            pending->parts++;
+        }
+        for (int j = 0; j < step; j++) {
+            sub[backend].push_back(args[i + j]);
+        }
+        positions[backend].push_back((int)(i - 1) / step);
+    }
+    if (pending->type == MERGE_MGET) {
+        pending->values.resize(args.size() - 1);
+    }
+    for (int i = 0; i < nbackends; i++) {
+        if (!sub[i].empty()) {
+            forward(client_id, i, sub[i], pending, positions[i]);
+        }
+    }
+    // a backend that could not be reached answers right away
+    _order.flush(_reactor, client_id);
+    return true;
+}
+
+void Proxy::forward(int client_id, int backend, const std::vector<std::string>& args,
+    const PendingPtr& pending, const std::vector<int>& positions)
+{
+    Connection* c = conn(backend, client_id);
+    if (!c) {
+        merge(pending, positions, Reply::Error("connect failed"), true, backend);
+        return;
+    }
+    c->send(Message(args), [this, c, pending, positions, backend, client_id](const Reply& reply) {
+        // Connection closes itself before failing the callbacks, so an
+        // error on a closed connection did not come from the backend
+        merge(pending, positions, reply, reply.IsError() && c->closed(), backend);
+        if (pending->done) {
+            _order.flush(_reactor, client_id);
+        }
+    });
+}
+
+void Proxy::merge(const PendingPtr& pending, const std::vector<int>& positions,
+    const Reply& reply, bool conn_failed, int backend)
+{
+    if (pending->done) {
+        return;
+    }
+    pending->parts--;
+    if (reply.IsError() && pending->error.empty()) {
+        if (conn_failed) {
+            const Backend& b = _backends[backend];
+            pending->error = "ERR backend " + b.host + ":" + std::to_string(b.port) + " " + reply.Str();
+        } else {
+            pending->error = reply.Str();
+        }
+    }
+
+    if (pending->type == MERGE_NONE) {
+        finish(pending, conn_failed ? "-" + pending->error + "\r\n" : reply.Encode());
+        return;
+    }
+    if (pending->type == MERGE_MGET && reply.Type() == Reply::ARRAY) {
+        const std::vector<Reply>& vals = reply.Elements();
+        for (size_t i = 0; i < positions.size() && i < vals.size(); i++) {
+            pending->values[positions[i]] = vals[i];
+        }
+    } else if (pending->type == MERGE_SUM && reply.Type() == Reply::INT) {
+        pending->sum += reply.Int();
+    }
+    if (pending->parts > 0) {
+        return;
+    }
+
+    if (!pending->error.empty()) {
+        finish(pending, "-" + pending->error + "\r\n");
+    } else if (pending->type == MERGE_MGET) {
+        std::string data = "*" + std::to_string(pending->values.size()) + "\r\n";
+        for (auto& v : pending->values) {
+            v.Encode(&data);
+        }
+        finish(pending, data);
+    } else if (pending->type == MERGE_MSET) {
+        finish(pending, "+OK\r\n");
+    } else {
+        finish(pending, ":" + std::to_string(pending->sum) + "\r\n");
+    }
+}
+
+void Proxy::finish(const PendingPtr& pending, const std::string& data) {
+    pending->done = true;
+    pending->data = data;
+    pending->values.clear();
+}
+
+}; // namespace redis
@@ -0,0 +1,79 @@
+#ifndef REDIS_PROXY_H_
+#define REDIS_PROXY_H_
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Service.h"
+#include "Reply.h"
+#include "ReplyOrder.h"
+
+namespace redis {
+
+class Connection;
+
+// Sharding proxy, a Service that forwards every request to one of a set of
+// backends chosen by hashing Message::Key().
+//
+// Each reactor keeps pool_size pipelined connections to every backend, and
+// a client always uses the same connection of a backend, so the backend
+// sees its requests in order. MGET, MSET, DEL, UNLINK and EXISTS are split
+// by shard and the partial replies merged. Other commands go to the shard
+// of their first key, keyless commands to the first backend. Responses are
+// written back in the order the client sent the requests. Commands that
+// would tie a backend connection to one client, such as MULTI, SELECT,
+// SUBSCRIBE or BLPOP, are refused.
+//
+// Like Redis Cluster, a key containing {tag} is hashed by tag only, so keys
+// sharing a tag live on the same backend.
+class Proxy : public Service {
+public:
+    struct Backend {
+        std::string host;
+        int port;
+    };
+
+    Proxy(const std::vector<Backend>& backends, int pool_size = 2);
+    ~Proxy();
+
+    // parses "host:port,host:port,..."
+    static int parse_backends(const std::string& str, std::vector<Backend>* backends);
+    // the backend index of key
+    static int shard(const std::string& key, int backends);
+
+    virtual void start(Reactor* reactor);
+    virtual bool process(Reactor* reactor, const Message& req);
+    virtual void event(Reactor* reactor, const Fdevent* fde);
+    virtual void closed(Reactor* reactor, int client_id);
+
+private:
+    // one client request, answered once all its backend replies are in
+    struct Pending : public ReplyOrder::Slot {
+        int type;
+        int parts = 0;
+        // merge state of split commands
+        std::vector<Reply> values;
+        std::string error;
+        int64_t sum = 0;
+    };
+    typedef std::shared_ptr<Pending> PendingPtr;
+
+    Connection* conn(int backend, int client_id);
+    void forward(int client_id, int backend, const std::vector<std::string>& args,
+        const PendingPtr& pending, const std::vector<int>& positions);
+    void merge(const PendingPtr& pending, const std::vector<int>& positions,
+        const Reply& reply, bool conn_failed, int backend);
+    void finish(const PendingPtr& pending, const std::string& data);
+
+    std::vector<Backend> _backends;
+    int _pool_size;
+    Reactor* _reactor;
+    // [backend * _pool_size + i]
+    std::vector<Connection*> _conns;
+    ReplyOrder _order;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,273 @@
+// Tests of Proxy over two backends, all started in-process: the split of
+// multi-key commands by shard, the merge of their replies, and the order of
+// replies per client.
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AsyncClient.h"
+#include "Proxy.h"
+#include "TestUtil.h"
+
+static const int BACKENDS = 2;
+
+// the commands the proxy splits, and GET and SET, over a map; the handler
+// runs on the backend's one consumer thread
+static redis::TestServer::Handler kv_handler(std::map<std::string, std::string>* kv) {
+    return [kv](const redis::Message& req, redis::Response* resp) {
+        std::vector<std::string> args = req.Array();
+        const char* cmd = args[0].c_str();
+        if (strcasecmp(cmd, "get") == 0) {
+            auto it = kv->find(args[1]);
+            if (it == kv->end()) {
+                resp->ReplyNotFound();
+            } else {
+                resp->ReplyBulk(it->second);
+            }
+        } else if (strcasecmp(cmd, "set") == 0) {
+            (*kv)[args[1]] = args[2];
+            resp->ReplyOK();
+        } else if (strcasecmp(cmd, "mset") == 0) {
+            for (size_t i = 1; i + 1 < args.size(); i += 2) {
+                (*kv)[args[i]] = args[i + 1];
+            }
+            resp->ReplyOK();
+        } else if (strcasecmp(cmd, "mget") == 0) {
+            std::vector<bool> exists;
+            std::vector<std::string> vals;
+            for (size_t i = 1; i < args.size(); i++) {
+                auto it = kv->find(args[i]);
+                exists.push_back(it != kv->end());
+                vals.push_back(it != kv->end() ? it->second : "");
+            }
+            resp->ReplyArray(exists, vals);
+        } else if (strcasecmp(cmd, "del") == 0 || strcasecmp(cmd, "exists") == 0) {
+            bool del = strcasecmp(cmd, "del") == 0;
+            int64_t n = 0;
+            for (size_t i = 1; i < args.size(); i++) {
+                n += del ? kv->erase(args[i]) : kv->count(args[i]);
+            }
+            resp->ReplyInt(n);
+        } else {
+            resp->ReplyError("unknown command");
+        }
+    };
+}
+
+// a compact text form of a reply, to compare with what is expected
+static std::string show(const redis::Reply& reply) {
+    switch (reply.Type()) {
+    case redis::Reply::STATUS:
+        return "+" + reply.Str();
+    case redis::Reply::ERROR:
+        return "-" + reply.Str();
+    case redis::Reply::INT:
+        return ":" + std::to_string(reply.Int());
+    case redis::Reply::NIL:
+        return "nil";
+    case redis::Reply::BULK:
+        return reply.Str();
+    }
+    std::string ret = "[";
+    for (size_t i = 0; i < reply.Elements().size(); i++) {
+        ret += (i ? "," : "") + show(reply.Elements()[i]);
+    }
+    return ret + "]";
+}
+
+static redis::Message request(const std::vector<std::string>& args) {
+    return redis::Message(args);
+}
+
+static std::string call(redis::AsyncClient* client, const std::vector<std::string>& args) {
+    return show(client->Call(request(args)).get());
+}
+
+// the i-th key that the proxy sends to backend b
+static std::string key_on(int b, int i) {
+    for (int n = 0; ; n++) {
+        std::string key = "key" + std::to_string(n);
+        if (redis::Proxy::shard(key, BACKENDS) == b && i-- == 0) {
+            return key;
+        }
+    }
+}
+
+// MSET, MGET, EXISTS and DEL spanning both backends: each backend gets the
+// keys of its shard, and the replies are merged in the order of the keys.
+static void test_split_merge(const std::string& path, redis::TestServer** backends) {
+    redis::AsyncClient client;
+    CHECK(client.Connect(path, 0) == 0);
+    redis::AsyncClient direct[BACKENDS];
+    for (int b = 0; b < BACKENDS; b++) {
+        CHECK(direct[b].Connect(backends[b]->path(), 0) == 0);
+    }
+
+    // interleaved, so that positions in the merged replies matter
+    std::vector<std::string> keys;
+    for (int i = 0; i < 4; i++) {
+        keys.push_back(key_on(0, i));
+        keys.push_back(key_on(1, i));
+    }
+    std::string missing = key_on(1, 100);
+
+    std::vector<std::string> mset = {"mset"};
+    for (auto& key : keys) {
+        mset.push_back(key);
+        mset.push_back("v-" + key);
+    }
+    CHECK_EQ(call(&client, mset), "+OK");
+
+    // each key was set on its own backend only
+    for (auto& key : keys) {
+        int b = redis::Proxy::shard(key, BACKENDS);
+        CHECK_EQ(call(&direct[b], {"get", key}), "v-" + key);
+        CHECK_EQ(call(&direct[1 - b], {"get", key}), "nil");
+    }
+
+    std::vector<std::string> mget = {"mget", keys[3], missing};
+    std::string want = "[v-" + keys[3] + ",nil";
+    for (auto& key : keys) {
+        mget.push_back(key);
+        want += ",v-" + key;
+    }
+    CHECK_EQ(call(&client, mget), want + "]");
+
+    // a key given twice counts twice
+    std::vector<std::string> exists = {"exists", missing, keys[0], keys[0]};
+    exists.insert(exists.end(), keys.begin(), keys.end());
+    CHECK_EQ(call(&client, exists), ":" + std::to_string(keys.size() + 2));
+
+    CHECK_EQ(call(&client, {"del", keys[0], keys[1], keys[2], missing}), ":3");
+    CHECK_EQ(call(&client, {"exists", keys[0], keys[1], keys[2], keys[3]}), ":1");
+    CHECK_EQ(call(&client, {"mget", keys[1], keys[3]}), "[nil,v-" + keys[3] + "]");
+    for (int i = 0; i < 3; i++) {
+        int b = redis::Proxy::shard(keys[i], BACKENDS);
+        CHECK_EQ(call(&direct[b], {"exists", keys[i]}), ":0");
+    }
+
+    // a single key command goes to the shard of its key
+    CHECK_EQ(call(&client, {"set", missing, "x"}), "+OK");
+    CHECK_EQ(call(&direct[1], {"get", missing}), "x");
+    CHECK_EQ(call(&direct[0], {"get", missing}), "nil");
+
+    // connection state would leak to the other clients of a pooled backend
+    // connection
+    CHECK(call(&client, {"multi"})[0] == '-');
+
+    client.Close();
+    for (int b = 0; b < BACKENDS; b++) {
+        direct[b].Close();
+    }
+    printf("split and merge ok\n");
+}
+
+// Clients pipeline commands that go to one or both backends, whose replies
+// come back at different times; each client gets its replies in the order
+// of its requests.
+static void test_reply_order(const std::string& path) {
+    const int CLIENTS = 4;
+    const int ROUNDS = 300;
+    std::vector<std::thread> threads;
+    std::atomic<int> failed(0);
+    for (int c = 0; c < CLIENTS; c++) {
+        threads.push_back(std::thread([&, c]() {
+            redis::AsyncClient client;
+            CHECK(client.Connect(path, 0) == 0);
+            std::string prefix = "c" + std::to_string(c) + ":";
+            std::map<std::string, std::string> model;
+            std::vector<std::string> want;
+            std::vector<std::string> got;
+            std::atomic<int> done(0);
+            auto send = [&](const std::vector<std::string>& args, const std::string& expect) {
+                want.push_back(expect);
+                client.Call(request(args), [&](const redis::Reply& reply) {
+                    got.push_back(show(reply));
+                    done++;
+                });
+            };
+            for (int i = 0; i < ROUNDS; i++) {
+                std::string a = prefix + std::to_string(i % 7);
+                std::string b = prefix + std::to_string(i % 11);
+                std::string v = std::to_string(i);
+                switch (i % 4) {
+                case 0:
+                    send({"set", a, v}, "+OK");
+                    model[a] = v;
+                    break;
+                case 1:
+                    send({"mset", a, v, b, v}, "+OK");
+                    model[a] = v;
+                    model[b] = v;
+                    break;
+                case 2: {
+                    std::string expect = "[";
+                    expect += model.count(a) ? model[a] : "nil";
+                    expect += ",";
+                    expect += model.count(b) ? model[b] : "nil";
+                    send({"mget", a, b}, expect + "]");
+                    break;
+                }
+                case 3: {
+                    int n = (int)model.count(a) + (int)(a != b && model.count(b));
+                    send({"del", a, b}, ":" + std::to_string(n));
+                    model.erase(a);
+                    model.erase(b);
+                    break;
+                }
+                }
+                send({"get", a}, model.count(a) ? model[a] : "nil");
+            }
+            for (int i = 0; i < 10000 && done < (int)want.size(); i++) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            client.Close();
+            if (got != want) {
+                for (size_t i = 0; i < want.size(); i++) {
+                    if (i >= got.size() || got[i] != want[i]) {
+                        fprintf(stderr, "client %d, reply %d: %s, want %s\n", c, (int)i,
+                            i < got.size() ? got[i].c_str() : "none", want[i].c_str());
+                        break;
+                    }
+                }
+                failed++;
+            }
+        }));
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    CHECK(failed == 0);
+    printf("reply order ok\n");
+}
+
+int main(int argc, char** argv) {
+    redis::TestServer* backends[BACKENDS];
+    std::map<std::string, std::string> kvs[BACKENDS];
+    std::vector<redis::Proxy::Backend> addrs;
+    for (int b = 0; b < BACKENDS; b++) {
+        backends[b] = new redis::TestServer("proxy_test.backend" + std::to_string(b));
+        backends[b]->Start(kv_handler(&kvs[b]));
+        addrs.push_back(redis::Proxy::Backend{backends[b]->path(), 0});
+    }
+
+    redis::TestServer proxy("proxy_test");
+    proxy.xport()->SetService([addrs](int index) {
+        return new redis::Proxy(addrs, 2);
+    });
+    proxy.Start();
+
+    test_split_merge(proxy.path(), backends);
+    test_reply_order(proxy.path());
+
+    for (int b = 0; b < BACKENDS; b++) {
+        delete backends[b];
+    }
+    printf("all passed\n");
+    return 0;
+}
@@ -0,0 +1,350 @@
+#include "PubSub.h"
+#include "Command.h"
+#include "Reactor.h"
+
+namespace redis {
+
+static void append_bulk(std::string* out, const std::string& s) {
+    out->push_back('$');
+    out->append(std::to_string(s.size()));
+    out->append("\r\n");
+    out->append(s);
+    out->append("\r\n");
+}
+
+static void append_header(std::string* out, char type, int64_t n) {
+    out->push_back(type);
+    out->append(std::to_string(n));
+    out->append("\r\n");
+}
+
+// "message" frame, or "pmessage" if pattern is not NULL; type is '*', or
+// '>' for RESP3
+static SharedBuffer encode_message(char type, const std::string* pattern, const std::string& channel, const std::string& message) {
+    std::string* out = new std::string();
+    out->reserve(64 + channel.size() + message.size() + (pattern ? pattern->size() : 0));
+    if (pattern) {
+        append_header(out, type, 4);
+        append_bulk(out, "pmessage");
+        append_bulk(out, *pattern);
+    } else {
+        append_header(out, type, 3);
+        append_bulk(out, "message");
+    }
+    append_bulk(out, channel);
+    append_bulk(out, message);
+    return SharedBuffer(out);
+}
+
+PubSub::PubSub(int reactors, bool resp3) {
+    _reactors = reactors;
+    _resp3 = resp3;
+    for (int i = 0; i < reactors; i++) {
+        Local* local = new Local();
+        for (int j = 0; j < reactors; j++) {
+            local->outbox.push_back(new Batch());
+        }
+        _locals.push_back(local);
+    }
+    _pattern_count = 0;
+}
+
+PubSub::~PubSub() {
+    for (auto local : _locals) {
+        while (local->inbox.size() > 0) {
+            Batch* batch;
+            local->inbox.pop(&batch);
+            delete batch;
+        }
+        for (auto batch : local->outbox) {
+            delete batch;
+        }
+        delete local;
+    }
+}
+
+PubSub::Frame PubSub::encode(const std::string* pattern, const std::string& channel, const std::string& message) {
+    Frame frame;
+    frame.resp2 = encode_message('*', pattern, channel, message);
+    if (_resp3) {
+        frame.resp3 = encode_message('>', pattern, channel, message);
+    }
+    return frame;
+}
+
+bool PubSub::process(Reactor* reactor, Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    int id = cmd ? cmd->id : -1;
+    const std::vector<std::string>& args = req.Vals();
+    Local* local = _locals[reactor->index()];
+    // RESP3 clients are not restricted
+    bool subscribed = client->proto < 3 && !local->clients.empty()
+        && local->clients.find(client) != local->clients.end();
+
+    switch (id) {
+    case CMD_SUBSCRIBE:
+    case CMD_PSUBSCRIBE:
+        subscribe(reactor, client, args, id == CMD_PSUBSCRIBE);
+        return true;
+    case CMD_UNSUBSCRIBE:
+    case CMD_PUNSUBSCRIBE:
+        unsubscribe(reactor, client, args, id == CMD_PUNSUBSCRIBE);
+        return true;
+    case CMD_PUBLISH:
+        if (subscribed) {
+            break;
+        }
+        reactor->answer(client, ":" + std::to_string(publish(reactor, args[1], args[2])) + "\r\n");
+        return true;
+    default:
+        if (!subscribed) {
+            return false;
+        }
+        if (id == CMD_PING) {
+            std::string out;
+            append_header(&out, '*', 2);
+            append_bulk(&out, "pong");
+            append_bulk(&out, args.size() > 1 ? args[1] : "");
+            reactor->answer(client, out);
+            return true;
+        }
+        break;
+    }
+    reactor->answer(client, "-ERR Can't execute '" + req.Cmd()
+        + "': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context\r\n");
+    return true;
+}
+
+void PubSub::subscribe(Reactor* reactor, Client* client, const std::vector<std::string>& args, bool pattern) {
+    int index = reactor->index();
+    Local* local = _locals[index];
+    Subscriptions& subs = local->clients[client];
+    std::unordered_set<std::string>& names = pattern ? subs.patterns : subs.channels;
+    std::string out;
+    for (size_t i = 1; i < args.size(); i++) {
+        const std::string& name = args[i];
+        if (names.insert(name).second) {
+            (pattern ? local->patterns : local->channels)[name].insert(client);
+            count(index, name, pattern, 1);
+        }
+        append_header(&out, client->proto >= 3 ? '>' : '*', 3);
+        append_bulk(&out, pattern ? "psubscribe" : "subscribe");
+        append_bulk(&out, name);
+        append_header(&out, ':', subs.count());
+    }
+    reactor->answer(client, out);
+}
+
+void PubSub::unsubscribe(Reactor* reactor, Client* client, const std::vector<std::string>& args, bool pattern) {
+    int index = reactor->index();
+    Local* local = _locals[index];
+    auto it = local->clients.find(client);
+    // without arguments: all of them
+    std::vector<std::string> names(args.begin() + 1, args.end());
+    if (names.empty() && it != local->clients.end()) {
+        auto& all = pattern ? it->second.patterns : it->second.channels;
+        names.assign(all.begin(), all.end());
+    }
+    const char* kind = pattern ? "punsubscribe" : "unsubscribe";
+    char type = client->proto >= 3 ? '>' : '*';
+    std::string out;
+    for (auto& name : names) {
+        int left = 0;
+        if (it != local->clients.end()) {
+            auto& mine = pattern ? it->second.patterns : it->second.channels;
+            if (mine.erase(name)) {
+                auto& subscribers = pattern ? local->patterns : local->channels;
+                auto s = subscribers.find(name);
+                s->second.erase(client);
+                if (s->second.empty()) {
+                    subscribers.erase(s);
+                }
+                count(index, name, pattern, -1);
+            }
+            left = it->second.count();
+        }
+        append_header(&out, type, 3);
+        append_bulk(&out, kind);
+        append_bulk(&out, name);
+        append_header(&out, ':', left);
+    }
+    if (names.empty()) {
+        append_header(&out, type, 3);
+        append_bulk(&out, kind);
+        out.append("$-1\r\n");
+        append_header(&out, ':', it != local->clients.end() ? it->second.count() : 0);
+    }
+    if (it != local->clients.end() && it->second.count() == 0) {
+        local->clients.erase(it);
+    }
+    reactor->answer(client, out);
+}
+
+void PubSub::closed(Reactor* reactor, Client* client) {
+    int index = reactor->index();
+    Local* local = _locals[index];
+    auto it = local->clients.find(client);
+    if (it == local->clients.end()) {
+        return;
+    }
+    for (int pattern = 0; pattern < 2; pattern++) {
+        auto& subscribers = pattern ? local->patterns : local->channels;
+        for (auto& name : pattern ? it->second.patterns : it->second.channels) {
+            auto s = subscribers.find(name);
+            s->second.erase(client);
+            if (s->second.empty()) {
+                subscribers.erase(s);
+            }
+            count(index, name, pattern, -1);
+        }
+    }
+    local->clients.erase(it);
+}
+
+void PubSub::count(int index, const std::string& name, bool pattern, int delta) {
+    std::unique_lock<std::shared_mutex> lk(_mutex);
+    if (!pattern) {
+        Counts& counts = _channels[name];
+        counts.resize(_reactors);
+        counts[index] += delta;
+        for (int n : counts) {
+            if (n > 0) {
+                return;
+            }
+        }
+        _channels.erase(name);
+        return;
+    }
+    auto* entries = delta > 0 ? _patterns.insert(name) : _patterns.find(name);
+    if (!entries) {
+        return;
+    }
+    Counts& counts = (*entries)[name];
+    if (counts.empty()) {
+        counts.resize(_reactors);
+        _pattern_count++;
+    }
+    counts[index] += delta;
+    for (int n : counts) {
+        if (n > 0) {
+            return;
+        }
+    }
+    entries->erase(name);
+    _pattern_count--;
+    if (entries->empty()) {
+        _patterns.remove(name);
+    }
+}
+
+int PubSub::publish(Reactor* reactor, const std::string& channel, const std::string& message) {
+    std::shared_ptr<Publication> pub;
+    std::vector<char> targets(_reactors, 0);
+    int receivers = 0;
+    auto add = [&](const Counts& counts) {
+        for (int i = 0; i < _reactors; i++) {
+            targets[i] |= counts[i] > 0;
+            receivers += counts[i];
+        }
+    };
+    {
+        std::shared_lock<std::shared_mutex> lk(_mutex);
+        auto it = _channels.find(channel);
+        if (it != _channels.end()) {
+            pub = std::make_shared<Publication>();
+            pub->message = encode(NULL, channel, message);
+            add(it->second);
+        }
+        if (_pattern_count > 0) {
+            _patterns.match(channel, [&](std::unordered_map<std::string, Counts>& entries) {
+                if (!pub) {
+                    pub = std::make_shared<Publication>();
+                }
+                for (auto& e : entries) {
+                    pub->patterns.push_back(std::make_pair(e.first, encode(&e.first, channel, message)));
+                    add(e.second);
+                }
+            });
+        }
+    }
+    if (!pub) {
+        return 0;
+    }
+    pub->channel = channel;
+
+    int index = reactor->index();
+    Local* local = _locals[index];
+    PublicationPtr ptr = pub;
+    for (int i = 0; i < _reactors; i++) {
+        if (!targets[i]) {
+            continue;
+        }
+        if (i == index) {
+            deliver(reactor, *ptr);
+        } else {
+            local->outbox[i]->push_back(ptr);
+            local->pending = true;
+        }
+    }
+    return receivers;
+}
+
+void PubSub::deliver(Reactor* reactor, const Publication& pub) {
+    Local* local = _locals[reactor->index()];
+    if (pub.message.resp2) {
+        auto it = local->channels.find(pub.channel);
+        if (it != local->channels.end()) {
+            for (auto client : it->second) {
+                reactor->push(client, pub.message.get(client->proto));
+            }
+            reactor->_stats->pubsub_messages.add(it->second.size());
+        }
+    }
+    for (auto& p : pub.patterns) {
+        auto it = local->patterns.find(p.first);
+        if (it != local->patterns.end()) {
+            for (auto client : it->second) {
+                reactor->push(client, p.second.get(client->proto));
+            }
+            reactor->_stats->pubsub_messages.add(it->second.size());
+        }
+    }
+}
+
+void PubSub::received(Reactor* reactor) {
+    SelectableQueue<Batch*>* inbox = &_locals[reactor->index()]->inbox;
+    while (inbox->size() > 0) {
+        Batch* batch;
+        inbox->pop(&batch);
+        for (auto& pub : *batch) {
+            deliver(reactor, *pub);
+        }
+        delete batch;
+    }
+}
+
+void PubSub::flush(Reactor* reactor) {
+    Local* local = _locals[reactor->index()];
+    if (!local->pending) {
+        return;
+    }
+    local->pending = false;
+    for (int i = 0; i < _reactors; i++) {
+        if (!local->outbox[i]->empty()) {
+            _locals[i]->inbox.push(local->outbox[i]);
+            local->outbox[i] = new Batch();
+        }
+    }
+}
+
+int PubSub::channels() {
+    std::shared_lock<std::shared_mutex> lk(_mutex);
+    return (int)_channels.size();
+}
+
+int PubSub::patterns() {
+    std::shared_lock<std::shared_mutex> lk(_mutex);
+    return _pattern_count;
+}
+
+}; // namespace redis
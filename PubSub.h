@@ -0,0 +1,126 @@
+#ifndef REDIS_PUBSUB_H_
+#define REDIS_PUBSUB_H_
+
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "Message.h"
+#include "PatternTrie.h"
+#include "SelectableQueue.h"
+#include "Transport.h"
+#include "link.h"
+
+namespace redis {
+
+class Reactor;
+
+// SUBSCRIBE, PSUBSCRIBE and PUBLISH across the reactors of a Transport, see
+// Transport::EnablePubSub().
+//
+// Every reactor keeps the subscriptions of its own clients. A directory
+// shared by all reactors counts the subscribers of every channel and
+// pattern per reactor; it is locked for writing only when subscriptions
+// change. PUBLISH looks the channel up and matches the patterns in the
+// directory once, encodes the message once per channel and matching
+// pattern into a SharedBuffer, and hands one Publication to every reactor
+// with receivers, batched per event loop iteration. The reactor puts the
+// buffers on the output chains of its subscribers, so the message is never
+// copied per subscriber.
+//
+// With RESP3 enabled (see HELLO) messages and subscription replies go to
+// RESP3 clients as pushes, and those clients may run any command while
+// subscribed.
+class PubSub {
+public:
+    // a message encoded for RESP2 clients, and as a push for RESP3 ones
+    struct Frame {
+        SharedBuffer resp2;
+        // NULL unless RESP3 is enabled
+        SharedBuffer resp3;
+
+        const SharedBuffer& get(int proto) const {
+            return proto >= 3 && resp3 ? resp3 : resp2;
+        }
+    };
+    struct Publication {
+        std::string channel;
+        // the "message" frame, NULL if nobody subscribed to the channel
+        Frame message;
+        // pattern, "pmessage" frame
+        std::vector<std::pair<std::string, Frame>> patterns;
+    };
+    typedef std::shared_ptr<const Publication> PublicationPtr;
+    typedef std::vector<PublicationPtr> Batch;
+
+    PubSub(int reactors, bool resp3 = false);
+    ~PubSub();
+
+    /* called by the reactor thread only */
+
+    SelectableQueue<Batch*>* inbox(int index) {
+        return &_locals[index]->inbox;
+    }
+    // Handles the pub/sub commands, and the restrictions on a subscribed
+    // client. Returns false if req is none of its business.
+    bool process(Reactor* reactor, Transport::Client* client, const Message& req);
+    // Returns the number of subscribers the message was handed to.
+    int publish(Reactor* reactor, const std::string& channel, const std::string& message);
+    // delivers the batches in inbox()
+    void received(Reactor* reactor);
+    // hands the publications of this iteration to the other reactors
+    void flush(Reactor* reactor);
+    void closed(Reactor* reactor, Transport::Client* client);
+
+    // number of channels and patterns with subscribers, any thread
+    int channels();
+    int patterns();
+
+private:
+    typedef Transport::Client Client;
+    // subscribers on each reactor
+    typedef std::vector<int> Counts;
+
+    struct Subscriptions {
+        std::unordered_set<std::string> channels;
+        std::unordered_set<std::string> patterns;
+        int count() const {
+            return (int)(channels.size() + patterns.size());
+        }
+    };
+
+    struct Local {
+        std::unordered_map<std::string, std::unordered_set<Client*>> channels;
+        std::unordered_map<std::string, std::unordered_set<Client*>> patterns;
+        std::unordered_map<Client*, Subscriptions> clients;
+        SelectableQueue<Batch*> inbox;
+        // publications for each reactor, pushed by flush()
+        std::vector<Batch*> outbox;
+        bool pending = false;
+    };
+
+    void subscribe(Reactor* reactor, Client* client, const std::vector<std::string>& names, bool pattern);
+    void unsubscribe(Reactor* reactor, Client* client, const std::vector<std::string>& names, bool pattern);
+    // updates the directory, delta is +1 or -1
+    void count(int index, const std::string& name, bool pattern, int delta);
+    void deliver(Reactor* reactor, const Publication& pub);
+
+    Frame encode(const std::string* pattern, const std::string& channel, const std::string& message);
+
+    int _reactors;
+    bool _resp3;
+    std::vector<Local*> _locals;
+
+    std::shared_mutex _mutex;
+    std::unordered_map<std::string, Counts> _channels;
+    // patterns spelled differently may share an entry, hence the map
+    PatternTrie<std::unordered_map<std::string, Counts>> _patterns;
+    int _pattern_count;
+};
+
+}; // namespace redis
+
+#endif
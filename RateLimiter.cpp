@@ -0,0 +1,124 @@
+#include "RateLimiter.h"
+#include <stdio.h>
+#include <algorithm>
+#include "Clock.h"
+#include "Command.h"
+
+namespace redis {
+
+void RateBucket::init(double rate, uint64_t ticks_per_sec) {
+    _interval = rate > 0 ? ticks_per_sec / rate : 0;
+    _burst = ticks_per_sec;
+}
+
+void RateBucket::take(uint64_t now, uint64_t n) {
+    if (_interval <= 0) {
+        return;
+    }
+    uint64_t cost = (uint64_t)(_interval * n);
+    uint64_t tat = _tat.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        next = std::max(tat, now) + cost;
+    } while (!_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+}
+
+RateLimiter::RateLimiter(const RateLimit& client, const RateLimit& address,
+    const std::unordered_map<std::string, RateLimit>& commands, const std::vector<std::string>& reject)
+{
+    _ticks_per_sec = Clock::from_us(1000000);
+    _client = client;
+    _address = address;
+    _commands.resize(command_table::COUNT, NULL);
+    _reject.resize(command_table::COUNT, false);
+    for (auto& it : commands) {
+        const Command* cmd = Command::find(it.first);
+        if (!cmd) {
+            fprintf(stderr, "rate limit: unknown command %s\n", it.first.c_str());
+            continue;
+        }
+        if (it.second.enabled() && !_commands[cmd->id]) {
+            _commands[cmd->id] = new RateState();
+            init(_commands[cmd->id], it.second);
+        }
+    }
+    for (auto& name : reject) {
+        const Command* cmd = Command::find(name);
+        if (!cmd) {
+            fprintf(stderr, "rate limit: unknown command %s\n", name.c_str());
+            continue;
+        }
+        _reject[cmd->id] = true;
+    }
+}
+
+RateLimiter::~RateLimiter() {
+    for (auto state : _commands) {
+        delete state;
+    }
+    for (auto& it : _addresses) {
+        delete it.second;
+    }
+}
+
+void RateLimiter::init(RateState* state, const RateLimit& limit) {
+    state->commands.init(limit.commands, _ticks_per_sec);
+    state->bytes.init(limit.bytes, _ticks_per_sec);
+}
+
+ClientRate* RateLimiter::connected(const std::string& address) {
+    ClientRate* ret = new ClientRate();
+    init(&ret->own, _client);
+    if (_address.enabled()) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        Address*& a = _addresses[address];
+        if (!a) {
+            a = new Address();
+            init(&a->state, _address);
+        }
+        a->clients++;
+        ret->address = &a->state;
+        ret->address_key = address;
+    }
+    return ret;
+}
+
+void RateLimiter::closed(ClientRate* client) {
+    if (client->address) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        auto it = _addresses.find(client->address_key);
+        if (it != _addresses.end() && --it->second->clients == 0) {
+            delete it->second;
+            _addresses.erase(it);
+        }
+    }
+    delete client;
+}
+
+int RateLimiter::admit(ClientRate* client, const Message& req, uint64_t bytes, uint64_t now, uint64_t* wait) {
+    const Command* cmd = req.GetCommand();
+    RateState* states[3] = {&client->own, client->address, cmd ? _commands[cmd->id] : NULL};
+    uint64_t w = 0;
+    for (auto s : states) {
+        if (s) {
+            w = std::max(w, std::max(s->commands.wait(now), s->bytes.wait(now)));
+        }
+    }
+    if (w > 0 && cmd && _reject[cmd->id]) {
+        return REJECT;
+    }
+    // a request that waits has its turn booked
+    for (auto s : states) {
+        if (s) {
+            s->commands.take(now, 1);
+            s->bytes.take(now, bytes);
+        }
+    }
+    if (w > 0) {
+        *wait = w;
+        return WAIT;
+    }
+    return PASS;
+}
+
+}; // namespace redis
@@ -0,0 +1,120 @@
+#ifndef REDIS_RATE_LIMITER_H_
+#define REDIS_RATE_LIMITER_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+
+namespace redis {
+
+// Sustained rates, 0 for no limit. Bursts of a second's worth pass.
+struct RateLimit {
+    double commands = 0;
+    double bytes = 0;
+
+    bool enabled() const {
+        return commands > 0 || bytes > 0;
+    }
+};
+
+// A token bucket kept as the time its debt is paid off (GCRA), a single
+// word, so buckets shared by reactors are updated with a CAS. Times are
+// Clock ticks.
+class RateBucket {
+public:
+    RateBucket() : _tat(0) {
+    }
+
+    void init(double rate, uint64_t ticks_per_sec);
+    bool enabled() const {
+        return _interval > 0;
+    }
+    // ticks until the bucket lets anything through, 0 if now
+    uint64_t wait(uint64_t now) const {
+        uint64_t tat = _tat.load(std::memory_order_relaxed);
+        return tat > now + _burst ? tat - now - _burst : 0;
+    }
+    // takes n units; the debt may go past the burst by one request, so a
+    // request larger than the burst still passes once the bucket is full
+    void take(uint64_t now, uint64_t n);
+
+private:
+    std::atomic<uint64_t> _tat;
+    // ticks per unit, 0 if unlimited
+    double _interval = 0;
+    uint64_t _burst = 0;
+};
+
+// The buckets of a client, of all the clients from an address, or of a
+// command.
+struct RateState {
+    RateBucket commands;
+    RateBucket bytes;
+};
+
+// A request held back until its client's turn, with its raw bytes.
+struct HeldRequest {
+    Message req;
+    std::string raw;
+};
+
+// What a client is charged to.
+struct ClientRate {
+    RateState own;
+    // shared with the other clients from the address, NULL if unlimited
+    RateState* address = NULL;
+    std::string address_key;
+};
+
+// Rate limits per client, per client address and per command, see
+// Transport::SetRateLimits(). The reactor asks admit() for every decoded
+// request before handling it. A request over a limit is rejected with an
+// error if its command is one of the reject commands; otherwise its turn is
+// booked, and the reactor holds it and reads no more of the client's input
+// until then.
+//
+// Buckets of a client belong to its reactor. Those of an address are
+// shared by the reactors and found once, when the client connects; those
+// of a command are looked up by CommandId. Checking a request costs a few
+// loads and, for the limits that apply, a CAS each.
+class RateLimiter {
+public:
+    enum { PASS, REJECT, WAIT };
+
+    RateLimiter(const RateLimit& client, const RateLimit& address,
+        const std::unordered_map<std::string, RateLimit>& commands, const std::vector<std::string>& reject);
+    ~RateLimiter();
+
+    // the buckets of a new client; any thread
+    ClientRate* connected(const std::string& address);
+    void closed(ClientRate* client);
+    // PASS or REJECT, or WAIT with *wait set to the ticks until req may
+    // pass; bytes is the size of req
+    int admit(ClientRate* client, const Message& req, uint64_t bytes, uint64_t now, uint64_t* wait);
+
+private:
+    struct Address {
+        RateState state;
+        int clients = 0;
+    };
+
+    void init(RateState* state, const RateLimit& limit);
+
+    uint64_t _ticks_per_sec;
+    RateLimit _client;
+    RateLimit _address;
+    // by CommandId, NULL if unlimited
+    std::vector<RateState*> _commands;
+    std::vector<bool> _reject;
+
+    std::mutex _mutex;
+    std::unordered_map<std::string, Address*> _addresses;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,682 @@
+#include "Reactor.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <algorithm>
+#include "link.h"
+#include "Channel.h"
+#include "fde.h"
+#include "Clock.h"
+#include "Capture.h"
+#include "Service.h"
+#include "PubSub.h"
+#include "ClientTracking.h"
+#include "Coalescer.h"
+#include "ResponseCache.h"
+#include "AdmissionControl.h"
+#include "BlockedClients.h"
+#include "BulkStream.h"
+
+namespace redis {
+
+Reactor::Reactor(Transport* xport, int index) {
+    _xport = xport;
+    _index = index;
+    _fdes = new Fdevents();
+    _accept_queue = &xport->accept_queues[index];
+    _send_queue = &xport->send_queues[index];
+    _stats = &xport->_stats[index];
+    _pool = &xport->_pools[index];
+    _capture = xport->_capture;
+    _service = xport->_service_factory ? xport->_service_factory(index) : NULL;
+    _pubsub = xport->_pubsub;
+    _tracking = xport->_tracking;
+    _coalescer = xport->_coalescer;
+    _limiter = xport->_limiter;
+    _admission = xport->_admission;
+    _blocked = xport->_blocked;
+    _cache = xport->_caches ? &xport->_caches[index] : NULL;
+    _sampler = xport->_samplers ? &xport->_samplers[index] : NULL;
+}
+
+Reactor::~Reactor() {
+    // may still answer clients while tearing down
+    delete _service;
+    for (auto it : _clients) {
+        Client* client = it.second;
+        delete client->tracking;
+        delete client->stream;
+        delete client->limited;
+        if (client->rate) {
+            _limiter->closed(client->rate);
+        }
+        _xport->_client_slabs[_index].free(client);
+    }
+    delete _fdes;
+}
+
+void Reactor::run() {
+    _fdes->set(_accept_queue->fd(), FDEVENT_IN, 0, _accept_queue);
+    _fdes->set(_send_queue->fd(), FDEVENT_IN, 0, _send_queue);
+    SelectableQueue<PubSub::Batch*>* pubsub_inbox = _pubsub ? _pubsub->inbox(_index) : NULL;
+    if (pubsub_inbox) {
+        _fdes->set(pubsub_inbox->fd(), FDEVENT_IN, 0, pubsub_inbox);
+    }
+    SelectableQueue<ClientTracking::Batch*>* tracking_inbox = _tracking ? _tracking->inbox(_index) : NULL;
+    if (tracking_inbox) {
+        _fdes->set(tracking_inbox->fd(), FDEVENT_IN, 0, tracking_inbox);
+    }
+    SelectableQueue<Coalescer::Batch*>* coalesce_inbox = _coalescer ? _coalescer->inbox(_index) : NULL;
+    if (coalesce_inbox) {
+        _fdes->set(coalesce_inbox->fd(), FDEVENT_IN, 0, coalesce_inbox);
+    }
+    SelectableQueue<BlockedClientPtr>* blocked_inbox = _blocked ? _blocked->inbox(_index) : NULL;
+    if (blocked_inbox) {
+        _fdes->set(blocked_inbox->fd(), FDEVENT_IN, 0, blocked_inbox);
+    }
+    if (_service) {
+        _service->start(this);
+    }
+
+    const Fdevents::events_t* events;
+    SpinPolicy spin(_xport->_busy_poll_us);
+
+    while (!_xport->_close_flag) {
+        if (_service) {
+            _service->tick(this);
+        }
+        int timeout = 100;
+        if (!_throttled.empty()) {
+            uint64_t now = Clock::now();
+            resume_throttled(now);
+            for (auto client : _throttled) {
+                uint64_t ms = Clock::to_us(client->resume_at - now) / 1000 + 1;
+                timeout = std::min(timeout, (int)ms);
+            }
+        }
+        if (_blocked) {
+            timeout = expire_blocked(Clock::now(), timeout);
+        }
+        if (_sampler) {
+            _sampler->tick(Clock::now());
+        }
+        if (spin.enabled()) {
+            events = _fdes->wait(0);
+            if (events && events->empty()) {
+                if (spin.idle()) {
+                    continue;
+                }
+                events = _fdes->wait(timeout);
+            } else {
+                spin.busy();
+            }
+        } else {
+            events = _fdes->wait(timeout);
+        }
+        if (events == NULL) {
+            exit(-1);
+        }
+        if (events->empty()) {
+            continue;
+        }
+        uint64_t stime = Clock::now();
+
+        for (int i = 0; i < (int)events->size(); i++) {
+            const Fdevent* fde = events->at(i);
+            if (fde->data.ptr == _accept_queue) {
+                accept_client();
+            } else if (fde->data.ptr == _send_queue) {
+                send_responses();
+            } else if (fde->data.ptr == pubsub_inbox) {
+                _pubsub->received(this);
+            } else if (fde->data.ptr == tracking_inbox) {
+                _tracking->received(this);
+            } else if (fde->data.ptr == coalesce_inbox) {
+                _coalescer->received(this);
+            } else if (fde->data.ptr == blocked_inbox) {
+                _blocked->received(this);
+            } else if (fde->data.num == TAG_SERVICE) {
+                _service->event(this, fde);
+            } else {
+                Client* client = (Client*)fde->data.ptr;
+                if (client->closing) {
+                    continue;
+                }
+                if (fde->events & FDEVENT_HUP) {
+                    // blocked, nobody to answer any more
+                    close_client_later(client);
+                } else if (fde->events & FDEVENT_IN) {
+                    read_client(client);
+                } else if (fde->events & FDEVENT_OUT) {
+                    write_client(client);
+                }
+            }
+        }
+
+        if (_pubsub) {
+            _pubsub->flush(this);
+        }
+        if (_tracking) {
+            _tracking->flush(this);
+        }
+        if (_coalescer) {
+            _coalescer->flush(this);
+        }
+        if (!_close_list.empty()) {
+            for (auto client : _close_list) {
+                close_client(client);
+            }
+            _close_list.clear();
+        }
+        _stats->loop_us.add(Clock::to_us(Clock::now() - stime));
+    }
+}
+
+void Reactor::accept_client() {
+    Client* client = NULL;
+    _accept_queue->pop(&client);
+    printf("process %s:%d\n", client->link->remote_ip, client->link->remote_port);
+    client->link->set_pool(_pool);
+
+    _fdes->set(client->link->fd(), FDEVENT_IN, TAG_CLIENT, client);
+    _clients[client->id] = client;
+    if (_limiter) {
+        client->rate = _limiter->connected(client->link->remote_ip);
+    }
+    _stats->accepts.add();
+}
+
+void Reactor::send_responses() {
+    while (_send_queue->size() > 0) {
+        Response msg;
+        _send_queue->pop(&msg);
+        if (reply(msg) == -1) {
+            printf("client %d not found\n", msg.ClientId());
+        }
+    }
+}
+
+int Reactor::reply(const Response& resp) {
+    auto it = _clients.find(resp.ClientId());
+    if (it == _clients.end()) {
+        if (_coalescer) {
+            _coalescer->orphan_replied(this, resp);
+        }
+        return -1;
+    }
+    Client* client = it->second;
+
+    _out.clear();
+    resp.EncodeTo(&_out, client->proto);
+    client->link->send(_out);
+    _stats->responses.add();
+    if (client->flight && client->flight_at == client->answered + 1) {
+        _coalescer->replied(this, client, resp, _out);
+    }
+    replied(client, _out);
+    if (resp.GetTrace().enabled()) {
+        client->traces.push_back(resp.GetTrace());
+        client->traces.back().ts[Trace::REPLY] = Clock::now();
+    }
+    answered(client);
+    _fdes->set(client->link->fd(), FDEVENT_OUT, TAG_CLIENT, client);
+    if (client->blocking && client->answered >= client->blocking) {
+        unblock(client);
+    }
+    return 0;
+}
+
+int Reactor::reply(int client_id, const std::string& data) {
+    auto it = _clients.find(client_id);
+    if (it == _clients.end()) {
+        return -1;
+    }
+    Client* client = it->second;
+
+    client->link->send(data);
+    _stats->responses.add();
+    replied(client, data);
+    answered(client);
+    _fdes->set(client->link->fd(), FDEVENT_OUT, TAG_CLIENT, client);
+    return 0;
+}
+
+void Reactor::replied(Client* client, const std::string& data) {
+    if (client->sampled > client->answered) {
+        _sampler->replied(client->id, client->answered + 1, data.size());
+    }
+    if (client->cache_at == client->answered + 1) {
+        _cache->fill(client->id, data, Clock::now());
+        client->cache_at = 0;
+    }
+}
+
+void Reactor::answered(Client* client) {
+    client->answered++;
+    while (!client->held.empty() && client->held.front().first <= client->answered) {
+        client->link->send(client->held.front().second);
+        _stats->responses.add();
+        client->held.pop_front();
+    }
+    while (!client->cache_writes.empty() && client->cache_writes.front().first <= client->answered) {
+        _xport->_cache_epochs->bump(client->cache_writes.front().second);
+        client->cache_writes.pop_front();
+    }
+    if (client->tracking && !client->tracking->writes.empty()) {
+        _tracking->answered(this, client);
+    }
+}
+
+void Reactor::answer(Client* client, const std::string& data) {
+    if (client->answered == client->passed) {
+        client->link->send(data);
+        _stats->responses.add();
+        _fdes->set(client->link->fd(), FDEVENT_OUT, TAG_CLIENT, client);
+    } else {
+        client->held.push_back(std::make_pair(client->passed, data));
+    }
+}
+
+void Reactor::push(Client* client, const SharedBuffer& data) {
+    if (client->closing) {
+        return;
+    }
+    if (client->answered == client->passed) {
+        client->link->send(data);
+        _fdes->set(client->link->fd(), FDEVENT_OUT, TAG_CLIENT, client);
+    } else {
+        client->held.push_back(std::make_pair(client->passed, *data));
+    }
+}
+
+void Reactor::read_client(Client* client) {
+    int ret = client->link->read();
+    _stats->read_calls.add();
+    if (ret == 0) {
+        _stats->read_eagain.add();
+        return;
+    }
+    if (ret < 0) {
+        close_client_later(client);
+        return;
+    }
+    _stats->bytes_in.add(ret);
+    process_input(client, _xport->_tracing ? Clock::now() : 0);
+}
+
+void Reactor::process_input(Client* client, uint64_t read_ts) {
+    while (!client->closing && !client->parked && !client->resume_at && !client->blocking) {
+        Message& req = _req;
+        if (client->limited) {
+            // held back by the rate limiter, its turn now
+            req = std::move(client->limited->req);
+            _raw.swap(client->limited->raw);
+            delete client->limited;
+            client->limited = NULL;
+        } else {
+            req.Recycle(client->id);
+            int ret;
+            if (_xport->_bulk_threshold > 0) {
+                ret = recv_streamed(client, &req);
+            } else {
+                ret = client->link->recv(&req, _capture || _cache ? &_raw : NULL);
+            }
+            if (ret == -1) {
+                close_client_later(client);
+                break;
+            } else if (ret == 0) {
+                // not ready
+                break;
+            }
+            _stats->commands.add();
+            if (_capture) {
+                _capture->record(_index, client->id, _raw);
+            }
+            if (read_ts) {
+                Trace* trace = req.MutableTrace();
+                trace->ts[Trace::READ] = read_ts;
+                trace->ts[Trace::DECODED] = Clock::now();
+                trace->set_cmd(req.Cmd(), req.Key());
+            }
+            if (!req.Error().empty()) {
+                // known command with bad arguments, the consumer never sees it
+                _stats->rejected.add();
+                answer(client, "-" + req.Error() + "\r\n");
+                continue;
+            }
+            if (client->rate && !admit(client, &req, ret)) {
+                continue;
+            }
+        }
+        if (_admission && client_deadline(client, req)) {
+            continue;
+        }
+        if (_pubsub && _pubsub->process(this, client, req)) {
+            continue;
+        }
+        if (_tracking && _tracking->process(this, client, req)) {
+            continue;
+        }
+        if (_cache && cached(client, req)) {
+            continue;
+        }
+        if (_admission && !_service && shed(client)) {
+            continue;
+        }
+        if (_sampler) {
+            sample(client, req);
+        }
+        client->passed++;
+        if (_service && _service->process(this, req)) {
+            continue;
+        }
+        if (_coalescer && _coalescer->process(this, client, req)) {
+            // the rest of the input waits for its response
+            _fdes->clr(client->link->fd(), FDEVENT_IN);
+            break;
+        }
+        if (_admission) {
+            uint64_t now = Clock::now();
+            req.SetQueued(now, _admission->deadline(now, client->deadline_ms));
+        }
+        const Command* cmd = req.GetCommand();
+        bool blocks = _blocked && cmd && (cmd->flags & CMD_FLAG_BLOCKING);
+        // the consumer owns it from now on, _req starts over empty
+        _xport->_recv_channel->push(std::move(req));
+        if (blocks) {
+            // the rest of the input waits for its response, unread; a close
+            // is still seen, to let the BlockedClients entry go
+            client->blocking = client->passed;
+            _fdes->clr(client->link->fd(), FDEVENT_IN);
+            _fdes->set(client->link->fd(), FDEVENT_HUP, TAG_CLIENT, client);
+            break;
+        }
+    }
+}
+
+bool Reactor::admit(Client* client, Message* req, uint64_t bytes) {
+    uint64_t now = Clock::now();
+    uint64_t wait = 0;
+    int ret = _limiter->admit(client->rate, *req, bytes, now, &wait);
+    if (ret == RateLimiter::PASS) {
+        return true;
+    }
+    if (ret == RateLimiter::REJECT) {
+        _stats->rate_rejected.add();
+        answer(client, "-ERR rate limit exceeded\r\n");
+        return false;
+    }
+    _stats->rate_limited.add();
+    client->limited = new HeldRequest();
+    client->limited->req = std::move(*req);
+    if (_cache) {
+        client->limited->raw = _raw;
+    }
+    client->resume_at = now + wait;
+    _fdes->clr(client->link->fd(), FDEVENT_IN);
+    _throttled.push_back(client);
+    return false;
+}
+
+void Reactor::resume_throttled(uint64_t now) {
+    std::vector<Client*> due;
+    for (size_t i = 0; i < _throttled.size();) {
+        Client* client = _throttled[i];
+        if (client->resume_at <= now) {
+            due.push_back(client);
+            _throttled[i] = _throttled.back();
+            _throttled.pop_back();
+        } else {
+            i++;
+        }
+    }
+    for (auto client : due) {
+        client->resume_at = 0;
+        _fdes->set(client->link->fd(), FDEVENT_IN, TAG_CLIENT, client);
+        process_input(client, 0);
+    }
+}
+
+bool Reactor::client_deadline(Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    const std::vector<std::string>& args = req.Vals();
+    if (!cmd || cmd->id != CMD_CLIENT || strcasecmp(args[1].c_str(), "deadline") != 0) {
+        return false;
+    }
+    char* end = NULL;
+    long ms = args.size() == 3 ? strtol(args[2].c_str(), &end, 10) : -1;
+    if (ms < 0 || ms > UINT32_MAX || *end != '\0') {
+        answer(client, "-ERR usage: CLIENT DEADLINE <milliseconds>, 0 for the default\r\n");
+        return true;
+    }
+    client->deadline_ms = (uint32_t)ms;
+    answer(client, "+OK\r\n");
+    return true;
+}
+
+bool Reactor::shed(Client* client) {
+    if (_admission->admit(_xport->_recv_channel->size_hint())) {
+        return false;
+    }
+    if (client->cache_at == client->passed + 1) {
+        // the miss just noted gets no response
+        _cache->closed(client->id);
+        client->cache_at = 0;
+    }
+    _stats->admission_shed.add();
+    answer(client, "-BUSY server is overloaded, try again later\r\n");
+    return true;
+}
+
+bool Reactor::cached(Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    if (!cmd) {
+        return false;
+    }
+    const std::vector<std::string>& args = req.Vals();
+    if (cmd->flags & CMD_FLAG_WRITE) {
+        int last = cmd->last_key < 0 ? (int)args.size() + cmd->last_key : cmd->last_key;
+        for (int i = cmd->first_key; i > 0 && i <= last && i < (int)args.size(); i += cmd->key_step) {
+            // now, and again once the write is answered: a read that runs
+            // before the write is applied must not be cached either
+            uint32_t slot = CacheEpochs::slot(args[i]);
+            _xport->_cache_epochs->bump(slot);
+            client->cache_writes.push_back(std::make_pair(client->passed + 1, slot));
+        }
+        return false;
+    }
+    if (!_xport->_cache_commands[cmd->id]) {
+        return false;
+    }
+    const std::string* data = _cache->get(_raw, client->proto, Clock::now());
+    if (data) {
+        answer(client, *data);
+        return true;
+    }
+    if (client->cache_at == 0) {
+        _cache->miss(client->id, _raw, client->proto, args[cmd->first_key]);
+        client->cache_at = client->passed + 1;
+    }
+    return false;
+}
+
+void Reactor::sample(Client* client, const Message& req) {
+    const Command* cmd = req.GetCommand();
+    const std::vector<std::string>& args = req.Vals();
+    if (!cmd || cmd->first_key == 0 || cmd->first_key >= (int)args.size()) {
+        return;
+    }
+    size_t bytes = 0;
+    for (auto& arg : args) {
+        bytes += arg.size();
+    }
+    // the reply is the one to this request
+    client->sampled = client->passed + 1;
+    _sampler->request(client->id, client->sampled, args[cmd->first_key], bytes);
+}
+
+int Reactor::recv_streamed(Client* client, Message* req) {
+    Link* link = client->link;
+    if (!client->stream) {
+        int ret = link->recv(req, _capture || _cache ? &_raw : NULL);
+        if (ret != 0) {
+            return ret;
+        }
+        client->stream = BulkStream::start(link->input(), link->input_size(), _xport->_bulk_threshold,
+            &_xport->_bulk_factory, client->id);
+        if (!client->stream) {
+            return 0;
+        }
+    }
+    BulkStream* stream = client->stream;
+    uint64_t streamed = stream->streamed();
+    int ret = stream->feed(link->input(), link->input_size());
+    if (ret == -1) {
+        return -1;
+    }
+    link->consume_input(ret);
+    _stats->bulk_streamed.add(stream->streamed() - streamed);
+    if (!stream->done()) {
+        return 0;
+    }
+    stream->take(req);
+    // the size of the request, near enough
+    ret += (int)std::min<uint64_t>(stream->streamed(), INT_MAX - ret);
+    delete stream;
+    client->stream = NULL;
+    if (_capture || _cache) {
+        // the payloads are in the sinks, record what the consumer sees
+        _raw = req->Encode();
+    }
+    return ret;
+}
+
+void Reactor::write_client(Client* client) {
+    int ret = client->link->write();
+    _stats->write_calls.add();
+    if (ret == -1) {
+        close_client_later(client);
+        return;
+    }
+    _stats->bytes_out.add(ret);
+    if (client->link->output_size() == 0) {
+        _fdes->clr(client->link->fd(), FDEVENT_OUT);
+        if (!client->traces.empty()) {
+            trace_flushed(client);
+        }
+    } else if (ret == 0) {
+        _stats->write_eagain.add();
+    }
+}
+
+void Reactor::unpark(Client* client, const SharedBuffer& data) {
+    client->parked = 0;
+    client->link->send(data);
+    _stats->responses.add();
+    replied(client, *data);
+    answered(client);
+    _fdes->set(client->link->fd(), FDEVENT_OUT, TAG_CLIENT, client);
+    _fdes->set(client->link->fd(), FDEVENT_IN, TAG_CLIENT, client);
+    process_input(client, 0);
+}
+
+void Reactor::unblock(Client* client) {
+    client->blocking = 0;
+    _fdes->clr(client->link->fd(), FDEVENT_HUP);
+    _fdes->set(client->link->fd(), FDEVENT_IN, TAG_CLIENT, client);
+    process_input(client, 0);
+}
+
+int Reactor::expire_blocked(uint64_t now, int max_ms) {
+    std::vector<int> ids;
+    uint64_t next = _blocked->expire(this, now, &ids);
+    for (auto id : ids) {
+        auto it = _clients.find(id);
+        if (it == _clients.end()) {
+            continue;
+        }
+        _stats->blocking_timeouts.add();
+        // behind the responses the consumer sent before blocking the client
+        Response resp(id);
+        resp.ReplyRaw(it->second->proto >= 3 ? "_\r\n" : "*-1\r\n");
+        _xport->Send(std::move(resp));
+    }
+    if (next == 0) {
+        return max_ms;
+    }
+    return std::min(max_ms, (int)(Clock::to_us(next - now) / 1000 + 1));
+}
+
+void Reactor::close_client_later(Client* client) {
+    if (!client->closing) {
+        client->closing = true;
+        _close_list.push_back(client);
+    }
+}
+
+void Reactor::close_client(Client* client) {
+    {
+        std::lock_guard<std::mutex> lk(_xport->_mutex);
+        _xport->_ids.erase(client->id);
+    }
+    _clients.erase(client->id);
+    if (_service) {
+        _service->closed(this, client->id);
+    }
+    if (_pubsub) {
+        _pubsub->closed(this, client);
+    }
+    if (_tracking) {
+        _tracking->closed(this, client);
+    }
+    if (_sampler) {
+        _sampler->closed(client->id);
+    }
+    if (_coalescer) {
+        _coalescer->closed(this, client);
+    }
+    if (_cache) {
+        _cache->closed(client->id);
+        // the writes may still be applied, better early than never
+        for (auto& w : client->cache_writes) {
+            _xport->_cache_epochs->bump(w.second);
+        }
+    }
+    if (client->blocking && _blocked) {
+        _blocked->closed(client->id);
+    }
+    if (client->resume_at) {
+        _throttled.erase(std::find(_throttled.begin(), _throttled.end(), client));
+    }
+    if (client->rate) {
+        _limiter->closed(client->rate);
+    }
+    delete client->limited;
+
+    printf("close %s:%d\n", client->link->remote_ip, client->link->remote_port);
+    _stats->closes.add();
+    _fdes->del(client->link->fd());
+    delete client->stream;
+    _xport->_client_slabs[_index].free(client);
+}
+
+void Reactor::trace_flushed(Client* client) {
+    uint64_t now = Clock::now();
+    for (auto& trace : client->traces) {
+        trace.ts[Trace::FLUSHED] = now;
+        for (int i = 0; i < Trace::STAGES; i++) {
+            uint64_t s = trace.ts[i];
+            uint64_t e = trace.ts[i + 1];
+            _stats->stage_us[i].add(e > s ? Clock::to_us(e - s) : 0);
+        }
+        uint64_t total = now - trace.ts[Trace::READ];
+        _stats->total_us.add(Clock::to_us(total));
+        if (total >= _xport->_slowlog_ticks) {
+            _xport->_slowlog->add(trace, client->link->remote_ip, client->link->remote_port);
+        }
+    }
+    client->traces.clear();
+}
+
+}; // namespace redis
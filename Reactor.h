@@ -0,0 +1,136 @@
+#ifndef REDIS_REACTOR_H_
+#define REDIS_REACTOR_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Transport.h"
+#include "link.h"
+
+class Fdevents;
+struct Fdevent;
+
+namespace redis {
+
+class Service;
+class PubSub;
+class ClientTracking;
+class KeySampler;
+class Coalescer;
+class ResponseCache;
+class RateLimiter;
+class AdmissionControl;
+class BlockedClients;
+
+// One event loop thread of a Transport. It owns the clients assigned to it
+// by the accept thread, reads and decodes their requests, and writes the
+// responses queued for them.
+class Reactor {
+public:
+    // Fdevent data.num, tells who owns a fd
+    enum { TAG_CLIENT = 0, TAG_SERVICE = 1 };
+
+    Reactor(Transport* xport, int index);
+    ~Reactor();
+
+    void run();
+
+    int index() const {
+        return _index;
+    }
+    Transport* transport() {
+        return _xport;
+    }
+    Fdevents* fdes() {
+        return _fdes;
+    }
+
+    // Queue a response to a client of this reactor. Returns -1 if the
+    // client is gone.
+    int reply(const Response& resp);
+    // same, for an already encoded response
+    int reply(int client_id, const std::string& data);
+
+private:
+    friend class PubSub;
+    friend class ClientTracking;
+    friend class Coalescer;
+    friend class BlockedClients;
+    typedef Transport::Client Client;
+
+    void accept_client();
+    void send_responses();
+    void read_client(Client* client);
+    // handles the requests in the client's input buffer
+    void process_input(Client* client, uint64_t read_ts);
+    // like Link::recv(), streaming large arguments to BulkSinks
+    int recv_streamed(Client* client, Message* req);
+    void write_client(Client* client);
+    // answer a request in the reactor, after those before it
+    void answer(Client* client, const std::string& data);
+    void answered(Client* client);
+    // the response to the next request of the client was written as data,
+    // for those waiting for it
+    void replied(Client* client, const std::string& data);
+    // answers req from the ResponseCache if it can, and keeps the cache
+    // up to date with req
+    bool cached(Client* client, const Message& req);
+    // false if the rate limiter rejected req, or held it back
+    bool admit(Client* client, Message* req, uint64_t bytes);
+    // reads on for the throttled clients whose turn came
+    void resume_throttled(uint64_t now);
+    // answers CLIENT DEADLINE
+    bool client_deadline(Client* client, const Message& req);
+    // answers a request with -BUSY if the AdmissionControl would not have
+    // it queued
+    bool shed(Client* client);
+    // a keyed request for the KeySampler, if its turn
+    void sample(Client* client, const Message& req);
+    // queue a push (pub/sub message, invalidation), after the responses
+    // before it
+    void push(Client* client, const SharedBuffer& data);
+    // answers the parked request of a client, and reads on
+    void unpark(Client* client, const SharedBuffer& data);
+    // reads on after a blocking request was answered
+    void unblock(Client* client);
+    // answers the blocked clients whose time is up, returns the ms until
+    // the next one is, at most max_ms
+    int expire_blocked(uint64_t now, int max_ms);
+    void close_client_later(Client* client);
+    void close_client(Client* client);
+    void trace_flushed(Client* client);
+
+    Transport* _xport;
+    int _index;
+    Fdevents* _fdes;
+    SelectableQueue<Client*>* _accept_queue;
+    SelectableQueue<Response>* _send_queue;
+    ReactorStats* _stats;
+    BufferPool* _pool;
+    Capture* _capture;
+    Service* _service;
+    PubSub* _pubsub;
+    ClientTracking* _tracking;
+    KeySampler* _sampler;
+    Coalescer* _coalescer;
+    ResponseCache* _cache;
+    RateLimiter* _limiter;
+    AdmissionControl* _admission;
+    BlockedClients* _blocked;
+
+    std::unordered_map<int, Client*> _clients;
+    std::vector<Client*> _close_list;
+    // clients held back by the rate limiter
+    std::vector<Client*> _throttled;
+    // scratch buffer for captured request bytes
+    std::string _raw;
+    // decoded requests go here, recycled for the next one unless passed to
+    // Recv(), so the ones handled inside the reactor do not allocate
+    Message _req;
+    // responses are encoded here before being copied to the link
+    std::string _out;
+};
+
+}; // namespace redis
+
+#endif
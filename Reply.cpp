@@ -0,0 +1,257 @@
+#include "Reply.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace redis {
+
+// every reply takes at least this many bytes, e.g. "_\r\n"
+static const int MIN_REPLY_SIZE = 3;
+
+// the size of a bulk or the count of an aggregate, -1 for nil, INT_MIN if
+// it is out of range
+static int parse_len(const char* p) {
+    long long n = strtoll(p, NULL, 10);
+    if (n > INT_MAX || n < -1) {
+        return n < 0 ? -1 : INT_MIN;
+    }
+    return (int)n;
+}
+
+// replies per entry of an aggregate of type t
+static int entry_size(char t) {
+    return t == '%' || t == '|' ? 2 : 1;
+}
+
+// the size of the aggregate whose header of head bytes is at data, 0 if
+// incomplete, -1 on protocol error
+static int skip_entries(const char* data, int len, int head) {
+    int count = parse_len(data + 1);
+    if (count == INT_MIN) {
+        return -1;
+    }
+    if (count < 0) {
+        return head;
+    }
+    if (count > (len - head) / (MIN_REPLY_SIZE * entry_size(data[0]))) {
+        return 0;
+    }
+    count *= entry_size(data[0]);
+    int off = head;
+    for (int i = 0; i < count; i++) {
+        int n = Reply::Skip(data + off, len - off);
+        if (n <= 0) {
+            return n;
+        }
+        off += n;
+    }
+    return off;
+}
+
+std::string Reply::Encode() const {
+    std::string buf;
+    Encode(&buf);
+    return buf;
+}
+
+void Reply::Encode(std::string* buf) const {
+    switch (_type) {
+    case STATUS:
+        buf->push_back('+');
+        buf->append(_str);
+        break;
+    case ERROR:
+        buf->push_back('-');
+        buf->append(_str);
+        break;
+    case INT:
+        buf->push_back(':');
+        buf->append(std::to_string(_int));
+        break;
+    case BULK:
+        buf->push_back('$');
+        buf->append(std::to_string(_str.size()));
+        buf->append("\r\n");
+        buf->append(_str);
+        break;
+    case ARRAY:
+    case MAP:
+    case PUSH:
+        buf->push_back(_type == ARRAY ? '*' : _type == MAP ? '%' : '>');
+        buf->append(std::to_string(_type == MAP ? _elements.size() / 2 : _elements.size()));
+        buf->append("\r\n");
+        for (auto& e : _elements) {
+            e.Encode(buf);
+        }
+        return;
+    default:
+        buf->append("$-1");
+        break;
+    }
+    buf->append("\r\n");
+}
+
+int Reply::Decode(const std::string& buf) {
+    return Decode(buf.data(), buf.size());
+}
+
+int Reply::Decode(const char* data, int len) {
+    _type = NIL;
+    _int = 0;
+    _str.clear();
+    _elements.clear();
+
+    if (len < 3) {
+        return 0;
+    }
+    const char* p = (const char*)memchr(data, '\n', len);
+    if (!p) {
+        return 0;
+    }
+    int head = (int)(p - data) + 1;
+    int line = head - 2; // without type and \n
+    if (line > 0 && data[head - 2] == '\r') {
+        line -= 1;
+    }
+    switch (data[0]) {
+    case '+':
+        _type = STATUS;
+        _str.assign(data + 1, line);
+        return head;
+    case '-':
+        _type = ERROR;
+        _str.assign(data + 1, line);
+        return head;
+    case ':':
+        _type = INT;
+        _int = strtoll(data + 1, NULL, 10);
+        return head;
+    case '_':
+        return head;
+    case '#':
+        _type = INT;
+        _int = data[1] == 't';
+        return head;
+    case ',':
+    case '(':
+        _type = BULK;
+        _str.assign(data + 1, line);
+        return head;
+    case '$':
+    case '=':
+    case '!': {
+        int size = parse_len(data + 1);
+        if (size == INT_MIN) {
+            return -1;
+        }
+        if (size < 0) {
+            return head;
+        }
+        if (size > len - head - 2) {
+            return 0;
+        }
+        _type = data[0] == '!' ? ERROR : BULK;
+        // a verbatim string starts with its format, e.g. "txt:"
+        int skip = data[0] == '=' && size >= 4 ? 4 : 0;
+        _str.assign(data + head + skip, size - skip);
+        return head + size + 2;
+    }
+    case '*':
+    case '~':
+    case '%':
+    case '>': {
+        int count = parse_len(data + 1);
+        if (count == INT_MIN) {
+            return -1;
+        }
+        if (count < 0) {
+            return head;
+        }
+        // the count is not trusted: no element is looked at before there
+        // is enough input for all of them
+        if (count > (len - head) / (MIN_REPLY_SIZE * entry_size(data[0]))) {
+            return 0;
+        }
+        count *= entry_size(data[0]);
+        _type = data[0] == '%' ? MAP : data[0] == '>' ? PUSH : ARRAY;
+        // grown as elements decode
+        int off = head;
+        for (int i = 0; i < count; i++) {
+            _elements.emplace_back();
+            int n = _elements.back().Decode(data + off, len - off);
+            if (n <= 0) {
+                _elements.clear();
+                _type = NIL;
+                return n;
+            }
+            off += n;
+        }
+        return off;
+    }
+    case '|': {
+        // attributes come before the reply they are about, and are dropped
+        int off = skip_entries(data, len, head);
+        if (off <= 0) {
+            return off;
+        }
+        int n = Decode(data + off, len - off);
+        return n <= 0 ? n : off + n;
+    }
+    default:
+        return -1;
+    }
+}
+
+int Reply::Skip(const char* data, int len) {
+    if (len < 3) {
+        return 0;
+    }
+    const char* p = (const char*)memchr(data, '\n', len);
+    if (!p) {
+        return 0;
+    }
+    int head = (int)(p - data) + 1;
+    switch (data[0]) {
+    case '+':
+    case '-':
+    case ':':
+    case '_':
+    case '#':
+    case ',':
+    case '(':
+        return head;
+    case '$':
+    case '=':
+    case '!': {
+        int size = parse_len(data + 1);
+        if (size == INT_MIN) {
+            return -1;
+        }
+        if (size < 0) {
+            return head;
+        }
+        if (size > len - head - 2) {
+            return 0;
+        }
+        return head + size + 2;
+    }
+    case '*':
+    case '~':
+    case '%':
+    case '>':
+        return skip_entries(data, len, head);
+    case '|': {
+        // and the reply the attributes are about
+        int off = skip_entries(data, len, head);
+        if (off <= 0) {
+            return off;
+        }
+        int n = Skip(data + off, len - off);
+        return n <= 0 ? n : off + n;
+    }
+    default:
+        return -1;
+    }
+}
+
+}; // namespace redis
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+#ifndef REDIS_REPLY_H_
+#define REDIS_REPLY_H_
+
+namespace redis {
+
+// Server replies, as seen from the client side. RESP3 types are mapped to
+// the nearest RESP2 one (null to NIL, boolean to INT, double, big number
+// and verbatim string to BULK, set to ARRAY), except for maps and pushes.
+// Attributes are dropped.
+class Reply {
+public:
+    enum { STATUS = 0, ERROR, INT, NIL, BULK, ARRAY, MAP, PUSH };
+
+    Reply() {
+    }
+    static Reply Error(const std::string& msg) {
+        Reply ret;
+        ret._type = ERROR;
+        ret._str = msg;
+        return ret;
+    }
+
+    int Type() const {
+        return _type;
+    }
+    bool IsError() const {
+        return _type == ERROR;
+    }
+    bool IsNil() const {
+        return _type == NIL;
+    }
+    // STATUS, ERROR and BULK
+    const std::string& Str() const {
+        return _str;
+    }
+    int64_t Int() const {
+        return _int;
+    }
+    bool IsPush() const {
+        return _type == PUSH;
+    }
+    // ARRAY, PUSH, and MAP as key, value, key, value...
+    const std::vector<Reply>& Elements() const {
+        return _elements;
+    }
+
+    // RESP encoding of this reply, NIL is encoded as a nil bulk
+    std::string Encode() const;
+    void Encode(std::string* buf) const;
+    // 返回解析了多少字节, 0: not ready, -1: error
+    int Decode(const std::string& buf);
+    int Decode(const char* data, int len);
+
+    // Size of the first complete reply in data, 0 if incomplete, -1 on
+    // protocol error.
+    static int Skip(const char* data, int len);
+
+private:
+    int _type = NIL;
+    int64_t _int = 0;
+    std::string _str;
+    std::vector<Reply> _elements;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef REDIS_REPLY_ORDER_H_
+#define REDIS_REPLY_ORDER_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include "Reactor.h"
+
+namespace redis {
+
+// Keeps the responses of each client in request order, for a Service that
+// answers some requests asynchronously. Every request gets a slot, and a
+// slot is written only once all slots before it are done.
+class ReplyOrder {
+public:
+    struct Slot {
+        bool done = false;
+        std::string data; // encoded response
+    };
+    typedef std::shared_ptr<Slot> SlotPtr;
+
+    // no response of client is waiting
+    bool empty(int client_id) const {
+        return _clients.find(client_id) == _clients.end();
+    }
+    void push(int client_id, const SlotPtr& slot) {
+        _clients[client_id].push_back(slot);
+    }
+    // writes the done slots at the front of the client's queue
+    void flush(Reactor* reactor, int client_id) {
+        auto it = _clients.find(client_id);
+        if (it == _clients.end()) {
+            return;
+        }
+        std::deque<SlotPtr>& queue = it->second;
+        while (!queue.empty() && queue.front()->done) {
+            reactor->reply(client_id, queue.front()->data);
+            queue.pop_front();
+        }
+        if (queue.empty()) {
+            _clients.erase(it);
+        }
+    }
+    // the client is gone, slots still in flight complete into nowhere
+    void drop(int client_id) {
+        _clients.erase(client_id);
+    }
+
+private:
+    std::unordered_map<int, std::deque<SlotPtr>> _clients;
+};
+
+}; // namespace redis
+
+#endif
@@ -3,36 +3,53 @@
 namespace redis {
 
 std::string Response::Encode() const {
+    return Encode(2);
+}
+
+std::string Response::Encode(int proto) const {
     std::string buf;
+    EncodeTo(&buf, proto);
+    return buf;
+}
+
+void Response::EncodeTo(std::string* out, int proto) const {
+    std::string& buf = *out;
     if (_type == STATUS) {
-        if (_vals.empty()) {
+        if (!_error) {
             buf.append("+OK\r\n");
         } else {
             buf.append("-ERR ");
-            buf.append(_vals[0]);
+            buf.append(_val);
             buf.append("\r\n");
         }
     } else if (_type == INT) {
         buf.append(":");
-        buf.append(_vals[0]);
+        buf.append(_val);
         buf.append("\r\n");
     } else if (_type == NOT_FOUND) {
-        buf.append("$-1\r\n");
+        buf.append(proto >= 3 ? "_\r\n" : "$-1\r\n");
     } else if (_type == BULK) {
-        const std::string& bulk = _vals[0];
+        const std::string& bulk = _val;
         buf.push_back('$');
         buf.append(std::to_string(bulk.size()));
         buf.append("\r\n");
         buf.append(bulk);
         buf.append("\r\n");
-    } else if (_type == ARRAY) {
-        buf.push_back('*');
-        buf.append(std::to_string(_vals.size()));
+    } else if (_type == RAW) {
+        buf.append(_val);
+    } else if (_type == ARRAY || _type == MAP) {
+        if (_type == MAP && proto >= 3) {
+            buf.push_back('%');
+            buf.append(std::to_string(_vals.size() / 2));
+        } else {
+            buf.push_back('*');
+            buf.append(std::to_string(_vals.size()));
+        }
         buf.append("\r\n");
         for (int i = 0; i < (int)_vals.size(); i++) {
             auto& p = _vals[i];
             if (i < (int)_exists.size() && _exists[i] == false) {
-                buf.append("$-1\r\n");
+                buf.append(proto >= 3 ? "_\r\n" : "$-1\r\n");
             } else {
                 buf.push_back('$');
                 buf.append(std::to_string(p.size()));
@@ -42,7 +59,6 @@ std::string Response::Encode() const {
             }
         }
     }
-    return buf;
 }
 
 }; // namespace redis
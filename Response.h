@@ -1,5 +1,6 @@
 #include <vector>
 #include <string>
+#include "Message.h"
 
 #ifndef REDIS_RESPONSE_H_
 #define REDIS_RESPONSE_H_
@@ -8,35 +9,44 @@ namespace redis {
 
 class Response {
 public:
-    enum { STATUS = 0, INT, NOT_FOUND, BULK, ARRAY };
+    enum { STATUS = 0, INT, NOT_FOUND, BULK, ARRAY, MAP, RAW };
 
     Response() {
     }
     Response(int clientId) {
         _clientId = clientId;
     }
+    // reply to req, carries over its client and trace
+    Response(const Message& req) {
+        _clientId = req.ClientId();
+        _trace = req.GetTrace();
+    }
 
     int ClientId() const {
         return _clientId;
     }
+    void SetClientId(int clientId) {
+        _clientId = clientId;
+    }
 
     void ReplyOK() {
         _type = STATUS;
     }
-    void ReplyError(const std::string msg) {
+    void ReplyError(std::string msg) {
         _type = STATUS;
-        _vals.push_back(msg);
+        _error = true;
+        _val = std::move(msg);
     }
     void ReplyInt(int64_t num) {
         _type = INT;
-        _vals.push_back(std::to_string(num));
+        _val = std::to_string(num);
     }
     void ReplyNotFound() {
         _type = NOT_FOUND;
     }
-    void ReplyBulk(const std::string data) {
+    void ReplyBulk(std::string data) {
         _type = BULK;
-        _vals.push_back(data);
+        _val = std::move(data);
     }
     void ReplyArray(const std::vector<std::string>& vals) {
         _type = ARRAY;
@@ -47,14 +57,42 @@ public:
         _exists = exists;
         _vals = vals;
     }
+    // field, value, field, value... a flat array for RESP2 clients
+    void ReplyMap(const std::vector<std::string>& vals) {
+        _type = MAP;
+        _vals = vals;
+    }
+
+    // already encoded RESP, e.g. a backend's reply passed through as is
+    void ReplyRaw(std::string data) {
+        _type = RAW;
+        _val = std::move(data);
+    }
+
+    const Trace& GetTrace() const {
+        return _trace;
+    }
+    Trace* MutableTrace() {
+        return &_trace;
+    }
 
+    // RESP2
     std::string Encode() const;
+    // for a client speaking protocol version proto (see HELLO)
+    std::string Encode(int proto) const;
+    // appends to *buf, which the caller may reuse for every response
+    void EncodeTo(std::string* buf, int proto) const;
 
 private:
-    int _clientId;
+    int _clientId = -1;
     int _type = STATUS;
+    bool _error = false;
+    // STATUS error message, INT, BULK or RAW; kept out of _vals so the common
+    // replies need no vector
+    std::string _val;
     std::vector<bool> _exists;
     std::vector<std::string> _vals;
+    Trace _trace;
 };
 
 }; // namespace redis
@@ -0,0 +1,88 @@
+#include "ResponseCache.h"
+#include <iterator>
+
+namespace redis {
+
+// per entry, besides the request and the response
+static const size_t ENTRY_OVERHEAD = 128;
+
+ResponseCache::ResponseCache() {
+    _epochs = NULL;
+    _max_bytes = 0;
+    _ttl = 0;
+}
+
+void ResponseCache::init(CacheEpochs* epochs, size_t max_bytes, uint64_t ttl) {
+    _epochs = epochs;
+    _max_bytes = max_bytes;
+    _ttl = ttl;
+}
+
+void ResponseCache::erase(Lru::iterator it) {
+    map(it->proto).erase(std::string_view(it->raw));
+    bytes.add(-(int64_t)(it->raw.size() + it->data.size() + ENTRY_OVERHEAD));
+    entries.add(-1);
+    _lru.erase(it);
+}
+
+const std::string* ResponseCache::get(const std::string& raw, int proto, uint64_t now) {
+    auto& m = map(proto);
+    auto it = m.find(std::string_view(raw));
+    if (it == m.end()) {
+        misses.add();
+        return NULL;
+    }
+    Lru::iterator e = it->second;
+    if (e->expire <= now || _epochs->get(e->slot) != e->epoch) {
+        erase(e);
+        evictions.add();
+        misses.add();
+        return NULL;
+    }
+    _lru.splice(_lru.begin(), _lru, e);
+    hits.add();
+    return &e->data;
+}
+
+void ResponseCache::miss(int client_id, const std::string& raw, int proto, const std::string& key) {
+    Pending& p = _pending[client_id];
+    p.raw = raw;
+    p.proto = proto;
+    p.slot = CacheEpochs::slot(key);
+    p.epoch = _epochs->get(p.slot);
+}
+
+void ResponseCache::fill(int client_id, const std::string& data, uint64_t now) {
+    auto pit = _pending.find(client_id);
+    if (pit == _pending.end()) {
+        return;
+    }
+    Pending& p = pit->second;
+    size_t size = p.raw.size() + data.size() + ENTRY_OVERHEAD;
+    // errors may not be there next time; a write may have come in between
+    if (data.empty() || data[0] == '-' || size > _max_bytes || _epochs->get(p.slot) != p.epoch) {
+        _pending.erase(pit);
+        return;
+    }
+    auto& m = map(p.proto);
+    auto it = m.find(std::string_view(p.raw));
+    if (it != m.end()) {
+        erase(it->second);
+    }
+    _lru.push_front(Entry{std::move(p.raw), p.proto, data, p.slot, p.epoch, now + _ttl});
+    m[std::string_view(_lru.front().raw)] = _lru.begin();
+    bytes.add(size);
+    entries.add(1);
+    _pending.erase(pit);
+
+    while ((size_t)bytes.get() > _max_bytes) {
+        erase(std::prev(_lru.end()));
+        evictions.add();
+    }
+}
+
+void ResponseCache::closed(int client_id) {
+    _pending.erase(client_id);
+}
+
+}; // namespace redis
@@ -0,0 +1,112 @@
+#ifndef REDIS_RESPONSE_CACHE_H_
+#define REDIS_RESPONSE_CACHE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "Stats.h"
+
+namespace redis {
+
+// Invalidation counters shared by the ResponseCaches of a Transport, by key
+// hash. A cached response remembers the counter of its key as of when its
+// request was read, and is dead once the counter moved. Keys sharing a
+// counter invalidate each other, which only costs a miss.
+class CacheEpochs {
+public:
+    static const int SIZE = 16384;
+
+    CacheEpochs() {
+        for (int i = 0; i < SIZE; i++) {
+            _epochs[i] = 0;
+        }
+    }
+
+    static uint32_t slot(const std::string& key) {
+        return (uint32_t)(std::hash<std::string>()(key) % SIZE);
+    }
+    uint64_t get(uint32_t slot) const {
+        return _epochs[slot].load(std::memory_order_acquire);
+    }
+    // any thread
+    void bump(const std::string& key) {
+        bump(slot(key));
+    }
+    void bump(uint32_t slot) {
+        _epochs[slot].fetch_add(1, std::memory_order_acq_rel);
+    }
+
+private:
+    std::atomic<uint64_t> _epochs[SIZE];
+};
+
+// Encoded responses of one reactor, keyed by the raw bytes of their
+// request and the protocol version of the client, see
+// Transport::EnableResponseCache(). At most max_bytes are kept, least
+// recently used first out, each for at most ttl ticks (Clock).
+//
+// A request that misses is noted, and the response the client gets for it
+// is put in the cache, unless it is an error or the key was invalidated
+// meanwhile. One miss per client is noted at a time.
+class ResponseCache {
+public:
+    ResponseCache();
+
+    void init(CacheEpochs* epochs, size_t max_bytes, uint64_t ttl);
+
+    // the cached response to the request, NULL if none
+    const std::string* get(const std::string& raw, int proto, uint64_t now);
+    // req, whose key is key, missed; the next fill() of the client is its
+    // response
+    void miss(int client_id, const std::string& raw, int proto, const std::string& key);
+    void fill(int client_id, const std::string& data, uint64_t now);
+    void closed(int client_id);
+
+    // written by the reactor, read by any thread
+    Counter hits;
+    Counter misses;
+    // dropped for room, expired or invalidated
+    Counter evictions;
+    Gauge bytes;
+    Gauge entries;
+
+private:
+    struct Entry {
+        std::string raw;
+        int proto;
+        std::string data;
+        uint32_t slot;
+        uint64_t epoch;
+        uint64_t expire;
+    };
+    typedef std::list<Entry> Lru;
+    struct Pending {
+        std::string raw;
+        int proto;
+        uint32_t slot;
+        uint64_t epoch;
+    };
+
+    // keys are views of Entry::raw
+    std::unordered_map<std::string_view, Lru::iterator>& map(int proto) {
+        return _maps[proto >= 3 ? 1 : 0];
+    }
+    void erase(Lru::iterator it);
+
+    CacheEpochs* _epochs;
+    size_t _max_bytes;
+    uint64_t _ttl;
+    // most recently used first
+    Lru _lru;
+    std::unordered_map<std::string_view, Lru::iterator> _maps[2];
+    std::unordered_map<int, Pending> _pending;
+};
+
+}; // namespace redis
+
+#endif
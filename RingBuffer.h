@@ -0,0 +1,94 @@
+#ifndef REDIS_RING_BUFFER_H_
+#define REDIS_RING_BUFFER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+namespace redis {
+
+// Lock-free byte ring, single writer, single reader.
+class RingBuffer {
+public:
+    // capacity is rounded up to a power of two
+    RingBuffer(size_t capacity) {
+        _capacity = 1;
+        while (_capacity < capacity) {
+            _capacity <<= 1;
+        }
+        _data = new char[_capacity];
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+    ~RingBuffer() {
+        delete[] _data;
+    }
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    size_t size() const {
+        return _tail.load(std::memory_order_acquire) - _head.load(std::memory_order_acquire);
+    }
+
+    // writer: appends both parts, or nothing if they don't fit
+    bool write(const void* a, size_t alen, const void* b = NULL, size_t blen = 0) {
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        uint64_t head = _head.load(std::memory_order_acquire);
+        if (_capacity - (tail - head) < alen + blen) {
+            return false;
+        }
+        copy_in(tail, a, alen);
+        copy_in(tail + alen, b, blen);
+        _tail.store(tail + alen + blen, std::memory_order_release);
+        return true;
+    }
+
+    // writer: appends as much of data as fits, returns the bytes written
+    size_t write_some(const void* data, size_t len) {
+        uint64_t tail = _tail.load(std::memory_order_relaxed);
+        uint64_t head = _head.load(std::memory_order_acquire);
+        size_t room = _capacity - (tail - head);
+        if (len > room) {
+            len = room;
+        }
+        copy_in(tail, data, len);
+        _tail.store(tail + len, std::memory_order_release);
+        return len;
+    }
+
+    // reader: returns the number of bytes copied to buf
+    size_t read(void* buf, size_t len) {
+        uint64_t head = _head.load(std::memory_order_relaxed);
+        uint64_t tail = _tail.load(std::memory_order_acquire);
+        size_t n = tail - head;
+        if (n > len) {
+            n = len;
+        }
+        size_t off = head & (_capacity - 1);
+        size_t first = n < _capacity - off ? n : _capacity - off;
+        memcpy(buf, _data + off, first);
+        memcpy((char*)buf + first, _data, n - first);
+        _head.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+private:
+    void copy_in(uint64_t pos, const void* src, size_t len) {
+        if (len == 0) {
+            return;
+        }
+        size_t off = pos & (_capacity - 1);
+        size_t first = len < _capacity - off ? len : _capacity - off;
+        memcpy(_data + off, src, first);
+        memcpy(_data, (const char*)src + first, len - first);
+    }
+
+    size_t _capacity;
+    char* _data;
+    alignas(64) std::atomic<uint64_t> _head;
+    alignas(64) std::atomic<uint64_t> _tail;
+};
+
+}; // namespace redis
+
+#endif
@@ -25,7 +25,7 @@ public:
     }
     int size();
     // multi writer
-    int push(const T item);
+    int push(T item);
     // single reader
     int pop(T* data);
 };
@@ -48,16 +48,18 @@ SelectableQueue<T>::~SelectableQueue() {
 }
 
 template <class T>
-int SelectableQueue<T>::push(const T item) {
+int SelectableQueue<T>::push(T item) {
     if (pthread_mutex_lock(&mutex) != 0) {
         return -1;
     }
-    { items.push(item); }
+    { items.push(std::move(item)); }
+    pthread_mutex_unlock(&mutex);
+    // notify outside the lock: a full pipe blocks the writer until the
+    // reader drains it, and the reader needs the lock to do so
     if (::write(fds[1], "1", 1) == -1) {
         fprintf(stderr, "write fds error\n");
         exit(0);
     }
-    pthread_mutex_unlock(&mutex);
     return 1;
 }
 
@@ -95,7 +97,7 @@ int SelectableQueue<T>::pop(T* data) {
                     pthread_mutex_unlock(&mutex);
                     return -1;
                 }
-                *data = items.front();
+                *data = std::move(items.front());
                 items.pop();
             }
             pthread_mutex_unlock(&mutex);
@@ -0,0 +1,46 @@
+#ifndef REDIS_SERVICE_H_
+#define REDIS_SERVICE_H_
+
+#include <functional>
+#include "Message.h"
+
+struct Fdevent;
+
+namespace redis {
+
+class Reactor;
+
+// Request processing that runs inside the reactor threads instead of
+// behind Transport::Recv(). Every reactor gets its own instance, so a
+// Service needs no locking for per-reactor state.
+class Service {
+public:
+    virtual ~Service() {
+    }
+
+    // Called once in the reactor thread before the event loop starts.
+    virtual void start(Reactor* reactor) {
+    }
+    // Called for every decoded request. Return true if the service took it
+    // and will answer through Reactor::reply(), false to pass it on to
+    // Transport::Recv(). A service that passes on some requests of a client
+    // must not answer later ones before those were answered.
+    virtual bool process(Reactor* reactor, const Message& req) = 0;
+    // An event on a fd the service registered with data.num = Reactor::TAG_SERVICE.
+    virtual void event(Reactor* reactor, const Fdevent* fde) {
+    }
+    // Called before every wait of the event loop, so at least every 100ms,
+    // for batched or periodic work. Must be cheap.
+    virtual void tick(Reactor* reactor) {
+    }
+    // The client is gone, drop whatever is kept for it.
+    virtual void closed(Reactor* reactor, int client_id) {
+    }
+};
+
+// creates the Service of reactor `index`
+typedef std::function<Service*(int index)> ServiceFactory;
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef REDIS_SLAB_H_
+#define REDIS_SLAB_H_
+
+#include <stddef.h>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "Numa.h"
+
+namespace redis {
+
+// Allocator of same-sized objects, carved from chunks of CHUNK objects and
+// recycled through a free list. Saves the malloc header and fragmentation
+// of a heap allocation per object, which adds up for objects kept per
+// connection. Thread-safe: objects may be freed by another thread than the
+// one that allocated them. Chunks are only released by the destructor.
+// With set_node() they are placed on a NUMA node.
+template <class T, int CHUNK = 256>
+class Slab {
+public:
+    Slab() {
+        _free = NULL;
+        _used = 0;
+        _node = -1;
+    }
+    ~Slab() {
+        for (auto chunk : _chunks) {
+            if (_node >= 0) {
+                Numa::free(chunk, CHUNK * sizeof(Slot));
+            } else {
+                delete[] chunk;
+            }
+        }
+    }
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    // allocate the chunks on node, before the first alloc()
+    void set_node(int node) {
+        _node = node;
+    }
+
+    // a default constructed T
+    T* alloc() {
+        Slot* slot;
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            if (!_free) {
+                grow();
+            }
+            slot = _free;
+            _free = slot->next;
+            _used++;
+        }
+        return new (slot->obj) T();
+    }
+
+    void free(T* obj) {
+        obj->~T();
+        Slot* slot = (Slot*)obj;
+        std::lock_guard<std::mutex> lk(_mutex);
+        slot->next = _free;
+        _free = slot;
+        _used--;
+    }
+
+    // objects alive
+    size_t used() {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _used;
+    }
+    // memory taken by the chunks
+    size_t bytes() {
+        std::lock_guard<std::mutex> lk(_mutex);
+        return _chunks.size() * CHUNK * sizeof(Slot);
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) char obj[sizeof(T)];
+    };
+
+    void grow() {
+        Slot* chunk;
+        if (_node >= 0) {
+            chunk = (Slot*)Numa::alloc(CHUNK * sizeof(Slot), _node);
+            if (!chunk) {
+                throw std::bad_alloc();
+            }
+        } else {
+            chunk = new Slot[CHUNK];
+        }
+        _chunks.push_back(chunk);
+        for (int i = CHUNK - 1; i >= 0; i--) {
+            chunk[i].next = _free;
+            _free = &chunk[i];
+        }
+    }
+
+    std::mutex _mutex;
+    Slot* _free;
+    size_t _used;
+    int _node;
+    std::vector<Slot*> _chunks;
+};
+
+}; // namespace redis
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef REDIS_SPIN_POLICY_H_
+#define REDIS_SPIN_POLICY_H_
+
+#include <stdint.h>
+#include "Clock.h"
+
+namespace redis {
+
+// Spin-then-park policy for busy polling loops.
+//
+// After a poll finds nothing, the caller keeps polling until the spin
+// budget runs out and then parks in a blocking wait. The budget adapts:
+// it is halved every time a spin ends without work, so idle loops quickly
+// stop burning CPU, and doubled (up to the configured maximum) every time
+// work shows up while spinning.
+class SpinPolicy {
+public:
+    // budget_us <= 0 disables spinning
+    SpinPolicy(int budget_us = 0) {
+        _max = budget_us > 0 ? Clock::from_us(budget_us) : 0;
+        _min = _max / 64;
+        _budget = _max;
+        _idle_since = 0;
+    }
+
+    bool enabled() const {
+        return _max > 0;
+    }
+
+    // A poll came back empty. Returns true to poll again, false to park.
+    bool idle() {
+        uint64_t now = Clock::now();
+        if (_idle_since == 0) {
+            _idle_since = now;
+        }
+        if (now - _idle_since < _budget) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+            return true;
+        }
+        _budget = _budget / 2 > _min ? _budget / 2 : _min;
+        _idle_since = 0;
+        return false;
+    }
+
+    // A poll found work.
+    void busy() {
+        if (_idle_since != 0) {
+            _budget = _budget * 2 < _max ? _budget * 2 : _max;
+        }
+        _idle_since = 0;
+    }
+
+private:
+    uint64_t _max;
+    uint64_t _min;
+    uint64_t _budget;
+    uint64_t _idle_since;
+};
+
+}; // namespace redis
+
+#endif
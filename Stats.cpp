@@ -0,0 +1,277 @@
+#include "Stats.h"
+#include <stdio.h>
+
+namespace redis {
+
+int HistogramData::index(uint64_t v) {
+    if (v < SUB_COUNT) {
+        return (int)v;
+    }
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - SUB_BITS;
+    int sub = (int)(v >> shift) - SUB_COUNT;
+    return (shift + 1) * SUB_COUNT + sub;
+}
+
+uint64_t HistogramData::value(int idx) {
+    if (idx < SUB_COUNT) {
+        return idx;
+    }
+    int shift = idx / SUB_COUNT - 1;
+    uint64_t sub = idx % SUB_COUNT;
+    return (SUB_COUNT + sub) << shift;
+}
+
+void HistogramData::add(uint64_t v, uint64_t n) {
+    counts[index(v)] += n;
+    count += n;
+    sum += v * n;
+    if (v > max) {
+        max = v;
+    }
+}
+
+void HistogramData::merge(const HistogramData& other) {
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] += other.counts[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+uint64_t HistogramData::percentile(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t want = (uint64_t)(count * p / 100.0);
+    if (want >= count) {
+        return max;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > want) {
+            uint64_t v = value(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+Histogram::Histogram() : _count(0), _sum(0), _max(0) {
+    for (int i = 0; i < HistogramData::BUCKETS; i++) {
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::add(uint64_t v) {
+    const auto R = std::memory_order_relaxed;
+    std::atomic<uint64_t>* c = &_counts[HistogramData::index(v)];
+    c->store(c->load(R) + 1, R);
+    _count.store(_count.load(R) + 1, R);
+    _sum.store(_sum.load(R) + v, R);
+    if (v > _max.load(R)) {
+        _max.store(v, R);
+    }
+}
+
+void Histogram::snapshot(HistogramData* out) const {
+    const auto R = std::memory_order_relaxed;
+    for (int i = 0; i < HistogramData::BUCKETS; i++) {
+        out->counts[i] += _counts[i].load(R);
+    }
+    out->count += _count.load(R);
+    out->sum += _sum.load(R);
+    uint64_t max = _max.load(R);
+    if (max > out->max) {
+        out->max = max;
+    }
+}
+
+void TransportStats::Reactor::merge(const Reactor& other) {
+    accepts += other.accepts;
+    closes += other.closes;
+    bytes_in += other.bytes_in;
+    bytes_out += other.bytes_out;
+    commands += other.commands;
+    responses += other.responses;
+    rejected += other.rejected;
+    pubsub_messages += other.pubsub_messages;
+    tracking_invalidations += other.tracking_invalidations;
+    read_calls += other.read_calls;
+    write_calls += other.write_calls;
+    read_eagain += other.read_eagain;
+    write_eagain += other.write_eagain;
+    bulk_streamed += other.bulk_streamed;
+    coalesced += other.coalesced;
+    rate_limited += other.rate_limited;
+    rate_rejected += other.rate_rejected;
+    admission_shed += other.admission_shed;
+    blocking_timeouts += other.blocking_timeouts;
+    cache_hits += other.cache_hits;
+    cache_misses += other.cache_misses;
+    cache_evictions += other.cache_evictions;
+    cache_bytes += other.cache_bytes;
+    cache_entries += other.cache_entries;
+    numa_local_accepts += other.numa_local_accepts;
+    numa_remote_accepts += other.numa_remote_accepts;
+    accept_queue += other.accept_queue;
+    send_queue += other.send_queue;
+    buffer_bytes += other.buffer_bytes;
+    pool_bytes += other.pool_bytes;
+    loop_us.merge(other.loop_us);
+    for (int i = 0; i < Trace::STAGES; i++) {
+        stage_us[i].merge(other.stage_us[i]);
+    }
+    total_us.merge(other.total_us);
+}
+
+static void append(std::string* buf, const char* name, uint64_t val) {
+    char tmp[128];
+    snprintf(tmp, sizeof(tmp), "%s:%llu\r\n", name, (unsigned long long)val);
+    buf->append(tmp);
+}
+
+static void append_histogram(std::string* buf, const char* name, const HistogramData& h) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s:count=%llu,mean=%llu,p50=%llu,p99=%llu,p999=%llu,max=%llu\r\n",
+        name,
+        (unsigned long long)h.count,
+        (unsigned long long)h.mean(),
+        (unsigned long long)h.percentile(50),
+        (unsigned long long)h.percentile(99),
+        (unsigned long long)h.percentile(99.9),
+        (unsigned long long)h.max);
+    buf->append(tmp);
+}
+
+static void append_reactor(std::string* buf, const TransportStats::Reactor& r) {
+    append(buf, "connected_clients", r.accepts - r.closes);
+    append(buf, "total_connections_received", r.accepts);
+    append(buf, "total_connections_closed", r.closes);
+    append(buf, "total_net_input_bytes", r.bytes_in);
+    append(buf, "total_net_output_bytes", r.bytes_out);
+    append(buf, "total_commands_decoded", r.commands);
+    append(buf, "total_responses_written", r.responses);
+    append(buf, "total_commands_rejected", r.rejected);
+    append(buf, "pubsub_messages_sent", r.pubsub_messages);
+    append(buf, "tracking_invalidations_sent", r.tracking_invalidations);
+    append(buf, "read_calls", r.read_calls);
+    append(buf, "write_calls", r.write_calls);
+    append(buf, "read_eagain", r.read_eagain);
+    append(buf, "write_eagain", r.write_eagain);
+    append(buf, "total_bulk_streamed_bytes", r.bulk_streamed);
+    append(buf, "total_commands_coalesced", r.coalesced);
+    append(buf, "total_commands_rate_limited", r.rate_limited);
+    append(buf, "total_commands_rate_rejected", r.rate_rejected);
+    append(buf, "total_commands_shed_early", r.admission_shed);
+    append(buf, "total_blocking_timeouts", r.blocking_timeouts);
+    append(buf, "response_cache_hits", r.cache_hits);
+    append(buf, "response_cache_misses", r.cache_misses);
+    append(buf, "response_cache_evictions", r.cache_evictions);
+    append(buf, "response_cache_entries", r.cache_entries);
+    append(buf, "mem_response_cache", r.cache_bytes);
+    append(buf, "accept_queue_depth", r.accept_queue);
+    append(buf, "send_queue_depth", r.send_queue);
+    append(buf, "mem_client_buffers", r.buffer_bytes);
+    append(buf, "mem_buffer_pool", r.pool_bytes);
+    append_histogram(buf, "loop_usec", r.loop_us);
+    if (r.total_us.count > 0) {
+        for (int i = 0; i < Trace::STAGES; i++) {
+            std::string name = std::string("latency_") + Trace::stage_name(i) + "_usec";
+            append_histogram(buf, name.c_str(), r.stage_us[i]);
+        }
+        append_histogram(buf, "latency_total_usec", r.total_us);
+    }
+}
+
+static void append_key(std::string* buf, const char* prefix, int i, const KeyStat& k) {
+    // keys are binary, and may be huge
+    std::string key = k.key.substr(0, 64);
+    for (auto& c : key) {
+        if (c < 0x21 || c > 0x7e || c == ',') {
+            c = '?';
+        }
+    }
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s%d:key=%s,count=%llu,request_bytes=%llu,reply_bytes=%llu\r\n",
+        prefix, i, key.c_str(),
+        (unsigned long long)k.count,
+        (unsigned long long)k.request_bytes,
+        (unsigned long long)k.reply_bytes);
+    buf->append(tmp);
+}
+
+std::string TransportStats::Format() const {
+    std::string buf;
+    buf.append("# Transport\r\n");
+    append(&buf, "reactors", reactors.size());
+    append(&buf, "recv_channel_depth", recv_channel);
+    append(&buf, "mem_client_struct", client_size);
+    append(&buf, "mem_clients_slab", client_slab_bytes);
+    // Client struct and buffers per connection, without the kernel socket
+    append(&buf, "mem_per_client", clients ? (clients * client_size + total.buffer_bytes) / clients : 0);
+    if (numa_nodes > 0) {
+        append(&buf, "numa_nodes", numa_nodes);
+        append(&buf, "numa_local_connections", total.numa_local_accepts);
+        append(&buf, "numa_remote_connections", total.numa_remote_accepts);
+    }
+    if (capturing) {
+        append(&buf, "capture_records", capture_records);
+        append(&buf, "capture_dropped", capture_dropped);
+    }
+    if (pubsub) {
+        append(&buf, "pubsub_channels", pubsub_channels);
+        append(&buf, "pubsub_patterns", pubsub_patterns);
+    }
+    if (tracking) {
+        append(&buf, "tracking_total_keys", tracking_keys);
+        append(&buf, "tracking_total_prefixes", tracking_prefixes);
+    }
+    if (coalescing) {
+        append(&buf, "coalesce_flights", coalesce_flights);
+    }
+    if (response_cache) {
+        uint64_t lookups = total.cache_hits + total.cache_misses;
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "response_cache_hit_rate:%.4f\r\n", lookups ? (double)total.cache_hits / lookups : 0);
+        buf.append(tmp);
+    }
+    if (admission) {
+        append(&buf, "admission_overloaded", admission_overloaded ? 1 : 0);
+        append(&buf, "admission_min_sojourn_usec", admission_min_sojourn_us);
+        append(&buf, "admission_service_usec", admission_service_us);
+        append(&buf, "total_commands_shed", total.admission_shed + admission_shed);
+        append(&buf, "total_commands_expired", admission_expired);
+    }
+    if (blocking) {
+        append(&buf, "blocked_clients", blocked_clients);
+    }
+    append_reactor(&buf, total);
+    if (key_sampling) {
+        buf.append("\r\n# Keys\r\n");
+        for (int i = 0; i < (int)hot_keys.size(); i++) {
+            append_key(&buf, "hotkey_", i, hot_keys[i]);
+        }
+        for (int i = 0; i < (int)big_keys.size(); i++) {
+            append_key(&buf, "bigkey_", i, big_keys[i]);
+        }
+    }
+    for (int i = 0; i < (int)reactors.size(); i++) {
+        buf.append("\r\n# Reactor");
+        buf.append(std::to_string(i));
+        buf.append("\r\n");
+        append_reactor(&buf, reactors[i]);
+        if (numa_nodes > 0) {
+            append(&buf, "numa_node", reactors[i].numa_node);
+            append(&buf, "numa_local_connections", reactors[i].numa_local_accepts);
+            append(&buf, "numa_remote_connections", reactors[i].numa_remote_accepts);
+        }
+    }
+    return buf;
+}
+
+}; // namespace redis
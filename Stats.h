@@ -0,0 +1,209 @@
+#ifndef REDIS_STATS_H_
+#define REDIS_STATS_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "Trace.h"
+#include "KeySampler.h"
+
+namespace redis {
+
+// Single-writer counter. Only the owning reactor updates it, readers may
+// load it from any thread, so no read-modify-write instruction is needed.
+class Counter {
+public:
+    Counter() : _val(0) {
+    }
+    void add(uint64_t n = 1) {
+        _val.store(_val.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    uint64_t get() const {
+        return _val.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> _val;
+};
+
+// Single-writer gauge, like Counter but it may go down.
+class Gauge {
+public:
+    Gauge() : _val(0) {
+    }
+    void add(int64_t n) {
+        _val.store(_val.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    int64_t get() const {
+        return _val.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<int64_t> _val;
+};
+
+// Plain (non-atomic) copy of a Histogram, used for snapshots and merging.
+struct HistogramData {
+    enum { SUB_BITS = 4, SUB_COUNT = 1 << SUB_BITS, BUCKETS = (65 - SUB_BITS) * SUB_COUNT };
+
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t counts[BUCKETS] = {0};
+
+    static int index(uint64_t v);
+    // lowest value that falls into bucket idx
+    static uint64_t value(int idx);
+
+    void add(uint64_t v, uint64_t n = 1);
+    void merge(const HistogramData& other);
+    // p in [0, 100]
+    uint64_t percentile(double p) const;
+    uint64_t mean() const {
+        return count ? sum / count : 0;
+    }
+};
+
+// HDR-style log-linear histogram, about 6% relative precision over the full
+// uint64_t range. Single writer, lock-free readers.
+class Histogram {
+public:
+    Histogram();
+    void add(uint64_t v);
+    // adds this histogram's counts into *out
+    void snapshot(HistogramData* out) const;
+
+private:
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sum;
+    std::atomic<uint64_t> _max;
+    std::atomic<uint64_t> _counts[HistogramData::BUCKETS];
+};
+
+// Per-reactor counters, written by the reactor thread only, except for the
+// numa_* ones which the accept thread writes.
+struct alignas(64) ReactorStats {
+    Counter accepts;
+    Counter closes;
+    Counter bytes_in;
+    Counter bytes_out;
+    Counter commands;
+    Counter responses;
+    // answered by the reactor, e.g. wrong arity
+    Counter rejected;
+    // pub/sub messages queued to subscribers
+    Counter pubsub_messages;
+    // keys in invalidation pushes sent to tracking clients
+    Counter tracking_invalidations;
+    Counter read_calls;
+    Counter write_calls;
+    Counter read_eagain;
+    Counter write_eagain;
+    // bytes of large arguments written to BulkSinks
+    Counter bulk_streamed;
+    // requests parked on an identical one in flight
+    Counter coalesced;
+    // requests held back, and rejected, by the rate limiter
+    Counter rate_limited;
+    Counter rate_rejected;
+    // answered -BUSY by the AdmissionControl instead of queued for Recv()
+    Counter admission_shed;
+    // blocked clients answered nil when their time was up
+    Counter blocking_timeouts;
+    // EnableNuma(): connections whose packets arrive on the reactor's node,
+    // and the others
+    Counter numa_local_accepts;
+    Counter numa_remote_accepts;
+    // time spent handling one batch of ready events, in microseconds
+    Histogram loop_us;
+    // traced requests only
+    Histogram stage_us[Trace::STAGES];
+    Histogram total_us;
+};
+
+struct TransportStats {
+    struct Reactor {
+        uint64_t accepts = 0;
+        uint64_t closes = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        uint64_t commands = 0;
+        uint64_t responses = 0;
+        uint64_t rejected = 0;
+        uint64_t pubsub_messages = 0;
+        uint64_t tracking_invalidations = 0;
+        uint64_t read_calls = 0;
+        uint64_t write_calls = 0;
+        uint64_t read_eagain = 0;
+        uint64_t write_eagain = 0;
+        uint64_t bulk_streamed = 0;
+        uint64_t coalesced = 0;
+        uint64_t rate_limited = 0;
+        uint64_t rate_rejected = 0;
+        uint64_t admission_shed = 0;
+        uint64_t blocking_timeouts = 0;
+        uint64_t cache_hits = 0;
+        uint64_t cache_misses = 0;
+        uint64_t cache_evictions = 0;
+        uint64_t cache_bytes = 0;
+        uint64_t cache_entries = 0;
+        uint64_t numa_local_accepts = 0;
+        uint64_t numa_remote_accepts = 0;
+        // -1 unless EnableNuma()
+        int numa_node = -1;
+        int accept_queue = 0;
+        int send_queue = 0;
+        // link buffers in use, and free in the reactor's BufferPool
+        int64_t buffer_bytes = 0;
+        int64_t pool_bytes = 0;
+        HistogramData loop_us;
+        HistogramData stage_us[Trace::STAGES];
+        HistogramData total_us;
+
+        void merge(const Reactor& other);
+    };
+
+    Reactor total;
+    std::vector<Reactor> reactors;
+    int recv_channel = 0;
+    // sizeof(Transport::Client), link included
+    uint64_t client_size = 0;
+    uint64_t clients = 0;
+    // slab memory for the Client structs
+    uint64_t client_slab_bytes = 0;
+    // 0 unless EnableNuma()
+    int numa_nodes = 0;
+    bool capturing = false;
+    uint64_t capture_records = 0;
+    uint64_t capture_dropped = 0;
+    bool pubsub = false;
+    int pubsub_channels = 0;
+    int pubsub_patterns = 0;
+    bool tracking = false;
+    uint64_t tracking_keys = 0;
+    uint64_t tracking_prefixes = 0;
+    bool coalescing = false;
+    int coalesce_flights = 0;
+    bool response_cache = false;
+    bool admission = false;
+    bool admission_overloaded = false;
+    // in the last interval
+    uint64_t admission_min_sojourn_us = 0;
+    uint64_t admission_service_us = 0;
+    // by Recv(), on top of those the reactors shed
+    uint64_t admission_shed = 0;
+    uint64_t admission_expired = 0;
+    bool blocking = false;
+    int blocked_clients = 0;
+    bool key_sampling = false;
+    std::vector<KeyStat> hot_keys;
+    std::vector<KeyStat> big_keys;
+
+    // INFO-style text dump
+    std::string Format() const;
+};
+
+}; // namespace redis
+
+#endif
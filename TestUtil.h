@@ -0,0 +1,103 @@
+#ifndef REDIS_TEST_UTIL_H_
+#define REDIS_TEST_UTIL_H_
+
+// Helpers of the *Test.cpp binaries: checks that end the test, and a
+// Transport started in-process on a unix socket.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AsyncClient.h"
+#include "Transport.h"
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) do { \
+        std::string a_ = (a), b_ = (b); \
+        if (a_ != b_) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s\n  %s\n  %s\n", __FILE__, __LINE__, #a, #b, \
+                a_.c_str(), b_.c_str()); \
+            exit(1); \
+        } \
+    } while (0)
+
+namespace redis {
+
+// A Transport listening on a unix socket of its own. Configure xport()
+// before Start(). The handler, if any, answers what reaches Recv(), on one
+// consumer thread, so a client's responses go out in request order.
+class TestServer {
+public:
+    typedef std::function<void(const Message& req, Response* resp)> Handler;
+
+    explicit TestServer(const std::string& name) {
+        _path = "/tmp/" + name + "." + std::to_string(getpid()) + ".sock";
+        _xport = new Transport();
+    }
+    ~TestServer() {
+        Stop();
+        delete _xport;
+        unlink(_path.c_str());
+    }
+
+    Transport* xport() {
+        return _xport;
+    }
+    const std::string& path() const {
+        return _path;
+    }
+
+    void Start(Handler handler = NULL) {
+        CHECK(_xport->Listen(_path) == 0);
+        CHECK(_xport->Start() == 0);
+        if (handler) {
+            _consumer = std::thread(&TestServer::consumer_func, this, handler);
+        }
+    }
+    // ends the consumer, which otherwise waits in Recv() for good
+    void Stop() {
+        if (!_consumer.joinable()) {
+            return;
+        }
+        AsyncClient client;
+        CHECK(client.Connect(_path, 0) == 0);
+        client.Call(Message(std::vector<std::string>{"test.stop"})).get();
+        client.Close();
+        _consumer.join();
+    }
+
+private:
+    void consumer_func(Handler handler) {
+        while (1) {
+            Message msg = _xport->Recv();
+            Response resp(msg);
+            bool stop = msg.Cmd() == "test.stop";
+            if (stop) {
+                resp.ReplyOK();
+            } else {
+                handler(msg, &resp);
+            }
+            _xport->Send(resp);
+            if (stop) {
+                return;
+            }
+        }
+    }
+
+    std::string _path;
+    Transport* _xport;
+    std::thread _consumer;
+};
+
+}; // namespace redis
+
+#endif
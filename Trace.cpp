@@ -0,0 +1,81 @@
+#include "Trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "Clock.h"
+
+namespace redis {
+
+void Trace::set_cmd(const std::string& name, const std::string& key) {
+    snprintf(cmd, sizeof(cmd), "%s %s", name.c_str(), key.c_str());
+}
+
+const char* Trace::stage_name(int stage) {
+    static const char* names[STAGES] = {"parse", "channel", "handler", "send_queue", "socket"};
+    if (stage < 0 || stage >= STAGES) {
+        return "";
+    }
+    return names[stage];
+}
+
+SlowLog::SlowLog(int capacity) {
+    _capacity = capacity > 0 ? capacity : 1;
+    _slots = new Slot[_capacity];
+    for (int i = 0; i < _capacity; i++) {
+        _slots[i].seq.store(0, std::memory_order_relaxed);
+    }
+    _next.store(0, std::memory_order_relaxed);
+}
+
+SlowLog::~SlowLog() {
+    delete[] _slots;
+}
+
+void SlowLog::add(const Trace& trace, const char* ip, int port) {
+    uint64_t id = _next.fetch_add(1, std::memory_order_relaxed);
+    Slot* slot = &_slots[id % _capacity];
+
+    // odd sequence: write in progress
+    slot->seq.store(id * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    SlowLogEntry* e = &slot->entry;
+    e->id = id;
+    e->time = ::time(NULL);
+    snprintf(e->client, sizeof(e->client), "%s:%d", ip, port);
+    memcpy(e->cmd, trace.cmd, sizeof(e->cmd));
+    e->cmd[sizeof(e->cmd) - 1] = '\0';
+    for (int i = 0; i < Trace::STAGES; i++) {
+        uint64_t s = trace.ts[i];
+        uint64_t t = trace.ts[i + 1];
+        e->stage_us[i] = (s && t > s) ? Clock::to_us(t - s) : 0;
+    }
+    e->total_us = Clock::to_us(trace.ts[Trace::FLUSHED] - trace.ts[Trace::READ]);
+
+    slot->seq.store(id * 2 + 2, std::memory_order_release);
+}
+
+std::vector<SlowLogEntry> SlowLog::entries() const {
+    std::vector<SlowLogEntry> ret;
+    uint64_t next = _next.load(std::memory_order_acquire);
+    uint64_t n = next < (uint64_t)_capacity ? next : _capacity;
+    for (uint64_t i = 0; i < n; i++) {
+        uint64_t id = next - 1 - i;
+        const Slot* slot = &_slots[id % _capacity];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if (seq != id * 2 + 2) {
+            // being written, or already overwritten by a newer entry
+            continue;
+        }
+        SlowLogEntry e;
+        memcpy(&e, &slot->entry, sizeof(e));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->seq.load(std::memory_order_relaxed) != seq) {
+            continue;
+        }
+        ret.push_back(e);
+    }
+    return ret;
+}
+
+}; // namespace redis
@@ -0,0 +1,71 @@
+#ifndef REDIS_TRACE_H_
+#define REDIS_TRACE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace redis {
+
+// Clock::now() timestamps of one request on its way through the Transport.
+// All zero when tracing is disabled.
+struct Trace {
+    enum {
+        READ = 0, // bytes read from the socket
+        DECODED,  // parsed into a Message by the reactor
+        RECV,     // returned by Transport::Recv()
+        SEND,     // Transport::Send() called with the Response
+        REPLY,    // Response taken from send_queues by the reactor
+        FLUSHED,  // last byte handed to the socket by Link::write()
+        MAX
+    };
+    // stage i is the interval ts[i] -> ts[i + 1]
+    enum { STAGES = MAX - 1 };
+
+    uint64_t ts[MAX] = {0};
+    // command name and key, truncated
+    char cmd[32] = {0};
+
+    bool enabled() const {
+        return ts[READ] != 0;
+    }
+    void set_cmd(const std::string& name, const std::string& key);
+
+    static const char* stage_name(int stage);
+};
+
+struct SlowLogEntry {
+    uint64_t id;
+    int64_t time; // unix timestamp
+    char client[64];
+    char cmd[32];
+    uint64_t total_us;
+    uint64_t stage_us[Trace::STAGES];
+};
+
+// Bounded ring of the most recent slow requests. Writers from any reactor
+// claim a slot with one atomic increment, each slot is guarded by a
+// sequence number so readers never block writers.
+class SlowLog {
+public:
+    SlowLog(int capacity);
+    ~SlowLog();
+
+    void add(const Trace& trace, const char* ip, int port);
+    // newest first
+    std::vector<SlowLogEntry> entries() const;
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        SlowLogEntry entry;
+    };
+    int _capacity;
+    Slot* _slots;
+    std::atomic<uint64_t> _next;
+};
+
+}; // namespace redis
+
+#endif
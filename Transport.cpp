@@ -1,39 +1,181 @@
 #include "Transport.h"
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
 #include "link.h"
+#include "Reactor.h"
 #include "Channel.h"
 #include "fde.h"
+#include "Clock.h"
+#include "Capture.h"
+#include "PubSub.h"
+#include "ClientTracking.h"
+#include "Coalescer.h"
+#include "ResponseCache.h"
+#include "AdmissionControl.h"
+#include "BlockedClients.h"
+#include "Command.h"
+#include "Numa.h"
 
 namespace redis {
 
 Transport::Transport() {
     _id_incr = 1;
-    _serv_link = NULL;
+    _stats = NULL;
+    _pools = NULL;
+    _client_slabs = NULL;
+    _tracing = false;
+    _slowlog_ticks = 0;
+    _slowlog = NULL;
+    _capture_buffer = 0;
+    _capture = NULL;
+    _busy_poll_us = 0;
+    _pubsub_enabled = false;
+    _pubsub = NULL;
+    _tracking_keys = 0;
+    _tracking = NULL;
+    _coalescer = NULL;
+    _cache_bytes = 0;
+    _cache_ttl_ms = 0;
+    _cache_epochs = NULL;
+    _caches = NULL;
+    _rate_limits = false;
+    _limiter = NULL;
+    _admission_target_us = 0;
+    _admission_interval_us = 0;
+    _admission_deadline_us = 0;
+    _admission = NULL;
+    _blocking_enabled = false;
+    _blocked = NULL;
+    _bulk_threshold = 0;
+    _sample_rate = 0;
+    _big_key_bytes = 0;
+    _samplers = NULL;
+    _numa = false;
     _recv_channel = new Channel<Message>();
     _close_flag = false;
 }
 
 Transport::~Transport() {
+    _close_flag = true;
     if (_main_thread.joinable()) {
-        _close_flag = true;
         _main_thread.join();
     }
+    for (auto& t : recv_threads) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
 
-    delete _serv_link;
+    delete _capture;
+    delete _pubsub;
+    delete _tracking;
+    delete _coalescer;
+    delete[] _caches;
+    delete _cache_epochs;
+    delete _limiter;
+    delete _admission;
+    delete _blocked;
+    delete[] _stats;
+    delete[] _pools;
+    delete[] _client_slabs;
+    delete[] _samplers;
+    delete _slowlog;
+    for (auto link : _serv_links) {
+        delete link;
+    }
     delete _recv_channel;
 }
 
-int Transport::Start(const std::string& ip, int port) {
-    _serv_link = Link::listen(ip.c_str(), port);
-    if (!_serv_link) {
+int Transport::Listen(const std::string& ip, int port) {
+    Link* link = Link::listen(ip.c_str(), port);
+    if (!link) {
         fprintf(stderr, "listen %s:%d failed: %s\n", ip.c_str(), port, strerror(errno));
         return -1;
     }
+    _serv_links.push_back(link);
+    return 0;
+}
+
+int Transport::Listen(const std::string& path) {
+    return Listen(path, 0);
+}
 
-    const int NUM = 4;
+int Transport::Start(const std::string& ip, int port) {
+    if (Listen(ip, port) == -1) {
+        return -1;
+    }
+    return Start();
+}
+
+int Transport::Start() {
+    if (_serv_links.empty()) {
+        fprintf(stderr, "no listener\n");
+        return -1;
+    }
+
+    // a client may be gone by the time its response is written, e.g. while
+    // its input was not read (throttled, parked); write() fails then
+    signal(SIGPIPE, SIG_IGN);
+
+    const int NUM = NUM_REACTORS;
+    if (!_capture_path.empty()) {
+        _capture = new Capture();
+        if (_capture->open(_capture_path, NUM, _capture_buffer) == -1) {
+            fprintf(stderr, "open capture %s failed: %s\n", _capture_path.c_str(), strerror(errno));
+            delete _capture;
+            _capture = NULL;
+            return -1;
+        }
+    }
+    if (_pubsub_enabled) {
+        _pubsub = new PubSub(NUM, _tracking_keys > 0);
+    }
+    if (_tracking_keys > 0) {
+        _tracking = new ClientTracking(NUM, _tracking_keys);
+    }
+    if (!_coalesce_commands.empty()) {
+        _coalescer = new Coalescer(NUM, _coalesce_commands);
+    }
+    if (_rate_limits) {
+        _limiter = new RateLimiter(_client_limit, _address_limit, _command_limits, _reject_commands);
+    }
+    if (_admission_target_us > 0) {
+        _admission = new AdmissionControl(_admission_target_us, _admission_interval_us, _admission_deadline_us);
+    }
+    if (_blocking_enabled) {
+        _blocked = new BlockedClients(NUM);
+    }
+    if (!_cache_commands.empty()) {
+        _cache_epochs = new CacheEpochs();
+        _caches = new ResponseCache[NUM];
+        for (int i = 0; i < NUM; i++) {
+            _caches[i].init(_cache_epochs, _cache_bytes, Clock::from_us((uint64_t)_cache_ttl_ms * 1000));
+        }
+    }
     accept_queues.resize(NUM);
     send_queues.resize(NUM);
+    _stats = new ReactorStats[NUM];
+    _pools = new BufferPool[NUM];
+    _client_slabs = new Slab<Client>[NUM];
+    if (_sample_rate > 0) {
+        _samplers = new KeySampler[NUM];
+        for (int i = 0; i < NUM; i++) {
+            _samplers[i].init(_sample_rate, _big_key_bytes);
+        }
+    }
+    if (_numa) {
+        int nodes = Numa::nodes();
+        _node_reactors.resize(nodes);
+        _node_next.resize(nodes, 0);
+        for (int i = 0; i < NUM; i++) {
+            int node = i % nodes;
+            _reactor_node.push_back(node);
+            _node_reactors[node].push_back(i);
+            _pools[i].set_node(node);
+            _client_slabs[i].set_node(node);
+        }
+    }
     for(int i=0; i<NUM; i++){
         std::thread t(&Transport::recv_func, this, i);
         recv_threads.push_back(std::move(t));
@@ -44,15 +186,19 @@ int Transport::Start(const std::string& ip, int port) {
 }
 
 void Transport::recv_func(Transport* xport, int index){
+    // before the reactor allocates anything, so that it is node-local
+    if (xport->_numa && Numa::bind_thread(xport->_reactor_node[index]) == -1) {
+        fprintf(stderr, "reactor %d: bind to node %d failed\n", index, xport->_reactor_node[index]);
+    }
+    Reactor reactor(xport, index);
+    reactor.run();
+}
+
+void Transport::main_func(Transport* xport) {
     Fdevents *fdes = new Fdevents();
-    SelectableQueue<Client*> *accept_queue = &xport->accept_queues[index];
-    SelectableQueue<Response> *send_queue = &xport->send_queues[index];
-    std::unordered_map<int, Client*> clients;
-
-    fdes->set(accept_queue->fd(), FDEVENT_IN, 0, accept_queue);
-    fdes->set(send_queue->fd(), FDEVENT_IN, 0, send_queue);
-    
-    std::vector<Client*> close_list;
+    for (auto serv_link : xport->_serv_links) {
+        fdes->set(serv_link->fd(), FDEVENT_IN, 0, serv_link);
+    }
     const Fdevents::events_t* events;
 
     while (!xport->_close_flag) {
@@ -66,139 +212,389 @@ void Transport::recv_func(Transport* xport, int index){
 
         for (int i = 0; i < (int)events->size(); i++) {
             const Fdevent* fde = events->at(i);
-            if (fde->data.ptr == accept_queue) {
-                Client* client = NULL;
-                accept_queue->pop(&client);
-                printf("process %s:%d\n", client->link->remote_ip, client->link->remote_port);
-
-                fdes->set(client->link->fd(), FDEVENT_IN, 0, client);
-                clients[client->id] = client;
-            } else if (fde->data.ptr == send_queue) {
-                while (send_queue->size() > 0) {
-                    Response msg;
-                    send_queue->pop(&msg);
-
-                    auto it = clients.find(msg.ClientId());
-                    if (it == clients.end()) {
-                        printf("client %d not found\n", msg.ClientId());
-                        continue;
-                    }
-                    Client* client = it->second;
-
-                    client->link->send(msg);
-                    fdes->set(client->link->fd(), FDEVENT_OUT, 0, client);
-                }
-            } else {
-                Client* client = (Client*)fde->data.ptr;
-                if (fde->events & FDEVENT_IN) {
-                    int ret = client->link->read();
-                    if (ret <= 0) {
-                        close_list.push_back(client);
-                        continue;
-                    }
-                    while (1) {
-                        Message req(client->id);
-                        int ret = client->link->recv(&req);
-                        if (ret == -1) {
-                            close_list.push_back(client);
-                            break;
-                        } else if (ret == 0) {
-                            // not ready
-                            break;
-                        }
-                        xport->_recv_channel->push(req);
-                    }
-                } else if (fde->events & FDEVENT_OUT) {
-                    int ret = client->link->write();
-                    if (ret == 0) {
-                        fdes->clr(client->link->fd(), FDEVENT_OUT);
-                    }
-                }
+            Link* serv_link = (Link*)fde->data.ptr;
+            Link conn;
+            if (serv_link->accept(&conn) == -1) {
+                fprintf(stderr, "%d accept error\n", __LINE__);
+                continue;
+            }
+            int index = xport->pick_reactor(&conn);
+            int id = xport->new_client_id(index);
+            if (index == -1) {
+                index = id % xport->accept_queues.size();
             }
-        }
-
-        if (!close_list.empty()) {
-            for (auto client : close_list) {
-                {
-                    std::lock_guard<std::mutex> lk(xport->_mutex);
-                    xport->_ids.erase(client->id);
-                }
-                clients.erase(client->id);
 
-                printf("close %s:%d\n", client->link->remote_ip, client->link->remote_port);
-                fdes->del(client->link->fd());
-                delete client->link;
-                delete client;
+            Client* client = xport->_client_slabs[index].alloc();
+            client->id = id;
+            Link* link = &client->conn;
+            link->adopt(&conn);
+            link->noblock(true);
+            if (xport->_busy_poll_us > 0) {
+                link->busy_poll(xport->_busy_poll_us);
             }
-            close_list.clear();
+            printf("accept %s:%d\n", link->remote_ip, link->remote_port);
+
+            client->link = link;
+
+            SelectableQueue<Client*> *queue = &xport->accept_queues[index];
+            queue->push(client);
         }
     }
 
-    for (auto it : clients) {
-        Client* client = it.second;
-        delete client->link;
-        delete client;
-    }
     delete fdes;
 }
 
-void Transport::main_func(Transport* xport) {
-    Fdevents *fdes = new Fdevents();
-    fdes->set(xport->_serv_link->fd(), FDEVENT_IN, 0, xport->_serv_link);
-    const Fdevents::events_t* events;
+int Transport::pick_reactor(Link* link) {
+    if (!_numa) {
+        return -1;
+    }
+    int node = Numa::node_of_cpu(link->incoming_cpu());
+    if (node < 0 || _node_reactors[node].empty()) {
+        // unix socket, or a node without reactors
+        int index = _node_next[0]++ % _reactor_node.size();
+        _stats[index].numa_remote_accepts.add();
+        return index;
+    }
+    const std::vector<int>& group = _node_reactors[node];
+    unsigned int napi_id = link->incoming_napi_id();
+    int index;
+    if (napi_id != 0) {
+        index = group[napi_id % group.size()];
+    } else {
+        index = group[_node_next[node]++ % group.size()];
+    }
+    _stats[index].numa_local_accepts.add();
+    return index;
+}
 
-    while (!xport->_close_flag) {
-        events = fdes->wait(100);
-        if (events == NULL) {
-            exit(-1);
-        }
-        if (events->empty()) {
+int Transport::new_client_id(int index) {
+    int num = (int)accept_queues.size();
+    while (1) {
+        _id_incr = std::max((int)1, _id_incr + 1);
+        if (index != -1 && _id_incr % num != index) {
             continue;
         }
 
-        for (int i = 0; i < (int)events->size(); i++) {
-            const Fdevent* fde = events->at(i);
-            if (fde->data.ptr == xport->_serv_link) {
-                Link* link = xport->_serv_link->accept();
-                if (!link) {
-                    fprintf(stderr, "%d accept error\n", __LINE__);
-                    continue;
-                }
-                link->noblock(true);
-                printf("accept %s:%d\n", link->remote_ip, link->remote_port);
-
-                Client* client = new Client();
-                client->link = link;
-
-                while (1) {
-                    xport->_id_incr = std::max((int)1, xport->_id_incr + 1);
-
-                    std::lock_guard<std::mutex> lk(xport->_mutex);
-                    if (xport->_ids.count(xport->_id_incr) == 0) {
-                        client->id = xport->_id_incr;
-                        xport->_ids[client->id] = 0;
-                        break;
-                    }
-                }
-
-                int index = client->id % xport->accept_queues.size();
-                SelectableQueue<Client*> *queue = &xport->accept_queues[index];
-                queue->push(client);
-            }
+        std::lock_guard<std::mutex> lk(_mutex);
+        if (_ids.count(_id_incr) == 0) {
+            _ids[_id_incr] = 0;
+            return _id_incr;
         }
     }
-
-    delete fdes;
 }
 
 Message Transport::Recv() {
-    return _recv_channel->pop();
+    Message msg;
+    while (1) {
+        bool got = false;
+        while (_recv_spin.enabled()) {
+            if (_recv_channel->try_pop(msg)) {
+                _recv_spin.busy();
+                got = true;
+                break;
+            }
+            if (!_recv_spin.idle()) {
+                break;
+            }
+        }
+        if (!got) {
+            _recv_channel->pop(msg);
+        }
+        if (!_admission || admitted(msg)) {
+            break;
+        }
+    }
+    if (msg.GetTrace().enabled()) {
+        msg.MutableTrace()->ts[Trace::RECV] = Clock::now();
+    }
+    return msg;
+}
+
+bool Transport::admitted(const Message& msg) {
+    int ret = _admission->dequeued(msg, Clock::now());
+    if (ret == AdmissionControl::PASS) {
+        return true;
+    }
+    // still answered, the client waits for responses in request order
+    Response resp(msg);
+    if (ret == AdmissionControl::SHED) {
+        resp.ReplyRaw("-BUSY server is overloaded, try again later\r\n");
+    } else {
+        resp.ReplyRaw("-TIMEOUT request deadline exceeded\r\n");
+    }
+    Send(std::move(resp));
+    return false;
 }
 
 void Transport::Send(const Response& msg) {
+    Send(Response(msg));
+}
+
+void Transport::Send(Response&& msg) {
     int index = msg.ClientId() % send_queues.size();
     SelectableQueue<Response> *queue = &send_queues[index];
-    queue->push(msg);
+    if (msg.GetTrace().enabled()) {
+        msg.MutableTrace()->ts[Trace::SEND] = Clock::now();
+    }
+    queue->push(std::move(msg));
+}
+
+void Transport::EnableTracing(int slowlog_us, int slowlog_len) {
+    _tracing = true;
+    _slowlog_ticks = Clock::from_us(slowlog_us);
+    delete _slowlog;
+    _slowlog = new SlowLog(slowlog_len);
+}
+
+void Transport::SetService(ServiceFactory factory) {
+    _service_factory = factory;
+}
+
+void Transport::EnablePubSub() {
+    _pubsub_enabled = true;
+}
+
+void Transport::EnableClientTracking(size_t max_keys) {
+    _tracking_keys = max_keys > 0 ? max_keys : 1;
+}
+
+void Transport::SetBulkSink(size_t threshold, BulkSinkFactory factory) {
+    _bulk_threshold = threshold > 0 ? threshold : 1;
+    _bulk_factory = factory;
+}
+
+void Transport::EnableCoalescing(const std::vector<std::string>& commands) {
+    _coalesce_commands = commands;
+}
+
+void Transport::EnableResponseCache(const std::vector<std::string>& commands, size_t max_bytes, int ttl_ms) {
+    _cache_commands.assign(command_table::COUNT, false);
+    for (auto& name : commands) {
+        const Command* cmd = Command::find(name);
+        if (!cmd) {
+            fprintf(stderr, "response cache: unknown command %s\n", name.c_str());
+        } else if (!(cmd->flags & CMD_FLAG_READ) || cmd->first_key == 0 || cmd->last_key != cmd->first_key) {
+            fprintf(stderr, "response cache: %s is not a single key read, not cached\n", name.c_str());
+        } else {
+            _cache_commands[cmd->id] = true;
+        }
+    }
+    _cache_bytes = max_bytes;
+    _cache_ttl_ms = ttl_ms;
+}
+
+void Transport::InvalidateCached(const std::string& key) {
+    if (_cache_epochs) {
+        _cache_epochs->bump(key);
+    }
+}
+
+void Transport::SetRateLimits(const RateLimit& client, const RateLimit& address,
+    const std::unordered_map<std::string, RateLimit>& commands, const std::vector<std::string>& reject)
+{
+    _rate_limits = true;
+    _client_limit = client;
+    _address_limit = address;
+    _command_limits = commands;
+    _reject_commands = reject;
+}
+
+void Transport::EnableAdmissionControl(int target_us, int interval_us, int deadline_us) {
+    _admission_target_us = target_us > 0 ? target_us : 1;
+    _admission_interval_us = interval_us;
+    _admission_deadline_us = deadline_us;
+}
+
+void Transport::EnableBlocking() {
+    _blocking_enabled = true;
+}
+
+int Transport::Block(const Message& req, int timeout_ms) {
+    const Command* cmd = req.GetCommand();
+    std::vector<std::string> keys;
+    if (cmd) {
+        const std::vector<std::string>& args = req.Vals();
+        int last = cmd->last_key < 0 ? (int)args.size() + cmd->last_key : cmd->last_key;
+        for (int i = cmd->first_key; i > 0 && i <= last; i += cmd->key_step) {
+            keys.push_back(args[i]);
+        }
+    }
+    return Block(req, keys, timeout_ms);
+}
+
+int Transport::Block(const Message& req, const std::vector<std::string>& keys, int timeout_ms) {
+    const Command* cmd = req.GetCommand();
+    if (!_blocked || !cmd || !(cmd->flags & CMD_FLAG_BLOCKING) || keys.empty()) {
+        return -1;
+    }
+    uint64_t deadline = timeout_ms > 0 ? Clock::now() + Clock::from_us((uint64_t)timeout_ms * 1000) : 0;
+    _blocked->block(req.ClientId(), keys, deadline);
+    // registered first: a close after this check finds the entry, one
+    // before it is caught here, so that Wake() never hands a value to a
+    // client that is gone
+    bool alive;
+    {
+        std::lock_guard<std::mutex> lk(_mutex);
+        alive = _ids.count(req.ClientId()) > 0;
+    }
+    if (!alive) {
+        _blocked->closed(req.ClientId());
+        return -1;
+    }
+    return 0;
+}
+
+bool Transport::Wake(const std::string& key, Response resp) {
+    if (!_blocked) {
+        return false;
+    }
+    int client_id = _blocked->wake(key);
+    if (client_id == -1) {
+        return false;
+    }
+    resp.SetClientId(client_id);
+    Send(std::move(resp));
+    return true;
+}
+
+void Transport::EnableKeySampling(int rate, size_t big_bytes) {
+    _sample_rate = rate > 0 ? rate : 1;
+    _big_key_bytes = big_bytes;
+}
+
+std::vector<KeyStat> Transport::HotKeys(int n) {
+    if (!_samplers) {
+        return std::vector<KeyStat>();
+    }
+    return KeySampler::hot(_samplers, NUM_REACTORS, n);
+}
+
+std::vector<KeyStat> Transport::BigKeys(int n) {
+    if (!_samplers) {
+        return std::vector<KeyStat>();
+    }
+    return KeySampler::big(_samplers, NUM_REACTORS, n);
+}
+
+void Transport::EnableNuma() {
+    _numa = true;
+}
+
+void Transport::EnableBusyPoll(int budget_us) {
+    _busy_poll_us = budget_us;
+    _recv_spin = SpinPolicy(budget_us);
+}
+
+void Transport::EnableCapture(const std::string& path, size_t buffer_size) {
+    _capture_path = path;
+    _capture_buffer = buffer_size;
+}
+
+std::vector<SlowLogEntry> Transport::SlowLogEntries() {
+    if (!_slowlog) {
+        return std::vector<SlowLogEntry>();
+    }
+    return _slowlog->entries();
+}
+
+TransportStats Transport::Stats() {
+    TransportStats ret;
+    if (!_stats) {
+        return ret;
+    }
+    ret.reactors.resize(send_queues.size());
+    for (int i = 0; i < (int)send_queues.size(); i++) {
+        const ReactorStats& s = _stats[i];
+        TransportStats::Reactor& r = ret.reactors[i];
+        r.accepts = s.accepts.get();
+        r.closes = s.closes.get();
+        r.bytes_in = s.bytes_in.get();
+        r.bytes_out = s.bytes_out.get();
+        r.commands = s.commands.get();
+        r.responses = s.responses.get();
+        r.rejected = s.rejected.get();
+        r.pubsub_messages = s.pubsub_messages.get();
+        r.tracking_invalidations = s.tracking_invalidations.get();
+        r.read_calls = s.read_calls.get();
+        r.write_calls = s.write_calls.get();
+        r.read_eagain = s.read_eagain.get();
+        r.write_eagain = s.write_eagain.get();
+        r.bulk_streamed = s.bulk_streamed.get();
+        r.coalesced = s.coalesced.get();
+        r.rate_limited = s.rate_limited.get();
+        r.rate_rejected = s.rate_rejected.get();
+        r.admission_shed = s.admission_shed.get();
+        r.blocking_timeouts = s.blocking_timeouts.get();
+        if (_caches) {
+            r.cache_hits = _caches[i].hits.get();
+            r.cache_misses = _caches[i].misses.get();
+            r.cache_evictions = _caches[i].evictions.get();
+            r.cache_bytes = _caches[i].bytes.get();
+            r.cache_entries = _caches[i].entries.get();
+        }
+        r.numa_local_accepts = s.numa_local_accepts.get();
+        r.numa_remote_accepts = s.numa_remote_accepts.get();
+        r.numa_node = _numa ? _reactor_node[i] : -1;
+        r.accept_queue = accept_queues[i].size();
+        r.send_queue = send_queues[i].size();
+        r.buffer_bytes = _pools[i].used.get();
+        r.pool_bytes = _pools[i].idle.get();
+        s.loop_us.snapshot(&r.loop_us);
+        for (int j = 0; j < Trace::STAGES; j++) {
+            s.stage_us[j].snapshot(&r.stage_us[j]);
+        }
+        s.total_us.snapshot(&r.total_us);
+        ret.total.merge(r);
+        ret.clients += _client_slabs[i].used();
+        ret.client_slab_bytes += _client_slabs[i].bytes();
+    }
+    ret.recv_channel = (int)_recv_channel->size();
+    ret.client_size = sizeof(Client);
+    if (_numa) {
+        ret.numa_nodes = (int)_node_reactors.size();
+    }
+    if (_pubsub) {
+        ret.pubsub = true;
+        ret.pubsub_channels = _pubsub->channels();
+        ret.pubsub_patterns = _pubsub->patterns();
+    }
+    if (_tracking) {
+        ret.tracking = true;
+        ret.tracking_keys = _tracking->keys();
+        ret.tracking_prefixes = _tracking->prefixes();
+    }
+    if (_coalescer) {
+        ret.coalescing = true;
+        ret.coalesce_flights = _coalescer->flights();
+    }
+    ret.response_cache = _caches != NULL;
+    if (_admission) {
+        ret.admission = true;
+        ret.admission_overloaded = _admission->overloaded();
+        ret.admission_min_sojourn_us = Clock::to_us(_admission->min_sojourn());
+        ret.admission_service_us = Clock::to_us(_admission->service_time());
+        ret.admission_shed = _admission->shed();
+        ret.admission_expired = _admission->expired();
+    }
+    if (_blocked) {
+        ret.blocking = true;
+        ret.blocked_clients = _blocked->blocked();
+    }
+    if (_samplers) {
+        ret.key_sampling = true;
+        ret.hot_keys = HotKeys();
+        ret.big_keys = BigKeys();
+    }
+    if (_capture) {
+        ret.capturing = true;
+        ret.capture_records = _capture->records();
+        ret.capture_dropped = _capture->dropped();
+    }
+    return ret;
+}
+
+std::string Transport::Info() {
+    return Stats().Format();
 }
 
 }; // namespace redis
@@ -1,5 +1,6 @@
 #ifndef NET_TRANSPORT_
 #define NET_TRANSPORT_
+#include <list>
 #include <unordered_map>
 #include <thread>
 #include <mutex>
@@ -7,6 +8,15 @@
 #include "Message.h"
 #include "Response.h"
 #include "SelectableQueue.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "SpinPolicy.h"
+#include "Service.h"
+#include "BulkSink.h"
+#include "KeySampler.h"
+#include "RateLimiter.h"
+#include "Slab.h"
+#include "link.h"
 
 template <class T>
 class Channel;
@@ -14,38 +24,299 @@ class Fdevents;
 
 namespace redis {
 
-class Link;
+class Capture;
+class PubSub;
+class ClientTracking;
+struct TrackingState;
+struct Flight;
+class Coalescer;
+class CacheEpochs;
+class ResponseCache;
+class BulkStream;
+class AdmissionControl;
+class BlockedClients;
 
 class Transport {
 public:
+    // reactor threads, clients are spread over them by id
+    static const int NUM_REACTORS = 4;
+
     Transport();
     ~Transport();
 
+    // Add a TCP listener, or a unix domain socket if ip is a path (see
+    // LinkAddr). May be called several times before Start(), connections
+    // from all listeners are spread over the same reactors.
+    int Listen(const std::string& ip, int port);
+    int Listen(const std::string& path);
+    int Start();
+    // Listen(ip, port) + Start()
     int Start(const std::string& ip, int port);
 
     // TODO: 优化
     Message Recv();
     void Send(const Response& resp);
+    // same, without copying resp
+    void Send(Response&& resp);
+
+    // point-in-time counters, gauges and histograms, safe to call from any thread
+    TransportStats Stats();
+    // INFO-style text dump of Stats()
+    std::string Info();
+
+    // Timestamp every request through each stage, must be called before
+    // Start(). Requests slower than slowlog_us end to end are kept in a ring
+    // of the last slowlog_len entries.
+    void EnableTracing(int slowlog_us, int slowlog_len = 128);
+    std::vector<SlowLogEntry> SlowLogEntries();
+
+    // Record every decoded request to a capture file, see Capture.h. Must
+    // be called before Start(), buffer_size is per reactor.
+    void EnableCapture(const std::string& path, size_t buffer_size = 4 * 1024 * 1024);
+
+    // Trade CPU for latency: reactors poll with epoll_wait(0) and Recv()
+    // polls the channel for up to budget_us before blocking, with adaptive
+    // back-off (see SpinPolicy). Accepted sockets get SO_BUSY_POLL. Must be
+    // called before Start().
+    void EnableBusyPoll(int budget_us);
+
+    // Process requests inside the reactors, see Service.h. Requests the
+    // service does not take still go to Recv(). Must be called before Start().
+    void SetService(ServiceFactory factory);
+
+    // Handle SUBSCRIBE, PSUBSCRIBE, PUBLISH and friends in the reactors,
+    // see PubSub.h. They never reach the service or Recv(). Must be called
+    // before Start().
+    void EnablePubSub();
+
+    // Answer HELLO in the reactors, and CLIENT TRACKING for clients that
+    // switched to RESP3, see ClientTracking.h. At most max_keys keys read by
+    // tracking clients are remembered. Must be called before Start().
+    void EnableClientTracking(size_t max_keys = 1000000);
+
+    // Spread the reactors over the NUMA nodes and pin each to the CPUs of
+    // its node, with its buffers and client structs in node-local memory.
+    // A connection goes to a reactor on the node of the CPU its packets
+    // arrive on (SO_INCOMING_CPU), and connections fed by the same NIC
+    // receive queue (SO_INCOMING_NAPI_ID) to the same reactor. Must be
+    // called before Start().
+    void EnableNuma();
+
+    // Arguments of at least threshold bytes are not buffered: once the
+    // command and the arguments before one are read, the reactor gets a
+    // sink for it from factory and writes it there as it arrives, and the
+    // request carries what the sink returned in its place. Peak memory per
+    // request is then bounded whatever the size of its values. See
+    // BulkSink.h. Must be called before Start().
+    void SetBulkSink(size_t threshold, BulkSinkFactory factory);
+
+    // Count one keyed request out of rate per reactor into a sketch of key
+    // frequencies, and note the keys of any requests or replies of at least
+    // big_bytes, see KeySampler.h. HotKeys() and BigKeys() return the top n
+    // of all the reactors, as of the last second, and INFO lists the top
+    // ten. Must be called before Start().
+    void EnableKeySampling(int rate = 16, size_t big_bytes = 64 * 1024);
+    std::vector<KeyStat> HotKeys(int n = 10);
+    std::vector<KeyStat> BigKeys(int n = 10);
+
+    // Single-flight for the given read commands (e.g. "get"): a request
+    // identical to one still waiting for its response is not passed to
+    // Recv(), it gets a copy of that response. See Coalescer.h. Must be
+    // called before Start().
+    void EnableCoalescing(const std::vector<std::string>& commands);
+
+    // Answer the given single-key read commands (e.g. "get") from a cache
+    // of encoded responses in each reactor, keyed by the raw request, of
+    // at most max_bytes per reactor; a response is served for at most
+    // ttl_ms. Writes passing through the reactors invalidate their keys,
+    // the application calls InvalidateCached() for changes made otherwise.
+    // See ResponseCache.h. Must be called before Start().
+    void EnableResponseCache(const std::vector<std::string>& commands, size_t max_bytes = 64 * 1024 * 1024,
+        int ttl_ms = 1000);
+    // drop the cached responses to reads of key, any thread
+    void InvalidateCached(const std::string& key);
+
+    // Token bucket limits on commands and bytes per second, for each client,
+    // for all the clients from one address together, and for each command
+    // name, checked in the reactors before a request is handled. A client
+    // over a limit is throttled: its request is held and its input is not
+    // read until its turn. Requests of the reject commands are answered
+    // with an error instead. See RateLimiter.h. Must be called before
+    // Start().
+    void SetRateLimits(const RateLimit& client, const RateLimit& address,
+        const std::unordered_map<std::string, RateLimit>& commands = {},
+        const std::vector<std::string>& reject = {});
+
+    // CoDel-style admission control on the Recv() queue: once requests
+    // have been waiting there longer than target_us for a whole interval_us,
+    // the reactors answer the requests the consumer would not get to in
+    // time with a -BUSY error rather than queue them, and Recv() answers the
+    // ones that waited more than twice the target with -BUSY too. Recv()
+    // also drops requests that waited longer than deadline_us (0 for no
+    // limit) or than the client asked for with CLIENT DEADLINE <ms>,
+    // whichever is shorter, answering -TIMEOUT. With a service set, the reactors shed nothing, as
+    // they cannot tell which requests it takes. See AdmissionControl.h.
+    // Must be called before Start().
+    void EnableAdmissionControl(int target_us = 5000, int interval_us = 100000, int deadline_us = 0);
+
+    // Server-side blocking for commands flagged CMD_FLAG_BLOCKING (BLPOP,
+    // BRPOP): after passing one to Recv(), the reactor reads no more of the
+    // client's input until it is answered. The consumer either answers it
+    // right away or calls Block(), which parks the client on keys (by
+    // default those of req, Message::Key() and on) for up to timeout_ms, 0
+    // for ever, and the consumer moves on. Wake() of one of the keys then answers the
+    // client that waited longest on it with resp, and returns false if
+    // nobody waits, resp is not sent then. A client whose time is up gets a
+    // nil reply from its reactor. See BlockedClients.h. Must be called
+    // before Start().
+    void EnableBlocking();
+    // -1 unless blocking is enabled, req is of a blocking command and its
+    // client is still connected
+    int Block(const Message& req, int timeout_ms);
+    int Block(const Message& req, const std::vector<std::string>& keys, int timeout_ms);
+    bool Wake(const std::string& key, Response resp);
 
 private:
+    friend class Reactor;
+    friend class PubSub;
+    friend class ClientTracking;
+    friend class Coalescer;
+
+    // Allocated from its reactor's slab with the link embedded, a few hundred
+    // bytes for an idle client: its buffers come from the reactor's
+    // BufferPool only while there is input or output.
     struct Client {
         int id;
+        // protocol version chosen with HELLO
+        int proto = 2;
+        bool closing = false;
+        // &conn
         Link* link;
+        // traced responses waiting for the output buffer to drain
+        std::vector<Trace> traces;
+        // requests handed to the service or Recv(), and responses written
+        // for them; responses come back in request order
+        uint64_t passed = 0;
+        uint64_t answered = 0;
+        // responses made by the reactor itself while requests before them
+        // were still unanswered, with the `passed` they have to wait for
+        // (a list, as an empty deque already allocates)
+        std::list<std::pair<uint64_t, std::string>> held;
+        // NULL unless the client used CLIENT TRACKING, or wrote while
+        // someone tracked
+        TrackingState* tracking = NULL;
+        // the request being streamed to a BulkSink, if any
+        BulkStream* stream = NULL;
+        // `passed` of the last request whose reply the KeySampler waits
+        // for, 0 if none
+        uint64_t sampled = 0;
+        // the flight the client leads, and `passed` of its request
+        Flight* flight = NULL;
+        uint64_t flight_at = 0;
+        // id of the flight a request of the client is parked on, 0 if none;
+        // no more input is read meanwhile
+        uint64_t parked = 0;
+        // `passed` of the request whose response the ResponseCache waits
+        // for, 0 if none
+        uint64_t cache_at = 0;
+        // CacheEpochs slots of the keys of writes not answered yet, with
+        // their `passed`
+        std::list<std::pair<uint64_t, uint32_t>> cache_writes;
+        // NULL unless rate limited
+        ClientRate* rate = NULL;
+        // a request held back by the rate limiter, and when its turn comes
+        // (Clock), 0 if none
+        HeldRequest* limited = NULL;
+        uint64_t resume_at = 0;
+        // set with CLIENT DEADLINE, 0 if none
+        uint32_t deadline_ms = 0;
+        // `passed` of a blocking request not answered yet, 0 if none; no
+        // more input is read meanwhile
+        uint64_t blocking = 0;
+        Link conn;
     };
 
     static void main_func(Transport* xport);
+    // reactor for a connection just accepted, -1 to go by client id
+    int pick_reactor(Link* link);
+    // an unused client id, one of reactor index if not -1
+    int new_client_id(int index);
+    // false if the AdmissionControl turned down msg, which is answered
+    bool admitted(const Message& msg);
     std::thread _main_thread;
 
     static void recv_func(Transport* xport, int index);
     std::vector<std::thread> recv_threads;
     std::vector<SelectableQueue<Client*>> accept_queues;
     std::vector<SelectableQueue<Response>> send_queues;
+    ReactorStats* _stats;
+    // one per reactor
+    BufferPool* _pools;
+    // one per reactor
+    Slab<Client>* _client_slabs;
 
     int _id_incr;
-    Link* _serv_link;
+    std::vector<Link*> _serv_links;
     Channel<Message>* _recv_channel;
     std::atomic<bool> _close_flag;
 
+    bool _tracing;
+    uint64_t _slowlog_ticks;
+    SlowLog* _slowlog;
+
+    std::string _capture_path;
+    size_t _capture_buffer;
+    Capture* _capture;
+
+    int _busy_poll_us;
+    SpinPolicy _recv_spin;
+
+    ServiceFactory _service_factory;
+    bool _pubsub_enabled;
+    PubSub* _pubsub;
+    size_t _tracking_keys;
+    ClientTracking* _tracking;
+    std::vector<std::string> _coalesce_commands;
+    Coalescer* _coalescer;
+
+    // by CommandId, empty unless EnableResponseCache()
+    std::vector<bool> _cache_commands;
+    size_t _cache_bytes;
+    int _cache_ttl_ms;
+    CacheEpochs* _cache_epochs;
+    // one per reactor
+    ResponseCache* _caches;
+
+    bool _rate_limits;
+    RateLimit _client_limit;
+    RateLimit _address_limit;
+    std::unordered_map<std::string, RateLimit> _command_limits;
+    std::vector<std::string> _reject_commands;
+    RateLimiter* _limiter;
+
+    int _admission_target_us;
+    int _admission_interval_us;
+    int _admission_deadline_us;
+    AdmissionControl* _admission;
+
+    bool _blocking_enabled;
+    BlockedClients* _blocked;
+
+    size_t _bulk_threshold;
+    BulkSinkFactory _bulk_factory;
+
+    int _sample_rate;
+    size_t _big_key_bytes;
+    // one per reactor
+    KeySampler* _samplers;
+
+    bool _numa;
+    // node of each reactor, reactors of each node, next one to pick
+    // (accept thread) of each node
+    std::vector<int> _reactor_node;
+    std::vector<std::vector<int>> _node_reactors;
+    std::vector<unsigned int> _node_next;
+
     std::mutex _mutex;
     std::unordered_map<int, int> _ids;
 };
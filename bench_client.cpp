@@ -0,0 +1,395 @@
+// RESP load generator.
+//
+// Closed loop: every connection keeps `pipeline` requests in flight and
+// issues a new one as soon as a reply arrives.
+// Open loop (--rate): requests are scheduled at a fixed aggregate rate,
+// independent of how fast the server answers. Latency is measured from the
+// scheduled start, not from the moment the request could actually be sent,
+// so a stalled server is not hidden by coordinated omission.
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Clock.h"
+#include "Message.h"
+#include "Reply.h"
+#include "Stats.h"
+#include "fde.h"
+#include "link.h"
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    int conns = 50;
+    int threads = 4;
+    int pipeline = 1;
+    int seconds = 10;
+    double rate = 0; // requests per second, 0: closed loop
+    int keys = 100000;
+    bool zipf = false;
+    double theta = 0.99;
+    int value_size = 32;
+    std::vector<std::pair<std::string, int>> mix;
+    int mix_total = 0;
+};
+
+static Options opt;
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -h, --host HOST        server host (127.0.0.1)\n"
+        "  -p, --port PORT        server port (6379)\n"
+        "  -c, --conns N          total connections (50)\n"
+        "  -t, --threads N        client threads (4)\n"
+        "  -P, --pipeline N       max requests in flight per connection (1)\n"
+        "  -d, --duration SEC     test duration (10)\n"
+        "  -r, --rate QPS         open loop at QPS requests/s, 0 for closed loop (0)\n"
+        "  -m, --mix SPEC         command mix, e.g. get=80,set=20 (get=100)\n"
+        "                         commands: get set del incr ping\n"
+        "  -k, --keys N           key space size (100000)\n"
+        "  -z, --zipf THETA       zipf key distribution, uniform if omitted\n"
+        "  -v, --value-size N     SET value size in bytes (32)\n",
+        prog);
+}
+
+static int parse_mix(const char* spec) {
+    opt.mix.clear();
+    opt.mix_total = 0;
+    std::string s(spec);
+    size_t pos = 0;
+    while (pos < s.size()) {
+        size_t end = s.find(',', pos);
+        if (end == std::string::npos) {
+            end = s.size();
+        }
+        std::string item = s.substr(pos, end - pos);
+        size_t eq = item.find('=');
+        std::string name = item.substr(0, eq);
+        int weight = eq == std::string::npos ? 1 : atoi(item.c_str() + eq + 1);
+        if (name != "get" && name != "set" && name != "del" && name != "incr" && name != "ping") {
+            fprintf(stderr, "unknown command in mix: %s\n", name.c_str());
+            return -1;
+        }
+        if (weight > 0) {
+            opt.mix.push_back(std::make_pair(name, weight));
+            opt.mix_total += weight;
+        }
+        pos = end + 1;
+    }
+    return opt.mix_total > 0 ? 0 : -1;
+}
+
+// Zipfian ranks in [0, n), Gray et al. "Quickly generating billion-record
+// synthetic databases". O(n) setup, O(1) per sample.
+class Zipf {
+public:
+    Zipf(int n, double theta) {
+        _n = n;
+        _theta = theta;
+        double zeta2 = 1 + pow(0.5, theta);
+        _zetan = 0;
+        for (int i = 1; i <= n; i++) {
+            _zetan += 1.0 / pow(i, theta);
+        }
+        _alpha = 1.0 / (1.0 - theta);
+        _eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / _zetan);
+        _half_pow = 1 + pow(0.5, theta);
+    }
+
+    int next(double u) const {
+        double uz = u * _zetan;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < _half_pow) {
+            return 1;
+        }
+        int ret = (int)(_n * pow(_eta * u - _eta + 1, _alpha));
+        return ret < _n ? ret : _n - 1;
+    }
+
+private:
+    int _n;
+    double _theta;
+    double _zetan;
+    double _alpha;
+    double _eta;
+    double _half_pow;
+};
+
+static Zipf* zipf = NULL;
+
+struct Conn {
+    redis::Link* link;
+    std::string input;
+    // scheduled start of each request in flight, in Clock ticks
+    std::deque<uint64_t> starts;
+    // open loop: scheduled start of the next request
+    uint64_t next_ts;
+};
+
+struct Worker {
+    int index;
+    int conns;
+    uint64_t done = 0;
+    uint64_t errors = 0;
+    redis::HistogramData latency;
+    std::thread thread;
+};
+
+static std::string value;
+
+static redis::Message make_request(std::mt19937_64& rng) {
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    int pick = (int)(rng() % opt.mix_total);
+    std::string cmd;
+    for (auto& p : opt.mix) {
+        if (pick < p.second) {
+            cmd = p.first;
+            break;
+        }
+        pick -= p.second;
+    }
+    if (cmd == "ping") {
+        return redis::Message(std::vector<std::string>{"ping"});
+    }
+    int k = zipf ? zipf->next(unit(rng)) : (int)(rng() % opt.keys);
+    std::string key = "key:" + std::to_string(k);
+    if (cmd == "set") {
+        return redis::Message(std::vector<std::string>{cmd, key, value});
+    }
+    return redis::Message(std::vector<std::string>{cmd, key});
+}
+
+static void worker_func(Worker* w) {
+    std::mt19937_64 rng(w->index * 7919 + 1);
+    Fdevents fdes;
+    std::vector<Conn*> conns;
+    for (int i = 0; i < w->conns; i++) {
+        redis::Link* link = redis::Link::connect(opt.host.c_str(), opt.port);
+        if (!link) {
+            fprintf(stderr, "connect %s:%d failed: %s\n", opt.host.c_str(), opt.port, strerror(errno));
+            exit(1);
+        }
+        link->noblock(true);
+        Conn* conn = new Conn();
+        conn->link = link;
+        conn->next_ts = 0;
+        fdes.set(link->fd(), FDEVENT_IN, 0, conn);
+        conns.push_back(conn);
+    }
+
+    int total_conns = opt.conns;
+    uint64_t interval = 0;
+    if (opt.rate > 0) {
+        interval = redis::Clock::from_us((uint64_t)(1000000.0 * total_conns / opt.rate));
+    }
+    uint64_t stime = redis::Clock::now();
+    uint64_t etime = stime + redis::Clock::from_us((uint64_t)opt.seconds * 1000000);
+    for (int i = 0; i < (int)conns.size(); i++) {
+        // spread the first request of each connection over one interval
+        conns[i]->next_ts = stime + interval * i / conns.size();
+    }
+
+    char buf[16 * 1024];
+    while (1) {
+        uint64_t now = redis::Clock::now();
+        if (now >= etime) {
+            break;
+        }
+        for (auto conn : conns) {
+            bool sent = false;
+            while ((int)conn->starts.size() < opt.pipeline) {
+                uint64_t start = now;
+                if (interval) {
+                    if (conn->next_ts > now) {
+                        break;
+                    }
+                    start = conn->next_ts;
+                    conn->next_ts += interval;
+                }
+                conn->link->send(make_request(rng));
+                conn->starts.push_back(start);
+                sent = true;
+            }
+            if (sent) {
+                if (conn->link->write() == -1) {
+                    fprintf(stderr, "write error\n");
+                    exit(1);
+                }
+                if (conn->link->output_size() > 0) {
+                    fdes.set(conn->link->fd(), FDEVENT_OUT, 0, conn);
+                }
+            }
+        }
+
+        const Fdevents::events_t* events = fdes.wait(interval ? 0 : 10);
+        if (events == NULL) {
+            exit(1);
+        }
+        for (int i = 0; i < (int)events->size(); i++) {
+            const Fdevent* fde = events->at(i);
+            Conn* conn = (Conn*)fde->data.ptr;
+            if (fde->events & FDEVENT_OUT) {
+                if (conn->link->write() == -1) {
+                    fprintf(stderr, "write error\n");
+                    exit(1);
+                }
+                if (conn->link->output_size() == 0) {
+                    fdes.clr(conn->link->fd(), FDEVENT_OUT);
+                }
+            }
+            if (!(fde->events & (FDEVENT_IN | FDEVENT_ERR))) {
+                continue;
+            }
+            int len = ::read(conn->link->fd(), buf, sizeof(buf));
+            if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+                fprintf(stderr, "connection closed by server\n");
+                exit(1);
+            }
+            if (len < 0) {
+                continue;
+            }
+            conn->input.append(buf, len);
+
+            uint64_t done_ts = redis::Clock::now();
+            int off = 0;
+            while (1) {
+                int n = redis::Reply::Skip(conn->input.data() + off, conn->input.size() - off);
+                if (n == -1) {
+                    fprintf(stderr, "protocol error\n");
+                    exit(1);
+                }
+                if (n == 0) {
+                    break;
+                }
+                if (conn->input[off] == '-') {
+                    w->errors++;
+                }
+                off += n;
+                if (conn->starts.empty()) {
+                    fprintf(stderr, "unexpected reply\n");
+                    exit(1);
+                }
+                uint64_t start = conn->starts.front();
+                conn->starts.pop_front();
+                if (done_ts < etime) {
+                    w->done++;
+                    w->latency.add(redis::Clock::to_us(done_ts - start));
+                }
+            }
+            conn->input.erase(0, off);
+        }
+    }
+
+    for (auto conn : conns) {
+        delete conn->link;
+        delete conn;
+    }
+}
+
+int main(int argc, char** argv) {
+    static struct option long_opts[] = {
+        {"host", required_argument, 0, 'h'},
+        {"port", required_argument, 0, 'p'},
+        {"conns", required_argument, 0, 'c'},
+        {"threads", required_argument, 0, 't'},
+        {"pipeline", required_argument, 0, 'P'},
+        {"duration", required_argument, 0, 'd'},
+        {"rate", required_argument, 0, 'r'},
+        {"mix", required_argument, 0, 'm'},
+        {"keys", required_argument, 0, 'k'},
+        {"zipf", required_argument, 0, 'z'},
+        {"value-size", required_argument, 0, 'v'},
+        {"help", no_argument, 0, '?'},
+        {0, 0, 0, 0},
+    };
+    parse_mix("get=100");
+    int c;
+    while ((c = getopt_long(argc, argv, "h:p:c:t:P:d:r:m:k:z:v:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'h': opt.host = optarg; break;
+        case 'p': opt.port = atoi(optarg); break;
+        case 'c': opt.conns = atoi(optarg); break;
+        case 't': opt.threads = atoi(optarg); break;
+        case 'P': opt.pipeline = atoi(optarg); break;
+        case 'd': opt.seconds = atoi(optarg); break;
+        case 'r': opt.rate = atof(optarg); break;
+        case 'm':
+            if (parse_mix(optarg) == -1) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k': opt.keys = atoi(optarg); break;
+        case 'z': opt.zipf = true; opt.theta = atof(optarg); break;
+        case 'v': opt.value_size = atoi(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.conns <= 0 || opt.threads <= 0 || opt.pipeline <= 0 || opt.keys <= 0 || opt.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.zipf && (opt.theta <= 0 || opt.theta >= 1)) {
+        fprintf(stderr, "zipf theta must be in (0, 1)\n");
+        return 1;
+    }
+    if (opt.threads > opt.conns) {
+        opt.threads = opt.conns;
+    }
+    if (opt.zipf) {
+        zipf = new Zipf(opt.keys, opt.theta);
+    }
+    value.assign(opt.value_size, 'x');
+
+    std::vector<Worker*> workers;
+    for (int i = 0; i < opt.threads; i++) {
+        Worker* w = new Worker();
+        w->index = i;
+        w->conns = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+        workers.push_back(w);
+    }
+    for (auto w : workers) {
+        w->thread = std::thread(worker_func, w);
+    }
+
+    uint64_t done = 0;
+    uint64_t errors = 0;
+    redis::HistogramData latency;
+    for (auto w : workers) {
+        w->thread.join();
+        done += w->done;
+        errors += w->errors;
+        latency.merge(w->latency);
+        delete w;
+    }
+    delete zipf;
+
+    printf("mode: %s", opt.rate > 0 ? "open loop" : "closed loop");
+    if (opt.rate > 0) {
+        printf(", target %.0f req/s", opt.rate);
+    }
+    printf("\nconnections: %d, threads: %d, pipeline: %d, keys: %d (%s)\n",
+        opt.conns, opt.threads, opt.pipeline, opt.keys, opt.zipf ? "zipf" : "uniform");
+    printf("requests: %llu, errors: %llu, duration: %ds\n",
+        (unsigned long long)done, (unsigned long long)errors, opt.seconds);
+    printf("throughput: %.0f req/s\n", (double)done / opt.seconds);
+    printf("latency(us): mean=%llu p50=%llu p99=%llu p999=%llu max=%llu\n",
+        (unsigned long long)latency.mean(),
+        (unsigned long long)latency.percentile(50),
+        (unsigned long long)latency.percentile(99),
+        (unsigned long long)latency.percentile(99.9),
+        (unsigned long long)latency.max);
+    return 0;
+}
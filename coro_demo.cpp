@@ -0,0 +1,124 @@
+// A server whose requests are handled by coroutines, see CoroService.h.
+//
+// Usage: coro_demo [--port 6379] [--workers 4] [--backend host:port]
+//   PING              answered without suspending
+//   SLEEP ms          suspends on a timer, no thread is held meanwhile
+//   SET key value     keys live on the reactor of their hash, the handler
+//   GET key           hops there and back (cross-shard call)
+//   DIGEST data n     n rounds of FNV-1a on a worker thread
+//   FWD cmd args...   sends cmd args... to the backend, returns its reply
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Connection.h"
+#include "CoroService.h"
+#include "Transport.h"
+
+using namespace redis;
+
+static WorkerPool* workers = NULL;
+static std::string backend_host;
+static int backend_port = 0;
+// by reactor, only touched on its thread
+static std::vector<std::unordered_map<std::string, std::string>> stores(Transport::NUM_REACTORS);
+static std::vector<Connection*> backends(Transport::NUM_REACTORS);
+
+static Task<Response> handle(CoroService* svc, Message req) {
+    // req is the frame's own copy, args stay valid across co_await
+    Response resp(req);
+    std::string cmd = req.Cmd();
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::tolower);
+    const std::vector<std::string>& args = req.Vals();
+
+    if (cmd == "ping") {
+        resp.ReplyRaw("+PONG\r\n");
+    } else if (cmd == "sleep" && args.size() == 2) {
+        co_await svc->sleep(atoi(args[1].c_str()));
+        resp.ReplyOK();
+    } else if ((cmd == "set" && args.size() == 3) || (cmd == "get" && args.size() == 2)) {
+        std::string key = args[1];
+        std::string val = cmd == "set" ? args[2] : "";
+        int shard = (int)(std::hash<std::string>()(key) % Transport::NUM_REACTORS);
+        co_await resume_on(svc->shard(shard));
+        auto& store = stores[shard];
+        if (cmd == "set") {
+            store[key] = val;
+            resp.ReplyOK();
+        } else {
+            auto it = store.find(key);
+            if (it == store.end()) {
+                resp.ReplyNotFound();
+            } else {
+                resp.ReplyBulk(it->second);
+            }
+        }
+    } else if (cmd == "digest" && args.size() == 3) {
+        std::string data = args[1];
+        int rounds = atoi(args[2].c_str());
+        co_await resume_on(workers);
+        uint64_t h = 14695981039346656037ULL;
+        for (int i = 0; i < rounds; i++) {
+            for (unsigned char c : data) {
+                h = (h ^ c) * 1099511628211ULL;
+            }
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)h);
+        resp.ReplyBulk(buf);
+    } else if (cmd == "fwd" && args.size() >= 2 && backend_port > 0) {
+        Message fwd(std::vector<std::string>(args.begin() + 1, args.end()));
+        Connection*& conn = backends[svc->index()];
+        if (!conn || conn->closed()) {
+            conn = svc->connect(backend_host, backend_port);
+        }
+        if (!conn) {
+            resp.ReplyError("backend unreachable");
+            co_return resp;
+        }
+        Reply reply = co_await svc->call(conn, fwd);
+        resp.ReplyRaw(reply.Encode());
+    } else {
+        resp.ReplyError("unknown command '" + cmd + "'");
+    }
+    co_return resp;
+}
+
+int main(int argc, char** argv) {
+    int port = 6379;
+    int nworkers = 4;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            nworkers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc) {
+            std::string s = argv[++i];
+            size_t pos = s.rfind(':');
+            if (pos == std::string::npos) {
+                fprintf(stderr, "bad backend: %s\n", s.c_str());
+                return -1;
+            }
+            backend_host = s.substr(0, pos);
+            backend_port = atoi(s.c_str() + pos + 1);
+        }
+    }
+
+    workers = new WorkerPool(nworkers);
+    CoroGroup group(handle, Transport::NUM_REACTORS);
+    Transport xport;
+    xport.SetService(group.factory());
+    if (xport.Start("127.0.0.1", port) == -1) {
+        return -1;
+    }
+    // the service takes every request
+    while (1) {
+        pause();
+    }
+    return 0;
+}
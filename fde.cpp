@@ -5,14 +5,22 @@ found in the LICENSE file.
 */
 #include "fde.h"
 
-struct Fdevent* Fdevents::get_fde(int fd) {
-    while ((int)events.size() <= fd) {
+// Fdevents are allocated for the fds actually set, the fds of a process
+// are shared by all the Fdevents instances of its threads.
+struct Fdevent* Fdevents::get_fde(int fd, bool create) {
+    if ((int)events.size() <= fd) {
+        if (!create) {
+            return NULL;
+        }
+        events.resize(fd + 1, NULL);
+    }
+    if (!events[fd] && create) {
         struct Fdevent* fde = new Fdevent();
-        fde->fd = events.size();
+        fde->fd = fd;
         fde->s_flags = FDEVENT_NONE;
         fde->data.num = 0;
         fde->data.ptr = NULL;
-        events.push_back(fde);
+        events[fd] = fde;
     }
     return events[fd];
 }
@@ -25,6 +33,9 @@ Fdevents::~Fdevents() {
     for (int i = 0; i < (int)events.size(); i++) {
         delete events[i];
     }
+    for (int i = 0; i < (int)deleted_events.size(); i++) {
+        delete deleted_events[i];
+    }
     if (ep_fd) {
         ::close(ep_fd);
     }
@@ -33,8 +44,8 @@ Fdevents::~Fdevents() {
 }
 
 bool Fdevents::isset(int fd, int flag) {
-    struct Fdevent* fde = get_fde(fd);
-    return (bool)(fde->s_flags & flag);
+    struct Fdevent* fde = get_fde(fd, false);
+    return fde && (bool)(fde->s_flags & flag);
 }
 
 int Fdevents::set(int fd, int flags, int data_num, void* data_ptr) {
@@ -55,6 +66,8 @@ int Fdevents::set(int fd, int flags, int data_num, void* data_ptr) {
         epe.events |= EPOLLIN;
     if (fde->s_flags & FDEVENT_OUT)
         epe.events |= EPOLLOUT;
+    if (fde->s_flags & FDEVENT_HUP)
+        epe.events |= EPOLLRDHUP;
 
     int ret = epoll_ctl(ep_fd, ctl_op, fd, &epe);
     if (ret == -1) {
@@ -66,18 +79,22 @@ int Fdevents::set(int fd, int flags, int data_num, void* data_ptr) {
 int Fdevents::del(int fd) {
     struct epoll_event epe;
     int ret = epoll_ctl(ep_fd, EPOLL_CTL_DEL, fd, &epe);
+
+    // fails if clr() took the last flag off, forget the fd anyway
+    struct Fdevent* fde = get_fde(fd, false);
+    if (fde) {
+        events[fd] = NULL;
+        deleted_events.push_back(fde);
+    }
     if (ret == -1) {
         return -1;
     }
-
-    struct Fdevent* fde = get_fde(fd);
-    fde->s_flags = FDEVENT_NONE;
     return 0;
 }
 
 int Fdevents::clr(int fd, int flags) {
-    struct Fdevent* fde = get_fde(fd);
-    if (!(fde->s_flags & flags)) {
+    struct Fdevent* fde = get_fde(fd, false);
+    if (!fde || !(fde->s_flags & flags)) {
         return 0;
     }
 
@@ -91,6 +108,8 @@ int Fdevents::clr(int fd, int flags) {
         epe.events |= EPOLLIN;
     if (fde->s_flags & FDEVENT_OUT)
         epe.events |= EPOLLOUT;
+    if (fde->s_flags & FDEVENT_HUP)
+        epe.events |= EPOLLRDHUP;
 
     int ret = epoll_ctl(ep_fd, ctl_op, fd, &epe);
     if (ret == -1) {
@@ -101,6 +120,10 @@ int Fdevents::clr(int fd, int flags) {
 
 const Fdevents::events_t* Fdevents::wait(int timeout_ms) {
     ready_events.clear();
+    for (int i = 0; i < (int)deleted_events.size(); i++) {
+        delete deleted_events[i];
+    }
+    deleted_events.clear();
 
     int nfds = epoll_wait(ep_fd, ep_events, MAX_FDS, timeout_ms);
     if (nfds == -1) {
@@ -121,6 +144,8 @@ const Fdevents::events_t* Fdevents::wait(int timeout_ms) {
             fde->events |= FDEVENT_IN;
         if (epe->events & EPOLLOUT)
             fde->events |= FDEVENT_OUT;
+        if (epe->events & EPOLLRDHUP)
+            fde->events |= FDEVENT_HUP;
         if (epe->events & EPOLLHUP)
             fde->events |= FDEVENT_ERR;
         if (epe->events & EPOLLERR)
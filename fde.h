@@ -18,6 +18,7 @@ found in the LICENSE file.
 #define FDEVENT_IN (1 << 0)
 #define FDEVENT_PRI (1 << 1)
 #define FDEVENT_OUT (1 << 2)
+// the peer closed its end (EPOLLRDHUP), e.g. while input is not read
 #define FDEVENT_HUP (1 << 3)
 #define FDEVENT_ERR (1 << 4)
 
@@ -40,10 +41,13 @@ private:
     static const int MAX_FDS = 8 * 1024;
     int ep_fd;
     struct epoll_event ep_events[MAX_FDS];
+    // by fd, NULL for fds never set or deleted
     events_t events;
     events_t ready_events;
+    // deleted since the last wait(), may still be in ready_events
+    events_t deleted_events;
 
-    struct Fdevent* get_fde(int fd);
+    struct Fdevent* get_fde(int fd, bool create = true);
 
 public:
     Fdevents();
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <netdb.h>
 
 #include "link.h"
@@ -12,12 +14,19 @@ namespace redis {
 
 Link::Link() {
     sock = -1;
+    family = AF_INET;
     noblock_ = false;
+    pool_ = NULL;
+    send_chain_pos = 0;
+    send_chain_off = 0;
+    send_chain_size = 0;
     remote_ip[0] = '\0';
     remote_port = -1;
 }
 
 Link::~Link() {
+    recv_buf.release(pool_);
+    send_buf.release(pool_);
     this->close();
 }
 
@@ -37,6 +46,18 @@ void Link::keepalive(bool enable) {
     ::setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, (void*)&opt, sizeof(opt));
 }
 
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+void Link::busy_poll(int usec) {
+    int opt = usec > 0 ? usec : 0;
+    // raising it above net.core.busy_read needs CAP_NET_ADMIN, best effort
+    ::setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, (void*)&opt, sizeof(opt));
+    opt = usec > 0 ? 1 : 0;
+    ::setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void*)&opt, sizeof(opt));
+}
+
 void Link::noblock(bool enable) {
     noblock_ = enable;
     if (enable) {
@@ -46,6 +67,31 @@ void Link::noblock(bool enable) {
     }
 }
 
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU 49
+#endif
+#ifndef SO_INCOMING_NAPI_ID
+#define SO_INCOMING_NAPI_ID 56
+#endif
+
+int Link::incoming_cpu() const {
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    if (::getsockopt(sock, SOL_SOCKET, SO_INCOMING_CPU, (void*)&cpu, &len) == -1) {
+        return -1;
+    }
+    return cpu;
+}
+
+unsigned int Link::incoming_napi_id() const {
+    unsigned int id = 0;
+    socklen_t len = sizeof(id);
+    if (::getsockopt(sock, SOL_SOCKET, SO_INCOMING_NAPI_ID, (void*)&id, &len) == -1) {
+        return 0;
+    }
+    return id;
+}
+
 static bool is_ip(const char* host) {
     if (strchr(host, ':') != NULL) {
         return true;
@@ -69,59 +115,147 @@ static bool is_ip(const char* host) {
     return dot_count == 3;
 }
 
+// thread-safe replacement for gethostbyname()
+static int resolve(const char* host, char* buf, int size) {
+    struct addrinfo hints;
+    struct addrinfo* res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0) {
+        return -1;
+    }
+    int ret = -1;
+    for (struct addrinfo* p = res; p; p = p->ai_next) {
+        void* addr;
+        if (p->ai_family == AF_INET) {
+            addr = &((struct sockaddr_in*)p->ai_addr)->sin_addr;
+        } else if (p->ai_family == AF_INET6) {
+            addr = &((struct sockaddr_in6*)p->ai_addr)->sin6_addr;
+        } else {
+            continue;
+        }
+        if (inet_ntop(p->ai_family, addr, buf, size)) {
+            ret = 0;
+            break;
+        }
+    }
+    freeaddrinfo(res);
+    return ret;
+}
+
 Link* Link::connect(const char* host, int port) {
+    return connect(host, port, false);
+}
+
+Link* Link::connect_noblock(const char* host, int port) {
+    return connect(host, port, true);
+}
+
+Link* Link::connect(const char* host, int port, bool noblock) {
     Link* link;
     int sock = -1;
 
     char ip_resolve[INET6_ADDRSTRLEN];
-    if (!is_ip(host)) {
-        struct hostent* hptr = gethostbyname(host);
-        for (int i = 0; hptr && hptr->h_addr_list[i] != NULL; i++) {
-            struct in_addr* addr = (struct in_addr*)hptr->h_addr_list[i];
-            if (inet_ntop(AF_INET, addr, ip_resolve, sizeof(ip_resolve))) {
-                //printf("resolve %s: %s\n", host, ip_resolve);
-                host = ip_resolve;
-                break;
-            }
+    if (!LinkAddr::is_unix(host) && !is_ip(host)) {
+        if (resolve(host, ip_resolve, sizeof(ip_resolve)) == 0) {
+            host = ip_resolve;
         }
     }
 
-    LinkAddr addr(host, port);
-
+    LinkAddr addr(AF_INET);
+    if (addr.parse(host, port) == -1) {
+        goto sock_err;
+    }
     if ((sock = ::socket(addr.family, SOCK_STREAM, 0)) == -1) {
         goto sock_err;
     }
+    if (noblock) {
+        ::fcntl(sock, F_SETFL, O_NONBLOCK | O_RDWR);
+    }
     if (::connect(sock, addr.addr(), addr.addrlen) == -1) {
-        goto sock_err;
+        if (!noblock || errno != EINPROGRESS) {
+            goto sock_err;
+        }
     }
 
     //log_debug("fd: %d, connect to %s:%d", sock, ip, port);
     link = new Link();
-    link->ipv4 = addr.ipv4;
+    link->family = addr.family;
     link->sock = sock;
-    link->keepalive(true);
-    link->nodelay(true);
+    link->noblock_ = noblock;
+    if (!addr.unix_domain()) {
+        link->keepalive(true);
+        link->nodelay(true);
+    }
     return link;
 sock_err:
     //log_debug("connect to %s:%d failed: %s", ip, port, strerror(errno));
     if (sock >= 0) {
+        int err = errno;
         ::close(sock);
+        errno = err;
     }
     return NULL;
 }
 
+int Link::finish_connect() {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) == -1) {
+        return -1;
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Removes the socket file at addr if it is left by a previous run: a
+// socket nobody listens on. Anything else there, or a live server, is
+// EADDRINUSE.
+static int remove_stale_socket(LinkAddr& addr) {
+    struct stat st;
+    if (::lstat(addr.path(), &st) == -1) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        errno = EADDRINUSE;
+        return -1;
+    }
+    int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1) {
+        return -1;
+    }
+    int ret = ::connect(sock, addr.addr(), addr.addrlen);
+    int err = errno;
+    ::close(sock);
+    if (ret == -1 && err == ECONNREFUSED) {
+        return ::unlink(addr.path());
+    }
+    errno = EADDRINUSE;
+    return -1;
+}
+
 Link* Link::listen(const char* ip, int port) {
     Link* link;
     int sock = -1;
-    LinkAddr addr(ip, port);
+    LinkAddr addr(AF_INET);
 
     int opt = 1;
+    if (addr.parse(ip, port) == -1) {
+        goto sock_err;
+    }
     if ((sock = ::socket(addr.family, SOCK_STREAM, 0)) == -1) {
         goto sock_err;
     }
     if (::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) == -1) {
         goto sock_err;
     }
+    if (addr.path() && remove_stale_socket(addr) == -1) {
+        goto sock_err;
+    }
     if (::bind(sock, addr.addr(), addr.addrlen) == -1) {
         goto sock_err;
     }
@@ -131,7 +265,7 @@ Link* Link::listen(const char* ip, int port) {
     //log_debug("server socket fd: %d, listen on: %s:%d", sock, ip, port);
 
     link = new Link();
-    link->ipv4 = addr.ipv4;
+    link->family = addr.family;
     link->sock = sock;
     snprintf(link->remote_ip, sizeof(link->remote_ip), "%s", ip);
     link->remote_port = port;
@@ -144,15 +278,41 @@ sock_err:
     return NULL;
 }
 
+Link* Link::connect(const char* path) {
+    return connect(path, 0);
+}
+
+Link* Link::listen(const char* path) {
+    return listen(path, 0);
+}
+
+void Link::adopt(Link* other) {
+    this->close();
+    sock = other->sock;
+    family = other->family;
+    noblock_ = other->noblock_;
+    memcpy(remote_ip, other->remote_ip, sizeof(remote_ip));
+    remote_port = other->remote_port;
+    other->sock = -1;
+}
+
 Link* Link::accept() {
-    Link* link;
+    Link* link = new Link();
+    if (accept(link) == -1) {
+        delete link;
+        return NULL;
+    }
+    return link;
+}
+
+int Link::accept(Link* link) {
     int client_sock;
-    LinkAddr addr(this->ipv4);
+    LinkAddr addr(this->family);
 
     while ((client_sock = ::accept(sock, addr.addr(), &addr.addrlen)) == -1) {
         if (errno != EINTR) {
             //log_error("socket %d accept failed: %s", sock, strerror(errno));
-            return NULL;
+            return -1;
         }
     }
 
@@ -163,8 +323,14 @@ Link* Link::accept() {
         //log_error("socket %d set linger failed: %s", client_sock, strerror(errno));
     }
 
-    link = new Link();
+    link->family = family;
     link->sock = client_sock;
+    if (addr.unix_domain()) {
+        // peers of a unix socket are usually unnamed, report the listener
+        snprintf(link->remote_ip, sizeof(link->remote_ip), "%s", this->remote_ip);
+        link->remote_port = 0;
+        return 0;
+    }
     link->keepalive(true);
     link->nodelay(true);
     link->remote_port = addr.port();
@@ -184,17 +350,18 @@ Link* Link::accept() {
             }
         }
     }
-    return link;
+    return 0;
 }
 
 int Link::read() {
     int ret = 0;
-    char buf[16 * 1024];
-    int want = sizeof(buf);
+    // straight into the input buffer, a whole block while it is empty
+    recv_buf.reserve(pool_, recv_buf.empty() ? BufferPool::BLOCK_SIZE : 4 * 1024);
+    int want = (int)recv_buf.room();
     while (1) {
         // test
         //want = 1;
-        int len = ::read(sock, buf, want);
+        int len = ::read(sock, recv_buf.tail(), want);
         if (len == 0) {
             return -1;
         } else if (len == -1) {
@@ -209,19 +376,29 @@ int Link::read() {
         } else {
             //log_debug("fd: %d, want=%d, read: %d", sock, want, len);
             ret += len;
-            recv_buf.append(buf, len);
+            recv_buf.len += len;
         }
         break;
     }
     //log_debug("read %d", ret);
+    if (ret <= 0 && pool_ && recv_buf.empty()) {
+        recv_buf.release(pool_);
+    }
     return ret;
 }
 
 int Link::recv(Message* req) {
+    return recv(req, NULL);
+}
+
+int Link::recv(Message* req, std::string* raw) {
     while (1) {
-        int n = req->Decode(recv_buf);
+        int n = req->Decode(recv_buf.begin(), (int)recv_buf.size());
         if (n == 0) {
             if (noblock_) {
+                if (pool_ && recv_buf.empty()) {
+                    recv_buf.release(pool_);
+                }
                 break;
             }
             int ret = this->read();
@@ -233,7 +410,33 @@ int Link::recv(Message* req) {
         } else if (n == -1) {
             return -1;
         } else {
-            recv_buf = recv_buf.substr(n);
+            if (raw) {
+                raw->assign(recv_buf.begin(), n);
+            }
+            recv_buf.consume(n);
+            return n;
+        }
+    }
+    return 0;
+}
+
+int Link::recv(Reply* reply) {
+    while (1) {
+        int n = reply->Decode(recv_buf.begin(), (int)recv_buf.size());
+        if (n == 0) {
+            if (noblock_) {
+                break;
+            }
+            int ret = this->read();
+            if (ret == 0) {
+                return 0;
+            } else if (ret == -1) {
+                return -1;
+            }
+        } else if (n == -1) {
+            return -1;
+        } else {
+            recv_buf.consume(n);
             return n;
         }
     }
@@ -241,10 +444,13 @@ int Link::recv(Message* req) {
 }
 
 int Link::write() {
+    if (send_chain_pos < send_chain.size()) {
+        return write_chain();
+    }
     int ret = 0;
     while (ret < (int)send_buf.size()) {
         int want = send_buf.size() - ret;
-        int len = ::write(sock, send_buf.data() + ret, want);
+        int len = ::write(sock, send_buf.begin() + ret, want);
         if (len == -1) {
             if (errno == EINTR) {
                 continue;
@@ -259,14 +465,94 @@ int Link::write() {
         break;
     }
     if (ret > 0) {
-        send_buf = send_buf.substr(ret);
+        send_buf.consume(ret);
+        if (send_buf.empty()) {
+            drained();
+        }
     }
     return ret;
 }
 
+// all output written
+void Link::drained() {
+    send_chain.clear();
+    send_chain_pos = 0;
+    if (pool_) {
+        send_buf.release(pool_);
+        // a big fan-out burst should not stay with the link
+        if (send_chain.capacity() > 64) {
+            std::vector<SharedBuffer>().swap(send_chain);
+        }
+    }
+}
+
+// one writev() over the shared buffers and send_buf
+int Link::write_chain() {
+    const int MAX_IOV = 64;
+    struct iovec iov[MAX_IOV];
+    int cnt = 0;
+    size_t off = send_chain_off;
+    for (size_t i = send_chain_pos; i < send_chain.size() && cnt < MAX_IOV; i++) {
+        iov[cnt].iov_base = (void*)(send_chain[i]->data() + off);
+        iov[cnt].iov_len = send_chain[i]->size() - off;
+        cnt++;
+        off = 0;
+    }
+    if (cnt < MAX_IOV && !send_buf.empty()) {
+        iov[cnt].iov_base = (void*)send_buf.begin();
+        iov[cnt].iov_len = send_buf.size();
+        cnt++;
+    }
+    ssize_t len;
+    while (1) {
+        len = ::writev(sock, iov, cnt);
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EWOULDBLOCK) {
+                return 0;
+            }
+            return -1;
+        }
+        break;
+    }
+    size_t left = len;
+    while (left > 0 && send_chain_pos < send_chain.size()) {
+        size_t n = send_chain[send_chain_pos]->size() - send_chain_off;
+        if (left < n) {
+            send_chain_off += left;
+            left = 0;
+            break;
+        }
+        left -= n;
+        send_chain_size -= send_chain[send_chain_pos]->size();
+        send_chain_off = 0;
+        send_chain[send_chain_pos].reset();
+        send_chain_pos++;
+    }
+    if (left > 0) {
+        send_buf.consume(left);
+    }
+    if (send_chain_pos == send_chain.size() && send_buf.empty()) {
+        drained();
+    } else if (send_chain_pos >= 64 && send_chain_pos * 2 >= send_chain.size()) {
+        // never drained completely, drop the written entries
+        send_chain.erase(send_chain.begin(), send_chain.begin() + send_chain_pos);
+        send_chain_pos = 0;
+    }
+    return (int)len;
+}
+
 int Link::send(const Response& resp) {
-    std::string data = resp.Encode();
-    send_buf.append(data);
+    return send(resp.Encode());
+}
+
+int Link::send(const Message& req) {
+    return send(req.Encode());
+}
+
+int Link::send(const std::string& data) {
+    send_buf.append(pool_, data.data(), data.size());
     if (!noblock_) {
         while (1) {
             int ret = this->write();
@@ -275,7 +561,7 @@ int Link::send(const Response& resp) {
             } else if (ret == -1) {
                 return -1;
             }
-            if (send_buf.empty()) {
+            if (output_size() == 0) {
                 break;
             }
         }
@@ -283,4 +569,26 @@ int Link::send(const Response& resp) {
     return (int)data.size();
 }
 
+int Link::send(const SharedBuffer& data) {
+    // send_buf is behind the chain, what was queued before data goes first
+    if (!send_buf.empty()) {
+        send_chain.push_back(std::make_shared<const std::string>(send_buf.begin(), send_buf.size()));
+        send_chain_size += send_chain.back()->size();
+        send_buf.consume(send_buf.size());
+    }
+    send_chain.push_back(data);
+    send_chain_size += data->size();
+    if (!noblock_) {
+        while (output_size() > 0) {
+            int ret = this->write();
+            if (ret == 0) {
+                break;
+            } else if (ret == -1) {
+                return -1;
+            }
+        }
+    }
+    return (int)data->size();
+}
+
 }; // namespace redis
@@ -5,19 +5,39 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <memory>
+#include <vector>
 
+#include "BufferPool.h"
 #include "Message.h"
 #include "Response.h"
+#include "Reply.h"
 
 namespace redis {
 
+// Immutable encoded output, shared by the links it is sent to.
+typedef std::shared_ptr<const std::string> SharedBuffer;
+
 class Link {
 private:
     int sock;
     bool noblock_;
-    bool ipv4;
-    std::string recv_buf;
-    std::string send_buf;
+    short family;
+    // NULL: buffers are kept, see set_pool()
+    BufferPool* pool_;
+    IoBuffer recv_buf;
+    // output goes out as send_chain from send_chain_pos, from
+    // send_chain_off of that buffer, followed by send_buf
+    std::vector<SharedBuffer> send_chain;
+    size_t send_chain_pos;
+    size_t send_chain_off;
+    size_t send_chain_size;
+    IoBuffer send_buf;
+
+    int write_chain();
+    void drained();
+
+    static Link* connect(const char* ip, int port, bool noblock);
 
 public:
     char remote_ip[INET6_ADDRSTRLEN];
@@ -25,26 +45,81 @@ public:
 
     Link();
     ~Link();
+    Link(const Link&) = delete;
+    Link& operator=(const Link&) = delete;
+
     int fd() const {
         return sock;
     }
+    // Take the buffers from pool while there is input or output, and give
+    // them back as soon as it has been consumed or written. Only for
+    // noblock() links, which the pool's thread owns.
+    void set_pool(BufferPool* pool) {
+        pool_ = pool;
+    }
     void close();
     void nodelay(bool enable = true);
     // noblock(true) is supposed to corperate with IO Multiplex,
     // otherwise, flush() may cause a lot unneccessary write calls.
     void noblock(bool enable = true);
     void keepalive(bool enable = true);
+    // SO_BUSY_POLL/SO_PREFER_BUSY_POLL, usec <= 0 disables
+    void busy_poll(int usec);
 
+    // ip may also be a unix socket path, see LinkAddr
     static Link* connect(const char* ip, int port);
     static Link* listen(const char* ip, int port);
+    static Link* connect(const char* path);
+    static Link* listen(const char* path);
+    // Returns as soon as the connection is in progress, wait for the fd to
+    // become writable and then call finish_connect(). Output queued before
+    // that is kept until the first write().
+    static Link* connect_noblock(const char* ip, int port);
+    // 0: connected, -1: failed, errno is set
+    int finish_connect();
     Link* accept();
+    // same, into an unused link, e.g. one embedded in a bigger object
+    int accept(Link* link);
+    // take over the socket of a link with nothing buffered, e.g. one just
+    // accepted, which is left closed
+    void adopt(Link* other);
+    // CPU that processed the last packets received, -1 if unknown
+    int incoming_cpu() const;
+    // id of the NIC receive queue the packets came from, 0 if unknown
+    unsigned int incoming_napi_id() const;
 
     int read();
     int write();
 
+    int input_size() const {
+        return (int)recv_buf.size();
+    }
+    // buffered input, for a caller that parses it itself
+    const char* input() const {
+        return recv_buf.begin();
+    }
+    void consume_input(size_t n) {
+        recv_buf.consume(n);
+        if (pool_ && recv_buf.empty()) {
+            recv_buf.release(pool_);
+        }
+    }
+    int output_size() const {
+        return (int)(send_chain_size - send_chain_off + send_buf.size());
+    }
+
     // 0: not ready, -1: error
     int recv(Message* req);
+    // also copies the raw bytes of the request to *raw
+    int recv(Message* req, std::string* raw);
     int send(const Response& resp);
+    // client side: queue a request, parse a reply
+    int send(const Message& req);
+    int recv(Reply* reply);
+    // queue already encoded bytes
+    int send(const std::string& data);
+    // queue a reference to data instead of a copy
+    int send(const SharedBuffer& data);
 };
 
 }; // namespace redis
@@ -3,34 +3,60 @@ Copyright (c) 2012-2014 The SSDB Authors. All rights reserved.
 Use of this source code is governed by a BSD-style license that can be
 found in the LICENSE file.
 */
+#include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
 #include "link_addr.h"
 
 namespace redis {
 
-LinkAddr::LinkAddr(const char* ip, int port) {
-    parse(ip, port);
+LinkAddr::LinkAddr(int family) {
+    this->set_family(family);
 }
 
-LinkAddr::LinkAddr(bool is_ipv4) {
-    this->is_ipv4(is_ipv4);
-}
-
-void LinkAddr::is_ipv4(bool yn) {
-    if (yn) {
-        ipv4 = true;
-        family = AF_INET;
+void LinkAddr::set_family(int family) {
+    this->family = family;
+    ipv4 = (family == AF_INET);
+    if (family == AF_INET) {
         addrlen = sizeof(addr4);
-    } else {
-        ipv4 = false;
-        family = AF_INET6;
+    } else if (family == AF_INET6) {
         addrlen = sizeof(addr6);
+    } else {
+        bzero(&addr_un, sizeof(addr_un));
+        addrlen = sizeof(addr_un);
     }
 }
 
-void LinkAddr::parse(const char* ip, int port) {
-    this->is_ipv4(strchr(ip, ':') == NULL);
+bool LinkAddr::is_unix(const char* host) {
+    return host[0] == '/' || host[0] == '@' || strncmp(host, "unix:", 5) == 0;
+}
+
+int LinkAddr::parse(const char* ip, int port) {
+    if (is_unix(ip)) {
+        this->set_family(AF_UNIX);
+        addr_un.sun_family = AF_UNIX;
+        if (strncmp(ip, "unix:", 5) == 0) {
+            ip += 5;
+        }
+        // a path needs its NUL, an abstract name the leading one
+        size_t max = sizeof(addr_un.sun_path) - 1;
+        size_t len = strlen(ip);
+        if (len > max) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        if (ip[0] == '@') {
+            // abstract namespace: leading NUL, length counts exactly the name
+            memcpy(addr_un.sun_path + 1, ip + 1, len - 1);
+            addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+        } else {
+            memcpy(addr_un.sun_path, ip, len);
+            addrlen = offsetof(struct sockaddr_un, sun_path) + len + 1;
+        }
+        return 0;
+    }
+    this->set_family(strchr(ip, ':') == NULL ? AF_INET : AF_INET6);
     if (ipv4) {
         bzero(&addr4, sizeof(addr4));
         addr4.sin_family = family;
@@ -42,6 +68,7 @@ void LinkAddr::parse(const char* ip, int port) {
         addr6.sin6_port = htons((short)port);
         inet_pton(family, ip, &addr6.sin6_addr);
     }
+    return 0;
 }
 
 }; // namespace redis
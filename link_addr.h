@@ -10,22 +10,40 @@ found in the LICENSE file.
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/un.h>
 
 namespace redis {
 
+// host is an IPv4/IPv6 address, or a unix domain socket given as
+// "/path", "unix:/path" or "@name" (abstract namespace, port is ignored).
 struct LinkAddr {
     bool ipv4;
     short family;
     socklen_t addrlen;
 
-    LinkAddr(bool is_ipv4);
-    LinkAddr(const char* ip, int port);
-    void parse(const char* ip, int port);
+    LinkAddr(int family);
+    // -1 with errno ENAMETOOLONG if a unix socket name does not fit
+    int parse(const char* ip, int port);
 
+    static bool is_unix(const char* host);
+
+    bool unix_domain() const {
+        return family == AF_UNIX;
+    }
+    // filesystem path of a unix socket, NULL for abstract or inet
+    const char* path() const {
+        return (unix_domain() && addr_un.sun_path[0]) ? addr_un.sun_path : NULL;
+    }
     unsigned short port() {
+        if (unix_domain()) {
+            return 0;
+        }
         return ipv4 ? ntohs(addr4.sin_port) : ntohs(addr6.sin6_port);
     }
     struct sockaddr* addr() {
+        if (unix_domain()) {
+            return (struct sockaddr*)&addr_un;
+        }
         return ipv4 ? (struct sockaddr*)&addr4 : (struct sockaddr*)&addr6;
     }
     void* sin_addr() {
@@ -35,9 +53,10 @@ struct LinkAddr {
 private:
     struct sockaddr_in addr4;
     struct sockaddr_in6 addr6;
+    struct sockaddr_un addr_un;
 
     LinkAddr() {};
-    void is_ipv4(bool yn);
+    void set_family(int family);
 };
 
 }; // namespace redis
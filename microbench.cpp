@@ -0,0 +1,708 @@
+// Microbenchmarks for the codec, the queues and the KV table, no network
+// needed.
+//
+// Usage: microbench [--text] [filter]
+//        microbench [--text] --numa
+//        microbench [--text] --busy-poll <usec>
+// Each benchmark is grown until one run takes at least 0.5s, then reported
+// as one JSON object per line (or a table with --text), so runs from two
+// commits can be diffed directly. allocs_per_op counts operator new calls
+// of all threads. --numa instead measures the latency of dependent loads
+// from the CPUs of each node to memory placed on each node, the cost a
+// reactor pays for remote memory. --busy-poll runs ping-pong round trips
+// over loopback TCP against a Transport started in-process, once as is and
+// once with EnableBusyPoll(usec), and reports their percentiles side by
+// side.
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Channel.h"
+#include "Clock.h"
+#include "KVTable.h"
+#include "Message.h"
+#include "Numa.h"
+#include "Response.h"
+#include "SelectableQueue.h"
+#include "Transport.h"
+
+static std::atomic<uint64_t> alloc_count(0);
+
+// GCC cannot tell that free() gets what malloc() returned below
+#pragma GCC diagnostic ignored "-Wpragmas"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+typedef void (*BenchFunc)(uint64_t iters);
+
+struct Bench {
+    const char* name;
+    BenchFunc func;
+    // payload bytes per iteration, 0 if throughput in bytes is meaningless
+    uint64_t bytes;
+};
+
+static std::vector<Bench>* benches() {
+    static std::vector<Bench> ret;
+    return &ret;
+}
+
+static int add_bench(const char* name, BenchFunc func, uint64_t bytes) {
+    benches()->push_back(Bench{name, func, bytes});
+    return 0;
+}
+
+#define BENCHMARK(func, bytes) static int func##_reg = add_bench(#func, func, bytes)
+
+// keep the compiler from optimizing away a result
+static inline void escape(const void* p) {
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+/* Message codec */
+
+static std::string resp_cmd(const std::vector<std::string>& args) {
+    return redis::Message(args).Encode();
+}
+
+static const std::string small_req = resp_cmd({"set", "key:000001", "value"});
+static const std::string inline_req = "set key:000001 value\r\n";
+static const std::string bulk64k_req = resp_cmd({"set", "key:000001", std::string(64 * 1024, 'x')});
+static const std::string bulk1m_req = resp_cmd({"set", "key:000001", std::string(1024 * 1024, 'x')});
+
+static std::string make_pipeline(int n) {
+    std::string ret;
+    for (int i = 0; i < n; i++) {
+        ret.append(resp_cmd({"get", "key:" + std::to_string(i)}));
+    }
+    return ret;
+}
+
+static const std::string pipeline_req = make_pipeline(16);
+
+static void decode_small(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Message msg;
+        msg.Decode(small_req);
+        escape(&msg);
+    }
+}
+BENCHMARK(decode_small, small_req.size());
+
+// the way a reactor decodes, into one recycled Message
+static void decode_small_recycled(uint64_t iters) {
+    redis::Message msg;
+    for (uint64_t i = 0; i < iters; i++) {
+        msg.Recycle(1);
+        msg.Decode(small_req);
+        escape(&msg);
+    }
+}
+BENCHMARK(decode_small_recycled, small_req.size());
+
+static void decode_inline(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Message msg;
+        msg.Decode(inline_req);
+        escape(&msg);
+    }
+}
+BENCHMARK(decode_inline, inline_req.size());
+
+// 16 pipelined GETs in one buffer, decoded the way Link::recv() walks them
+static void decode_pipelined_16(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        const char* p = pipeline_req.data();
+        int len = (int)pipeline_req.size();
+        while (len > 0) {
+            redis::Message msg;
+            int n = msg.Decode(p, len);
+            if (n <= 0) {
+                break;
+            }
+            escape(&msg);
+            p += n;
+            len -= n;
+        }
+    }
+}
+BENCHMARK(decode_pipelined_16, pipeline_req.size());
+
+static void decode_pipelined_16_recycled(uint64_t iters) {
+    redis::Message msg;
+    for (uint64_t i = 0; i < iters; i++) {
+        const char* p = pipeline_req.data();
+        int len = (int)pipeline_req.size();
+        while (len > 0) {
+            msg.Recycle(1);
+            int n = msg.Decode(p, len);
+            if (n <= 0) {
+                break;
+            }
+            escape(&msg);
+            p += n;
+            len -= n;
+        }
+    }
+}
+BENCHMARK(decode_pipelined_16_recycled, pipeline_req.size());
+
+static void decode_bulk_64k(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Message msg;
+        msg.Decode(bulk64k_req);
+        escape(&msg);
+    }
+}
+BENCHMARK(decode_bulk_64k, bulk64k_req.size());
+
+static void decode_bulk_1m(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Message msg;
+        msg.Decode(bulk1m_req);
+        escape(&msg);
+    }
+}
+BENCHMARK(decode_bulk_1m, bulk1m_req.size());
+
+// a large bulk arriving in 16KB reads, re-parsed after every read
+static void decode_bulk_1m_incremental(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        for (size_t len = 16 * 1024;; len += 16 * 1024) {
+            if (len > bulk1m_req.size()) {
+                len = bulk1m_req.size();
+            }
+            redis::Message msg;
+            int n = msg.Decode(bulk1m_req.data(), (int)len);
+            escape(&msg);
+            if (n != 0) {
+                break;
+            }
+        }
+    }
+}
+BENCHMARK(decode_bulk_1m_incremental, bulk1m_req.size());
+
+static void command_find(uint64_t iters) {
+    static const char* names[] = {"GET", "set", "MGET", "incrby", "nosuchcmd", "Expire", "del", "ping"};
+    for (uint64_t i = 0; i < iters; i++) {
+        const char* name = names[i & 7];
+        const redis::Command* cmd = redis::Command::find(name, strlen(name));
+        escape(cmd);
+    }
+}
+BENCHMARK(command_find, 0);
+
+static void message_encode(uint64_t iters) {
+    redis::Message msg(std::vector<std::string>{"set", "key:000001", "value"});
+    for (uint64_t i = 0; i < iters; i++) {
+        std::string buf = msg.Encode();
+        escape(buf.data());
+    }
+}
+BENCHMARK(message_encode, 0);
+
+/* Response codec */
+
+static void encode_response(const redis::Response& resp, uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        std::string buf = resp.Encode();
+        escape(buf.data());
+    }
+}
+
+static void response_ok(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyOK();
+    encode_response(resp, iters);
+}
+BENCHMARK(response_ok, 0);
+
+static void response_error(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyError("wrong number of arguments");
+    encode_response(resp, iters);
+}
+BENCHMARK(response_error, 0);
+
+static void response_int(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyInt(1234567890);
+    encode_response(resp, iters);
+}
+BENCHMARK(response_int, 0);
+
+static void response_not_found(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyNotFound();
+    encode_response(resp, iters);
+}
+BENCHMARK(response_not_found, 0);
+
+static void response_bulk_32(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyBulk(std::string(32, 'x'));
+    encode_response(resp, iters);
+}
+BENCHMARK(response_bulk_32, 32);
+
+// the way a reactor encodes, into one reused buffer
+static void response_bulk_32_encode_to(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyBulk(std::string(32, 'x'));
+    std::string buf;
+    for (uint64_t i = 0; i < iters; i++) {
+        buf.clear();
+        resp.EncodeTo(&buf, 2);
+        escape(buf.data());
+    }
+}
+BENCHMARK(response_bulk_32_encode_to, 32);
+
+static void response_bulk_64k(uint64_t iters) {
+    redis::Response resp(1);
+    resp.ReplyBulk(std::string(64 * 1024, 'x'));
+    encode_response(resp, iters);
+}
+BENCHMARK(response_bulk_64k, 64 * 1024);
+
+static void response_array_16(uint64_t iters) {
+    redis::Response resp(1);
+    std::vector<std::string> vals(16, std::string(32, 'x'));
+    std::vector<bool> exists(16, true);
+    exists[3] = false;
+    resp.ReplyArray(exists, vals);
+    encode_response(resp, iters);
+}
+BENCHMARK(response_array_16, 16 * 32);
+
+/* queues: P producers, one consumer, iters items in total */
+
+template <int P>
+static void channel_mpsc(uint64_t iters) {
+    Channel<redis::Message> chan;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < P; p++) {
+        uint64_t n = iters / P + (p < (int)(iters % P) ? 1 : 0);
+        producers.push_back(std::thread([&chan, n]() {
+            redis::Message msg(1, std::vector<std::string>{"get", "key:000001"});
+            for (uint64_t i = 0; i < n; i++) {
+                chan.push(msg);
+            }
+        }));
+    }
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Message msg = chan.pop();
+        escape(&msg);
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+}
+static void channel_mpsc_1(uint64_t iters) {
+    channel_mpsc<1>(iters);
+}
+static void channel_mpsc_4(uint64_t iters) {
+    channel_mpsc<4>(iters);
+}
+BENCHMARK(channel_mpsc_1, 0);
+BENCHMARK(channel_mpsc_4, 0);
+
+template <int P>
+static void selectable_queue_mpsc(uint64_t iters) {
+    SelectableQueue<redis::Response> queue;
+    std::vector<std::thread> producers;
+    for (int p = 0; p < P; p++) {
+        uint64_t n = iters / P + (p < (int)(iters % P) ? 1 : 0);
+        producers.push_back(std::thread([&queue, n]() {
+            redis::Response resp(1);
+            resp.ReplyBulk("value");
+            for (uint64_t i = 0; i < n; i++) {
+                queue.push(resp);
+            }
+        }));
+    }
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::Response resp;
+        queue.pop(&resp);
+        escape(&resp);
+    }
+    for (auto& t : producers) {
+        t.join();
+    }
+}
+static void selectable_queue_mpsc_1(uint64_t iters) {
+    selectable_queue_mpsc<1>(iters);
+}
+static void selectable_queue_mpsc_4(uint64_t iters) {
+    selectable_queue_mpsc<4>(iters);
+}
+BENCHMARK(selectable_queue_mpsc_1, 0);
+BENCHMARK(selectable_queue_mpsc_4, 0);
+
+/* KV table, 100k keys of 10 bytes */
+
+static std::vector<std::string> make_keys(const char* prefix, int n) {
+    std::vector<std::string> ret;
+    for (int i = 0; i < n; i++) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%s:%06d", prefix, i);
+        ret.push_back(buf);
+    }
+    return ret;
+}
+
+static const std::vector<std::string> kv_keys = make_keys("key", 100000);
+static const std::vector<std::string> kv_miss_keys = make_keys("nok", 100000);
+
+static void kv_table_set(uint64_t iters) {
+    redis::KVTable table;
+    for (uint64_t i = 0; i < iters; i++) {
+        redis::KVTable::Entry* e = table.insert(kv_keys[i % kv_keys.size()], 0);
+        e->val.assign("value", 5);
+    }
+    escape(&table);
+}
+BENCHMARK(kv_table_set, 0);
+
+static void kv_table_get(uint64_t iters) {
+    static redis::KVTable* table = NULL;
+    if (!table) {
+        table = new redis::KVTable();
+        for (auto& key : kv_keys) {
+            table->insert(key, 0)->val = "value";
+        }
+    }
+    for (uint64_t i = 0; i < iters; i++) {
+        // every 4th lookup misses
+        size_t k = (i * 7919) % kv_keys.size();
+        redis::KVTable::Entry* e = table->find(i % 4 == 3 ? kv_miss_keys[k] : kv_keys[k], 0);
+        escape(e);
+    }
+}
+BENCHMARK(kv_table_get, 0);
+
+/* numa */
+
+struct NumaResult {
+    double ns_per_load;
+    // pages found on the memory node
+    double on_node;
+};
+
+// share of the pages of [p, p + size) the kernel put on node
+static double pages_on_node(char* p, size_t size, int node) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<void*> pages;
+    for (size_t off = 0; off < size; off += page) {
+        pages.push_back(p + off);
+    }
+    std::vector<int> status(pages.size(), -1);
+    if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), NULL, status.data(), 0) != 0) {
+        return -1;
+    }
+    size_t n = 0;
+    for (int s : status) {
+        if (s == node) {
+            n++;
+        }
+    }
+    return (double)n / pages.size();
+}
+
+// random cyclic chase through cache lines, too big for the caches
+static void numa_chase(int cpu_node, int mem_node, NumaResult* ret) {
+    const size_t SIZE = 256 * 1024 * 1024;
+    const size_t LINE = 64;
+    const size_t LOADS = 20 * 1000 * 1000;
+    ret->ns_per_load = -1;
+    ret->on_node = -1;
+    if (redis::Numa::bind_thread(cpu_node) == -1) {
+        return;
+    }
+    char* mem = (char*)redis::Numa::alloc(SIZE, mem_node);
+    if (!mem) {
+        return;
+    }
+    size_t lines = SIZE / LINE;
+    std::vector<size_t> order(lines);
+    for (size_t i = 0; i < lines; i++) {
+        order[i] = i;
+    }
+    std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(42));
+    for (size_t i = 0; i < lines; i++) {
+        *(char**)(mem + order[i] * LINE) = mem + order[(i + 1) % lines] * LINE;
+    }
+    ret->on_node = pages_on_node(mem, SIZE, mem_node);
+
+    char* p = mem;
+    uint64_t stime = redis::Clock::now();
+    for (size_t i = 0; i < LOADS; i++) {
+        p = *(char**)p;
+    }
+    ret->ns_per_load = (double)redis::Clock::to_ns(redis::Clock::now() - stime) / LOADS;
+    escape(p);
+    redis::Numa::free(mem, SIZE);
+}
+
+static int run_numa(bool text) {
+    int nodes = redis::Numa::nodes();
+    if (text) {
+        printf("%-10s %-10s %-8s %12s %10s\n", "cpu_node", "mem_node", "access", "ns/load", "on_node");
+    }
+    for (int c = 0; c < nodes; c++) {
+        if (redis::Numa::cpus(c).empty()) {
+            continue;
+        }
+        for (int m = 0; m < nodes; m++) {
+            NumaResult r;
+            // a fresh thread, so that binding does not stick to the next run
+            std::thread t(numa_chase, c, m, &r);
+            t.join();
+            const char* access = c == m ? "local" : "remote";
+            if (text) {
+                printf("%-10d %-10d %-8s %12.1f %10.2f\n", c, m, access, r.ns_per_load, r.on_node);
+            } else {
+                printf("{\"name\":\"numa_chase\",\"cpu_node\":%d,\"mem_node\":%d,\"access\":\"%s\","
+                    "\"ns_per_load\":%.1f,\"on_node\":%.2f}\n",
+                    c, m, access, r.ns_per_load, r.on_node);
+            }
+            fflush(stdout);
+        }
+    }
+    return 0;
+}
+
+/* busy poll */
+
+struct RttResult {
+    double p50_us;
+    double p99_us;
+    double p999_us;
+    double rtts_per_sec;
+};
+
+// a loopback port free right now
+static int free_port() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    int port = -1;
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && getsockname(fd, (struct sockaddr*)&addr, &len) == 0) {
+        port = ntohs(addr.sin_port);
+    }
+    close(fd);
+    return port;
+}
+
+// One client, one request in flight: the latency a lone request sees, from
+// the client's write to the end of the reply, through a reactor, Recv(),
+// a consumer thread and Send().
+static int rtt_run(int busy_poll_us, int rounds, RttResult* ret) {
+    int port = free_port();
+    redis::Transport xport;
+    if (busy_poll_us > 0) {
+        xport.EnableBusyPoll(busy_poll_us);
+    }
+    if (port == -1 || xport.Start("127.0.0.1", port) == -1) {
+        fprintf(stderr, "start failed: %s\n", strerror(errno));
+        return -1;
+    }
+    std::thread consumer([&xport]() {
+        while (1) {
+            redis::Message msg = xport.Recv();
+            redis::Response resp(msg);
+            resp.ReplyOK();
+            xport.Send(resp);
+            if (msg.Cmd() == "quit") {
+                return;
+            }
+        }
+    });
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "connect failed: %s\n", strerror(errno));
+        exit(1);
+    }
+    auto round_trip = [fd](const std::string& req) {
+        if (write(fd, req.data(), req.size()) != (ssize_t)req.size()) {
+            exit(1);
+        }
+        // "+OK\r\n"
+        char buf[16];
+        size_t got = 0;
+        while (got < 5) {
+            ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+            if (n <= 0) {
+                exit(1);
+            }
+            got += n;
+        }
+    };
+
+    const std::string ping = resp_cmd({"ping"});
+    // warm up, and let the spin budget settle
+    for (int i = 0; i < rounds / 10; i++) {
+        round_trip(ping);
+    }
+    std::vector<uint64_t> rtts(rounds);
+    uint64_t stime = redis::Clock::now();
+    for (int i = 0; i < rounds; i++) {
+        uint64_t t = redis::Clock::now();
+        round_trip(ping);
+        rtts[i] = redis::Clock::now() - t;
+    }
+    double secs = redis::Clock::to_ns(redis::Clock::now() - stime) / 1e9;
+    round_trip(resp_cmd({"quit"}));
+    close(fd);
+    consumer.join();
+
+    std::sort(rtts.begin(), rtts.end());
+    auto at = [&rtts](double q) {
+        return redis::Clock::to_ns(rtts[(size_t)(q * (rtts.size() - 1))]) / 1000.0;
+    };
+    ret->p50_us = at(0.50);
+    ret->p99_us = at(0.99);
+    ret->p999_us = at(0.999);
+    ret->rtts_per_sec = rounds / secs;
+    return 0;
+}
+
+static int run_busy_poll(int budget_us, bool text) {
+    const int ROUNDS = 50000;
+    RttResult r[2];
+    if (rtt_run(0, ROUNDS, &r[0]) == -1 || rtt_run(budget_us, ROUNDS, &r[1]) == -1) {
+        return 1;
+    }
+    if (text) {
+        printf("%-16s %10s %10s %10s %12s\n", "busy_poll_us", "p50_us", "p99_us", "p999_us", "rtts/s");
+    }
+    for (int i = 0; i < 2; i++) {
+        int us = i ? budget_us : 0;
+        if (text) {
+            printf("%-16d %10.1f %10.1f %10.1f %12.0f\n", us, r[i].p50_us, r[i].p99_us, r[i].p999_us, r[i].rtts_per_sec);
+        } else {
+            printf("{\"name\":\"busy_poll_rtt\",\"busy_poll_us\":%d,\"p50_us\":%.1f,\"p99_us\":%.1f,"
+                "\"p999_us\":%.1f,\"rtts_per_sec\":%.0f}\n",
+                us, r[i].p50_us, r[i].p99_us, r[i].p999_us, r[i].rtts_per_sec);
+        }
+    }
+    fflush(stdout);
+    return 0;
+}
+
+/* driver */
+
+static double run(const Bench& b, uint64_t iters, uint64_t* allocs) {
+    uint64_t count = alloc_count.load();
+    uint64_t stime = redis::Clock::now();
+    b.func(iters);
+    double ret = redis::Clock::to_ns(redis::Clock::now() - stime) / 1e9;
+    *allocs = alloc_count.load() - count;
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    bool text = false;
+    bool numa = false;
+    int busy_poll_us = 0;
+    const char* filter = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--text") == 0) {
+            text = true;
+        } else if (strcmp(argv[i], "--numa") == 0) {
+            numa = true;
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            busy_poll_us = atoi(argv[++i]);
+        } else {
+            filter = argv[i];
+        }
+    }
+
+    if (numa) {
+        return run_numa(text);
+    }
+    if (busy_poll_us > 0) {
+        return run_busy_poll(busy_poll_us, text);
+    }
+
+    const double min_time = 0.5;
+    if (text) {
+        printf("%-32s %12s %12s %14s %12s %10s\n", "benchmark", "iterations", "ns/op", "ops/s", "MB/s", "allocs/op");
+    }
+    for (auto& b : *benches()) {
+        if (filter && !strstr(b.name, filter)) {
+            continue;
+        }
+        uint64_t iters = 1;
+        double secs = 0;
+        uint64_t allocs = 0;
+        while (1) {
+            secs = run(b, iters, &allocs);
+            if (secs >= min_time) {
+                break;
+            }
+            double mult = secs > 0 ? min_time * 1.4 / secs : 100;
+            if (mult > 100) {
+                mult = 100;
+            } else if (mult < 2) {
+                mult = 2;
+            }
+            iters = (uint64_t)(iters * mult);
+        }
+        double ns_per_op = secs * 1e9 / iters;
+        double ops = iters / secs;
+        double mbps = b.bytes * ops / (1024 * 1024);
+        double allocs_per_op = (double)allocs / iters;
+        if (text) {
+            printf("%-32s %12llu %12.1f %14.0f %12.1f %10.2f\n", b.name, (unsigned long long)iters, ns_per_op, ops, mbps,
+                allocs_per_op);
+        } else {
+            printf("{\"name\":\"%s\",\"iterations\":%llu,\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"mb_per_sec\":%.1f,"
+                "\"allocs_per_op\":%.2f}\n",
+                b.name, (unsigned long long)iters, ns_per_op, ops, mbps, allocs_per_op);
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,220 @@
+// Replays a capture written by Transport::EnableCapture() against a server.
+//
+// Every captured client gets its own connection, so requests of one client
+// are sent in their original order. With --speed 1 (the default) requests
+// go out at their original offsets, --speed 2 replays twice as fast, and
+// --speed 0 sends everything as fast as possible.
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Capture.h"
+#include "Clock.h"
+#include "Reply.h"
+#include "Stats.h"
+#include "fde.h"
+#include "link.h"
+
+struct Conn {
+    redis::Link* link;
+    std::string input;
+    // send time of each request in flight, in Clock ticks
+    std::deque<uint64_t> starts;
+};
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "Usage: %s [options] capture_file\n"
+        "  -h, --host HOST     server host (127.0.0.1)\n"
+        "  -p, --port PORT     server port (6379)\n"
+        "  -s, --speed X       time scale, 0 for as fast as possible (1)\n",
+        prog);
+}
+
+int main(int argc, char** argv) {
+    static struct option long_opts[] = {
+        {"host", required_argument, 0, 'h'},
+        {"port", required_argument, 0, 'p'},
+        {"speed", required_argument, 0, 's'},
+        {"help", no_argument, 0, '?'},
+        {0, 0, 0, 0},
+    };
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    double speed = 1;
+    int c;
+    while ((c = getopt_long(argc, argv, "h:p:s:", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'h': host = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 's': speed = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || speed < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE* fp = fopen(argv[optind], "rb");
+    if (!fp) {
+        fprintf(stderr, "open %s failed: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if (redis::Capture::read_header(fp) != 1) {
+        fprintf(stderr, "%s is not a capture file\n", argv[optind]);
+        return 1;
+    }
+    std::vector<redis::Capture::Record> records;
+    while (1) {
+        redis::Capture::Record rec;
+        int ret = redis::Capture::read_record(fp, &rec);
+        if (ret == 0) {
+            break;
+        } else if (ret == -1) {
+            fprintf(stderr, "truncated record after %d records, ignored\n", (int)records.size());
+            break;
+        }
+        records.push_back(std::move(rec));
+    }
+    fclose(fp);
+    // the rings of the reactors are written one after another, so records
+    // are in time order per reactor only; a client's records all come from
+    // one ring and keep their order
+    std::stable_sort(records.begin(), records.end(),
+        [](const redis::Capture::Record& a, const redis::Capture::Record& b) {
+            return a.time_us < b.time_us;
+        });
+
+    Fdevents fdes;
+    std::unordered_map<uint32_t, Conn*> conns;
+    uint64_t replies = 0;
+    uint64_t errors = 0;
+    uint64_t inflight = 0;
+    redis::HistogramData latency;
+
+    size_t next = 0;
+    uint64_t stime = redis::Clock::now();
+    uint64_t last_reply = stime;
+    char buf[16 * 1024];
+    while (next < records.size() || inflight > 0) {
+        uint64_t now = redis::Clock::now();
+        if (next == records.size() && redis::Clock::to_us(now - last_reply) > 10 * 1000 * 1000) {
+            fprintf(stderr, "timeout waiting for %llu replies\n", (unsigned long long)inflight);
+            break;
+        }
+        uint64_t elapsed_us = redis::Clock::to_us(now - stime);
+        while (next < records.size()) {
+            const redis::Capture::Record& rec = records[next];
+            if (speed > 0 && rec.time_us / speed > elapsed_us) {
+                break;
+            }
+            Conn* conn;
+            auto it = conns.find(rec.client_id);
+            if (it == conns.end()) {
+                redis::Link* link = redis::Link::connect(host.c_str(), port);
+                if (!link) {
+                    fprintf(stderr, "connect %s:%d failed: %s\n", host.c_str(), port, strerror(errno));
+                    return 1;
+                }
+                link->noblock(true);
+                conn = new Conn();
+                conn->link = link;
+                conns[rec.client_id] = conn;
+                fdes.set(link->fd(), FDEVENT_IN, 0, conn);
+            } else {
+                conn = it->second;
+            }
+            conn->link->send(rec.data);
+            conn->starts.push_back(now);
+            inflight++;
+            next++;
+            if (conn->link->write() == -1) {
+                fprintf(stderr, "write error\n");
+                return 1;
+            }
+            if (conn->link->output_size() > 0) {
+                fdes.set(conn->link->fd(), FDEVENT_OUT, 0, conn);
+            }
+        }
+        if (next == records.size() && inflight == 0) {
+            break;
+        }
+
+        const Fdevents::events_t* events = fdes.wait(speed > 0 ? 1 : 0);
+        if (events == NULL) {
+            return 1;
+        }
+        for (int i = 0; i < (int)events->size(); i++) {
+            const Fdevent* fde = events->at(i);
+            Conn* conn = (Conn*)fde->data.ptr;
+            if (fde->events & FDEVENT_OUT) {
+                if (conn->link->write() == -1) {
+                    fprintf(stderr, "write error\n");
+                    return 1;
+                }
+                if (conn->link->output_size() == 0) {
+                    fdes.clr(conn->link->fd(), FDEVENT_OUT);
+                }
+            }
+            if (!(fde->events & (FDEVENT_IN | FDEVENT_ERR))) {
+                continue;
+            }
+            int len = ::read(conn->link->fd(), buf, sizeof(buf));
+            if (len == 0 || (len == -1 && errno != EAGAIN && errno != EINTR)) {
+                fprintf(stderr, "connection closed by server\n");
+                return 1;
+            }
+            if (len < 0) {
+                continue;
+            }
+            conn->input.append(buf, len);
+            last_reply = redis::Clock::now();
+            int off = 0;
+            while (1) {
+                int n = redis::Reply::Skip(conn->input.data() + off, conn->input.size() - off);
+                if (n == -1) {
+                    fprintf(stderr, "protocol error\n");
+                    return 1;
+                }
+                if (n == 0 || conn->starts.empty()) {
+                    break;
+                }
+                if (conn->input[off] == '-') {
+                    errors++;
+                }
+                off += n;
+                latency.add(redis::Clock::to_us(last_reply - conn->starts.front()));
+                conn->starts.pop_front();
+                replies++;
+                inflight--;
+            }
+            conn->input.erase(0, off);
+        }
+    }
+    double secs = redis::Clock::to_ns(redis::Clock::now() - stime) / 1e9;
+
+    for (auto it : conns) {
+        delete it.second->link;
+        delete it.second;
+    }
+
+    printf("records: %d, connections: %d, replies: %llu, errors: %llu\n",
+        (int)records.size(), (int)conns.size(), (unsigned long long)replies, (unsigned long long)errors);
+    printf("elapsed: %.3fs, throughput: %.0f req/s\n", secs, secs > 0 ? replies / secs : 0);
+    printf("latency(us): mean=%llu p50=%llu p99=%llu p999=%llu max=%llu\n",
+        (unsigned long long)latency.mean(),
+        (unsigned long long)latency.percentile(50),
+        (unsigned long long)latency.percentile(99),
+        (unsigned long long)latency.percentile(99.9),
+        (unsigned long long)latency.max);
+    return 0;
+}
@@ -1,5 +1,11 @@
 #include "Transport.h"
+#include "Proxy.h"
+#include "KVEngine.h"
+#include "Aof.h"
 #include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
 
 double microtime() {
     struct timeval now;
@@ -8,21 +14,245 @@ double microtime() {
     return ret;
 }
 
+// "a,b,c"
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> ret;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        ret.push_back(list.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return ret;
+}
+
+typedef std::unordered_map<std::string, std::deque<std::string>> Lists;
+
+// LPUSH, RPUSH, LPOP, RPOP, BLPOP and BRPOP on lists kept by the consumer.
+// Returns false if the client was blocked, and has no response yet.
+bool handle_list(redis::Transport* xport, Lists* lists, const redis::Message& msg, redis::Response* resp) {
+    const std::vector<std::string>& args = msg.Vals();
+    int cmd = msg.GetCommand()->id;
+    if (cmd == redis::CMD_LPUSH || cmd == redis::CMD_RPUSH) {
+        std::deque<std::string>& list = (*lists)[msg.Key()];
+        for (size_t i = 2; i < args.size(); i++) {
+            // a client blocked on the list takes the value on its way in
+            redis::Response woken;
+            woken.ReplyArray({msg.Key(), args[i]});
+            if (xport->Wake(msg.Key(), std::move(woken))) {
+                continue;
+            }
+            if (cmd == redis::CMD_LPUSH) {
+                list.push_front(args[i]);
+            } else {
+                list.push_back(args[i]);
+            }
+        }
+        resp->ReplyInt(list.size());
+        if (list.empty()) {
+            lists->erase(msg.Key());
+        }
+        return true;
+    }
+
+    bool block = cmd == redis::CMD_BLPOP || cmd == redis::CMD_BRPOP;
+    bool left = cmd == redis::CMD_LPOP || cmd == redis::CMD_BLPOP;
+    size_t last = block ? args.size() - 2 : 1;
+    for (size_t i = 1; i <= last; i++) {
+        auto it = lists->find(args[i]);
+        if (it == lists->end()) {
+            continue;
+        }
+        std::string val = left ? it->second.front() : it->second.back();
+        if (left) {
+            it->second.pop_front();
+        } else {
+            it->second.pop_back();
+        }
+        if (it->second.empty()) {
+            lists->erase(it);
+        }
+        if (block) {
+            resp->ReplyArray({args[i], val});
+        } else {
+            resp->ReplyBulk(val);
+        }
+        return true;
+    }
+    if (block && xport->Block(msg, (int)(atof(args.back().c_str()) * 1000)) == 0) {
+        return false;
+    }
+    resp->ReplyNotFound();
+    return true;
+}
+
 int main(int argc, char** argv) {
     // std::string buf = "  *2\r\n$1\na\n$2\r\nbc\r\n ";
     // redis::Message msg;
     // int n = msg.Decode(buf);
     // printf("%d\n%s\n", n, msg.Encode().c_str());
 
+    // outlives the reactors that run its engines
+    redis::KVStore store(redis::Transport::NUM_REACTORS);
     redis::Transport xport;
-    xport.Start("127.0.0.1", 6379);
+    int port = 6379;
+    int pool_size = 2;
+    std::vector<redis::Proxy::Backend> backends;
+    bool kv = false;
+    std::string aof;
+    int appendfsync = redis::Aof::FSYNC_EVERYSEC;
+    std::string bulk_spool;
+    size_t bulk_threshold = 1024 * 1024;
+    bool rate_limits = false;
+    redis::RateLimit client_limit;
+    redis::RateLimit address_limit;
+    std::unordered_map<std::string, redis::RateLimit> command_limits;
+    std::vector<std::string> reject;
+    bool lists_enabled = false;
+    Lists lists;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0) {
+            xport.EnableTracing(1000);
+        } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            xport.EnableCapture(argv[++i]);
+        } else if (strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            xport.EnableBusyPoll(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--pubsub") == 0) {
+            xport.EnablePubSub();
+        } else if (strcmp(argv[i], "--tracking") == 0) {
+            // HELLO and CLIENT TRACKING
+            xport.EnableClientTracking();
+        } else if (strcmp(argv[i], "--bulk-spool") == 0 && i + 1 < argc) {
+            // values of bulk_threshold bytes or more go to files in this
+            // directory, requests carry the file name instead
+            bulk_spool = argv[++i];
+        } else if (strcmp(argv[i], "--bulk-threshold") == 0 && i + 1 < argc) {
+            bulk_threshold = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--coalesce") == 0 && i + 1 < argc) {
+            // comma separated read commands, e.g. get,mget
+            xport.EnableCoalescing(split_list(argv[++i]));
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            // comma separated single key reads, e.g. get,ttl
+            xport.EnableResponseCache(split_list(argv[++i]));
+        } else if (strcmp(argv[i], "--client-rate") == 0 && i + 2 < argc) {
+            // commands and bytes per second, 0 for no limit
+            client_limit.commands = atof(argv[++i]);
+            client_limit.bytes = atof(argv[++i]);
+            rate_limits = true;
+        } else if (strcmp(argv[i], "--address-rate") == 0 && i + 2 < argc) {
+            address_limit.commands = atof(argv[++i]);
+            address_limit.bytes = atof(argv[++i]);
+            rate_limits = true;
+        } else if (strcmp(argv[i], "--command-rate") == 0 && i + 2 < argc) {
+            // name, commands per second
+            std::string name = argv[++i];
+            command_limits[name].commands = atof(argv[++i]);
+            rate_limits = true;
+        } else if (strcmp(argv[i], "--rate-reject") == 0 && i + 1 < argc) {
+            // comma separated commands answered with an error when limited
+            reject = split_list(argv[++i]);
+        } else if (strcmp(argv[i], "--admission") == 0 && i + 2 < argc) {
+            // --admission target_us deadline_us, CoDel interval of 100ms
+            int target_us = atoi(argv[++i]);
+            xport.EnableAdmissionControl(target_us, 100000, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--lists") == 0) {
+            // LPUSH, RPUSH, LPOP, RPOP, BLPOP and BRPOP
+            lists_enabled = true;
+            xport.EnableBlocking();
+        } else if (strcmp(argv[i], "--hotkeys") == 0) {
+            // HOTKEYS and BIGKEYS, and the Keys section of INFO
+            xport.EnableKeySampling();
+        } else if (strcmp(argv[i], "--numa") == 0) {
+            xport.EnableNuma();
+        } else if (strcmp(argv[i], "--unix") == 0 && i + 1 < argc) {
+            xport.Listen(argv[++i]);
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--pool") == 0 && i + 1 < argc) {
+            pool_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--kv") == 0) {
+            // built-in KV engine instead of replying +OK to everything
+            kv = true;
+        } else if (strcmp(argv[i], "--aof") == 0 && i + 1 < argc) {
+            aof = argv[++i];
+        } else if (strcmp(argv[i], "--appendfsync") == 0 && i + 1 < argc) {
+            appendfsync = redis::Aof::parse_policy(argv[++i]);
+            if (appendfsync == -1) {
+                fprintf(stderr, "bad appendfsync: %s\n", argv[i]);
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--proxy") == 0 && i + 1 < argc) {
+            // --proxy host:port,host:port,...
+            if (redis::Proxy::parse_backends(argv[++i], &backends) == -1) {
+                fprintf(stderr, "bad backend list: %s\n", argv[i]);
+                return -1;
+            }
+        }
+    }
+    if (kv) {
+        if (!aof.empty() && store.open_aof(aof, appendfsync) == -1) {
+            fprintf(stderr, "open aof %s failed\n", aof.c_str());
+            return -1;
+        }
+        xport.SetService([&store](int index) {
+            return new redis::KVEngine(&store, index);
+        });
+    } else if (!backends.empty()) {
+        xport.SetService([&backends, pool_size](int index) {
+            return new redis::Proxy(backends, pool_size);
+        });
+    }
+    if (rate_limits) {
+        xport.SetRateLimits(client_limit, address_limit, command_limits, reject);
+    }
+    if (!bulk_spool.empty()) {
+        xport.SetBulkSink(bulk_threshold, redis::FileBulkSink::factory(bulk_spool));
+    }
+    xport.Listen("127.0.0.1", port);
+    if (xport.Start() == -1) {
+        return -1;
+    }
     double stime = microtime();
     int count = 0;
     while (1) {
         redis::Message msg = xport.Recv();
         // printf("req from %d\n", msg.ClientId());
-        redis::Response resp(msg.ClientId());
-        xport.Send(resp);
+        redis::Response resp(msg);
+        if (msg.Cmd() == "info") {
+            resp.ReplyBulk(xport.Info());
+        } else if (msg.Cmd() == "slowlog") {
+            std::vector<std::string> lines;
+            for (auto& e : xport.SlowLogEntries()) {
+                char buf[256];
+                snprintf(buf, sizeof(buf), "%llu %s [%s] total=%lluus parse=%llu channel=%llu handler=%llu send_queue=%llu socket=%llu",
+                    (unsigned long long)e.id, e.client, e.cmd, (unsigned long long)e.total_us,
+                    (unsigned long long)e.stage_us[0], (unsigned long long)e.stage_us[1],
+                    (unsigned long long)e.stage_us[2], (unsigned long long)e.stage_us[3],
+                    (unsigned long long)e.stage_us[4]);
+                lines.push_back(buf);
+            }
+            resp.ReplyArray(lines);
+        } else if (msg.Cmd() == "hotkeys" || msg.Cmd() == "bigkeys") {
+            std::vector<std::string> lines;
+            for (auto& k : msg.Cmd() == "hotkeys" ? xport.HotKeys() : xport.BigKeys()) {
+                char buf[64];
+                snprintf(buf, sizeof(buf), " count=%llu request=%llu reply=%llu",
+                    (unsigned long long)k.count, (unsigned long long)k.request_bytes,
+                    (unsigned long long)k.reply_bytes);
+                lines.push_back(k.key + buf);
+            }
+            resp.ReplyArray(lines);
+        } else if (lists_enabled && msg.GetCommand() && msg.GetCommand()->id >= redis::CMD_LPUSH
+            && msg.GetCommand()->id <= redis::CMD_BRPOP)
+        {
+            if (!handle_list(&xport, &lists, msg, &resp)) {
+                continue;
+            }
+        }
+        xport.Send(std::move(resp));
         count ++;
         if(count % 100000 == 0){
             double etime = microtime();